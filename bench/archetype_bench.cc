@@ -0,0 +1,134 @@
+/*
+  archetype_bench.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "bench.hh"
+#include "../src/game/components/archetype.hh"
+#include "../src/game/components/chunked_pool.hh"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+
+namespace snow {
+
+
+namespace {
+
+
+const int BENCH_PASSES = 50;
+
+
+// IDs private to the benchmark -- the store below is its own, so they only
+// need to be distinct from each other
+enum : unsigned
+{
+  BENCH_POSITION_ID = 0,
+  BENCH_VELOCITY_ID = 1,
+};
+
+
+struct position_data_t
+{
+  static const unsigned COMPONENT_ID = BENCH_POSITION_ID;
+  float x, y, z;
+};
+
+
+struct velocity_data_t
+{
+  static const unsigned COMPONENT_ID = BENCH_VELOCITY_ID;
+  float x, y, z;
+};
+
+
+// Per-type pools laid out the way component_t's are: each entry knows its
+// owner, and an owner knows the index of each of its components.
+struct pooled_velocity_t
+{
+  uint32_t        owner;
+  velocity_data_t data;
+};
+
+
+struct owner_t
+{
+  uint32_t        position;
+  uint32_t        velocity;
+};
+
+
+} // namespace <anon>
+
+
+
+/*==============================================================================
+  archetype_benchmark(count)
+
+    Integrates position += velocity * dt over count objects, once through
+    per-type pools (walking the velocity pool and looking up each owner's
+    position) and once through archetype chunks. Velocities are added in a
+    shuffled order, as happens once objects come and go, so the two pools
+    don't line up.
+==============================================================================*/
+void archetype_benchmark(size_t count)
+{
+  const float dt = 1.0f / 60.0f;
+
+  std::vector<size_t> order(count);
+  for (size_t index = 0; index < count; ++index) {
+    order[index] = index;
+  }
+  std::shuffle(order.begin(), order.end(), std::mt19937(static_cast<uint32_t>(count)));
+
+  chunked_pool_t<position_data_t> positions;
+  chunked_pool_t<pooled_velocity_t> velocities;
+  std::vector<owner_t> owners(count);
+  for (size_t index = 0; index < count; ++index) {
+    owners[index].position = positions.make_storage();
+    positions[owners[index].position] = position_data_t { 0, 0, 0 };
+  }
+  for (const size_t index : order) {
+    owners[index].velocity = velocities.make_storage();
+    velocities[owners[index].velocity] = pooled_velocity_t {
+      static_cast<uint32_t>(index), velocity_data_t { 1, 2, 3 }
+    };
+  }
+
+  const double pool_time = time_passes(BENCH_PASSES, [&] {
+    for (const pooled_velocity_t &vel : velocities) {
+      position_data_t &pos = positions[owners[vel.owner].position];
+      pos.x += vel.data.x * dt;
+      pos.y += vel.data.y * dt;
+      pos.z += vel.data.z * dt;
+    }
+  });
+
+  archetype_store_t store;
+  store.register_column<position_data_t>();
+  store.register_column<velocity_data_t>();
+  std::vector<archetype_store_t::entity_t> entities(count);
+  for (size_t index = 0; index < count; ++index) {
+    entities[index] = store.create();
+    store.add(entities[index], position_data_t { 0, 0, 0 });
+  }
+  for (const size_t index : order) {
+    store.add(entities[index], velocity_data_t { 1, 2, 3 });
+  }
+
+  const double chunk_time = time_passes(BENCH_PASSES, [&store, dt] {
+    store.each<position_data_t, velocity_data_t>(
+      [dt] (archetype_store_t::entity_t, position_data_t &pos, velocity_data_t &vel) {
+        pos.x += vel.x * dt;
+        pos.y += vel.y * dt;
+        pos.z += vel.z * dt;
+      });
+  });
+
+  s_log_note("Archetype benchmark, %zu objects: per-type pools %.1f us/pass, archetype chunks %.1f us/pass",
+    count, pool_time, chunk_time);
+}
+
+
+} // namespace snow
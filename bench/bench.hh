@@ -0,0 +1,66 @@
+/*
+  bench.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__BENCH_HH__
+#define __SNOW__BENCH_HH__
+
+#include "../src/config.hh"
+#include <chrono>
+
+
+namespace snow {
+
+
+/*==============================================================================
+
+  Benchmarks run by snow_bench. Each takes the number of items to run over
+  and logs its results. They live outside the game's sources, so none of
+  them are built into the game, and they use only the public interfaces of
+  what they measure.
+
+==============================================================================*/
+void archetype_benchmark(size_t count);
+void component_handle_benchmark(size_t count);
+void level_benchmark(size_t count);
+void light_grid_benchmark(size_t count);
+void netevent_stress_benchmark(size_t count);
+void netlocal_benchmark(size_t count);
+void netscheduler_saturation_benchmark(size_t count);
+void prediction_benchmark(size_t count);
+void spatial_benchmark(size_t count);
+void transform_benchmark(size_t count);
+
+
+
+// Returns the time taken by a single call to fn in microseconds.
+template <typename FN>
+double time_once(FN &&fn)
+{
+  const auto start = std::chrono::steady_clock::now();
+  fn();
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+
+
+// Runs pass once to warm up, then passes more times, and returns the mean
+// time of a pass in microseconds.
+template <typename FN>
+double time_passes(int passes, FN &&pass)
+{
+  pass();
+  const auto start = std::chrono::steady_clock::now();
+  for (int index = 0; index < passes; ++index) {
+    pass();
+  }
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(end - start).count() / passes;
+}
+
+
+} // namespace snow
+
+#endif /* end __SNOW__BENCH_HH__ include guard */
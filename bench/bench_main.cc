@@ -0,0 +1,77 @@
+/*
+  bench_main.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "bench.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace {
+
+
+struct benchmark_t
+{
+  const char *  name;
+  void        (*run)(size_t count);
+  size_t        default_count;
+};
+
+
+const benchmark_t g_benchmarks[] = {
+  { "archetypes", snow::archetype_benchmark,                 4096 },
+  { "handles",    snow::component_handle_benchmark,          50000 },
+  { "level",      snow::level_benchmark,                     100000 },
+  { "lights",     snow::light_grid_benchmark,                4096 },
+  { "netevents",  snow::netevent_stress_benchmark,           1000000 },
+  { "transport",  snow::netlocal_benchmark,                  1000000 },
+  { "scheduler",  snow::netscheduler_saturation_benchmark,   200 },
+  { "prediction", snow::prediction_benchmark,                1000000 },
+  { "spatial",    snow::spatial_benchmark,                   50000 },
+  { "transforms", snow::transform_benchmark,                 100000 },
+};
+
+
+
+void usage(const char *program)
+{
+  std::fprintf(stderr, "Usage: %s all | <benchmark> [count]\nBenchmarks:\n", program);
+  for (const benchmark_t &bench : g_benchmarks) {
+    std::fprintf(stderr, "  %-16s (default count %zu)\n", bench.name, bench.default_count);
+  }
+}
+
+
+} // namespace <anon>
+
+
+
+int main(int argc, char const *argv[])
+{
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const bool run_all = std::strcmp(argv[1], "all") == 0;
+  bool found = false;
+  for (const benchmark_t &bench : g_benchmarks) {
+    if (!run_all && std::strcmp(argv[1], bench.name) != 0) {
+      continue;
+    }
+    size_t count = bench.default_count;
+    if (!run_all && argc > 2) {
+      count = std::strtoul(argv[2], NULL, 10);
+    }
+    bench.run(count);
+    found = true;
+  }
+
+  if (!found) {
+    usage(argv[0]);
+    return 1;
+  }
+  return 0;
+}
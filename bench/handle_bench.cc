@@ -0,0 +1,118 @@
+/*
+  handle_bench.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "bench.hh"
+#include "../src/game/components/component_handle.hh"
+#include <algorithm>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+
+namespace snow {
+
+
+namespace {
+
+
+// Lookups per handle in each pass
+const size_t BENCH_LOOKUPS = 20;
+const int BENCH_PASSES = 5;
+
+
+// Key for the map the slot map replaced, which was keyed by whole handle
+inline uint64_t map_key(const component_handle_t &handle)
+{
+  return (static_cast<uint64_t>(handle.generation) << 32) | handle.global_index;
+}
+
+
+} // namespace <anon>
+
+
+
+/*==============================================================================
+  component_handle_benchmark(count)
+
+    Allocates count component handles and times resolving them through the
+    generational slot map against a std::unordered_map from handle to
+    component, in random and in sequential order. Handles only store and
+    return addresses, so the "components" are bytes of a buffer. Warns if a
+    stale handle resolves after its slot is reused.
+==============================================================================*/
+void component_handle_benchmark(size_t count)
+{
+  count = std::min<size_t>(count, component_handle_t::MAX_SLOTS - 1);
+
+  std::vector<char> storage(count);
+  std::vector<component_handle_t> handles(count);
+  std::unordered_map<uint64_t, component_base_t *> map;
+  map.reserve(count);
+  for (size_t index = 0; index < count; ++index) {
+    component_base_t *component = reinterpret_cast<component_base_t *>(&storage[index]);
+    handles[index] = component_handle_t::allocate(static_cast<uint32_t>(index));
+    component_handle_t::put(handles[index], component);
+    map.emplace(map_key(handles[index]), component);
+  }
+
+  if (count > 0) {
+    const component_handle_t stale = handles[0];
+    component_handle_t::erase(stale);
+    handles[0] = component_handle_t::allocate(0);
+    component_handle_t::put(handles[0], reinterpret_cast<component_base_t *>(&storage[0]));
+    if (component_handle_t::get(stale) != nullptr) {
+      s_log_warning("Stale component handle resolved after its slot was reused");
+    }
+    map.erase(map_key(stale));
+    map.emplace(map_key(handles[0]), reinterpret_cast<component_base_t *>(&storage[0]));
+  }
+
+  std::mt19937 rng(static_cast<uint32_t>(count));
+  std::vector<uint32_t> order(count * BENCH_LOOKUPS);
+  for (uint32_t &index : order) {
+    index = static_cast<uint32_t>(rng() % count);
+  }
+
+  // Sums addresses so the lookups can't be optimized out
+  uintptr_t sink = 0;
+  const double lookups = static_cast<double>(order.size());
+  const double map_random = time_passes(BENCH_PASSES, [&] {
+    for (const uint32_t index : order) {
+      sink += reinterpret_cast<uintptr_t>(map.find(map_key(handles[index]))->second);
+    }
+  });
+  const double slots_random = time_passes(BENCH_PASSES, [&] {
+    for (const uint32_t index : order) {
+      sink += reinterpret_cast<uintptr_t>(component_handle_t::get(handles[index]));
+    }
+  });
+  const double map_sequential = time_passes(BENCH_PASSES, [&] {
+    for (const component_handle_t &handle : handles) {
+      for (size_t lookup = 0; lookup < BENCH_LOOKUPS; ++lookup) {
+        sink += reinterpret_cast<uintptr_t>(map.find(map_key(handle))->second);
+      }
+    }
+  });
+  const double slots_sequential = time_passes(BENCH_PASSES, [&] {
+    for (const component_handle_t &handle : handles) {
+      for (size_t lookup = 0; lookup < BENCH_LOOKUPS; ++lookup) {
+        sink += reinterpret_cast<uintptr_t>(component_handle_t::get(handle));
+      }
+    }
+  });
+
+  for (const component_handle_t &handle : handles) {
+    component_handle_t::erase(handle);
+  }
+
+  s_log_note("Component handles, %zu live: random %.2f ns unordered_map, %.2f ns slot map; "
+    "sequential %.2f ns unordered_map, %.2f ns slot map (%d)", count,
+    map_random * 1000.0 / lookups, slots_random * 1000.0 / lookups,
+    map_sequential * 1000.0 / lookups, slots_sequential * 1000.0 / lookups,
+    static_cast<int>(sink & 1));
+}
+
+
+} // namespace snow
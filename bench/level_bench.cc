@@ -0,0 +1,65 @@
+/*
+  level_bench.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "bench.hh"
+#include "../src/game/gameobject.hh"
+#include "../src/game/components/point_light.hh"
+#include "../src/game/components/transform.hh"
+#include "../src/game/systems/level.hh"
+#include <chrono>
+
+
+namespace snow {
+
+
+/*==============================================================================
+  level_benchmark(count)
+
+    Builds count objects the way code does today -- one object and component
+    at a time -- in a four-way tree with a light on every eighth object, then
+    times saving the level and loading it back from the snapshot.
+==============================================================================*/
+void level_benchmark(size_t count)
+{
+  using clock_t = std::chrono::steady_clock;
+  const auto millis = [] (clock_t::time_point start, clock_t::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+  };
+
+  level_t level;
+  const clock_t::time_point build_start = clock_t::now();
+  for (size_t index = 0; index < count; ++index) {
+    game_object_t *const object = new game_object_t;
+    transform_t *const transform = object->get_component<transform_t>();
+    transform->set_translation({ float(index % 64), float(index / 64 % 64), float(index / 4096) });
+    transform->set_rotation_euler(0.0f, float(index % 360), 0.0f);
+    if (index > 0) {
+      level.object((index - 1) / 4)->add_child(object);
+    }
+    if (index % 8 == 0) {
+      object->add_component<point_light_t>();
+      point_light_t *const light = object->get_component<point_light_t>();
+      light->radius = 4.0f;
+      light->color = { 1.0f, 1.0f, 1.0f, 1.0f };
+      light->cookie = nullptr;
+    }
+    level.add_object(object);
+  }
+  const clock_t::time_point build_end = clock_t::now();
+
+  const level_t::charbuf_t snapshot = level.save();
+  const clock_t::time_point save_end = clock_t::now();
+  level.clear();
+  const clock_t::time_point load_start = clock_t::now();
+  level.load(snapshot.data(), snapshot.size());
+  const clock_t::time_point load_end = clock_t::now();
+
+  s_log_note("Level benchmark, %zu objects: built one by one in %.1f ms, saved %zu bytes in %.1f ms, loaded in %.1f ms",
+    level.object_count(), millis(build_start, build_end), snapshot.size(),
+    millis(build_end, save_end), millis(load_start, load_end));
+}
+
+
+} // namespace snow
@@ -0,0 +1,122 @@
+/*
+  light_grid_bench.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "bench.hh"
+#include "../src/game/systems/light_grid.hh"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+
+namespace snow {
+
+
+namespace {
+
+
+const int BENCH_PASSES = 100;
+const uint32_t BENCH_WIDTH = 1280;
+const uint32_t BENCH_HEIGHT = 720;
+const uint32_t BENCH_TILE_SIZES[] = { 16, 32, 64 };
+
+
+
+// OpenGL-style perspective projection, column-major.
+mat4f_t bench_projection(float fov_y, float aspect, float near_dist, float far_dist)
+{
+  const float focal = 1.0f / std::tan(fov_y * 0.5f);
+  mat4f_t result;
+  float *m = (float *)&result;
+  std::fill(m, m + 16, 0.0f);
+  m[0] = focal / aspect;
+  m[5] = focal;
+  m[10] = (far_dist + near_dist) / (near_dist - far_dist);
+  m[11] = -1.0f;
+  m[14] = 2.0f * far_dist * near_dist / (near_dist - far_dist);
+  return result;
+}
+
+
+
+mat4f_t bench_identity()
+{
+  mat4f_t result;
+  float *m = (float *)&result;
+  std::fill(m, m + 16, 0.0f);
+  m[0] = m[5] = m[10] = m[15] = 1.0f;
+  return result;
+}
+
+
+} // namespace <anon>
+
+
+
+/*==============================================================================
+  light_grid_benchmark(count)
+
+    Bins a fixed set of count lights, generated from a seeded RNG, for a
+    1280x720 viewport and a camera at the origin looking down -Z. Checks a
+    few hand-placed lights land where they should, then logs the time taken
+    by bin() and tile occupancy for each of BENCH_TILE_SIZES.
+==============================================================================*/
+void light_grid_benchmark(size_t count)
+{
+  const mat4f_t view = bench_identity();
+  const mat4f_t projection = bench_projection(1.0471976f, float(BENCH_WIDTH) / BENCH_HEIGHT, 0.5f, 500.0f);
+
+  {
+    // A light dead ahead covers the center tile, one behind the camera or
+    // past the far plane covers nothing
+    light_grid_t grid;
+    grid.resize(BENCH_WIDTH, BENCH_HEIGHT);
+    grid.add_light(vec3f_t { 0.0f, 0.0f, -10.0f }, 1.0f);
+    grid.add_light(vec3f_t { 0.0f, 0.0f, 10.0f }, 1.0f);
+    grid.add_light(vec3f_t { 0.0f, 0.0f, -600.0f }, 1.0f);
+    grid.bin(view, projection);
+    const size_t center = (size_t(grid.tiles_y() / 2) * grid.tiles_x() + grid.tiles_x() / 2) * 2;
+    const std::vector<uint32_t> &ranges = grid.tile_ranges();
+    if (grid.visible_count() != 1 || ranges[center + 1] != 1 ||
+        grid.light_indices()[ranges[center]] != 0) {
+      s_log_warning("Light grid placed test lights incorrectly");
+    }
+  }
+
+  s_log_note("Light grid benchmark, %zu lights, %ux%u viewport", count, BENCH_WIDTH, BENCH_HEIGHT);
+
+  for (const uint32_t tile_size : BENCH_TILE_SIZES) {
+    light_grid_t grid(tile_size);
+    grid.resize(BENCH_WIDTH, BENCH_HEIGHT);
+
+    std::mt19937 rng(static_cast<uint32_t>(count));
+    std::uniform_real_distribution<float> across(-300.0f, 300.0f);
+    std::uniform_real_distribution<float> up(-30.0f, 60.0f);
+    std::uniform_real_distribution<float> ahead(-450.0f, 20.0f);
+    std::uniform_real_distribution<float> radius(1.0f, 15.0f);
+    for (size_t index = 0; index < count; ++index) {
+      grid.add_light(vec3f_t { across(rng), up(rng), ahead(rng) }, radius(rng));
+    }
+
+    const double bin_time = time_passes(BENCH_PASSES, [&] { grid.bin(view, projection); });
+
+    const std::vector<uint32_t> &ranges = grid.tile_ranges();
+    size_t busy_tiles = 0;
+    uint32_t most = 0;
+    for (size_t tile = 0; tile < ranges.size(); tile += 2) {
+      busy_tiles += ranges[tile + 1] != 0;
+      most = std::max(most, ranges[tile + 1]);
+    }
+
+    const size_t indices = grid.light_indices().size();
+    s_log_note("  %ux%u tiles of %u px: %.1f us/bin, %zu lights visible, %zu indices, "
+      "%zu tiles lit, %.1f lights per lit tile (max %u)",
+      grid.tiles_x(), grid.tiles_y(), tile_size, bin_time, grid.visible_count(), indices,
+      busy_tiles, busy_tiles ? double(indices) / busy_tiles : 0.0, most);
+  }
+}
+
+
+} // namespace snow
@@ -0,0 +1,101 @@
+/*
+  netevent_bench.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "bench.hh"
+#include "../src/net/netevent_pool.hh"
+#include "../src/net/netpacket_pool.hh"
+#include <algorithm>
+#include <deque>
+#include <utility>
+
+
+namespace snow {
+
+
+namespace {
+
+
+const size_t BENCH_MESSAGES_PER_PACKET = 8;
+const size_t BENCH_MESSAGE_LENGTH = 24;
+// One message in this many is retained by a "system" for a few frames
+const size_t BENCH_RETAIN_EVERY = 7;
+const size_t BENCH_RETAIN_FRAMES = 4;
+// Frames run before the pool's size is taken as its steady state
+const size_t BENCH_WARMUP_FRAMES = 1000;
+
+
+} // namespace <anon>
+
+
+
+/*==============================================================================
+  netevent_stress_benchmark(count)
+
+    Pushes count messages through a netevent_pool_t the way the client does:
+    each frame receives a packet, borrows a netevent per message, dispatches
+    it and drops the dispatch reference. Some messages are retained for a few
+    frames, as a system deferring its handling would. Memory must stay flat:
+    once warmed up, the pool must not grow, and every netevent and packet
+    must be released by the end.
+==============================================================================*/
+void netevent_stress_benchmark(size_t count)
+{
+  netevent_pool_t pool;
+  netpacket_pool_t &packets = netpacket_pool_t::default_pool();
+  const size_t length = BENCH_MESSAGES_PER_PACKET * BENCH_MESSAGE_LENGTH;
+  std::deque<std::pair<size_t, const netevent_t *>> retained;
+  size_t warm_capacity = 0;
+  size_t peak_live = 0;
+  size_t sent = 0;
+  size_t frame = 0;
+
+  const double total_time = time_once([&] {
+    for (; sent < count; ++frame) {
+      ENetPacket *packet = packets.create(length, 0);
+      netpacket_retain(packet);
+      for (size_t message = 0; message < BENCH_MESSAGES_PER_PACKET && sent < count; ++message, ++sent) {
+        netevent_t *event = pool.acquire();
+        event->borrow_from(packet, packet->data + message * BENCH_MESSAGE_LENGTH, BENCH_MESSAGE_LENGTH);
+        if (sent % BENCH_RETAIN_EVERY == 0) {
+          netevent_pool_t::retain(event);
+          retained.emplace_back(frame + BENCH_RETAIN_FRAMES, event);
+        }
+        // Dispatched
+        netevent_pool_t::release(event);
+      }
+      netpacket_release(packet);
+
+      peak_live = std::max(peak_live, pool.live());
+      while (!retained.empty() && retained.front().first <= frame) {
+        netevent_pool_t::release(retained.front().second);
+        retained.pop_front();
+      }
+      if (frame == BENCH_WARMUP_FRAMES) {
+        warm_capacity = pool.capacity();
+      }
+    }
+  });
+
+  for (const auto &held : retained) {
+    netevent_pool_t::release(held.second);
+  }
+  retained.clear();
+
+  if (frame > BENCH_WARMUP_FRAMES && pool.capacity() > warm_capacity) {
+    s_log_warning("Netevent pool grew from %zu to %zu entries after warming up",
+      warm_capacity, pool.capacity());
+  }
+  if (pool.live() != 0) {
+    s_log_warning("%zu netevents still live after the stress test", pool.live());
+  }
+
+  s_log_note("Netevent stress, %zu messages in %zu frames: %.1f ns/message, "
+    "pool of %zu netevents (peak %zu live), %zu packet blocks free",
+    sent, frame, sent ? total_time * 1000.0 / sent : 0.0, pool.capacity(), peak_live,
+    packets.free_blocks());
+}
+
+
+} // namespace snow
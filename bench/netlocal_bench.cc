@@ -0,0 +1,290 @@
+/*
+  netlocal_bench.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "bench.hh"
+#include "../src/net/netevent_batch.hh"
+#include "../src/net/netlocal.hh"
+#include "../src/net/nettransport.hh"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+
+namespace snow {
+
+
+namespace {
+
+
+const size_t BENCH_MESSAGE_LENGTH = 24;
+// Messages queued between flushes, as for a busy tick
+const size_t BENCH_MESSAGES_PER_FLUSH = 64;
+// One-packet-per-message runs send this fraction of count
+const size_t BENCH_UNBATCHED_DIVISOR = 4;
+const size_t BENCH_ROUND_TRIPS = 10000;
+// A run that hasn't finished after this long is abandoned
+const double BENCH_TIMEOUT_SECONDS = 30.0;
+const enet_uint16 BENCH_ENET_PORT = 47810;
+const enet_uint32 BENCH_CONNECT_TIMEOUT_MS = 1000;
+const int BENCH_FLAGS = ENET_PACKET_FLAG_RELIABLE;
+
+
+using bench_clock_t = std::chrono::steady_clock;
+
+
+// In-process connection. Each side is serviced by its own thread.
+struct local_link_t
+{
+  netlocal_t  local;
+  ENetPeer *  to_server = NULL;
+  ENetPeer *  to_client = NULL;
+
+  bool connect()
+  {
+    to_server = local.connect();
+    to_client = local.client_peer();
+    ENetEvent event;
+    return server_receive(event) && event.type == ENET_EVENT_TYPE_CONNECT;
+  }
+
+  bool client_receive(ENetEvent &event) { return netlocal_t::receive(to_server, event); }
+  bool server_receive(ENetEvent &event) { return netlocal_t::receive(to_client, event); }
+};
+
+
+
+// ENet over the loopback interface, one host per side
+struct enet_link_t
+{
+  ENetHost *  server = NULL;
+  ENetHost *  client = NULL;
+  ENetPeer *  to_server = NULL;
+  ENetPeer *  to_client = NULL;
+
+  ~enet_link_t()
+  {
+    if (client) {
+      enet_host_destroy(client);
+    }
+    if (server) {
+      enet_host_destroy(server);
+    }
+  }
+
+  bool connect()
+  {
+    ENetAddress address;
+    enet_address_set_host(&address, "127.0.0.1");
+    address.port = BENCH_ENET_PORT;
+    server = enet_host_create(&address, 1, 1, 0, 0);
+    client = enet_host_create(NULL, 1, 1, 0, 0);
+    if (server == NULL || client == NULL) {
+      return false;
+    }
+
+    to_server = enet_host_connect(client, &address, 1, 0);
+    bool connected = false;
+    ENetEvent event;
+    const auto deadline = bench_clock_t::now() + std::chrono::milliseconds(BENCH_CONNECT_TIMEOUT_MS);
+    while (to_server != NULL && (!connected || to_client == NULL) && bench_clock_t::now() < deadline) {
+      if (enet_host_service(server, &event, 1) > 0 && event.type == ENET_EVENT_TYPE_CONNECT) {
+        to_client = event.peer;
+      }
+      if (enet_host_service(client, &event, 1) > 0 && event.type == ENET_EVENT_TYPE_CONNECT) {
+        connected = true;
+      }
+    }
+    return connected && to_client != NULL;
+  }
+
+  bool client_receive(ENetEvent &event) { return enet_host_service(client, &event, 0) > 0; }
+  bool server_receive(ENetEvent &event) { return enet_host_service(server, &event, 0) > 0; }
+};
+
+
+
+netevent_t bench_event()
+{
+  netevent_t event;
+  event.set_message(1);
+  event.set_buffer(netevent_t::charbuf_t(BENCH_MESSAGE_LENGTH, 0xAB));
+  return event;
+}
+
+
+
+bool timed_out(bench_clock_t::time_point start)
+{
+  return std::chrono::duration<double>(bench_clock_t::now() - start).count() > BENCH_TIMEOUT_SECONDS;
+}
+
+
+
+// Messages per second sent client to server, batched or one per packet. The
+// server thread counts messages until it has all of them.
+template <typename LINK>
+double measure_throughput(LINK &link, size_t count, bool batched)
+{
+  std::atomic<bool> done { false };
+  const auto start = bench_clock_t::now();
+
+  std::thread server([&] {
+    ENetEvent event;
+    size_t received = 0;
+    while (received < count && !timed_out(start)) {
+      if (!link.server_receive(event)) {
+        std::this_thread::yield();
+      } else if (event.type == ENET_EVENT_TYPE_RECEIVE) {
+        received += netevent_batch_t::split(event.packet, [](const uint8_t *, size_t) { });
+        enet_packet_destroy(event.packet);
+      }
+    }
+    done.store(received == count, std::memory_order_release);
+  });
+
+  netevent_t message = bench_event();
+  netevent_batch_t batch;
+  ENetEvent event;
+  for (size_t index = 0; index < count; ++index) {
+    if (batched) {
+      batch.queue(link.to_server, 0, message, BENCH_FLAGS);
+      if ((index + 1) % BENCH_MESSAGES_PER_FLUSH == 0) {
+        batch.flush();
+      }
+    } else {
+      message.send(link.to_server, 0, BENCH_FLAGS);
+    }
+    // Lets ENet put what's queued on the wire
+    while (link.client_receive(event)) {
+    }
+  }
+  batch.flush();
+
+  // Keep servicing the client until the server has everything
+  while (!done.load(std::memory_order_acquire) && !timed_out(start)) {
+    if (!link.client_receive(event)) {
+      std::this_thread::yield();
+    }
+  }
+  server.join();
+
+  if (!done.load(std::memory_order_acquire)) {
+    s_log_warning("Timed out waiting for %zu messages", count);
+    return 0.0;
+  }
+  return count / std::chrono::duration<double>(bench_clock_t::now() - start).count();
+}
+
+
+
+// Round trips of a single message echoed back by the server thread, in
+// microseconds, sorted.
+template <typename LINK>
+std::vector<double> measure_round_trips(LINK &link)
+{
+  std::atomic<bool> stop { false };
+  std::thread echo([&] {
+    netevent_t reply = bench_event();
+    ENetEvent event;
+    while (!stop.load(std::memory_order_acquire)) {
+      if (!link.server_receive(event)) {
+        std::this_thread::yield();
+      } else if (event.type == ENET_EVENT_TYPE_RECEIVE) {
+        enet_packet_destroy(event.packet);
+        reply.send(link.to_client, 0, BENCH_FLAGS);
+      }
+    }
+  });
+
+  netevent_t message = bench_event();
+  std::vector<double> round_trips;
+  round_trips.reserve(BENCH_ROUND_TRIPS);
+  const auto start = bench_clock_t::now();
+  for (size_t index = 0; index < BENCH_ROUND_TRIPS && !timed_out(start); ++index) {
+    ENetEvent event;
+    const double micros = time_once([&] {
+      message.send(link.to_server, 0, BENCH_FLAGS);
+      while (!link.client_receive(event) || event.type != ENET_EVENT_TYPE_RECEIVE) {
+        if (timed_out(start)) {
+          return;
+        }
+        std::this_thread::yield();
+      }
+      enet_packet_destroy(event.packet);
+    });
+    if (timed_out(start)) {
+      s_log_warning("Timed out waiting for a round trip");
+      break;
+    }
+    round_trips.push_back(micros);
+  }
+  stop.store(true, std::memory_order_release);
+  echo.join();
+
+  std::sort(round_trips.begin(), round_trips.end());
+  return round_trips;
+}
+
+
+
+template <typename LINK>
+void run_link(const char *name, LINK &link, size_t count)
+{
+  if (!link.connect()) {
+    s_log_warning("%s: couldn't connect, skipped", name);
+    return;
+  }
+
+  const double batched = measure_throughput(link, count, true);
+  const double unbatched = measure_throughput(link, count / BENCH_UNBATCHED_DIVISOR, false);
+  const std::vector<double> round_trips = measure_round_trips(link);
+  if (round_trips.empty()) {
+    return;
+  }
+
+  s_log_note("  %s: %.2fM messages/s batched %zu per flush, %.2fM messages/s one per packet, "
+    "round trip %.2f us median (%.2f us p99)", name, batched / 1e6, BENCH_MESSAGES_PER_FLUSH,
+    unbatched / 1e6, round_trips[round_trips.size() / 2],
+    round_trips[round_trips.size() * 99 / 100]);
+}
+
+
+} // namespace <anon>
+
+
+
+/*==============================================================================
+  netlocal_benchmark(count)
+
+    Compares the in-process connection used for a local server against ENet
+    over the loopback interface. For each, count messages of 24 bytes are
+    sent from a client thread to a server thread, first batched as in a busy
+    tick and then (a quarter as many) one per packet, then a single message
+    is bounced off the server thread to time round trips. All messages are
+    reliable. ENet is skipped if it can't bind its port.
+==============================================================================*/
+void netlocal_benchmark(size_t count)
+{
+  s_log_note("Transport benchmark, %zu messages", count);
+
+  {
+    local_link_t link;
+    run_link("Local", link, count);
+  }
+
+  if (enet_initialize() != 0) {
+    s_log_warning("ENet failed to initialize, skipped");
+    return;
+  }
+  {
+    enet_link_t link;
+    run_link("ENet loopback", link, count);
+  }
+  enet_deinitialize();
+}
+
+
+} // namespace snow
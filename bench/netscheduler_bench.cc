@@ -0,0 +1,144 @@
+/*
+  netscheduler_bench.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "bench.hh"
+#include "../src/net/netscheduler.hh"
+#include "../src/timing.hh"
+#include <algorithm>
+#include <vector>
+
+
+namespace snow {
+
+
+namespace {
+
+
+// 14.4 kbit/s, well under what count keys updating every tick would need
+const uint32_t BENCH_BANDWIDTH = 14400 / 8;
+const unsigned BENCH_TICKS = 5000;
+const size_t BENCH_MIN_PAYLOAD = 16;
+// Unconditional messages are sent every this many ticks
+const unsigned BENCH_MESSAGE_INTERVAL = 10;
+const uint16_t BENCH_MESSAGE_ID = netevent_t::MAX_ID;
+
+
+struct saturation_t
+{
+  unsigned              tick;
+  uint64_t              bytes;
+  // Tick each key was last sent and the longest it went without being sent
+  std::vector<unsigned> last_sent;
+  std::vector<unsigned> longest_wait;
+};
+
+
+
+// Stands in for the transport: records what the scheduler let through and
+// frees the packet
+int bench_send(void *context, ENetPeer *peer, enet_uint8 channel, ENetPacket *packet)
+{
+  saturation_t &run = *static_cast<saturation_t *>(context);
+  run.bytes += packet->dataLength;
+  netevent_batch_t::split(packet, [&run](const uint8_t *data, size_t length) {
+    netevent_t event;
+    if (!event.read_from(data, length) || event.message() >= run.last_sent.size()) {
+      return;
+    }
+    const uint16_t key = event.message();
+    run.longest_wait[key] = std::max(run.longest_wait[key], run.tick - run.last_sent[key]);
+    run.last_sent[key] = run.tick;
+  });
+  enet_packet_destroy(packet);
+  return 0;
+}
+
+
+} // namespace <anon>
+
+
+
+/*==============================================================================
+  netscheduler_saturation_benchmark(count)
+
+    Offers a single peer far more than its bandwidth allows: count keyed
+    state updates, spread across the three priority classes, are replaced
+    every tick for BENCH_TICKS ticks, with an unconditional message every few
+    ticks. Logs the time taken by schedule(), the bandwidth actually used
+    against the limit, the largest the update queue got, and the longest any
+    key of each class went unsent. Warns if the queue outgrows the number of
+    keys or the scheduler sends more than its budget allows.
+==============================================================================*/
+void netscheduler_saturation_benchmark(size_t count)
+{
+  count = std::min<size_t>(count, BENCH_MESSAGE_ID);
+
+  saturation_t run = { 0, 0, std::vector<unsigned>(count, 0), std::vector<unsigned>(count, 0) };
+  ENetPeer peer = { };
+  netscheduler_t scheduler;
+  netevent_batch_t batch;
+  scheduler.set_bandwidth(BENCH_BANDWIDTH);
+  batch.set_send_fn(bench_send, &run);
+
+  std::vector<netevent_t> updates(count);
+  for (size_t key = 0; key < count; ++key) {
+    updates[key].set_message(static_cast<uint32_t>(key));
+    updates[key].set_buffer(netevent_t::charbuf_t(BENCH_MIN_PAYLOAD + key % 8, 0xAB));
+  }
+  netevent_t message;
+  message.set_message(BENCH_MESSAGE_ID);
+
+  size_t longest_queue = 0;
+  double schedule_time = 0;
+  for (run.tick = 1; run.tick <= BENCH_TICKS; ++run.tick) {
+    for (size_t key = 0; key < count; ++key) {
+      scheduler.update(&peer, static_cast<uint32_t>(key), netpriority_t(key % NET_PRIORITY_COUNT),
+        0, updates[key]);
+    }
+    if (run.tick % BENCH_MESSAGE_INTERVAL == 0) {
+      scheduler.send(&peer, 1, message);
+    }
+
+    schedule_time += time_once([&] { scheduler.schedule(batch, FRAME_SEQ_TIME); });
+    batch.flush();
+    longest_queue = std::max(longest_queue, scheduler.stats(&peer).queued);
+  }
+
+  // Keys never sent since their last send count up to the end of the run
+  unsigned longest_wait[NET_PRIORITY_COUNT] = { 0, 0, 0 };
+  for (size_t key = 0; key < count; ++key) {
+    const unsigned waited = std::max(run.longest_wait[key], BENCH_TICKS - run.last_sent[key]);
+    unsigned &longest = longest_wait[key % NET_PRIORITY_COUNT];
+    longest = std::max(longest, waited);
+  }
+
+  const netscheduler_stats_t stats = scheduler.stats(&peer);
+  const double seconds = BENCH_TICKS * FRAME_SEQ_TIME;
+  const double bytes_per_second = run.bytes / seconds;
+  // Payload bytes only, so ENet's headers would come on top of this
+  const double allowed = BENCH_BANDWIDTH + BENCH_BANDWIDTH * FRAME_SEQ_TIME *
+    netscheduler_t::MAX_BURST_TICKS / seconds;
+
+  if (longest_queue > count) {
+    s_log_warning("Scheduler queue grew to %zu updates for %zu keys", longest_queue, count);
+  }
+  if (bytes_per_second > allowed) {
+    s_log_warning("Scheduler sent %.0f bytes/s over a limit of %u bytes/s",
+      bytes_per_second, BENCH_BANDWIDTH);
+  }
+
+  s_log_note("Scheduler saturation, %zu keys for %u ticks: %.2f us/schedule, %.0f/%u bytes/s, "
+    "queue at most %zu", count, BENCH_TICKS, schedule_time / BENCH_TICKS,
+    bytes_per_second, BENCH_BANDWIDTH, longest_queue);
+  s_log_note("  %llu sent, %llu deferred, %llu replaced, %llu dropped",
+    (unsigned long long)stats.updates_sent, (unsigned long long)stats.updates_deferred,
+    (unsigned long long)stats.updates_replaced, (unsigned long long)stats.updates_dropped);
+  s_log_note("  Longest wait in ticks: %u high, %u normal, %u low",
+    longest_wait[NET_PRIORITY_HIGH], longest_wait[NET_PRIORITY_NORMAL],
+    longest_wait[NET_PRIORITY_LOW]);
+}
+
+
+} // namespace snow
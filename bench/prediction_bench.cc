@@ -0,0 +1,104 @@
+/*
+  prediction_bench.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "bench.hh"
+#include "../src/game/snapshot_ring.hh"
+#include "../src/game/components/player_mover.hh"
+#include <cmath>
+
+
+namespace snow {
+
+
+namespace {
+
+
+// Ticks of prediction kept, as by player_t
+const size_t BENCH_RING_TICKS = 32;
+// Ticks re-simulated per correction
+const uint32_t BENCH_REPLAY_TICKS = 10;
+// How far the server's position is from the prediction
+const float BENCH_ERROR = 0.5f;
+
+
+using bench_ring_t = snapshot_ring_t<vec3f_t, player_input_t, BENCH_RING_TICKS>;
+
+
+
+player_input_t bench_input(uint32_t tick)
+{
+  const player_input_t input = {
+    static_cast<int8_t>(int(tick % 3) - 1),
+    static_cast<int8_t>(int(tick / 3 % 3) - 1)
+  };
+  return input;
+}
+
+
+
+void bench_step(vec3f_t &state, const player_input_t &input)
+{
+  player_mover_t::simulate(state, input, player_mover_t::SPEED);
+}
+
+
+} // namespace <anon>
+
+
+
+/*==============================================================================
+  prediction_benchmark(count)
+
+    Times client-side prediction as player_t does it: count ticks of player
+    movement are recorded in a snapshot ring, then count corrections each
+    rewind the ring BENCH_REPLAY_TICKS ticks and re-simulate every input
+    since. Warns if replaying from an uncorrected state doesn't reproduce
+    the recorded prediction.
+==============================================================================*/
+void prediction_benchmark(size_t count)
+{
+  bench_ring_t ring;
+  vec3f_t position = vec3f_t::zero;
+  uint32_t tick = 0;
+
+  const double record_time = time_once([&] {
+    for (size_t index = 0; index < count; ++index, ++tick) {
+      const player_input_t input = bench_input(tick);
+      bench_step(position, input);
+      ring.record(tick, input, position);
+    }
+  });
+
+  const uint32_t latest = ring.latest_tick();
+  const uint32_t from = latest - BENCH_REPLAY_TICKS;
+  const bench_ring_t::snapshot_t *const snapshot = ring.find(from);
+  if (snapshot == NULL) {
+    s_log_warning("Prediction ring holds fewer than %u ticks, skipped", BENCH_REPLAY_TICKS);
+    return;
+  }
+
+  const vec3f_t recorded = snapshot->state;
+  if ((ring.replay(from, recorded, bench_step) - position).length() > 1.0e-3f) {
+    s_log_warning("Replaying the prediction didn't reproduce it");
+  }
+
+  // Alternate the error's sign so the replayed states stay bounded
+  vec3f_t sum = vec3f_t::zero;
+  const double replay_time = time_once([&] {
+    for (size_t index = 0; index < count; ++index) {
+      const float error = (index & 1) ? BENCH_ERROR : -BENCH_ERROR;
+      sum += ring.replay(from, recorded + vec3f_t { error, error, 0 }, bench_step);
+    }
+  });
+
+  s_log_note("Prediction, %zu corrections of %u ticks: %.1f ns/correction "
+    "(%.1f ns/tick re-simulated), %.1f ns/tick recorded (checksum %.1f)", count,
+    BENCH_REPLAY_TICKS, count ? replay_time * 1000.0 / count : 0.0,
+    count ? replay_time * 1000.0 / (count * BENCH_REPLAY_TICKS) : 0.0,
+    count ? record_time * 1000.0 / count : 0.0, sum.x + sum.y);
+}
+
+
+} // namespace snow
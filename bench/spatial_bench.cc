@@ -0,0 +1,240 @@
+/*
+  spatial_bench.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "bench.hh"
+#include "../src/game/change_log.hh"
+#include "../src/game/gameobject.hh"
+#include "../src/game/scene_graph.hh"
+#include "../src/game/spatial_index.hh"
+#include "../src/game/components/transform.hh"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+
+namespace snow {
+
+
+namespace {
+
+
+const size_t BENCH_QUERIES = 200;
+const float BENCH_EXTENT = 1000.0f;
+const float BENCH_HEIGHT = 64.0f;
+const float BENCH_RADIUS = 32.0f;
+const size_t BENCH_NEAREST = 8;
+const int BENCH_UPDATE_PASSES = 20;
+
+
+using candidate_t = std::pair<float, uint32_t>;
+
+
+
+float distance_sq(float x, float y, float z, const vec3f_t &p)
+{
+  const float dx = x - p.x;
+  const float dy = y - p.y;
+  const float dz = z - p.z;
+  return dx * dx + dy * dy + dz * dz;
+}
+
+
+
+// Keeps the count nearest candidates in a max-heap, farthest at the front.
+void push_candidate(std::vector<candidate_t> &heap, size_t count, const candidate_t &candidate)
+{
+  if (heap.size() < count) {
+    heap.push_back(candidate);
+    std::push_heap(heap.begin(), heap.end());
+  } else if (candidate.first < heap.front().first) {
+    std::pop_heap(heap.begin(), heap.end());
+    heap.back() = candidate;
+    std::push_heap(heap.begin(), heap.end());
+  }
+}
+
+
+} // namespace <anon>
+
+
+
+/*==============================================================================
+  spatial_benchmark(count)
+
+    Scatters count objects over a BENCH_EXTENT square, BENCH_HEIGHT tall, and
+    times BENCH_QUERIES radius, box and nearest queries through the index and
+    through a linear scan of the objects' world translations. Then times
+    update() after moving 1% of the objects and after moving all of them,
+    one change_log() tick per pass, as a game would between ticks. A nearest
+    query from far outside the objects is timed as well.
+==============================================================================*/
+void spatial_benchmark(size_t count)
+{
+  using clock_t = std::chrono::steady_clock;
+  const auto elapsed_us = [] (clock_t::time_point start) {
+    return std::chrono::duration<double, std::micro>(clock_t::now() - start).count();
+  };
+
+  std::mt19937 rng(static_cast<uint32_t>(count));
+  std::uniform_real_distribution<float> horizontal(0.0f, BENCH_EXTENT);
+  std::uniform_real_distribution<float> vertical(0.0f, BENCH_HEIGHT);
+  const auto random_point = [&] {
+    return vec3f_t { horizontal(rng), vertical(rng), horizontal(rng) };
+  };
+
+  spatial_index_t index;
+  std::vector<game_object_t *> objects(count);
+  std::vector<uint32_t> slots(count);
+  for (size_t obj_index = 0; obj_index < count; ++obj_index) {
+    game_object_t *object = new game_object_t;
+    transform_t *tform = object->get_component<transform_t>();
+    tform->set_translation(random_point());
+    objects[obj_index] = object;
+    slots[obj_index] = tform->slot();
+  }
+  transform_store().update_world(scene_graph());
+
+  auto start = clock_t::now();
+  for (game_object_t *object : objects) {
+    index.insert(object);
+  }
+  index.update();
+  const double build_time = elapsed_us(start);
+
+  std::vector<vec3f_t> centers(BENCH_QUERIES);
+  for (vec3f_t &center : centers) {
+    center = random_point();
+  }
+
+  const transform_store_t &store = transform_store();
+  std::vector<game_object_t *> results;
+  std::vector<candidate_t> heap;
+  const float radius_sq = BENCH_RADIUS * BENCH_RADIUS;
+
+  // Radius
+  size_t index_hits = 0;
+  start = clock_t::now();
+  for (const vec3f_t &center : centers) {
+    results.clear();
+    index.query_radius(center, BENCH_RADIUS, results);
+    index_hits += results.size();
+  }
+  const double radius_time = elapsed_us(start) / BENCH_QUERIES;
+
+  size_t scan_hits = 0;
+  start = clock_t::now();
+  for (const vec3f_t &center : centers) {
+    results.clear();
+    for (size_t obj_index = 0; obj_index < count; ++obj_index) {
+      const vec3f_t pos = store.world_translation(slots[obj_index]);
+      if (distance_sq(pos.x, pos.y, pos.z, center) <= radius_sq) {
+        results.push_back(objects[obj_index]);
+      }
+    }
+    scan_hits += results.size();
+  }
+  const double radius_scan_time = elapsed_us(start) / BENCH_QUERIES;
+  const size_t radius_hits = scan_hits;
+  if (index_hits != scan_hits) {
+    s_log_warning("Radius queries found %zu objects, linear scan found %zu", index_hits, scan_hits);
+  }
+
+  // Box
+  index_hits = 0;
+  start = clock_t::now();
+  for (const vec3f_t &center : centers) {
+    results.clear();
+    const vec3f_t min = { center.x - BENCH_RADIUS, center.y - BENCH_RADIUS, center.z - BENCH_RADIUS };
+    const vec3f_t max = { center.x + BENCH_RADIUS, center.y + BENCH_RADIUS, center.z + BENCH_RADIUS };
+    index.query_box(min, max, results);
+    index_hits += results.size();
+  }
+  const double box_time = elapsed_us(start) / BENCH_QUERIES;
+
+  scan_hits = 0;
+  start = clock_t::now();
+  for (const vec3f_t &center : centers) {
+    results.clear();
+    for (size_t obj_index = 0; obj_index < count; ++obj_index) {
+      const vec3f_t pos = store.world_translation(slots[obj_index]);
+      if (std::abs(pos.x - center.x) <= BENCH_RADIUS &&
+          std::abs(pos.y - center.y) <= BENCH_RADIUS &&
+          std::abs(pos.z - center.z) <= BENCH_RADIUS) {
+        results.push_back(objects[obj_index]);
+      }
+    }
+    scan_hits += results.size();
+  }
+  const double box_scan_time = elapsed_us(start) / BENCH_QUERIES;
+  if (index_hits != scan_hits) {
+    s_log_warning("Box queries found %zu objects, linear scan found %zu", index_hits, scan_hits);
+  }
+
+  // Nearest
+  start = clock_t::now();
+  for (const vec3f_t &center : centers) {
+    results.clear();
+    index.query_nearest(center, BENCH_NEAREST, results);
+  }
+  const double nearest_time = elapsed_us(start) / BENCH_QUERIES;
+
+  start = clock_t::now();
+  for (const vec3f_t &center : centers) {
+    heap.clear();
+    for (size_t obj_index = 0; obj_index < count; ++obj_index) {
+      const vec3f_t pos = store.world_translation(slots[obj_index]);
+      push_candidate(heap, BENCH_NEAREST,
+        candidate_t { distance_sq(pos.x, pos.y, pos.z, center), uint32_t(obj_index) });
+    }
+    std::sort_heap(heap.begin(), heap.end());
+  }
+  const double nearest_scan_time = elapsed_us(start) / BENCH_QUERIES;
+
+  // Nearest from well outside the occupied cells
+  const vec3f_t far_center = { -BENCH_EXTENT * 100.0f, 0.0f, -BENCH_EXTENT * 100.0f };
+  start = clock_t::now();
+  for (size_t query = 0; query < BENCH_QUERIES; ++query) {
+    results.clear();
+    index.query_nearest(far_center, BENCH_NEAREST, results);
+  }
+  const double nearest_far_time = elapsed_us(start) / BENCH_QUERIES;
+
+  // Updates
+  std::uniform_real_distribution<float> nudge(-2.0f, 2.0f);
+  const auto time_update = [&] (size_t stride) {
+    double total = 0;
+    for (int pass = 0; pass < BENCH_UPDATE_PASSES; ++pass) {
+      for (size_t obj_index = pass % stride; obj_index < count; obj_index += stride) {
+        transform_t *tform = objects[obj_index]->get_component<transform_t>();
+        tform->set_translation(tform->translation() + vec3f_t { nudge(rng), nudge(rng), nudge(rng) });
+      }
+      transform_store().update_world(scene_graph());
+      change_log().advance();
+      const auto update_start = clock_t::now();
+      index.update();
+      total += elapsed_us(update_start);
+    }
+    return total / BENCH_UPDATE_PASSES;
+  };
+  const double update_few_time = time_update(100);
+  const double update_all_time = time_update(1);
+
+  for (game_object_t *object : objects) {
+    index.remove(object);
+    delete object;
+  }
+
+  s_log_note("Spatial index benchmark, %zu objects, %.0f us to build", count, build_time);
+  s_log_note("  radius %.0f: index %.1f us/query, scan %.1f us/query (%.1f hits)",
+    BENCH_RADIUS, radius_time, radius_scan_time, double(radius_hits) / BENCH_QUERIES);
+  s_log_note("  box: index %.1f us/query, scan %.1f us/query", box_time, box_scan_time);
+  s_log_note("  nearest %zu: index %.1f us/query, scan %.1f us/query, %.1f us/query from far away",
+    BENCH_NEAREST, nearest_time, nearest_scan_time, nearest_far_time);
+  s_log_note("  update: 1%% moved %.1f us, all moved %.1f us", update_few_time, update_all_time);
+}
+
+
+} // namespace snow
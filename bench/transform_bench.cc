@@ -0,0 +1,170 @@
+/*
+  transform_bench.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "bench.hh"
+#include "../src/game/scene_graph.hh"
+#include "../src/game/components/transform_store.hh"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+
+namespace snow {
+
+
+namespace {
+
+
+const int BENCH_PASSES = 50;
+const float BENCH_EXTENT = 100.0f;
+// Largest difference from the reference matrices tolerated
+const float BENCH_TOLERANCE = 1.0e-3f;
+
+
+// Per-object layout the store replaced: a rotation matrix, scale and
+// translation, with local = T * R * S built from generic 4x4 multiplies
+struct aos_transform_t
+{
+  mat3f_t rotation;
+  vec3f_t scale;
+  vec3f_t translation;
+};
+
+
+
+// out = lhs * rhs for column-major 4x4 matrices
+void multiply(const float *lhs, const float *rhs, float *out)
+{
+  for (int col = 0; col < 4; ++col) {
+    for (int row = 0; row < 4; ++row) {
+      float sum = 0;
+      for (int index = 0; index < 4; ++index) {
+        sum += lhs[index * 4 + row] * rhs[col * 4 + index];
+      }
+      out[col * 4 + row] = sum;
+    }
+  }
+}
+
+
+
+void aos_local(const aos_transform_t &transform, float *out)
+{
+  const vec3f_t &t = transform.translation;
+  const vec3f_t &s = transform.scale;
+  const mat3f_t &r = transform.rotation;
+  const float translation[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, t.x, t.y, t.z, 1 };
+  const float rotation[16] = {
+    r.r.x, r.r.y, r.r.z, 0,
+    r.s.x, r.s.y, r.s.z, 0,
+    r.t.x, r.t.y, r.t.z, 0,
+    0, 0, 0, 1
+  };
+  const float scale[16] = { s.x, 0, 0, 0, 0, s.y, 0, 0, 0, 0, s.z, 0, 0, 0, 0, 1 };
+  float translation_rotation[16];
+  multiply(translation, rotation, translation_rotation);
+  multiply(translation_rotation, scale, out);
+}
+
+
+
+inline const float *floats(const mat4f_t &matrix)
+{
+  return reinterpret_cast<const float *>(&matrix);
+}
+
+
+} // namespace <anon>
+
+
+
+/*==============================================================================
+  transform_benchmark(count)
+
+    Fills a transform_store_t with count random transforms and times
+    computing their local matrices each frame: per object from the old
+    array-of-structures layout, per slot with compute_local(), and in one
+    update_local() pass (SSE where available). Then times setting every
+    slot's translation and refreshing world matrices with update_world().
+    Warns if any store matrix differs from the per-object reference by more
+    than BENCH_TOLERANCE.
+==============================================================================*/
+void transform_benchmark(size_t count)
+{
+  std::mt19937 rng(static_cast<uint32_t>(count));
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+  // A separate store, so the benchmark doesn't share the game's
+  transform_store_t store;
+  store.reserve(count);
+  std::vector<aos_transform_t> reference(count);
+  for (size_t index = 0; index < count; ++index) {
+    const uint32_t slot = store.allocate();
+    const quatf_t rotation =
+      quatf_t::from_angle_axis(unit(rng) * 3.0f, vec3f_t::pos_Y) *
+      quatf_t::from_angle_axis(unit(rng) * 3.0f, vec3f_t::pos_X);
+    const vec3f_t translation = {
+      unit(rng) * BENCH_EXTENT, unit(rng) * BENCH_EXTENT, unit(rng) * BENCH_EXTENT
+    };
+    const vec3f_t scale = {
+      1.0f + unit(rng) * 0.5f, 1.0f + unit(rng) * 0.5f, 1.0f + unit(rng) * 0.5f
+    };
+    store.set_rotation(slot, rotation);
+    store.set_translation(slot, translation);
+    store.set_scale(slot, scale);
+    reference[index] = { mat3f_t::from_quat(rotation), scale, translation };
+  }
+
+  std::vector<mat4f_t> out(count);
+  const double aos_time = time_passes(BENCH_PASSES, [&] {
+    for (size_t index = 0; index < count; ++index) {
+      aos_local(reference[index], reinterpret_cast<float *>(&out[index]));
+    }
+  });
+  const double scalar_time = time_passes(BENCH_PASSES, [&] {
+    for (size_t index = 0; index < count; ++index) {
+      out[index] = store.compute_local(static_cast<uint32_t>(index));
+    }
+  });
+  const double batch_time = time_passes(BENCH_PASSES, [&] { store.update_local(); });
+
+  float max_error = 0;
+  for (size_t index = 0; index < count; ++index) {
+    float expected[16];
+    aos_local(reference[index], expected);
+    const float *batch = floats(store.local(static_cast<uint32_t>(index)));
+    const mat4f_t single = store.compute_local(static_cast<uint32_t>(index));
+    for (int element = 0; element < 16; ++element) {
+      max_error = std::max(max_error, std::fabs(expected[element] - batch[element]));
+      max_error = std::max(max_error, std::fabs(expected[element] - floats(single)[element]));
+    }
+  }
+  if (max_error > BENCH_TOLERANCE) {
+    s_log_warning("Transform matrices differ from the reference by up to %g", max_error);
+  }
+
+  // No nodes, so every slot is a root
+  scene_graph_t graph;
+  float offset = 0;
+  const double update_time = time_passes(BENCH_PASSES, [&] {
+    offset += 1.0f;
+    for (size_t index = 0; index < count; ++index) {
+      const uint32_t slot = static_cast<uint32_t>(index);
+      vec3f_t translation = reference[index].translation;
+      translation.x += offset;
+      store.set_translation(slot, translation);
+    }
+    store.update_world(graph);
+  });
+
+  s_log_note("Transforms, %zu per frame: %.3f ms per-object 4x4, %.3f ms compute_local, "
+    "%.3f ms update_local, %.3f ms to move all and update_world (max error %g)",
+    count, aos_time / 1000.0, scalar_time / 1000.0, batch_time / 1000.0,
+    update_time / 1000.0, max_error);
+}
+
+
+} // namespace snow
@@ -4,6 +4,7 @@
   is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
 */
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <stdexcept>
@@ -16,6 +17,7 @@
 #include <snow/snow-common.hh>
 
 #include "../server/sv_main.hh"
+#include "../game/components/component_pools.hh"
 
 // Font test
 #include "../renderer/font.hh"
@@ -36,6 +38,7 @@ namespace snow {
 #endif
 #define UP_BANDWIDTH      (14400 / 8)
 #define DOWN_BANDWIDTH    (57600 / 8)
+#define NETSIM_PORT       (server_t::DEFAULT_SERVER_PORT + 1)
 #define GL_QUEUE_NAME     "net.spifftastic.snow.gl_queue"
 #define FRAME_QUEUE_NAME  "net.spifftastic.snow.frame_queue"
 
@@ -110,6 +113,90 @@ client_t::client_t() :
       cl_willQuit->seti(1);
     }
   })
+#if USE_SERVER
+  , cmd_netstats_("net_stats", [this](cvar_set_t &cvars, const ccmd_t::args_t &args) {
+    const netevent_stats_t &stats = netevent_stats();
+    const double sent = static_cast<double>(stats.messages_sent.load());
+    const double received = static_cast<double>(stats.messages_received.load());
+    s_log_note("Netevents sent: %.0f (%.3f packet allocs/message)",
+      sent, sent > 0 ? stats.packet_allocs.load() / sent : 0.0);
+    s_log_note("Netevents received: %.0f (%.3f allocs/message, %.3f copies/message)",
+      received,
+      received > 0 ? stats.payload_allocs.load() / received : 0.0,
+      received > 0 ? stats.payload_copies.load() / received : 0.0);
+    s_log_note("Netevents rejected: %llu",
+      (unsigned long long)stats.messages_rejected.load());
+    const netscheduler_stats_t sched = netscheduler_.stats(peer_);
+    s_log_note("Scheduler: %zu queued, %llu sent, %llu deferred, %llu replaced, %llu dropped",
+      sched.queued,
+      (unsigned long long)sched.updates_sent,
+      (unsigned long long)sched.updates_deferred,
+      (unsigned long long)sched.updates_replaced,
+      (unsigned long long)sched.updates_dropped);
+    const netbulk_stats_t bulk = netbulk_.stats();
+    s_log_note("Bulk: %llu/%llu bytes sent/received (%llu resumed), %llu/%llu transfers, %llu cancelled, %llu failed",
+      (unsigned long long)bulk.bytes_sent,
+      (unsigned long long)bulk.bytes_received,
+      (unsigned long long)bulk.bytes_resumed,
+      (unsigned long long)bulk.transfers_sent,
+      (unsigned long long)bulk.transfers_received,
+      (unsigned long long)bulk.transfers_cancelled,
+      (unsigned long long)bulk.transfers_failed);
+    s_log_note("Replicated cvars: %zu applied, %zu unknown, %zu rejected",
+      netcvar_stats_.applied, netcvar_stats_.unknown, netcvar_stats_.rejected);
+    if (peer_ != NULL && !netpeer_is_local(peer_)) {
+      s_log_note("Round trip: %u ms (variance %u ms)",
+        (unsigned)peer_->roundTripTime, (unsigned)peer_->roundTripTimeVariance);
+    }
+#if USE_LOCAL_SERVER
+    const server_t &server = server_t::get_server(server_t::DEFAULT_SERVER_NUM);
+    const server_tick_stats_t ticks = server.tick_stats();
+    s_log_note("Server ticks: %llu, %.3f ms mean, %.3f ms stddev, %.3f ms max",
+      (unsigned long long)ticks.ticks, ticks.mean_ms, ticks.stddev_ms, ticks.max_ms);
+    const netio_stats_t io = server.netio_stats();
+    s_log_note("Server I/O: %llu events, %llu packets sent, %llu failed, %llu/%llu deferred in/out",
+      (unsigned long long)io.events_received,
+      (unsigned long long)io.packets_sent,
+      (unsigned long long)io.send_failures,
+      (unsigned long long)io.inbound_deferred,
+      (unsigned long long)io.outbound_deferred);
+#endif
+    if (netsim_.is_running()) {
+      const netsim_stats_t up = netsim_.upstream_stats();
+      const netsim_stats_t down = netsim_.downstream_stats();
+      s_log_note("Simulator up: %llu/%llu delivered, %llu lost, %llu overflowed",
+        (unsigned long long)up.delivered, (unsigned long long)up.received,
+        (unsigned long long)up.lost, (unsigned long long)up.overflowed);
+      s_log_note("Simulator down: %llu/%llu delivered, %llu lost, %llu overflowed",
+        (unsigned long long)down.delivered, (unsigned long long)down.received,
+        (unsigned long long)down.lost, (unsigned long long)down.overflowed);
+    }
+    // Each end compresses what it sends, so report both
+    const auto log_compression = [] (const char *end, const netcompressor_stats_t &compression) {
+      const uint64_t offered = compression.packets_compressed + compression.packets_skipped;
+      s_log_note("%s compression: %.3f ratio, %llu/%llu packets compressed, %.3f ms/packet",
+        end,
+        compression.ratio(),
+        (unsigned long long)compression.packets_compressed,
+        (unsigned long long)offered,
+        offered > 0 ? compression.compress_nsec / (1.0e6 * offered) : 0.0);
+      s_log_note("%s decompression: %llu packets, %llu failures, %.3f ms/packet",
+        end,
+        (unsigned long long)compression.packets_decompressed,
+        (unsigned long long)compression.decompress_failures,
+        compression.packets_decompressed > 0
+          ? compression.decompress_nsec / (1.0e6 * compression.packets_decompressed)
+          : 0.0);
+    };
+    log_compression("Client", netcompressor_.stats());
+#if USE_LOCAL_SERVER
+    log_compression("Server", server.compression_stats());
+#endif
+  })
+#endif
+  , cmd_poolstats_("pool_stats", [](cvar_set_t &cvars, const ccmd_t::args_t &args) {
+    log_component_pool_stats();
+  })
 {
 }
 
@@ -154,7 +241,7 @@ void client_t::initialize(int argc, const char *argv[])
 #if USE_LOCAL_SERVER
   // Create client host
   s_log_note("Creating local client");
-  host_ = enet_host_create(NULL, 1, 2, DOWN_BANDWIDTH, UP_BANDWIDTH);
+  host_ = enet_host_create(NULL, 1, NET_CHANNEL_COUNT, DOWN_BANDWIDTH, UP_BANDWIDTH);
   if (host_ == NULL) {
     s_throw(std::runtime_error, "Unable to create client host");
   }
@@ -162,13 +249,10 @@ void client_t::initialize(int argc, const char *argv[])
   s_log_note("Starting local server");
   server_t::get_server(server_t::DEFAULT_SERVER_NUM).initialize(argc, argv);
 
-  s_log_note("Attempting to connect to server");
-  ENetAddress server_addr;
-  enet_address_set_host(&server_addr, "127.0.0.1");
-  server_addr.port = server_t::DEFAULT_SERVER_PORT;
-  if (!connect(server_addr)) {
-    s_throw(std::runtime_error, "Unable to connect to local server");
-  }
+  // The local server is reached through an in-process connection rather than
+  // over loopback. The client host remains for remote servers.
+  s_log_note("Connecting to local server");
+  peer_ = server_t::get_server(server_t::DEFAULT_SERVER_NUM).connect_local();
 #endif
 
   res_ = &resources_t::default_resources();
@@ -211,7 +295,7 @@ void client_t::quit()
 #if USE_SERVER
 bool client_t::connect(ENetAddress address)
 {
-  peer_ = enet_host_connect(host_, &address, 2, 0);
+  peer_ = enet_host_connect(host_, &address, NET_CHANNEL_COUNT, 0);
 
   if (peer_ == NULL) {
     s_log_error("Unable to allocate peer to connect to server");
@@ -252,11 +336,156 @@ bool client_t::is_connected() const
 void client_t::disconnect()
 {
   if (host_ != NULL) {
+    netscheduler_.drop(peer_);
+    netbulk_.drop(peer_);
+    netevent_batch_.flush();
     enet_host_flush(host_);
-    enet_peer_disconnect(peer_, 0);
+    netpeer_disconnect(peer_, 0);
     enet_host_destroy(host_);
     host_ = NULL;
+    peer_ = NULL;
+  }
+}
+
+
+
+bool client_t::send_netevent(const netevent_t &event, enet_uint8 channel, int flags)
+{
+  if (!is_connected()) {
+    return false;
+  }
+  return netevent_batch_.queue(peer_, channel, event, flags);
+}
+
+
+
+bool client_t::send_netstate(uint32_t key, netpriority_t priority,
+  const netevent_t &event, enet_uint8 channel, int flags)
+{
+  if (!is_connected()) {
+    return false;
+  }
+  netscheduler_.update(peer_, key, priority, channel, event, flags);
+  return true;
+}
+
+
+
+void client_t::update_compression()
+{
+  int mode = net_compress->geti();
+  const string &dictionary = net_compressDict->gets();
+
+#if !USE_LOCAL_SERVER
+  // A remote server can't be told the mode, and a host that compresses
+  // can't talk to one that doesn't, so compression stays off
+  if (mode != NET_COMPRESS_NONE) {
+    s_log_warning("net_compress requires a local server, leaving compression off");
+    mode = NET_COMPRESS_NONE;
+    net_compress->seti(mode);
+    net_compress->update();
+  }
+#endif
+
+  if (!netcompressor_.load_dictionary(dictionary)) {
+    s_log_warning("Compressing without a dictionary");
+  }
+
+  if (host_ != NULL) {
+    netcompressor_t::apply_mode(host_, mode, netcompressor_);
+  }
+
+#if USE_LOCAL_SERVER
+  // Both ends have to agree on the codec and dictionary
+  server_t::get_server(server_t::DEFAULT_SERVER_NUM).set_compression(mode, dictionary);
+#endif
+}
+
+
+
+void client_t::update_netsim()
+{
+  cvar_t *const settings[] = {
+    net_simLatency, net_simJitter, net_simLoss, net_simDuplicate,
+    net_simReorder, net_simBandwidth, net_simSeed
+  };
+
+  bool changed = false;
+  for (cvar_t *setting : settings) {
+    if (setting->has_flags(CVAR_MODIFIED)) {
+      setting->update();
+      changed = true;
+    }
   }
+  if (net_sim->has_flags(CVAR_MODIFIED)) {
+    net_sim->update();
+  }
+
+  const bool enable = net_sim->geti() != 0;
+  if (changed || (enable && !netsim_.is_running())) {
+    netsim_config_t config;
+    config.latency_ms = static_cast<uint32_t>(std::max(net_simLatency->geti(), 0));
+    config.jitter_ms = static_cast<uint32_t>(std::max(net_simJitter->geti(), 0));
+    config.loss = net_simLoss->getf();
+    config.duplicate = net_simDuplicate->getf();
+    config.reorder = net_simReorder->getf();
+    config.bandwidth = static_cast<uint32_t>(std::max(net_simBandwidth->geti(), 0));
+    config.seed = static_cast<uint32_t>(net_simSeed->geti());
+    netsim_.configure(config);
+  }
+
+#if USE_LOCAL_SERVER
+  if (enable == netsim_.is_running()) {
+    return;
+  }
+
+  drop_connection();
+
+  if (enable) {
+    // Route the connection to the local server over ENet through the relay
+    ENetAddress server_addr;
+    enet_address_set_host(&server_addr, "127.0.0.1");
+    server_addr.port = server_t::DEFAULT_SERVER_PORT;
+    ENetAddress relay_addr = server_addr;
+    relay_addr.port = NETSIM_PORT;
+
+    if (netsim_.start(NETSIM_PORT, server_addr) && connect(relay_addr)) {
+      s_log_note("Connected to local server through network simulator");
+      return;
+    }
+
+    s_log_error("Unable to start network simulator");
+    netsim_.stop();
+    net_sim->seti(0);
+    net_sim->update();
+  } else {
+    netsim_.stop();
+  }
+
+  peer_ = server_t::get_server(server_t::DEFAULT_SERVER_NUM).connect_local();
+#else
+  if (enable) {
+    s_log_warning("The network simulator requires a local server");
+  }
+#endif
+}
+
+
+
+void client_t::drop_connection()
+{
+  if (peer_ == NULL) {
+    return;
+  }
+
+  netscheduler_.drop(peer_);
+  netbulk_.drop(peer_);
+  netevent_batch_.drop(peer_);
+  netpeer_disconnect(peer_, 0);
+  if (host_ != NULL) {
+    enet_host_flush(host_);
+  }
+  peer_ = NULL;
 }
 #endif
 
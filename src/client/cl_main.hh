@@ -7,11 +7,19 @@
 #define __SNOW_CL_MAIN_HH__
 
 #include "../config.hh"
-#include <snow/types/object_pool.hh>
 #include "../dispatch.hh"
+#include "../net/netcompressor.hh"
 #include "../net/netevent.hh"
+#include "../net/netbulk.hh"
+#include "../net/netcvars.hh"
+#include "../net/netevent_batch.hh"
+#include "../net/netevent_pool.hh"
+#include "../net/netscheduler.hh"
+#include "../net/netsim.hh"
+#include "../net/nettransport.hh"
 #include "../event_queue.hh"
 #include "../console.hh"
+#include "../game/messages.hh"
 #include "../game/resources.hh"
 #if USE_SERVER
 #include <enet/enet.h>
@@ -53,6 +61,19 @@ struct S_EXPORT client_t
   bool is_connected() const;
   // Disconnects from the server (if connected)
   void disconnect();
+  // Queues a netevent to be sent to the server at the end of the current
+  // frame. Netevents queued in the same frame are sent in a single packet.
+  bool send_netevent(const netevent_t &event, enet_uint8 channel,
+    int flags = ENET_PACKET_FLAG_RELIABLE);
+  // Queues a state update for key to be sent to the server as bandwidth
+  // allows, replacing any unsent update for the same key. See netscheduler_t.
+  bool send_netstate(uint32_t key, netpriority_t priority, const netevent_t &event,
+    enet_uint8 channel, int flags = 0);
+
+  // Messages consumed by the client itself, dispatched from game_messages_t.
+  // Everything else is passed on to systems as a NET_EVENT.
+  void on_message(const welcome_msg_t &msg, const netevent_t &event);
+  void on_message(const netcvar_delta_msg_t &msg, const netevent_t &event);
 #endif
 
   /* Adds a system to the list of systems to update/send events to. Does not
@@ -71,10 +92,19 @@ protected:
   void dispose();
 #if USE_SERVER
   void pump_netevents(double timeslice);
+  void emit_netevents(ENetPacket *packet, double timeslice);
+  // Applies net_compress and net_compressDict to the client host (and local
+  // server, if any)
+  void update_compression();
+  // Applies the net_sim* cvars. When net_sim is enabled, the connection to the
+  // local server goes over ENet through a netsim_t relay instead of the
+  // in-process connection.
+  void update_netsim();
+  // Drops the current connection without destroying the client host
+  void drop_connection();
 #endif
 
 private:
-  using netevent_pool_t = object_pool_t<netevent_t, unsigned, false>;
   using system_pair_t = std::pair<int, system_t *>;
 
   std::atomic<bool>         running_ { false };
@@ -86,6 +116,12 @@ private:
   ENetHost *                host_ = NULL;
   ENetPeer *                peer_ = NULL;
   netevent_pool_t           netevent_pool_;
+  netevent_batch_t          netevent_batch_;
+  netscheduler_t            netscheduler_;
+  netbulk_t                 netbulk_;
+  netcvar_stats_t           netcvar_stats_ { 0, 0, 0 };
+  netcompressor_t           netcompressor_;
+  netsim_t                  netsim_;
 #endif
 
   GLFWwindow *              window_ = NULL;
@@ -101,6 +137,10 @@ private:
 
   // CCMDS
   ccmd_t cmd_quit_;
+#if USE_SERVER
+  ccmd_t cmd_netstats_;
+#endif
+  ccmd_t cmd_poolstats_;
 
   // CVARS
   cvar_t *cl_willQuit;
@@ -108,6 +148,18 @@ private:
   cvar_t *wnd_mouseMode;
   cvar_t *r_drawFrame;
   cvar_t *r_clearFrame;
+#if USE_SERVER
+  cvar_t *net_compress;
+  cvar_t *net_compressDict;
+  cvar_t *net_sim;
+  cvar_t *net_simLatency;
+  cvar_t *net_simJitter;
+  cvar_t *net_simLoss;
+  cvar_t *net_simDuplicate;
+  cvar_t *net_simReorder;
+  cvar_t *net_simBandwidth;
+  cvar_t *net_simSeed;
+#endif
 };
 
 
@@ -5,10 +5,18 @@
 */
 #include "cl_main.hh"
 #include "../game/system.hh"
+#include "../game/change_log.hh"
 #include "../game/console_pane.hh"
+#include "../game/object_commands.hh"
+#include "../game/scene_graph.hh"
+#include "../game/components/player_mover.hh"
+#include "../game/systems/player.hh"
+#include "../game/components/transform_store.hh"
 #include "../renderer/gl_error.hh"
 #include "../timing.hh"
 #include "../deferred.hh"
+#include "../net/netlocal.hh"
+#include "../net/netpacket_pool.hh"
 #include <thread>
 
 
@@ -36,6 +44,18 @@ std::chrono::milliseconds cl_frameloop_sleep_duration()
 }
 
 
+
+#if USE_SERVER
+// Each input message repeats the unacknowledged inputs before it, so only the
+// newest one needs to go out
+void cl_send_player_input(void *context, const netevent_t &event)
+{
+  client_t *client = (client_t *)context;
+  client->send_netstate(PLAYER_INPUT_MESSAGE, NET_PRIORITY_HIGH, event, 1);
+}
+#endif
+
+
 } // namespace <anon>
 
 
@@ -44,31 +64,18 @@ std::chrono::milliseconds cl_frameloop_sleep_duration()
   pump_netevents
 
     Reads events from the server or other connections and inserts them into the
-    event queue.
+    event queue. Called at the start of every simulation tick, so it never
+    waits for events.
 ==============================================================================*/
 #if USE_SERVER
 void client_t::pump_netevents(double timeslice)
 {
-  #define NET_TIMEOUT 1
-
   ENetEvent event;
   int error = 0;
-  while ((error = enet_host_service(host_, &event, NET_TIMEOUT)) > 0) {
-    if (event.type == ENET_EVENT_TYPE_RECEIVE) {
-      if (event.packet) {
-        const auto index = netevent_pool_.allocate();
-        netevent_t &netevent = netevent_pool_[index];
-        netevent.read_from(event.packet);
-        enet_packet_destroy(event.packet);
-        event_t emitted = {
-          EVENT_SENDER_NET,
-          { .sender = this },
-          NET_EVENT,
-          timeslice
-        };
-        emitted.net = &netevent;
-        event_queue_.emit_event(emitted);
-        s_log_note("Emitted net event");
+  if (host_ != NULL) {
+    while ((error = enet_host_service(host_, &event, 0)) > 0) {
+      if (event.type == ENET_EVENT_TYPE_RECEIVE && event.packet) {
+        emit_netevents(event.packet, timeslice);
       }
     }
   }
@@ -76,6 +83,67 @@ void client_t::pump_netevents(double timeslice)
   if (error < 0) {
     s_log_error("Error checking for ENet events: %d", error);
   }
+
+  if (netpeer_is_local(peer_)) {
+    while (netlocal_t::receive(peer_, event)) {
+      if (event.type == ENET_EVENT_TYPE_RECEIVE && event.packet) {
+        emit_netevents(event.packet, timeslice);
+      } else if (event.type == ENET_EVENT_TYPE_DISCONNECT) {
+        s_log_note("Disconnected from local server");
+      }
+    }
+  }
+}
+
+
+
+void client_t::emit_netevents(ENetPacket *packet, double timeslice)
+{
+  // Packets may carry several netevents. Each one borrows its data from the
+  // packet, which is destroyed once the last netevent releases it.
+  netpacket_retain(packet);
+  netevent_batch_t::split(packet, [&](const uint8_t *data, size_t length) {
+    netevent_t &netevent = *netevent_pool_.acquire();
+    if (!netevent.borrow_from(packet, data, length)) {
+      netevent_pool_t::release(&netevent);
+      return;
+    }
+    netevent_stats().messages_received += 1;
+    // Bulk transfer messages and those the client handles itself are
+    // consumed here. Messages the registry rejects (and counts) are dropped
+    // rather than passed to systems.
+    if (netbulk_.handle(peer_, netevent) ||
+        game_messages_t::dispatch(*this, netevent) ||
+        !game_messages_t::accepts(netevent.message(), netevent.payload_length())) {
+      netevent_pool_t::release(&netevent);
+      return;
+    }
+    event_t emitted = {
+      EVENT_SENDER_NET,
+      { .sender = this },
+      NET_EVENT,
+      timeslice
+    };
+    emitted.net = &netevent;
+    event_queue_.emit_event(emitted);
+  });
+  netpacket_release(packet);
+}
+
+
+
+void client_t::on_message(const welcome_msg_t &msg, const netevent_t &event)
+{
+  s_log_note("Welcomed by server");
+}
+
+
+
+void client_t::on_message(const netcvar_delta_msg_t &msg, const netevent_t &event)
+{
+  // Server cvars are applied immediately (delayed cvars take effect on the
+  // next update_cvars())
+  apply_cvar_delta(cvars_, msg, &netcvar_stats_);
 }
 #endif
 
@@ -115,6 +183,13 @@ void client_t::read_events(double timeslice)
           }
           ++sys_iter;
         }
+#if USE_SERVER
+        // Netevents only live as long as it takes to dispatch them unless a
+        // system retains them
+        if (event.kind == NET_EVENT && event.net) {
+          netevent_pool_t::release(event.net);
+        }
+#endif
         break;
       }
     }
@@ -132,11 +207,18 @@ void client_t::read_events(double timeslice)
 ==============================================================================*/
 void client_t::do_frame(double step, double timeslice)
 {
+  // Systems see world matrices as of the end of the last tick, whether or not
+  // a frame was drawn since
+  transform_store().update_world(scene_graph());
+
   for (const auto &spair : logic_systems_) {
     if (spair.second->active()) {
       spair.second->frame(step, timeslice);
     }
   }
+  // Structural changes recorded by systems during the frame
+  object_commands().play_back();
+  change_log().advance();
 }
 
 
@@ -177,12 +259,34 @@ void client_t::frameloop()
 
   cvars_.clear();
   cvars_.register_ccmd(&cmd_quit_);
+#if USE_SERVER
+  cvars_.register_ccmd(&cmd_netstats_);
+#endif
+  cvars_.register_ccmd(&cmd_poolstats_);
 
   cl_willQuit = cvars_.get_cvar( "cl_willQuit", 0, CVAR_READ_ONLY | CVAR_DELAYED | CVAR_INVISIBLE );
   wnd_focused = cvars_.get_cvar( "wnd_focused", 1, CVAR_READ_ONLY | CVAR_DELAYED | CVAR_INVISIBLE );
   wnd_mouseMode = cvars_.get_cvar("wnd_mouseMode", true, CVAR_DELAYED | CVAR_INVISIBLE);
   r_drawFrame = cvars_.get_cvar( "r_drawFrame", 1, CVAR_READ_ONLY | CVAR_DELAYED );
   r_clearFrame = cvars_.get_cvar("r_clearFrame", 1, CVAR_READ_ONLY | CVAR_DELAYED );
+#if USE_SERVER
+  net_compress = cvars_.get_cvar("net_compress", (int)NET_COMPRESS_NONE, CVAR_FLAGS_DEFAULT);
+  net_compressDict = cvars_.get_cvar("net_compressDict", string(), CVAR_FLAGS_DEFAULT);
+  update_compression();
+
+  net_sim = cvars_.get_cvar("net_sim", 0, CVAR_FLAGS_DEFAULT);
+  net_simLatency = cvars_.get_cvar("net_simLatency", 0, CVAR_FLAGS_DEFAULT);
+  net_simJitter = cvars_.get_cvar("net_simJitter", 0, CVAR_FLAGS_DEFAULT);
+  net_simLoss = cvars_.get_cvar("net_simLoss", 0.0f, CVAR_FLAGS_DEFAULT);
+  net_simDuplicate = cvars_.get_cvar("net_simDuplicate", 0.0f, CVAR_FLAGS_DEFAULT);
+  net_simReorder = cvars_.get_cvar("net_simReorder", 0.0f, CVAR_FLAGS_DEFAULT);
+  net_simBandwidth = cvars_.get_cvar("net_simBandwidth", 0, CVAR_FLAGS_DEFAULT);
+  net_simSeed = cvars_.get_cvar("net_simSeed", 1, CVAR_FLAGS_DEFAULT);
+  update_netsim();
+
+  // Gameplay tunables set by the server's cvar deltas
+  const cvar_t *player_speed = player_mover_t::register_speed(cvars_, false);
+#endif
 
   console.set_cvar_set(&cvars_);
 
@@ -196,6 +300,21 @@ void client_t::frameloop()
 
   add_system(&console, 16777216, -16777216);
 
+#if USE_SERVER
+  // The local player, predicted here and corrected by the server
+  player_t player;
+  game_object_t *player_object = new game_object_t;
+  player_object->add_component<player_mover_t>();
+  player.set_player(player_object);
+  player.set_speed_cvar(player_speed);
+  player.set_send_fn(cl_send_player_input, this);
+  add_system(&player);
+  deferred release_player {[&]{
+    remove_system(&player);
+    delete player_object;
+  }};
+#endif
+
   // Set this to true before getting the base time since it might loop a couple
   // times setting it.
   running_ = true;
@@ -216,8 +335,20 @@ void client_t::frameloop()
     while (sim_time_ < cur_time) {
       sim_time_ += FRAME_SEQ_TIME;
       ++frame;
+#if USE_SERVER
+      // Messages from the server join this tick's events
+      pump_netevents(sim_time_);
+#endif
       read_events(sim_time_);
       do_frame(FRAME_SEQ_TIME, sim_time_);
+#if USE_SERVER
+      // Send state updates that fit in this frame's bandwidth, then send
+      // anything queued for the server during the frame in as few packets as
+      // possible
+      netscheduler_.schedule(netevent_batch_, FRAME_SEQ_TIME);
+      netbulk_.update(netevent_batch_, FRAME_SEQ_TIME);
+      netevent_batch_.flush();
+#endif
 
 #if HIDE_CURSOR_ON_CONSOLE_CLOSE
       if (wnd_mouseMode->has_flags(CVAR_MODIFIED)) {
@@ -226,6 +357,17 @@ void client_t::frameloop()
       }
 #endif
 
+#if USE_SERVER
+      if (net_compress->has_flags(CVAR_MODIFIED) ||
+          net_compressDict->has_flags(CVAR_MODIFIED)) {
+        net_compress->update();
+        net_compressDict->update();
+        update_compression();
+      }
+
+      update_netsim();
+#endif
+
       cvars_.update_cvars();
     }
 
@@ -246,6 +388,10 @@ void client_t::frameloop()
     if (frame != last_frame && r_drawFrame->geti()) {
       last_frame = frame;
 
+      // Bring world matrices up to date for anything that moved in the last
+      // tick
+      transform_store().update_world(scene_graph());
+
       if (r_clearFrame->geti()) {
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
         assert_gl("Clearing buffers");
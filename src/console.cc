@@ -4,6 +4,7 @@
   is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
 */
 #include "console.hh"
+#include <algorithm>
 #include <cstdlib>
 #include <snow-ext/hash.hh>
 
@@ -66,7 +67,9 @@ cvar_t::cvar_t(const string &name, int value, unsigned flags) :
   hash_(murmur3::hash32(name)),
   flags_(flags & ~CVAR_DELAYED),
   name_(name),
-  cache_()
+  cache_(),
+  cache_int_(0),
+  cache_float_(0)
 {
   cache_.reserve(CVAR_RESERVE_STORAGE);
   value_.reserve(CVAR_RESERVE_STORAGE);
@@ -86,7 +89,9 @@ cvar_t::cvar_t(const string &name, float value, unsigned flags) :
   hash_(murmur3::hash32(name)),
   flags_(flags&~CVAR_DELAYED),
   name_(name),
-  cache_()
+  cache_(),
+  cache_int_(0),
+  cache_float_(0)
 {
   cache_.reserve(CVAR_RESERVE_STORAGE);
   value_.reserve(CVAR_RESERVE_STORAGE);
@@ -104,7 +109,9 @@ cvar_t::cvar_t(const string &name, const string &value, unsigned flags) :
   hash_(murmur3::hash32(name)),
   flags_(flags&~CVAR_DELAYED),
   name_(name),
-  cache_()
+  cache_(),
+  cache_int_(0),
+  cache_float_(0)
 {
   cache_.reserve(CVAR_RESERVE_STORAGE);
   value_.reserve(CVAR_RESERVE_STORAGE);
@@ -260,6 +267,8 @@ void cvar_t::seti_force(int value, bool force)
     return;
   } else if (owner_ && has_flags(CVAR_DELAYED)) {
     flags_ = (flags_ & ~CVAR_CACHED_MASK) | CVAR_CACHED_INT;
+    cache_int_ = value;
+    cache_float_ = (float)value;
     cache_ = std::to_string(value);
   } else {
     flags_ = (flags_ & ~CVAR_TYPE_MASK) | CVAR_INT;
@@ -298,6 +307,8 @@ void cvar_t::setf_force(float value, bool force)
     return;
   } else if (owner_ && has_flags(CVAR_DELAYED)) {
     flags_ = (flags_ & ~CVAR_CACHED_MASK) | CVAR_CACHED_FLOAT;
+    cache_int_ = (int)value;
+    cache_float_ = value;
     cache_ = std::to_string(value);
   } else {
     flags_ = (flags_ & ~CVAR_TYPE_MASK) | CVAR_FLOAT;
@@ -336,6 +347,8 @@ void cvar_t::sets_force(const string &value, bool force)
     return;
   } else if (owner_ && has_flags(CVAR_DELAYED)) {
     flags_ = (flags_ & ~CVAR_CACHED_MASK) | CVAR_CACHED_STRING;
+    cache_int_ = std::atoi(value.c_str());
+    cache_float_ = std::atof(value.c_str());
     cache_ = value;
   } else {
     flags_ = (flags_ & ~CVAR_TYPE_MASK) | CVAR_STRING;
@@ -408,12 +421,12 @@ bool cvar_t::can_modify() const
 void cvar_t::update()
 {
   if (has_flags(CVAR_HAS_CACHE)) {
-    int_value_ = std::atoi(cache_.c_str());
-    float_value_ = std::atof(cache_.c_str());
+    int_value_ = cache_int_;
+    float_value_ = cache_float_;
     value_ = std::move(cache_);
     // remove modified flag and shift cached type into place
     flags_ = (flags_ & CVAR_CACHE_STRIP_MASK) |
-      ((flags_ & CVAR_CACHED_MASK) << CVAR_TYPE_SHIFT);
+      ((flags_ & CVAR_CACHED_MASK) >> CVAR_TYPE_SHIFT);
   } else if (has_flags(CVAR_MODIFIED)) {
     flags_ ^= CVAR_MODIFIED;
   }
@@ -767,6 +780,11 @@ bool cvar_set_t::unregister_cvar(cvar_t *cvar)
   if (iter != cvars_.end() && iter->second.kind == console_item_t::KIND_CVAR) {
     iter->second.cvar->owner_ = nullptr;
     cvars_.erase(iter);
+    auto pending = std::find(replicate_cvars_.begin(), replicate_cvars_.end(), cvar);
+    if (pending != replicate_cvars_.end()) {
+      cvar->flags_ &= ~CVAR_REPLICATE_PENDING;
+      replicate_cvars_.erase(pending);
+    }
     return true;
   } else {
     s_log_error("CVar %s is not registered", cvar->name().c_str());
@@ -782,6 +800,10 @@ void cvar_set_t::update_cvars()
   if (!update_cvars_.empty()) {
     for (cvar_t *cv : update_cvars_) {
       cv->update();
+      if (cv->has_flags(CVAR_REPLICATED) && !cv->has_flags(CVAR_REPLICATE_PENDING)) {
+        cv->flags_ |= CVAR_REPLICATE_PENDING;
+        replicate_cvars_.push_back(cv);
+      }
     }
     update_cvars_.clear();
   }
@@ -944,6 +966,35 @@ void cvar_set_t::clear()
 
   cvars_.clear();
   temp_cvars_.clear();
+  replicate_cvars_.clear();
+}
+
+
+
+/*!
+  Moves replicated cvars changed by update_cvars() since the last call into
+  out. Each cvar appears at most once.
+*/
+void cvar_set_t::take_replicated(std::vector<cvar_t *> &out)
+{
+  for (cvar_t *cv : replicate_cvars_) {
+    cv->flags_ &= ~CVAR_REPLICATE_PENDING;
+    out.push_back(cv);
+  }
+  replicate_cvars_.clear();
+}
+
+
+
+/*! Appends all registered cvars with the given flags to out. */
+void cvar_set_t::find_cvars(unsigned flags, std::vector<cvar_t *> &out) const
+{
+  for (const auto &pair : cvars_) {
+    if (pair.second.kind == console_item_t::KIND_CVAR &&
+        pair.second.cvar->has_flags(flags)) {
+      out.push_back(pair.second.cvar);
+    }
+  }
 }
 
 
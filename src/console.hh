@@ -48,8 +48,14 @@ enum cvar_flags_t : unsigned
   //! Specifies the cvar is invisible to the user (e.g., via a console). This is
   // never a default flag.
   CVAR_INVISIBLE        = 0x1 << 8,
+  //! Cvar changes on the server are replicated to all clients (see
+  // netcvars.hh).
+  CVAR_REPLICATED       = 0x1 << 9,
   //! Cvar has been modified (do not set this yourself -- it's not needed)
   CVAR_MODIFIED         = 0x1 << 16,
+  //! Replicated cvar has changed since the set's replicated changes were last
+  // taken (do not set this yourself either)
+  CVAR_REPLICATE_PENDING = 0x1 << 17,
   CVAR_HAS_CACHE        = CVAR_DELAYED | CVAR_MODIFIED,
 
   // cvar types
@@ -158,6 +164,8 @@ private:
   string          name_;   // cvar name
   string          value_;  // to_string(int or float)
   string          cache_;  // cached value (not retreived prior to update)
+  int             cache_int_;   // cached value as an int, so update() needn't parse
+  float           cache_float_; // cached value as a float
   std::list<cvar_t *>::const_iterator update_iter_;
 };
 
@@ -312,6 +320,14 @@ struct cvar_set_t
   /*! Clears both cvars and ccmds from the set */
   void clear();
 
+  /*!
+    \brief Moves replicated cvars (CVAR_REPLICATED) changed by update_cvars()
+    since the last call into out. Each cvar appears at most once.
+  */
+  void take_replicated(std::vector<cvar_t *> &out);
+  /*! \brief Appends all registered cvars with the given flags to out. */
+  void find_cvars(unsigned flags, std::vector<cvar_t *> &out) const;
+
   /*! Returns a const iterator to the beginning of the list of modified cvars */
   ptr_list_t::const_iterator modified_cbegin() const;
   /*! Returns a const iterator to after the end of the list of modified cvars */
@@ -334,6 +350,7 @@ private:
 
   item_map_t cvars_                   { };
   ptr_list_t update_cvars_            { };
+  std::vector<cvar_t *> replicate_cvars_ { };
   // FIXME: Use std::list so cvar_t/ccmd_t pointers aren't invalidated later
   // NOTE: determine a fixed size for the vector, reserve
   // enough, and then quietly fail on overflow.
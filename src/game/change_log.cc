@@ -0,0 +1,126 @@
+/*
+  change_log.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "change_log.hh"
+#include "gameobject.hh"
+
+
+namespace snow {
+
+
+namespace {
+
+
+change_log_t g_change_log;
+
+
+} // namespace <anon>
+
+
+
+change_log_t &change_log()
+{
+  return g_change_log;
+}
+
+
+
+const uint32_t change_log_t::NO_ENTRY;
+const uint32_t change_log_t::HISTORY_TICKS;
+
+
+
+uint32_t change_log_t::tick() const
+{
+  return tick_;
+}
+
+
+
+/*==============================================================================
+  advance()
+
+    Moves to the next tick. A journal is compacted once its oldest entry is
+    too old to be asked for, or once most of it has been forgotten, so each
+    journal is rewritten at most about once every HISTORY_TICKS ticks unless
+    objects churn.
+==============================================================================*/
+void change_log_t::advance()
+{
+  ++tick_;
+  for (unsigned id = 0; id < MAX_COMPONENT_IDS; ++id) {
+    const std::vector<entry_t> &journal = journals_[id];
+    if (journal.empty()) {
+      continue;
+    }
+    if (dead_[id] * 2 > journal.size() || !has_history_since(journal.front().tick)) {
+      compact(id);
+    }
+  }
+}
+
+
+
+bool change_log_t::has_history_since(uint32_t since) const
+{
+  return since + HISTORY_TICKS >= tick_;
+}
+
+
+
+void change_log_t::mark(game_object_t *object, unsigned component_id)
+{
+  uint32_t &changed = object->changed_ticks_[component_id];
+  uint32_t &entry = object->change_entries_[component_id];
+  if (changed == tick_ && entry != NO_ENTRY) {
+    return;
+  }
+
+  std::vector<entry_t> &journal = journals_[component_id];
+  if (entry != NO_ENTRY) {
+    journal[entry].object = nullptr;
+    ++dead_[component_id];
+  }
+  entry = static_cast<uint32_t>(journal.size());
+  changed = tick_;
+  journal.push_back(entry_t { tick_, object });
+}
+
+
+
+void change_log_t::forget(game_object_t *object, unsigned component_id)
+{
+  uint32_t &entry = object->change_entries_[component_id];
+  if (entry != NO_ENTRY) {
+    journals_[component_id][entry].object = nullptr;
+    ++dead_[component_id];
+    entry = NO_ENTRY;
+  }
+}
+
+
+
+// Drops forgotten entries and entries too old to be asked for, and updates
+// the objects' entry indices for those that remain.
+void change_log_t::compact(unsigned component_id)
+{
+  std::vector<entry_t> &journal = journals_[component_id];
+  size_t kept = 0;
+  for (const entry_t &entry : journal) {
+    if (!entry.object) {
+      continue;
+    } else if (!has_history_since(entry.tick)) {
+      entry.object->change_entries_[component_id] = NO_ENTRY;
+      continue;
+    }
+    entry.object->change_entries_[component_id] = static_cast<uint32_t>(kept);
+    journal[kept++] = entry;
+  }
+  journal.resize(kept);
+  dead_[component_id] = 0;
+}
+
+
+} // namespace snow
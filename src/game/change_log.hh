@@ -0,0 +1,117 @@
+/*
+  change_log.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__CHANGE_LOG_HH__
+#define __SNOW__CHANGE_LOG_HH__
+
+#include "../config.hh"
+#include "components/component_id.hh"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+
+namespace snow {
+
+
+struct game_object_t;
+
+
+/*==============================================================================
+
+  Records which components changed and when, so systems that react to changes
+  (rendering, replication, spatial indexing) can visit only what changed
+  instead of every component each tick.
+
+  Time is counted in ticks, starting at 1. The client advances the tick once
+  a frame, after logic systems and deferred object commands have run. Each
+  game object keeps, per component ID, the tick its component was last
+  marked changed (see game_object_t::mark_changed). Adding a component marks
+  it, as do transform_t's setters and reparenting; other components must be
+  marked by whoever modifies them, e.g. light->mark_changed().
+
+  The log also keeps, per component ID, a journal of the objects marked in
+  the last HISTORY_TICKS ticks, newest last, one entry per object. This is
+  what each_changed_since() walks, so its cost is proportional to the number
+  of changes. A consumer typically remembers the last tick it has seen every
+  change for -- tick() - 1, since the current tick may still see changes --
+  and passes that as since the next time it runs.
+
+  If since is older than the journal reaches back, each_changed_since()
+  returns false without visiting anything, and the caller should fall back to
+  processing everything. Don't mark components with the same ID from inside
+  each_changed_since(). Not thread safe.
+
+==============================================================================*/
+struct S_EXPORT change_log_t
+{
+  static const uint32_t NO_ENTRY = UINT32_MAX;
+  static const uint32_t HISTORY_TICKS = 64;
+
+  change_log_t() = default;
+  ~change_log_t() = default;
+
+  change_log_t(const change_log_t &) = delete;
+  change_log_t &operator = (const change_log_t &) = delete;
+
+  uint32_t        tick() const;
+  // Moves to the next tick and drops journal entries too old to be asked for.
+  void            advance();
+
+  // Whether each_changed_since() can answer for since.
+  bool            has_history_since(uint32_t since) const;
+
+  // Calls fn(game_object_t *) for each object whose component_id component
+  // was marked after tick since, oldest change first.
+  template <typename FN>
+  bool            each_changed_since(unsigned component_id, uint32_t since, FN &&fn) const;
+
+  // Called by game_object_t.
+  void            mark(game_object_t *object, unsigned component_id);
+  void            forget(game_object_t *object, unsigned component_id);
+
+private:
+  struct entry_t
+  {
+    uint32_t        tick;
+    game_object_t * object;
+  };
+
+  void            compact(unsigned component_id);
+
+  uint32_t                                            tick_ = 1;
+  std::array<std::vector<entry_t>, MAX_COMPONENT_IDS> journals_;
+  // Forgotten entries still in each journal
+  std::array<size_t, MAX_COMPONENT_IDS>               dead_ {};
+};
+
+
+// Log shared by all game objects.
+S_EXPORT change_log_t &change_log();
+
+
+
+template <typename FN>
+bool change_log_t::each_changed_since(unsigned component_id, uint32_t since, FN &&fn) const
+{
+  if (!has_history_since(since)) {
+    return false;
+  }
+  const std::vector<entry_t> &journal = journals_[component_id];
+  auto iter = std::upper_bound(journal.cbegin(), journal.cend(), since,
+    [] (uint32_t tick, const entry_t &entry) { return tick < entry.tick; });
+  for (; iter != journal.cend(); ++iter) {
+    if (iter->object) {
+      fn(iter->object);
+    }
+  }
+  return true;
+}
+
+
+} // namespace snow
+
+#endif /* end __SNOW__CHANGE_LOG_HH__ include guard */
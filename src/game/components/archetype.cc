@@ -0,0 +1,267 @@
+/*
+  archetype.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "archetype.hh"
+#include <cassert>
+#include <cstring>
+
+
+namespace snow {
+
+
+namespace {
+
+
+size_t align_up(size_t offset, size_t align)
+{
+  return (offset + align - 1) & ~(align - 1);
+}
+
+
+} // namespace <anon>
+
+
+
+const size_t archetype_store_t::CHUNK_SIZE;
+const archetype_store_t::entity_t archetype_store_t::NO_ENTITY;
+
+
+
+archetype_store_t::archetype_store_t()
+{
+  columns_.fill(column_t { 0, 0 });
+  // Archetype 0 holds entities with no components
+  find_archetype(component_mask_t());
+}
+
+
+
+void archetype_store_t::register_column(unsigned id, size_t size, size_t align)
+{
+  column_t &column = columns_[id];
+  if (column.size == 0) {
+    column = column_t { size, align };
+  } else if (column.size != size || column.align != align) {
+    s_throw(std::invalid_argument, "Component ID is already registered with a different type");
+  }
+}
+
+
+
+auto archetype_store_t::create() -> entity_t
+{
+  entity_t entity;
+  if (!free_.empty()) {
+    entity = free_.back();
+    free_.pop_back();
+  } else {
+    entity = static_cast<entity_t>(locations_.size());
+    locations_.push_back(location_t { 0, 0 });
+  }
+  locations_[entity] = location_t { 0, append_row(archetypes_[0], entity) };
+  ++live_;
+  return entity;
+}
+
+
+
+void archetype_store_t::destroy(entity_t entity)
+{
+  assert(entity < locations_.size());
+  const location_t loc = locations_[entity];
+  remove_row(archetypes_[loc.archetype], loc.row);
+  locations_[entity] = location_t { 0, NO_ENTITY };
+  free_.push_back(entity);
+  --live_;
+}
+
+
+
+size_t archetype_store_t::size() const
+{
+  return live_;
+}
+
+
+
+auto archetype_store_t::mask(entity_t entity) const -> const component_mask_t &
+{
+  return archetypes_[locations_[entity].archetype].mask;
+}
+
+
+
+/*==============================================================================
+  find_archetype(mask)
+
+    Returns the index of the archetype for mask, creating it if needed. Each
+    chunk is laid out as an array of entity IDs followed by one array per
+    column, and holds as many rows as fit in CHUNK_SIZE after alignment.
+==============================================================================*/
+uint32_t archetype_store_t::find_archetype(const component_mask_t &mask)
+{
+  const auto found = archetype_index_.find(mask);
+  if (found != archetype_index_.end()) {
+    return found->second;
+  }
+
+  size_t row_size = sizeof(entity_t);
+  for (unsigned id = 0; id < MAX_COMPONENT_IDS; ++id) {
+    if (mask[id]) {
+      if (columns_[id].size == 0) {
+        s_throw(std::invalid_argument, "Component ID has no registered column");
+      }
+      row_size += columns_[id].size;
+    }
+  }
+
+  archetype_t archetype;
+  archetype.mask = mask;
+  archetype.capacity = 0;
+  archetype.count = 0;
+  archetype.offsets.fill(0);
+  // Padding between columns may push the estimate over, so back off until it
+  // fits
+  for (uint32_t capacity = static_cast<uint32_t>(CHUNK_SIZE / row_size); capacity > 0; --capacity) {
+    size_t offset = sizeof(entity_t) * capacity;
+    for (unsigned id = 0; id < MAX_COMPONENT_IDS; ++id) {
+      if (mask[id]) {
+        offset = align_up(offset, columns_[id].align);
+        archetype.offsets[id] = static_cast<uint32_t>(offset);
+        offset += columns_[id].size * capacity;
+      }
+    }
+    if (offset <= CHUNK_SIZE) {
+      archetype.capacity = capacity;
+      break;
+    }
+  }
+  if (archetype.capacity == 0) {
+    s_throw(std::invalid_argument, "Archetype rows do not fit in a chunk");
+  }
+
+  const uint32_t index = static_cast<uint32_t>(archetypes_.size());
+  archetypes_.push_back(std::move(archetype));
+  archetype_index_.emplace(mask, index);
+  return index;
+}
+
+
+
+uint32_t archetype_store_t::append_row(archetype_t &archetype, entity_t entity)
+{
+  const uint32_t row = archetype.count;
+  const uint32_t chunk = row / archetype.capacity;
+  if (chunk == archetype.chunks.size()) {
+    archetype.chunks.emplace_back(new chunk_t);
+  }
+  ((entity_t *)archetype.chunks[chunk]->data)[row % archetype.capacity] = entity;
+  ++archetype.count;
+  return row;
+}
+
+
+
+/*==============================================================================
+  remove_row(archetype, row)
+
+    Removes a row by moving the archetype's last row into its place, keeping
+    rows packed at the front of the chunks. The last chunk is released once
+    it's empty.
+==============================================================================*/
+void archetype_store_t::remove_row(archetype_t &archetype, uint32_t row)
+{
+  const uint32_t last = archetype.count - 1;
+  const uint32_t capacity = archetype.capacity;
+  if (row != last) {
+    uint8_t *const dst = archetype.chunks[row / capacity]->data;
+    const uint8_t *const src = archetype.chunks[last / capacity]->data;
+    const uint32_t dst_row = row % capacity;
+    const uint32_t src_row = last % capacity;
+    const entity_t moved = ((const entity_t *)src)[src_row];
+    ((entity_t *)dst)[dst_row] = moved;
+    for (unsigned id = 0; id < MAX_COMPONENT_IDS; ++id) {
+      if (archetype.mask[id]) {
+        const size_t size = columns_[id].size;
+        std::memcpy(dst + archetype.offsets[id] + dst_row * size,
+                    src + archetype.offsets[id] + src_row * size, size);
+      }
+    }
+    locations_[moved].row = row;
+  }
+  archetype.count = last;
+  if (last % capacity == 0) {
+    archetype.chunks.pop_back();
+  }
+}
+
+
+
+void archetype_store_t::move_entity(entity_t entity, const component_mask_t &mask)
+{
+  const uint32_t to_index = find_archetype(mask);
+  const location_t from = locations_[entity];
+  archetype_t &source = archetypes_[from.archetype];
+  archetype_t &target = archetypes_[to_index];
+  const uint32_t row = append_row(target, entity);
+
+  // Copy the columns the two archetypes share
+  const component_mask_t shared = source.mask & target.mask;
+  const uint8_t *const src = source.chunks[from.row / source.capacity]->data;
+  uint8_t *const dst = target.chunks[row / target.capacity]->data;
+  const uint32_t src_row = from.row % source.capacity;
+  const uint32_t dst_row = row % target.capacity;
+  for (unsigned id = 0; id < MAX_COMPONENT_IDS; ++id) {
+    if (shared[id]) {
+      const size_t size = columns_[id].size;
+      std::memcpy(dst + target.offsets[id] + dst_row * size,
+                  src + source.offsets[id] + src_row * size, size);
+    }
+  }
+
+  remove_row(source, from.row);
+  locations_[entity] = location_t { to_index, row };
+}
+
+
+
+void *archetype_store_t::column_data(entity_t entity, unsigned id) const
+{
+  assert(entity < locations_.size());
+  const location_t loc = locations_[entity];
+  const archetype_t &archetype = archetypes_[loc.archetype];
+  if (!archetype.mask[id]) {
+    return nullptr;
+  }
+  const size_t row = loc.row % archetype.capacity;
+  return archetype.chunks[loc.row / archetype.capacity]->data +
+         archetype.offsets[id] + row * columns_[id].size;
+}
+
+
+
+void *archetype_store_t::add_column(entity_t entity, unsigned id)
+{
+  assert(entity < locations_.size());
+  component_mask_t mask = archetypes_[locations_[entity].archetype].mask;
+  assert(!mask[id]);
+  mask.set(id);
+  move_entity(entity, mask);
+  return column_data(entity, id);
+}
+
+
+
+void archetype_store_t::remove_column(entity_t entity, unsigned id)
+{
+  assert(entity < locations_.size());
+  component_mask_t mask = archetypes_[locations_[entity].archetype].mask;
+  assert(mask[id]);
+  mask.reset(id);
+  move_entity(entity, mask);
+}
+
+
+} // namespace snow
@@ -0,0 +1,219 @@
+/*
+  archetype.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__ARCHETYPE_HH__
+#define __SNOW__ARCHETYPE_HH__
+
+#include "../../config.hh"
+#include "component_id.hh"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+
+namespace snow {
+
+
+/*==============================================================================
+
+  Optional archetype storage for plain component data. Where component_t
+  keeps each component type in its own pool, an archetype_store_t groups
+  entities by their exact set of components (their archetype) and stores
+  each archetype's data in CHUNK_SIZE chunks, one column per component. A
+  system that needs several components, e.g.
+
+    store.each<position_t, velocity_t>(
+      [] (entity_t entity, position_t &pos, velocity_t &vel) {
+        ...
+      });
+
+  then reads each column front to back instead of jumping between pools.
+
+  Column types are trivially copyable structs with a static COMPONENT_ID,
+  and must be registered with register_column<T>() before use. IDs share
+  the component_id_t space, so an entity's mask() can be compared against
+  the same masks game objects and object_query_t use. The store doesn't
+  touch component_t pools -- the two can be used side by side, and
+  systems can move data over one component at a time.
+
+  Adding or removing a component moves the entity's row to another
+  archetype, and destroying an entity moves another row into its place, so
+  pointers returned by get() and add() are only good until the next change
+  to the store. Refer to entities by ID. Not thread safe.
+
+==============================================================================*/
+struct S_EXPORT archetype_store_t
+{
+  using entity_t = uint32_t;
+
+  static const size_t   CHUNK_SIZE = 16 * 1024;
+  static const entity_t NO_ENTITY = UINT32_MAX;
+
+  archetype_store_t();
+  ~archetype_store_t() = default;
+
+  archetype_store_t(const archetype_store_t &) = delete;
+  archetype_store_t &operator = (const archetype_store_t &) = delete;
+
+  template <typename T>
+  void                    register_column();
+
+  // Returns a new entity with no components.
+  entity_t                create();
+  void                    destroy(entity_t entity);
+  // Number of live entities.
+  size_t                  size() const;
+
+  // Adds a T to the entity, which must not already have one, and returns it.
+  template <typename T>
+  T *                     add(entity_t entity, const T &value = T());
+  template <typename T>
+  void                    remove(entity_t entity);
+  // Returns the entity's T, or nullptr if it has none.
+  template <typename T>
+  T *                     get(entity_t entity);
+  template <typename T>
+  const T *               get(entity_t entity) const;
+  const component_mask_t &mask(entity_t entity) const;
+
+  // Calls fn(entity_t, T &...) for every entity that has all of T.
+  template <typename... T, typename FN>
+  void                    each(FN &&fn);
+
+private:
+  struct column_t
+  {
+    size_t    size;
+    size_t    align;
+  };
+
+  struct chunk_t
+  {
+    // Entity IDs, followed by each column, at the archetype's offsets
+    alignas(16) uint8_t data[CHUNK_SIZE];
+  };
+
+  struct archetype_t
+  {
+    component_mask_t  mask;
+    // Rows per chunk
+    uint32_t          capacity;
+    // Total rows, filling chunks in order
+    uint32_t          count;
+    std::array<uint32_t, MAX_COMPONENT_IDS> offsets;
+    std::vector<std::unique_ptr<chunk_t>> chunks;
+  };
+
+  struct location_t
+  {
+    uint32_t  archetype;
+    uint32_t  row;
+  };
+
+  void                    register_column(unsigned id, size_t size, size_t align);
+  uint32_t                find_archetype(const component_mask_t &mask);
+  uint32_t                append_row(archetype_t &archetype, entity_t entity);
+  void                    remove_row(archetype_t &archetype, uint32_t row);
+  void                    move_entity(entity_t entity, const component_mask_t &mask);
+  void *                  column_data(entity_t entity, unsigned id) const;
+  void *                  add_column(entity_t entity, unsigned id);
+  void                    remove_column(entity_t entity, unsigned id);
+
+  template <typename FN, typename... T>
+  static void             each_row(FN &fn, const entity_t *entities, uint32_t count, T *... columns);
+
+  std::array<column_t, MAX_COMPONENT_IDS> columns_;
+  std::vector<archetype_t>  archetypes_;
+  std::unordered_map<component_mask_t, uint32_t> archetype_index_;
+  std::vector<location_t>   locations_;
+  std::vector<entity_t>     free_;
+  size_t                    live_ = 0;
+};
+
+
+
+template <typename T>
+void archetype_store_t::register_column()
+{
+  static_assert(std::is_trivially_copyable<T>::value,
+    "Archetype columns must be trivially copyable");
+  static_assert(alignof(T) <= 16, "Archetype columns may be at most 16-byte aligned");
+  static_assert(T::COMPONENT_ID < MAX_COMPONENT_IDS,
+    "Component ID must be within the range of valid component IDs");
+  register_column(T::COMPONENT_ID, sizeof(T), alignof(T));
+}
+
+
+
+template <typename T>
+T *archetype_store_t::add(entity_t entity, const T &value)
+{
+  return new(add_column(entity, T::COMPONENT_ID)) T(value);
+}
+
+
+
+template <typename T>
+void archetype_store_t::remove(entity_t entity)
+{
+  remove_column(entity, T::COMPONENT_ID);
+}
+
+
+
+template <typename T>
+T *archetype_store_t::get(entity_t entity)
+{
+  return (T *)column_data(entity, T::COMPONENT_ID);
+}
+
+
+
+template <typename T>
+const T *archetype_store_t::get(entity_t entity) const
+{
+  return (const T *)column_data(entity, T::COMPONENT_ID);
+}
+
+
+
+template <typename... T, typename FN>
+void archetype_store_t::each(FN &&fn)
+{
+  const component_mask_t required = component_mask({ T::COMPONENT_ID... });
+  for (archetype_t &archetype : archetypes_) {
+    if ((archetype.mask & required) != required || archetype.count == 0) {
+      continue;
+    }
+    uint32_t remaining = archetype.count;
+    for (const std::unique_ptr<chunk_t> &chunk : archetype.chunks) {
+      const uint32_t count = remaining < archetype.capacity ? remaining : archetype.capacity;
+      uint8_t *const data = chunk->data;
+      each_row(fn, (const entity_t *)data, count,
+        (T *)(data + archetype.offsets[T::COMPONENT_ID])...);
+      remaining -= count;
+    }
+  }
+}
+
+
+
+template <typename FN, typename... T>
+void archetype_store_t::each_row(FN &fn, const entity_t *entities, uint32_t count,
+  T *... columns)
+{
+  for (uint32_t row = 0; row < count; ++row) {
+    fn(entities[row], columns[row]...);
+  }
+}
+
+
+} // namespace snow
+
+#endif /* end __SNOW__ARCHETYPE_HH__ include guard */
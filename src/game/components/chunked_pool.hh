@@ -0,0 +1,300 @@
+/*
+  chunked_pool.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__CHUNKED_POOL_HH__
+#define __SNOW__CHUNKED_POOL_HH__
+
+#include "../../config.hh"
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+
+namespace snow {
+
+
+struct pool_stats_t
+{
+  // Entries in use
+  size_t    live;
+  // Entries ever handed out since the last compaction -- iteration covers
+  // this many slots
+  size_t    used;
+  // Entries the allocated chunks can hold
+  size_t    capacity;
+  size_t    chunks;
+};
+
+
+/*==============================================================================
+
+  Pool of T grown in chunks of CHUNK_LENGTH entries. Chunks are never moved
+  or freed while in use, so growing the pool never invalidates references to
+  its entries, and there's no hard limit on its size. The reserved count
+  passed to the constructor is only allocated up front.
+
+  Freed entries are reused lowest index first, so live entries stay packed
+  toward the front and iteration, which visits only live entries, skips few
+  holes. compact() goes further and moves live entries from the back into
+  the holes, then frees chunks no longer needed. Since that moves entries,
+  it takes a callback to tell owners where each entry went.
+
+  Entries are raw storage: make_storage() doesn't construct anything and
+  destroy() doesn't destruct anything. T must be trivially copyable, since
+  compact() moves entries with memcpy. Not thread safe.
+
+==============================================================================*/
+template <typename T, size_t CHUNK_LENGTH = 256>
+struct chunked_pool_t
+{
+  struct iterator;
+
+  explicit chunked_pool_t(size_t reserved = 0);
+  ~chunked_pool_t() = default;
+
+  chunked_pool_t(const chunked_pool_t &) = delete;
+  chunked_pool_t &operator = (const chunked_pool_t &) = delete;
+
+  // Returns the index of an unused entry.
+  uint32_t        make_storage();
+  void            destroy(uint32_t index);
+  bool            is_live(uint32_t index) const;
+
+  T &             operator [] (uint32_t index);
+  const T &       operator [] (uint32_t index) const;
+
+  iterator        begin();
+  iterator        end();
+
+  /*
+    Moves live entries into the lowest free indices and frees unused chunks
+    beyond the reserved count. relocated(T &entry, uint32_t index, uint32_t
+    from) is called for each moved entry at its new index, with the index it
+    was moved from. Returns the number of entries moved.
+  */
+  template <typename FN>
+  size_t          compact(FN &&relocated);
+
+  pool_stats_t    stats() const;
+
+private:
+  struct chunk_t
+  {
+    T                           entries[CHUNK_LENGTH];
+    std::bitset<CHUNK_LENGTH>   live;
+  };
+
+  chunk_t &       chunk_for(uint32_t index);
+  const chunk_t & chunk_for(uint32_t index) const;
+  void            reserve_chunks(size_t count);
+
+  std::vector<std::unique_ptr<chunk_t>> chunks_;
+  // Min-heap of destroyed indices below used_
+  std::vector<uint32_t>       free_;
+  size_t                      reserved_chunks_;
+  uint32_t                    used_ = 0;
+  size_t                      live_ = 0;
+};
+
+
+
+template <typename T, size_t CHUNK_LENGTH>
+struct chunked_pool_t<T, CHUNK_LENGTH>::iterator :
+  public std::iterator<std::forward_iterator_tag, T>
+{
+  iterator(chunked_pool_t *pool, uint32_t index) :
+    pool_(pool), index_(index)
+  {
+    skip_dead();
+  }
+
+  T &operator * () const { return (*pool_)[index_]; }
+  T *operator -> () const { return &(*pool_)[index_]; }
+  iterator &operator ++ () { ++index_; skip_dead(); return *this; }
+  iterator operator ++ (int) { iterator prev = *this; ++*this; return prev; }
+  bool operator == (const iterator &other) const { return index_ == other.index_; }
+  bool operator != (const iterator &other) const { return index_ != other.index_; }
+
+private:
+  void skip_dead()
+  {
+    while (index_ < pool_->used_ && !pool_->is_live(index_)) {
+      ++index_;
+    }
+  }
+
+  chunked_pool_t *  pool_;
+  uint32_t          index_;
+};
+
+
+
+template <typename T, size_t CHUNK_LENGTH>
+chunked_pool_t<T, CHUNK_LENGTH>::chunked_pool_t(size_t reserved) :
+  reserved_chunks_((reserved + CHUNK_LENGTH - 1) / CHUNK_LENGTH)
+{
+  // Checked here rather than in the class body so T may be incomplete where
+  // the pool is declared
+  static_assert(std::is_trivially_copyable<T>::value,
+    "Pool entries must be trivially copyable");
+  reserve_chunks(reserved_chunks_);
+}
+
+
+
+template <typename T, size_t CHUNK_LENGTH>
+uint32_t chunked_pool_t<T, CHUNK_LENGTH>::make_storage()
+{
+  uint32_t index;
+  if (!free_.empty()) {
+    std::pop_heap(free_.begin(), free_.end(), std::greater<uint32_t>());
+    index = free_.back();
+    free_.pop_back();
+  } else {
+    index = used_++;
+    reserve_chunks(index / CHUNK_LENGTH + 1);
+  }
+  chunk_for(index).live.set(index % CHUNK_LENGTH);
+  ++live_;
+  return index;
+}
+
+
+
+template <typename T, size_t CHUNK_LENGTH>
+void chunked_pool_t<T, CHUNK_LENGTH>::destroy(uint32_t index)
+{
+  chunk_t &chunk = chunk_for(index);
+  if (!chunk.live[index % CHUNK_LENGTH]) {
+    return;
+  }
+  chunk.live.reset(index % CHUNK_LENGTH);
+  free_.push_back(index);
+  std::push_heap(free_.begin(), free_.end(), std::greater<uint32_t>());
+  --live_;
+}
+
+
+
+template <typename T, size_t CHUNK_LENGTH>
+bool chunked_pool_t<T, CHUNK_LENGTH>::is_live(uint32_t index) const
+{
+  return index < used_ && chunk_for(index).live[index % CHUNK_LENGTH];
+}
+
+
+
+template <typename T, size_t CHUNK_LENGTH>
+T &chunked_pool_t<T, CHUNK_LENGTH>::operator [] (uint32_t index)
+{
+  return chunk_for(index).entries[index % CHUNK_LENGTH];
+}
+
+
+
+template <typename T, size_t CHUNK_LENGTH>
+const T &chunked_pool_t<T, CHUNK_LENGTH>::operator [] (uint32_t index) const
+{
+  return chunk_for(index).entries[index % CHUNK_LENGTH];
+}
+
+
+
+template <typename T, size_t CHUNK_LENGTH>
+auto chunked_pool_t<T, CHUNK_LENGTH>::begin() -> iterator
+{
+  return iterator(this, 0);
+}
+
+
+
+template <typename T, size_t CHUNK_LENGTH>
+auto chunked_pool_t<T, CHUNK_LENGTH>::end() -> iterator
+{
+  return iterator(this, used_);
+}
+
+
+
+template <typename T, size_t CHUNK_LENGTH>
+template <typename FN>
+size_t chunked_pool_t<T, CHUNK_LENGTH>::compact(FN &&relocated)
+{
+  size_t moved = 0;
+  uint32_t hole = 0;
+  uint32_t last = used_;
+  for (;;) {
+    while (hole < last && is_live(hole)) {
+      ++hole;
+    }
+    while (last > hole && !is_live(last - 1)) {
+      --last;
+    }
+    if (hole >= last) {
+      break;
+    }
+
+    // Move the last live entry into the first hole
+    const uint32_t from = last - 1;
+    std::memcpy(&(*this)[hole], &(*this)[from], sizeof(T));
+    chunk_for(hole).live.set(hole % CHUNK_LENGTH);
+    chunk_for(from).live.reset(from % CHUNK_LENGTH);
+    relocated((*this)[hole], hole, from);
+    ++moved;
+  }
+
+  used_ = static_cast<uint32_t>(live_);
+  free_.clear();
+  const size_t needed = std::max(reserved_chunks_, (live_ + CHUNK_LENGTH - 1) / CHUNK_LENGTH);
+  if (chunks_.size() > needed) {
+    chunks_.resize(needed);
+  }
+  return moved;
+}
+
+
+
+template <typename T, size_t CHUNK_LENGTH>
+pool_stats_t chunked_pool_t<T, CHUNK_LENGTH>::stats() const
+{
+  return pool_stats_t { live_, used_, chunks_.size() * CHUNK_LENGTH, chunks_.size() };
+}
+
+
+
+template <typename T, size_t CHUNK_LENGTH>
+auto chunked_pool_t<T, CHUNK_LENGTH>::chunk_for(uint32_t index) -> chunk_t &
+{
+  return *chunks_[index / CHUNK_LENGTH];
+}
+
+
+
+template <typename T, size_t CHUNK_LENGTH>
+auto chunked_pool_t<T, CHUNK_LENGTH>::chunk_for(uint32_t index) const -> const chunk_t &
+{
+  return *chunks_[index / CHUNK_LENGTH];
+}
+
+
+
+template <typename T, size_t CHUNK_LENGTH>
+void chunked_pool_t<T, CHUNK_LENGTH>::reserve_chunks(size_t count)
+{
+  while (chunks_.size() < count) {
+    chunks_.emplace_back(new chunk_t);
+  }
+}
+
+
+} // namespace snow
+
+#endif /* end __SNOW__CHUNKED_POOL_HH__ include guard */
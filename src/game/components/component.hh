@@ -9,7 +9,7 @@
 #include "../../config.hh"
 #include "component_id.hh"
 #include "component_handle.hh"
-#include <snow/types/object_pool.hh>
+#include "chunked_pool.hh"
 #include <cstdint>
 
 
@@ -29,7 +29,7 @@ CLASSNAME :: CLASSNAME (game_object_t *obj__) : component_t(obj__) {}         \
 CLASSNAME :: ~CLASSNAME () {}
 
 
-/* Default maximum storage reserved for any component type */
+/* Default storage reserved up front for any component type */
 enum : size_t { MAX_COMPONENT_STORAGE = 8192 };
 
 
@@ -64,6 +64,13 @@ struct component_base_t
     - a static constexpr const char *COMPONENT_NAME member pointing to a string
       naming the component (often the classname sans _t suffix)
 
+  RESERVED is the number of components allocated up front. Pools grow past
+  it in chunks as needed, so it's a sizing hint rather than a limit.
+  compact() moves live components to close holes left by destroyed ones,
+  which keeps iteration dense. Components are moved as raw memory, so they
+  must not hold pointers into themselves, and pointers to components are
+  invalidated by compact() -- hold handles instead.
+
 ==============================================================================*/
 template <typename T, unsigned ID, size_t RESERVED = MAX_COMPONENT_STORAGE>
 struct component_t : component_base_t
@@ -84,7 +91,12 @@ struct component_t : component_base_t
   // function is undefined and may crash the application.
   const component_handle_t &handle() const;
 
+  // Records a change to the component in change_log(). Call after modifying
+  // a component's data so systems tracking changes see it.
+  void mark_changed();
+
 
+  // Components allocated up front -- pools may grow beyond this
   static constexpr const unsigned MAX_COMPONENTS  = RESERVED;
   static constexpr const unsigned COMPONENT_ID = ID;
 
@@ -105,6 +117,11 @@ struct component_t : component_base_t
   template <typename Q, typename... ARGS>
   static void apply_fn(Q function, ARGS &&... args);
 
+  // Moves components to fill holes in the pool. Handles stay valid, but
+  // component pointers don't. Returns the number of components moved.
+  static size_t compact();
+  static pool_stats_t pool_stats();
+
 protected:
 
   struct component_store_t
@@ -117,7 +134,7 @@ protected:
   component_store_t *store_ptr();
   const component_store_t *store_ptr() const;
 
-  using component_pool_t = object_pool_t<component_store_t, uint32_t, false>;
+  using component_pool_t = chunked_pool_t<component_store_t>;
 
   static component_pool_t component_pool_;
 
@@ -212,6 +229,16 @@ const component_handle_t &component_t<T, ID, RESERVED>::handle() const
 
 
 
+template <typename T, unsigned ID, size_t RESERVED>
+void component_t<T, ID, RESERVED>::mark_changed()
+{
+  if (game_object) {
+    game_object->mark_changed(ID);
+  }
+}
+
+
+
 template <typename T, unsigned ID, size_t RESERVED>
 template <typename Q, typename... ARGS>
 void component_t<T, ID, RESERVED>::apply_fn(Q function, ARGS &&... args)
@@ -245,6 +272,37 @@ void component_t<T, ID, RESERVED>::const_apply_method(Q (T::*function)(MARGS...)
 
 
 
+/*==============================================================================
+  compact()
+
+    Closes holes in the pool by moving components from its end. Each moved
+    component's handle is remapped and its game object's index for it is
+    updated, so handles and game_object_t::get_component keep working.
+==============================================================================*/
+template <typename T, unsigned ID, size_t RESERVED>
+size_t component_t<T, ID, RESERVED>::compact()
+{
+  return component_pool_.compact([] (component_store_t &store, uint32_t index, uint32_t from) {
+    component_base_t *const component = (component_base_t *)(T *)&store.component;
+    store.handle.local_index = index;
+    component_handle_t::relocate(store.handle,
+      (component_base_t *)(T *)&component_pool_[from].component, component);
+    if (component->game_object) {
+      component->game_object->component_indices_[ID].local_index = index;
+    }
+  });
+}
+
+
+
+template <typename T, unsigned ID, size_t RESERVED>
+pool_stats_t component_t<T, ID, RESERVED>::pool_stats()
+{
+  return component_pool_.stats();
+}
+
+
+
 template <typename T, unsigned ID, size_t RESERVED>
 T *component_t<T, ID, RESERVED>::data_for_index(uint32_t index)
 {
@@ -258,7 +316,6 @@ void *component_t<T, ID, RESERVED>::operator new (size_t size)
 {
   assert(size <= sizeof(T));
   const uint32_t index = component_pool_.make_storage();
-  assert(index < RESERVED); // Do not exceed reserved storage amount
   component_store_t &store = component_pool_[index];
   store.handle = component_handle_t::allocate(index);
   component_handle_t::put(store.handle, (component_base_t *)&store.component);
@@ -4,85 +4,173 @@
   is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
 */
 #include "component_handle.hh"
-#include <map>
-#include <unordered_map>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <cassert>
 
 
 namespace snow {
 
 
-struct hash_handle_t {
-  uint_fast64_t operator () (const component_handle_t &handle) const
+namespace {
+
+
+const uint32_t PAGE_BITS = 12;
+const uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+const uint32_t PAGE_COUNT = component_handle_t::MAX_SLOTS / PAGE_SIZE;
+
+
+struct slot_t
+{
+  // Generation of the handle currently allowed to use the slot. Zero is
+  // never a valid generation, so zeroed handles resolve to nothing.
+  std::atomic<uint32_t>           generation { 1 };
+  std::atomic<component_base_t *> component { nullptr };
+};
+
+
+using page_t = slot_t[PAGE_SIZE];
+
+
+struct slot_map_t
+{
+  std::mutex                    lock;
+  // Pages are allocated as slots are first needed and never freed or moved
+  std::atomic<page_t *>         pages[PAGE_COUNT];
+  std::atomic<uint32_t>         count { 0 };
+  // Freed slots, oldest first
+  std::deque<uint32_t>          free;
+
+  slot_map_t()
+  {
+    for (std::atomic<page_t *> &page : pages) {
+      page.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  ~slot_map_t()
+  {
+    for (std::atomic<page_t *> &page : pages) {
+      delete[] page.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot_t &at(uint32_t index)
   {
-    const uint_fast64_t left = static_cast<uint_fast64_t>(handle.local_index);
-    const uint_fast64_t right = static_cast<uint_fast64_t>(handle.global_index);
-    return ((left & 0xFFFF) | ((right & 0xFFFF) << 16) |
-      ((left & 0xFFFF0000) << 32) | ((right & 0xFFFF0000) << 16));
+    return (*pages[index >> PAGE_BITS].load(std::memory_order_acquire))[index & (PAGE_SIZE - 1)];
   }
 };
 
 
+slot_map_t g_components;
 
-using component_map_t = typename std::conditional<true, //sizeof(size_t) >= 8,
-  std::unordered_map<component_handle_t, component_base_t *, hash_handle_t>,
-  std::map<component_handle_t, component_base_t *> >::type;
-// using component_map_t = std::unordered_map<component_handle_t, component_base_t *, hash_handle_t>;
 
 
-static component_map_t g_components;
+// Generation after the given one, skipping zero
+inline uint32_t next_generation(uint32_t generation)
+{
+  return generation == UINT32_MAX ? 1 : generation + 1;
+}
+
+
+} // namespace <anon>
+
+
+
+const uint32_t component_handle_t::MAX_SLOTS;
 
 
 
 component_handle_t component_handle_t::allocate(uint32_t local)
 {
-  static uint32_t global_count = 0xDEADBEEFUL;
-  const size_t start_index = global_count;
-  component_handle_t result = {
-    local, ++global_count
-  };
-  while (g_components.find(result) != g_components.end() && global_count != start_index) {
-    result.global_index = ++global_count;
+  std::lock_guard<std::mutex> guard(g_components.lock);
+  uint32_t index;
+  if (!g_components.free.empty()) {
+    index = g_components.free.front();
+    g_components.free.pop_front();
+  } else {
+    index = g_components.count.load(std::memory_order_relaxed);
+    if (index >= MAX_SLOTS) {
+      s_throw(std::runtime_error, "No free component handles");
+    }
+    std::atomic<page_t *> &page = g_components.pages[index >> PAGE_BITS];
+    if (page.load(std::memory_order_relaxed) == nullptr) {
+      page.store(new page_t[1], std::memory_order_release);
+    }
+    g_components.count.store(index + 1, std::memory_order_release);
   }
-  if (global_count == start_index) {
-    std::clog << "No free global indices for a component, somehow." << std::endl;
-    assert(global_count == start_index);
-  }
-  return result;
+
+  const uint32_t generation = g_components.at(index).generation.load(std::memory_order_relaxed);
+  return { local, index, generation };
 }
 
 
 
 void component_handle_t::put(const component_handle_t &handle, component_base_t *component)
 {
-#ifndef NDEBUG
-  const auto result =
-#endif
-  g_components.insert({ handle, component });
-#ifndef NDEBUG
-  assert(result.second);
-#endif
+  std::lock_guard<std::mutex> guard(g_components.lock);
+  const uint32_t index = handle.global_index;
+  assert(index < g_components.count.load(std::memory_order_relaxed));
+  slot_t &slot = g_components.at(index);
+  assert(slot.generation.load(std::memory_order_relaxed) == handle.generation);
+  // Mapping a slot twice would leave its first component unreachable
+  assert(slot.component.load(std::memory_order_relaxed) == nullptr);
+  slot.component.store(component, std::memory_order_release);
+}
+
+
+
+void component_handle_t::relocate(const component_handle_t &handle, component_base_t *from,
+  component_base_t *to)
+{
+  std::lock_guard<std::mutex> guard(g_components.lock);
+  const uint32_t index = handle.global_index;
+  assert(index < g_components.count.load(std::memory_order_relaxed));
+  slot_t &slot = g_components.at(index);
+  assert(slot.generation.load(std::memory_order_relaxed) == handle.generation);
+  assert(slot.component.load(std::memory_order_relaxed) == from);
+  (void)from;
+  slot.component.store(to, std::memory_order_release);
 }
 
 
 
 component_base_t *component_handle_t::get(const component_handle_t &handle)
 {
-  auto iter = g_components.find(handle);
-  if (iter != g_components.end()) {
-    return iter->second;
+  const uint32_t index = handle.global_index;
+  if (index >= g_components.count.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  slot_t &slot = g_components.at(index);
+  component_base_t *component = slot.component.load(std::memory_order_acquire);
+  if (slot.generation.load(std::memory_order_acquire) != handle.generation) {
+    return nullptr;
   }
-  return nullptr;
+  return component;
 }
 
 
 
 void component_handle_t::erase(const component_handle_t &handle)
 {
-  auto iter = g_components.find(handle);
-  if (iter != g_components.end()) {
-    g_components.erase(iter);
+  std::lock_guard<std::mutex> guard(g_components.lock);
+  const uint32_t index = handle.global_index;
+  if (index >= g_components.count.load(std::memory_order_relaxed)) {
+    return;
   }
+  slot_t &slot = g_components.at(index);
+  if (slot.generation.load(std::memory_order_relaxed) != handle.generation) {
+    return;
+  }
+
+  // Bump the generation before clearing the component so a concurrent get()
+  // sees a mismatch rather than a null component for a live generation
+  slot.generation.store(next_generation(handle.generation), std::memory_order_release);
+  slot.component.store(nullptr, std::memory_order_release);
+  g_components.free.push_back(index);
 }
 
 
@@ -103,14 +191,15 @@ component_base_t *component_handle_t::get()
 
 bool component_handle_t::operator == (const component_handle_t &other) const
 {
-  return local_index == other.local_index && global_index == other.global_index;
+  return local_index == other.local_index && global_index == other.global_index &&
+    generation == other.generation;
 }
 
 
 
 bool component_handle_t::operator != (const component_handle_t &other) const
 {
-  return local_index != other.local_index || global_index != other.global_index;
+  return !(*this == other);
 }
 
 
@@ -17,24 +17,49 @@ struct component_base_t;
 struct game_object_t;
 
 
+/*==============================================================================
+
+  Handles resolve through a global generational slot map. A handle holds its
+  slot's index (global_index) and the slot's generation when the handle was
+  allocated. Erasing a handle bumps its slot's generation, so stale handles
+  no longer match and get() returns null for them.
+
+  Generations are 32 bits and wrap around, skipping zero, so slots are never
+  retired and the index space never shrinks. Freed slots are reused oldest
+  first, so a stale handle could only match a later component after its slot
+  had been reused four billion times.
+
+  Slots live in fixed pages that never move, so get() may be called from any
+  thread without locking, while allocate/put/erase lock.
+
+==============================================================================*/
 struct component_handle_t final
 {
+  // Components that may be live at once
+  static const uint32_t MAX_SLOTS = 1u << 20;
+
   uint32_t local_index;   // Index within the component's own pool
-  uint32_t global_index;  // Global index used to identify the component among all others
+  uint32_t global_index;  // Slot index in the global slot map
+  uint32_t generation;    // Slot's generation when the handle was allocated
 
   // Short-hand for get(*this)
   const component_base_t *get() const;
   component_base_t *get();
 
-  // Gets a new handle with a new global index and the given local index.
+  // Gets a new handle with a free slot and the given local index.
   static component_handle_t allocate(uint32_t local);
-  // Maps the given component handle to the component address.
+  // Maps a newly allocated handle to the component address. A handle may
+  // only be put once.
   static void put(const component_handle_t &handle, component_base_t *component);
-  // Gets the component associated with a given handle. Returns null if no
-  // component is found. If the handle isn't associated with a handle, however,
-  // it will fail an assert.
+  // Remaps the handle from the component's old address to its new one, for
+  // pools that move components.
+  static void relocate(const component_handle_t &handle, component_base_t *from,
+    component_base_t *to);
+  // Gets the component associated with a given handle. Returns null if the
+  // handle was erased or never allocated.
   static component_base_t *get(const component_handle_t &handle);
-  // Unmaps any component with the given handle from the global component map.
+  // Unmaps the handle's component and frees its slot. Stale handles are
+  // ignored.
   static void erase(const component_handle_t &handle);
 
 
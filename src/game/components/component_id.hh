@@ -6,6 +6,9 @@
 #ifndef __SNOW__COMPONENT_ID_HH__
 #define __SNOW__COMPONENT_ID_HH__
 
+#include <bitset>
+#include <initializer_list>
+
 
 namespace snow {
 
@@ -23,6 +26,20 @@ enum component_id_t : unsigned
 };
 
 
+// Set of component IDs, as held by a game object
+using component_mask_t = std::bitset<MAX_COMPONENT_IDS>;
+
+
+inline component_mask_t component_mask(std::initializer_list<unsigned> ids)
+{
+  component_mask_t mask;
+  for (unsigned id : ids) {
+    mask.set(id);
+  }
+  return mask;
+}
+
+
 } // namespace snow
 
 
@@ -0,0 +1,58 @@
+/*
+  component_pools.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "component_pools.hh"
+#include "player_mover.hh"
+#include "point_light.hh"
+#include "transform.hh"
+
+
+namespace snow {
+
+
+namespace {
+
+
+struct component_pool_t
+{
+  const char *  name;
+  size_t      (*compact)();
+  pool_stats_t (*stats)();
+};
+
+
+const component_pool_t g_pools[] = {
+  { transform_t::COMPONENT_NAME, transform_t::compact, transform_t::pool_stats },
+  { point_light_t::COMPONENT_NAME, point_light_t::compact, point_light_t::pool_stats },
+  { player_mover_t::COMPONENT_NAME, player_mover_t::compact, player_mover_t::pool_stats },
+};
+
+
+} // namespace <anon>
+
+
+
+size_t compact_component_pools()
+{
+  size_t moved = 0;
+  for (const component_pool_t &pool : g_pools) {
+    moved += pool.compact();
+  }
+  return moved;
+}
+
+
+
+void log_component_pool_stats()
+{
+  for (const component_pool_t &pool : g_pools) {
+    const pool_stats_t stats = pool.stats();
+    s_log_note("%s: %zu live, %zu used, %zu capacity in %zu chunks",
+      pool.name, stats.live, stats.used, stats.capacity, stats.chunks);
+  }
+}
+
+
+} // namespace snow
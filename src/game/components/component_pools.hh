@@ -0,0 +1,35 @@
+/*
+  component_pools.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__COMPONENT_POOLS_HH__
+#define __SNOW__COMPONENT_POOLS_HH__
+
+#include "../../config.hh"
+#include <cstddef>
+
+
+namespace snow {
+
+
+/*==============================================================================
+
+  Housekeeping over the pools of every component type the game defines. A
+  new component type should be added to the table in component_pools.cc.
+
+  Compacting moves components, so pointers to components (as opposed to
+  handles and game_object_t::get_component) are invalid afterward. It's done
+  once a level has loaded, while nothing holds such pointers across frames.
+
+==============================================================================*/
+
+// Compacts every component pool. Returns the number of components moved.
+S_EXPORT size_t compact_component_pools();
+// Logs each component pool's pool_stats().
+S_EXPORT void log_component_pool_stats();
+
+
+} // namespace snow
+
+#endif /* end __SNOW__COMPONENT_POOLS_HH__ include guard */
@@ -14,6 +14,40 @@ DEFINE_COMPONENT_CTOR_DTOR(player_mover_t);
 
 
 
+cvar_t *player_mover_t::register_speed(cvar_set_t &cvars, bool replicate)
+{
+  const int flags = replicate
+    ? CVAR_SERVER | CVAR_REPLICATED | CVAR_DELAYED
+    : CVAR_SERVER | CVAR_READ_ONLY;
+  return cvars.get_cvar("g_playerSpeed", SPEED, flags);
+}
+
+
+
+void player_mover_t::simulate(vec3f_t &position, const player_input_t &input, float speed)
+{
+  vec2f_t delta = {
+    static_cast<float>(input.x),
+    static_cast<float>(input.y)
+  };
+  delta.normalize().scale(speed);
+  position.x += delta.x;
+  position.y += delta.y;
+}
+
+
+
+void player_mover_t::apply(const player_input_t &input, float speed)
+{
+  transform_t *transform = get_component<transform_t>();
+  vec3f_t position = transform->translation();
+  simulate(position, input, speed);
+  transform->set_translation(position);
+  last_input = input;
+}
+
+
+
 void player_mover_t::move(const vec2f_t &velocity)
 {
   get_component<transform_t>()->translate(velocity);
@@ -7,17 +7,45 @@
 #define __SNOW__PLAYER_MOVER_HH__
 
 #include "component.hh"
+#include "../../console.hh"
 
 
 namespace snow {
 
 
+/* Movement input for a single tick. Each axis is -1, 0, or 1. */
+struct player_input_t
+{
+  int8_t x;
+  int8_t y;
+};
+
+
 struct player_mover_t : component_t<player_mover_t, PLAYER_COMPONENT>
 {
 
   DECL_COMPONENT_CTOR_DTOR(player_mover_t);
 
+  // Default distance moved per tick
+  static constexpr float SPEED = 4.0f;
+
+  // Registers g_playerSpeed, the distance moved per tick, in cvars and
+  // returns it. The server's is replicated to clients (replicate = true).
+  // Clients register theirs read-only, so only the server's value is ever
+  // applied to it and prediction moves at the server's speed.
+  static cvar_t *register_speed(cvar_set_t &cvars, bool replicate);
+
+  // Advances a position by one tick of input. Only depends on its arguments,
+  // so predicted ticks can be re-simulated from a snapshot.
+  static void simulate(vec3f_t &position, const player_input_t &input, float speed);
+
   void move(const vec2f_t &velocity);
+  // Applies one tick of input to the object's transform and records it in
+  // last_input.
+  void apply(const player_input_t &input, float speed);
+
+  // Input applied on the mover's last tick
+  player_input_t last_input = { 0, 0 };
 
 };
 
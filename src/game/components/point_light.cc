@@ -0,0 +1,15 @@
+/*
+  point_light.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "point_light.hh"
+
+
+namespace snow {
+
+
+DEFINE_COMPONENT_CTOR_DTOR(point_light_t);
+
+
+} // namespace snow
@@ -7,6 +7,7 @@
 #define __SNOW__POINT_LIGHT_HH__
 
 #include "../../config.hh"
+#include <snow/math/math3d.hh>
 #include "component.hh"
 
 
@@ -19,9 +20,7 @@ struct rmaterial_t;
 struct point_light_t : component_t<point_light_t, LIGHT_COMPONENT, 256>
 {
 
-  point_light_t();
-  point_light_t(game_object_t *obj);
-  ~point_light_t() override;
+  DECL_COMPONENT_CTOR_DTOR(point_light_t);
 
   float radius;
   vec4f_t color;
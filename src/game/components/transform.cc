@@ -10,49 +10,145 @@
 namespace snow {
 
 
-DEFINE_COMPONENT_CTOR_DTOR(transform_t);
+namespace {
+
+
+// Rotation matrix entries used to recover Euler angles, computed straight from
+// the quaternion rather than building the whole matrix. Same convention as
+// transform_store_t::compute_local().
+struct euler_basis_t
+{
+  float r10, r11;       // roll
+  float r02, r12, r22;  // pitch and yaw
+};
+
+
+
+euler_basis_t euler_basis(const quatf_t &q)
+{
+  const float x = q.xyz.x, y = q.xyz.y, z = q.xyz.z, w = q.w;
+  const float norm = x * x + y * y + z * z + w * w;
+  const float s = norm > 0 ? 2.0f / norm : 0.0f;
+  return {
+    (x * y + w * z) * s,
+    1.0f - (x * x + z * z) * s,
+    (x * z + w * y) * s,
+    (y * z - w * x) * s,
+    1.0f - (x * x + y * y) * s
+  };
+}
+
+
+
+float basis_pitch(const euler_basis_t &b)
+{
+  return std::atan2(b.r12, std::sqrt(b.r02 * b.r02 + b.r22 * b.r22));
+}
+
+
+
+float basis_yaw(const euler_basis_t &b)
+{
+  return -std::atan2(b.r02, b.r22);
+}
+
+
+
+float basis_roll(const euler_basis_t &b)
+{
+  return std::atan2(b.r10, b.r11);
+}
+
+
+} // namespace <anon>
+
+
+
+transform_t::transform_t() :
+  slot_(transform_store().allocate())
+{
+  /* nop */
+}
+
+
+
+transform_t::transform_t(game_object_t *obj) :
+  component_t(obj),
+  slot_(transform_store().allocate())
+{
+  /* nop */
+}
+
+
+
+transform_t::transform_t(const transform_t &other) :
+  component_t(),
+  slot_(transform_store().allocate())
+{
+  *this = other;
+}
+
+
+
+transform_t::~transform_t()
+{
+  transform_store().release(slot_);
+}
+
+
+
+transform_t &transform_t::operator = (const transform_t &other)
+{
+  transform_store_t &store = transform_store();
+  store.set_translation(slot_, store.translation(other.slot_));
+  store.set_scale(slot_, store.scale(other.slot_));
+  store.set_rotation(slot_, store.rotation(other.slot_));
+  mark_changed();
+  return *this;
+}
 
 
 
 void transform_t::move_relative(const vec3f_t &t)
 {
-  set_translation(translation_ + rotation_ * t);
+  set_translation(translation() + rotation() * t);
 }
 
 
 
 void transform_t::translate(const vec3f_t &t)
 {
-  set_translation(translation_ + t);
+  set_translation(translation() + t);
 }
 
 
 
 void transform_t::scale(const vec3f_t &s)
 {
-  set_scale(scale_ * s);
+  set_scale(scale() * s);
 }
 
 
 void transform_t::rotate(const mat3f_t &mat)
 {
-  set_rotation(rotation_ * mat);
+  set_rotation_quat(rotation_quat() * quatf_t::from_mat3(mat));
 }
 
 
 
 void transform_t::rotate_quat(const quatf_t &quat)
 {
-  set_rotation(rotation_ * mat3f_t::from_quat(quat));
+  set_rotation_quat(rotation_quat() * quat);
 }
 
 
 
 void transform_t::rotate_euler(float pitch, float yaw, float roll)
 {
-  set_rotation(quatf_t::from_angle_axis(this->yaw() + yaw, vec3f_t::pos_Y) *
-               quatf_t::from_angle_axis(this->pitch() + pitch, vec3f_t::pos_X) *
-               quatf_t::from_angle_axis(this->roll() + roll, vec3f_t::pos_Z));
+  const euler_basis_t basis = euler_basis(rotation_quat());
+  set_rotation_euler(basis_pitch(basis) + pitch,
+                     basis_yaw(basis) + yaw,
+                     basis_roll(basis) + roll);
 }
 
 
@@ -66,37 +162,40 @@ void transform_t::rotate_euler(const vec3f_t &angles)
 
 void transform_t::set_translation(const vec3f_t &t)
 {
-  translation_ = t;
+  transform_store().set_translation(slot_, t);
+  mark_changed();
 }
 
 
 
 void transform_t::set_scale(const vec3f_t &s)
 {
-  scale_ = s;
+  transform_store().set_scale(slot_, s);
+  mark_changed();
 }
 
 
 
 void transform_t::set_rotation(const mat3f_t &mat)
 {
-  rotation_ = mat;
+  set_rotation_quat(quatf_t::from_mat3(mat));
 }
 
 
 
 void transform_t::set_rotation_quat(const quatf_t &quat)
 {
-  set_rotation(mat3f_t::from_quat(quat));
+  transform_store().set_rotation(slot_, quat);
+  mark_changed();
 }
 
 
 
 void transform_t::set_rotation_euler(float pitch, float yaw, float roll)
 {
-  set_rotation(quatf_t::from_angle_axis(yaw, vec3f_t::pos_Y) *
-               quatf_t::from_angle_axis(pitch, vec3f_t::pos_X) *
-               quatf_t::from_angle_axis(roll, vec3f_t::pos_Z));
+  set_rotation_quat(quatf_t::from_angle_axis(yaw, vec3f_t::pos_Y) *
+                    quatf_t::from_angle_axis(pitch, vec3f_t::pos_X) *
+                    quatf_t::from_angle_axis(roll, vec3f_t::pos_Z));
 }
 
 
@@ -108,33 +207,41 @@ void transform_t::set_rotation_euler(const vec3f_t &angles)
 
 
 
-auto transform_t::translation() const -> const vec3f_t &
+auto transform_t::translation() const -> vec3f_t
 {
-  return translation_;
+  return transform_store().translation(slot_);
 }
 
 
 
-auto transform_t::scale() const -> const vec3f_t &
+auto transform_t::scale() const -> vec3f_t
 {
-  return scale_;
+  return transform_store().scale(slot_);
 }
 
 
 
-auto transform_t::rotation() const -> const mat3f_t &
+auto transform_t::rotation() const -> mat3f_t
 {
-  return rotation_;
+  return mat3f_t::from_quat(rotation_quat());
+}
+
+
+
+auto transform_t::rotation_quat() const -> quatf_t
+{
+  return transform_store().rotation(slot_);
 }
 
 
 
 auto transform_t::rotation_euler() const -> vec3f_t
 {
+  const euler_basis_t basis = euler_basis(rotation_quat());
   return {
-    pitch(),
-    yaw(),
-    roll()
+    basis_pitch(basis),
+    basis_yaw(basis),
+    basis_roll(basis)
   };
 }
 
@@ -142,23 +249,21 @@ auto transform_t::rotation_euler() const -> vec3f_t
 
 auto transform_t::pitch() const -> float
 {
-  return std::atan2(rotation_.t.y,
-                    std::sqrt(rotation_.t.x * rotation_.t.x +
-                              rotation_.t.z * rotation_.t.z));
+  return basis_pitch(euler_basis(rotation_quat()));
 }
 
 
 
 auto transform_t::yaw() const -> float
 {
-  return -std::atan2(rotation_.t.x, rotation_.t.z);
+  return basis_yaw(euler_basis(rotation_quat()));
 }
 
 
 
 auto transform_t::roll() const -> float
 {
-  return std::atan2(rotation_.r.y, rotation_.s.y);
+  return basis_roll(euler_basis(rotation_quat()));
 }
 
 
@@ -166,9 +271,9 @@ auto transform_t::roll() const -> float
 transform_t transform_t::transformed(const transform_t &other) const
 {
   transform_t r;
-  r.set_rotation(rotation_ * other.rotation_);
-  r.set_translation(rotation_ * other.translation_ + translation_);
-  r.set_scale(scale_ * other.scale_);
+  r.set_rotation_quat(rotation_quat() * other.rotation_quat());
+  r.set_translation(rotation() * other.translation() + translation());
+  r.set_scale(scale() * other.scale());
   return r;
 }
 
@@ -176,8 +281,9 @@ transform_t transform_t::transformed(const transform_t &other) const
 
 transform_t &transform_t::transform(const transform_t &other)
 {
-  set_rotation(rotation_ * other.rotation_);
-  set_translation(rotation_ * other.translation_ + translation_);
+  const quatf_t rotation_before = rotation_quat();
+  set_rotation_quat(rotation_before * other.rotation_quat());
+  set_translation(mat3f_t::from_quat(rotation_before) * other.translation() + translation());
   return *this;
 }
 
@@ -185,27 +291,21 @@ transform_t &transform_t::transform(const transform_t &other)
 
 auto transform_t::local_mat4() const -> mat4f_t
 {
-  return mat4f_t::look_at(vec3f_t::zero, vec3f_t::zero, vec3f_t::zero);
-  // return (mat4f_t::translation(translation_) *
-          // mat4f_t::scaling(scale_) *
-          // (mat4f_t)rotation_);
+  return transform_store().compute_local(slot_);
 }
 
 
 
 auto transform_t::world_mat4() const -> mat4f_t
 {
-  mat4f_t result = local_mat4();
-  game_object_t *parent = game_object ? game_object->parent() : nullptr;
+  return transform_store().world(slot_);
+}
+
 
-  while (parent) {
-    const transform_t *parent_tform = parent->get_component<transform_t>();
-    if (parent_tform) {
-      result = parent_tform->local_mat4() * result;
-    }
-  }
 
-  return result;
+uint32_t transform_t::slot() const
+{
+  return slot_;
 }
 
 
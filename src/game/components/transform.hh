@@ -9,6 +9,7 @@
 #include "../../config.hh"
 #include <snow/math/math3d.hh>
 #include "component.hh"
+#include "transform_store.hh"
 
 namespace snow {
 
@@ -16,10 +17,23 @@ namespace snow {
 struct game_object_t;
 
 
+/*==============================================================================
+
+  A transform_t is a view of a slot in the shared transform_store_t -- its
+  translation, scale and rotation live in the store's arrays rather than the
+  component, so batch passes (see transform_store_t::update_local) can work
+  over every transform at once. Rotations are stored as quaternions.
+
+  Copying a transform_t allocates a new slot with the same values.
+
+==============================================================================*/
 struct S_EXPORT transform_t : public component_t<transform_t, TRANSFORM_COMPONENT>
 {
   DECL_COMPONENT_CTOR_DTOR(transform_t);
 
+  transform_t(const transform_t &other);
+  transform_t &operator = (const transform_t &other);
+
 /*******************************************************************************
 *                               relative changes                               *
 *******************************************************************************/
@@ -47,9 +61,10 @@ struct S_EXPORT transform_t : public component_t<transform_t, TRANSFORM_COMPONEN
 *                                   getters                                    *
 *******************************************************************************/
 
-  const vec3f_t & translation() const;
-  const vec3f_t & scale() const;
-  const mat3f_t & rotation() const;
+  vec3f_t         translation() const;
+  vec3f_t         scale() const;
+  mat3f_t         rotation() const;
+  quatf_t         rotation_quat() const;
   float           pitch() const;
   float           yaw() const  ;
   float           roll() const ;
@@ -63,12 +78,15 @@ struct S_EXPORT transform_t : public component_t<transform_t, TRANSFORM_COMPONEN
   transform_t &   transform(const transform_t &other);
 
   mat4f_t         local_mat4() const;
+  // World matrix as of the last transform_store_t::update_world(), which the
+  // client runs at the start of every tick and before drawing.
   mat4f_t         world_mat4() const;
 
+  // Slot in transform_store()
+  uint32_t        slot() const;
 
-  mat3f_t         rotation_;
-  vec3f_t         scale_;
-  vec3f_t         translation_;
+private:
+  uint32_t        slot_;
 };
 
 
@@ -0,0 +1,517 @@
+/*
+  transform_store.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "transform_store.hh"
+#include "../scene_graph.hh"
+#include <cassert>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define S_TRANSFORM_SSE 1
+#include <xmmintrin.h>
+#endif
+
+
+namespace snow {
+
+
+namespace {
+
+
+static_assert(sizeof(mat4f_t) == sizeof(float) * 16,
+  "mat4f_t must be 16 tightly packed floats");
+
+
+transform_store_t g_transform_store;
+
+
+// Values of dirty_
+const uint8_t SLOT_CLEAN = 0;
+const uint8_t SLOT_DIRTY = 1;
+const uint8_t SLOT_UPDATED = 2;
+
+
+
+// out = parent * local for column-major matrices. Each column of the result
+// is the parent's columns weighted by the local column's components.
+void multiply_world(const mat4f_t &parent, const mat4f_t &local, mat4f_t &out)
+{
+  const float *a = (const float *)&parent;
+  const float *b = (const float *)&local;
+  float *m = (float *)&out;
+#if S_TRANSFORM_SSE
+  const __m128 a0 = _mm_loadu_ps(a + 0);
+  const __m128 a1 = _mm_loadu_ps(a + 4);
+  const __m128 a2 = _mm_loadu_ps(a + 8);
+  const __m128 a3 = _mm_loadu_ps(a + 12);
+  for (int column = 0; column < 16; column += 4) {
+    const __m128 sum = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(b[column + 0])),
+                 _mm_mul_ps(a1, _mm_set1_ps(b[column + 1]))),
+      _mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(b[column + 2])),
+                 _mm_mul_ps(a3, _mm_set1_ps(b[column + 3]))));
+    _mm_storeu_ps(m + column, sum);
+  }
+#else
+  for (int column = 0; column < 16; column += 4) {
+    for (int row = 0; row < 4; ++row) {
+      m[column + row] = a[row] * b[column] + a[row + 4] * b[column + 1] +
+                        a[row + 8] * b[column + 2] + a[row + 12] * b[column + 3];
+    }
+  }
+#endif
+}
+
+
+} // namespace <anon>
+
+
+
+transform_store_t &transform_store()
+{
+  return g_transform_store;
+}
+
+
+
+const uint32_t transform_store_t::NO_SLOT;
+const size_t transform_store_t::COLUMN_COUNT;
+
+
+
+uint32_t transform_store_t::allocate()
+{
+  uint32_t slot;
+  if (!free_.empty()) {
+    slot = free_.back();
+    free_.pop_back();
+  } else {
+    slot = static_cast<uint32_t>(tx_.size());
+    tx_.push_back(0); ty_.push_back(0); tz_.push_back(0);
+    sx_.push_back(1); sy_.push_back(1); sz_.push_back(1);
+    qx_.push_back(0); qy_.push_back(0); qz_.push_back(0); qw_.push_back(1);
+    local_.push_back(mat4f_t::identity);
+    world_.push_back(mat4f_t::identity);
+    dirty_.push_back(SLOT_CLEAN);
+    return slot;
+  }
+
+  // Released slots are already reset
+  local_[slot] = mat4f_t::identity;
+  world_[slot] = mat4f_t::identity;
+  return slot;
+}
+
+
+
+void transform_store_t::release(uint32_t slot)
+{
+  assert(slot < tx_.size());
+  if (slot >= tx_.size()) {
+    return;
+  }
+  // Reset the slot so batch passes over it stay cheap and well-defined
+  set_translation(slot, vec3f_t::zero);
+  set_scale(slot, vec3f_t::one);
+  set_rotation(slot, quatf_t::identity);
+  free_.push_back(slot);
+}
+
+
+
+void transform_store_t::reserve(size_t count)
+{
+  for (std::vector<float> *array : { &tx_, &ty_, &tz_, &sx_, &sy_, &sz_, &qx_, &qy_, &qz_, &qw_ }) {
+    array->reserve(count);
+  }
+  local_.reserve(count);
+  world_.reserve(count);
+  dirty_.reserve(count);
+}
+
+
+
+size_t transform_store_t::size() const
+{
+  return tx_.size();
+}
+
+
+
+vec3f_t transform_store_t::translation(uint32_t slot) const
+{
+  return { tx_[slot], ty_[slot], tz_[slot] };
+}
+
+
+
+vec3f_t transform_store_t::scale(uint32_t slot) const
+{
+  return { sx_[slot], sy_[slot], sz_[slot] };
+}
+
+
+
+quatf_t transform_store_t::rotation(uint32_t slot) const
+{
+  quatf_t q;
+  q.xyz = { qx_[slot], qy_[slot], qz_[slot] };
+  q.w = qw_[slot];
+  return q;
+}
+
+
+
+void transform_store_t::set_translation(uint32_t slot, const vec3f_t &t)
+{
+  tx_[slot] = t.x;
+  ty_[slot] = t.y;
+  tz_[slot] = t.z;
+  mark_dirty(slot);
+}
+
+
+
+void transform_store_t::set_scale(uint32_t slot, const vec3f_t &s)
+{
+  sx_[slot] = s.x;
+  sy_[slot] = s.y;
+  sz_[slot] = s.z;
+  mark_dirty(slot);
+}
+
+
+
+void transform_store_t::set_rotation(uint32_t slot, const quatf_t &q)
+{
+  qx_[slot] = q.xyz.x;
+  qy_[slot] = q.xyz.y;
+  qz_[slot] = q.xyz.z;
+  qw_[slot] = q.w;
+  mark_dirty(slot);
+}
+
+
+
+void transform_store_t::load_columns(const uint32_t *slots, size_t count,
+  const float *const *columns)
+{
+  size_t run_start = 0;
+  while (run_start < count) {
+    size_t run_end = run_start + 1;
+    while (run_end < count && slots[run_end] == slots[run_end - 1] + 1) {
+      ++run_end;
+    }
+    const size_t length = run_end - run_start;
+    for (size_t index = 0; index < COLUMN_COUNT; ++index) {
+      std::memcpy(column(index)->data() + slots[run_start], columns[index] + run_start,
+                  length * sizeof(float));
+    }
+    run_start = run_end;
+  }
+  for (size_t index = 0; index < count; ++index) {
+    mark_dirty(slots[index]);
+  }
+}
+
+
+
+void transform_store_t::store_columns(const uint32_t *slots, size_t count,
+  float *const *columns) const
+{
+  size_t run_start = 0;
+  while (run_start < count) {
+    size_t run_end = run_start + 1;
+    while (run_end < count && slots[run_end] == slots[run_end - 1] + 1) {
+      ++run_end;
+    }
+    const size_t length = run_end - run_start;
+    for (size_t index = 0; index < COLUMN_COUNT; ++index) {
+      std::memcpy(columns[index] + run_start, column(index)->data() + slots[run_start],
+                  length * sizeof(float));
+    }
+    run_start = run_end;
+  }
+}
+
+
+
+/*==============================================================================
+  update_world(graph)
+
+    Recomputes the local and world matrices of every dirty slot and every
+    slot below one. Slots are visited in the graph's node order, parent
+    before child, so a parent's world matrix is always current by the time
+    its children need it, and a child is recomputed whenever its parent was.
+    Dirty slots the walk didn't reach have no node and are treated as roots.
+    If enough slots are dirty, local matrices are computed up front by the
+    batch kernel instead of one at a time.
+==============================================================================*/
+void transform_store_t::update_world(scene_graph_t &graph)
+{
+  if (dirty_slots_.empty()) {
+    return;
+  }
+
+  // Past a quarter of the store, skipping clean slots saves less than the
+  // batch kernel does
+  const bool batched = dirty_slots_.size() * 4 >= tx_.size();
+  if (batched) {
+    update_local();
+  }
+
+  for (const uint32_t node : graph.node_order()) {
+    const uint32_t slot = graph.slot(node);
+    if (slot == NO_SLOT) {
+      continue;
+    }
+    const uint32_t parent_node = graph.parent(node);
+    const uint32_t parent = parent_node == scene_graph_t::NO_NODE ?
+      NO_SLOT : graph.slot(parent_node);
+    if (dirty_[slot] == SLOT_DIRTY ||
+        (parent != NO_SLOT && dirty_[parent] == SLOT_UPDATED)) {
+      update_world(slot, parent, batched);
+    }
+  }
+
+  // Recomputed descendants were appended while walking
+  for (const uint32_t slot : dirty_slots_) {
+    if (dirty_[slot] == SLOT_DIRTY) {
+      update_world(slot, NO_SLOT, batched);
+    }
+    dirty_[slot] = SLOT_CLEAN;
+  }
+  dirty_slots_.clear();
+}
+
+
+
+auto transform_store_t::world(uint32_t slot) const -> const mat4f_t &
+{
+  return world_[slot];
+}
+
+
+
+vec3f_t transform_store_t::world_translation(uint32_t slot) const
+{
+  const float *m = (const float *)&world_[slot];
+  return { m[12], m[13], m[14] };
+}
+
+
+
+bool transform_store_t::is_dirty(uint32_t slot) const
+{
+  return dirty_[slot] != SLOT_CLEAN;
+}
+
+
+
+void transform_store_t::update_local()
+{
+  update_local(0, static_cast<uint32_t>(tx_.size()));
+}
+
+
+
+void transform_store_t::update_local(uint32_t first, uint32_t count)
+{
+  if (first > tx_.size() || count > tx_.size() - first) {
+    s_throw(std::out_of_range, "Transform slot range is out of range");
+  }
+#if S_TRANSFORM_SSE
+  const uint32_t batched = count & ~3u;
+  update_local_sse(first, batched);
+  update_local_scalar(first + batched, count - batched);
+#else
+  update_local_scalar(first, count);
+#endif
+}
+
+
+
+auto transform_store_t::local(uint32_t slot) const -> const mat4f_t &
+{
+  return local_[slot];
+}
+
+
+
+/*==============================================================================
+  compute_local(slot)
+
+    Computes translation * rotation * scale for a single slot. The rotation
+    is scaled by 2 / |q|^2 rather than assuming a unit quaternion, so rotations
+    that have drifted from unit length don't skew the matrix.
+==============================================================================*/
+mat4f_t transform_store_t::compute_local(uint32_t slot) const
+{
+  const float x = qx_[slot], y = qy_[slot], z = qz_[slot], w = qw_[slot];
+  const float norm = x * x + y * y + z * z + w * w;
+  const float s = norm > 0 ? 2.0f / norm : 0.0f;
+
+  const float xx = x * x * s, yy = y * y * s, zz = z * z * s;
+  const float xy = x * y * s, xz = x * z * s, yz = y * z * s;
+  const float wx = w * x * s, wy = w * y * s, wz = w * z * s;
+
+  mat4f_t result;
+  float *m = (float *)&result;
+  m[0]  = (1.0f - (yy + zz)) * sx_[slot];
+  m[1]  = (xy + wz) * sx_[slot];
+  m[2]  = (xz - wy) * sx_[slot];
+  m[3]  = 0.0f;
+  m[4]  = (xy - wz) * sy_[slot];
+  m[5]  = (1.0f - (xx + zz)) * sy_[slot];
+  m[6]  = (yz + wx) * sy_[slot];
+  m[7]  = 0.0f;
+  m[8]  = (xz + wy) * sz_[slot];
+  m[9]  = (yz - wx) * sz_[slot];
+  m[10] = (1.0f - (xx + yy)) * sz_[slot];
+  m[11] = 0.0f;
+  m[12] = tx_[slot];
+  m[13] = ty_[slot];
+  m[14] = tz_[slot];
+  m[15] = 1.0f;
+  return result;
+}
+
+
+
+void transform_store_t::mark_dirty(uint32_t slot)
+{
+  if (dirty_[slot] == SLOT_CLEAN) {
+    dirty_[slot] = SLOT_DIRTY;
+    dirty_slots_.push_back(slot);
+  }
+}
+
+
+
+void transform_store_t::update_world(uint32_t slot, uint32_t parent, bool batched)
+{
+  if (!batched) {
+    local_[slot] = compute_local(slot);
+  }
+  if (parent == NO_SLOT) {
+    world_[slot] = local_[slot];
+  } else {
+    multiply_world(world_[parent], local_[slot], world_[slot]);
+  }
+  if (dirty_[slot] == SLOT_CLEAN) {
+    dirty_slots_.push_back(slot);
+  }
+  dirty_[slot] = SLOT_UPDATED;
+}
+
+
+
+std::vector<float> *transform_store_t::column(size_t index)
+{
+  return const_cast<std::vector<float> *>(static_cast<const transform_store_t *>(this)->column(index));
+}
+
+
+
+const std::vector<float> *transform_store_t::column(size_t index) const
+{
+  const std::vector<float> *const columns[COLUMN_COUNT] = {
+    &tx_, &ty_, &tz_, &sx_, &sy_, &sz_, &qx_, &qy_, &qz_, &qw_
+  };
+  return columns[index];
+}
+
+
+
+void transform_store_t::update_local_scalar(uint32_t first, uint32_t count)
+{
+  for (uint32_t slot = first; slot < first + count; ++slot) {
+    local_[slot] = compute_local(slot);
+  }
+}
+
+
+
+/*==============================================================================
+  update_local_sse(first, count)
+
+    Same math as compute_local(), four slots at a time: each register holds
+    one component of four consecutive transforms. The resulting columns are
+    transposed back into four matrices before being stored. count must be a
+    multiple of four.
+==============================================================================*/
+void transform_store_t::update_local_sse(uint32_t first, uint32_t count)
+{
+#if S_TRANSFORM_SSE
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+
+  for (uint32_t slot = first; slot < first + count; slot += 4) {
+    const __m128 x = _mm_loadu_ps(&qx_[slot]);
+    const __m128 y = _mm_loadu_ps(&qy_[slot]);
+    const __m128 z = _mm_loadu_ps(&qz_[slot]);
+    const __m128 w = _mm_loadu_ps(&qw_[slot]);
+
+    const __m128 norm = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+      _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+    // Zero-length quaternions yield the identity rotation, as in the scalar
+    // path, rather than 2 / 0
+    const __m128 s = _mm_and_ps(_mm_cmpgt_ps(norm, zero), _mm_div_ps(two, norm));
+
+    const __m128 xs = _mm_mul_ps(x, s);
+    const __m128 ys = _mm_mul_ps(y, s);
+    const __m128 zs = _mm_mul_ps(z, s);
+    const __m128 xx = _mm_mul_ps(x, xs), yy = _mm_mul_ps(y, ys), zz = _mm_mul_ps(z, zs);
+    const __m128 xy = _mm_mul_ps(x, ys), xz = _mm_mul_ps(x, zs), yz = _mm_mul_ps(y, zs);
+    const __m128 wx = _mm_mul_ps(w, xs), wy = _mm_mul_ps(w, ys), wz = _mm_mul_ps(w, zs);
+
+    const __m128 sx = _mm_loadu_ps(&sx_[slot]);
+    const __m128 sy = _mm_loadu_ps(&sy_[slot]);
+    const __m128 sz = _mm_loadu_ps(&sz_[slot]);
+
+    // Columns of the four matrices, one component per register
+    __m128 c0x = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx);
+    __m128 c0y = _mm_mul_ps(_mm_add_ps(xy, wz), sx);
+    __m128 c0z = _mm_mul_ps(_mm_sub_ps(xz, wy), sx);
+    __m128 c0w = zero;
+    __m128 c1x = _mm_mul_ps(_mm_sub_ps(xy, wz), sy);
+    __m128 c1y = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy);
+    __m128 c1z = _mm_mul_ps(_mm_add_ps(yz, wx), sy);
+    __m128 c1w = zero;
+    __m128 c2x = _mm_mul_ps(_mm_add_ps(xz, wy), sz);
+    __m128 c2y = _mm_mul_ps(_mm_sub_ps(yz, wx), sz);
+    __m128 c2z = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz);
+    __m128 c2w = zero;
+    __m128 c3x = _mm_loadu_ps(&tx_[slot]);
+    __m128 c3y = _mm_loadu_ps(&ty_[slot]);
+    __m128 c3z = _mm_loadu_ps(&tz_[slot]);
+    __m128 c3w = one;
+
+    // After transposing, register N of each column holds that column for
+    // slot + N
+    _MM_TRANSPOSE4_PS(c0x, c0y, c0z, c0w);
+    _MM_TRANSPOSE4_PS(c1x, c1y, c1z, c1w);
+    _MM_TRANSPOSE4_PS(c2x, c2y, c2z, c2w);
+    _MM_TRANSPOSE4_PS(c3x, c3y, c3z, c3w);
+
+    float *m = (float *)&local_[slot];
+    _mm_storeu_ps(m + 0,  c0x); _mm_storeu_ps(m + 4,  c1x);
+    _mm_storeu_ps(m + 8,  c2x); _mm_storeu_ps(m + 12, c3x);
+    _mm_storeu_ps(m + 16, c0y); _mm_storeu_ps(m + 20, c1y);
+    _mm_storeu_ps(m + 24, c2y); _mm_storeu_ps(m + 28, c3y);
+    _mm_storeu_ps(m + 32, c0z); _mm_storeu_ps(m + 36, c1z);
+    _mm_storeu_ps(m + 40, c2z); _mm_storeu_ps(m + 44, c3z);
+    _mm_storeu_ps(m + 48, c0w); _mm_storeu_ps(m + 52, c1w);
+    _mm_storeu_ps(m + 56, c2w); _mm_storeu_ps(m + 60, c3w);
+  }
+#else
+  update_local_scalar(first, count);
+#endif
+}
+
+
+} // namespace snow
@@ -0,0 +1,142 @@
+/*
+  transform_store.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__TRANSFORM_STORE_HH__
+#define __SNOW__TRANSFORM_STORE_HH__
+
+#include "../../config.hh"
+#include <snow/math/math3d.hh>
+#include <cstdint>
+#include <vector>
+
+
+namespace snow {
+
+
+struct scene_graph_t;
+
+
+/*==============================================================================
+
+  Structure-of-arrays storage for transforms. Each transform occupies a slot,
+  and each of its components (translation x, y, z, scale x, y, z, and the
+  rotation quaternion's x, y, z, w) is kept in its own array, so a pass over
+  every transform reads contiguous floats that SSE can load four at a time.
+
+  update_local() computes local matrices (translation * rotation * scale) for
+  a range of slots in one pass, four transforms per iteration when SSE is
+  available. Unused slots hold the identity transform, so passes never need
+  to skip them. local() returns the matrix computed by the last pass, while
+  compute_local() computes a single slot's matrix on demand.
+
+  The store doesn't keep a hierarchy of its own: slots are parented through
+  the scene_graph_t nodes of the objects they belong to. World matrices are
+  cached, and changing a slot marks it dirty. update_world(), which the
+  client calls at the start of every simulation tick and again before
+  drawing, walks the graph's node order, parents before children, and
+  recomputes each dirty slot along with everything below it. Slots without a
+  node are treated as roots. world() is a cached read, so a slot changed
+  during a tick reads its old world matrix until the next update_world().
+
+  The store doesn't record which slots changed for anyone else. transform_t's
+  setters mark the transform changed in change_log(), and consumers that
+  only want what moved, such as spatial_index_t, read the change ticks.
+  Writing to the store directly bypasses the change log.
+
+  Slots are reused once released, and the arrays grow as needed, so pointers
+  into the store are invalidated by allocate(). Refer to transforms by slot.
+  Not thread safe. Releasing a slot that was never allocated is a programming
+  error: it asserts in debug builds and is ignored otherwise, since release()
+  is called from transform_t's destructor.
+
+==============================================================================*/
+struct S_EXPORT transform_store_t
+{
+  static const uint32_t NO_SLOT = UINT32_MAX;
+  // Arrays per transform, in the order bulk copies take them: translation x,
+  // y, z, scale x, y, z, and rotation x, y, z, w.
+  static const size_t   COLUMN_COUNT = 10;
+
+  transform_store_t() = default;
+  ~transform_store_t() = default;
+
+  transform_store_t(const transform_store_t &) = delete;
+  transform_store_t &operator = (const transform_store_t &) = delete;
+
+  // Returns a new slot holding the identity transform.
+  uint32_t        allocate();
+  void            release(uint32_t slot);
+  // Reserves storage for at least count slots.
+  void            reserve(size_t count);
+  // Number of slots, including released slots awaiting reuse.
+  size_t          size() const;
+
+  vec3f_t         translation(uint32_t slot) const;
+  vec3f_t         scale(uint32_t slot) const;
+  quatf_t         rotation(uint32_t slot) const;
+
+  void            set_translation(uint32_t slot, const vec3f_t &t);
+  void            set_scale(uint32_t slot, const vec3f_t &s);
+  // Rotations needn't be normalized -- the matrix is computed from the
+  // quaternion's direction only.
+  void            set_rotation(uint32_t slot, const quatf_t &q);
+
+  // Bulk copies count transforms between COLUMN_COUNT arrays of count floats
+  // each and the given slots. Runs of consecutive slots are copied with a
+  // single memcpy per column. Loading marks the slots dirty.
+  void            load_columns(const uint32_t *slots, size_t count, const float *const *columns);
+  void            store_columns(const uint32_t *slots, size_t count, float *const *columns) const;
+
+  // Marks the slot's world matrix for recomputation, e.g. once its node has
+  // been reparented.
+  void            mark_dirty(uint32_t slot);
+
+  // Recomputes local and world matrices for dirty slots and their
+  // descendants in graph, parents first.
+  void            update_world(scene_graph_t &graph);
+  // World matrix as of the last update_world().
+  const mat4f_t & world(uint32_t slot) const;
+  vec3f_t         world_translation(uint32_t slot) const;
+  // Whether the slot itself has changed since the last update_world().
+  bool            is_dirty(uint32_t slot) const;
+
+  // Computes local matrices for every slot, or for count slots from first.
+  void            update_local();
+  void            update_local(uint32_t first, uint32_t count);
+  // Local matrix as of the last update_local() covering the slot, or the last
+  // update_world() if the slot was dirty.
+  const mat4f_t & local(uint32_t slot) const;
+  mat4f_t         compute_local(uint32_t slot) const;
+
+private:
+  void            update_local_scalar(uint32_t first, uint32_t count);
+  void            update_local_sse(uint32_t first, uint32_t count);
+  void            update_world(uint32_t slot, uint32_t parent, bool batched);
+  std::vector<float> *column(size_t index);
+  const std::vector<float> *column(size_t index) const;
+
+  std::vector<float>    tx_, ty_, tz_;
+  std::vector<float>    sx_, sy_, sz_;
+  std::vector<float>    qx_, qy_, qz_, qw_;
+  std::vector<mat4f_t>  local_;
+  std::vector<uint32_t> free_;
+
+  std::vector<mat4f_t>  world_;
+  // Per slot, whether it's clean, dirty, or already recomputed by the
+  // update_world() in progress
+  std::vector<uint8_t>  dirty_;
+  // Every slot that isn't clean
+  std::vector<uint32_t> dirty_slots_;
+};
+
+
+// Store shared by all transform_t components. Only the simulation thread may
+// touch it, including creating and destroying objects with transforms.
+S_EXPORT transform_store_t &transform_store();
+
+
+} // namespace snow
+
+#endif /* end __SNOW__TRANSFORM_STORE_HH__ include guard */
@@ -14,9 +14,14 @@ namespace snow {
 /*!
   \brief Constructor
 */
-game_object_t::game_object_t()
+game_object_t::game_object_t() :
+  node_(scene_graph().allocate(this))
 {
+  changed_ticks_.fill(0);
+  change_entries_.fill(change_log_t::NO_ENTRY);
+  object_query_t::object_added(this);
   add_component<transform_t>();
+  scene_graph().set_slot(node_, get_component<transform_t>()->slot());
 }
 
 
@@ -26,6 +31,15 @@ game_object_t::game_object_t()
 */
 game_object_t::~game_object_t()
 {
+  object_query_t::object_removed(this);
+  // Children become roots, so their world matrices no longer include this
+  for (game_object_t *child : children()) {
+    transform_store().mark_dirty(child->get_component<transform_t>()->slot());
+  }
+  scene_graph().release(node_);
+  for (unsigned id = 0; id < MAX_COMPONENT_IDS; ++id) {
+    change_log().forget(this, id);
+  }
   for (unsigned id = 0; id < MAX_COMPONENT_IDS; ++id) {
     if (components_[id]) {
       delete component_handle_t::get(component_indices_[id]);
@@ -41,7 +55,8 @@ game_object_t::~game_object_t()
 */
 game_object_t *game_object_t::parent()
 {
-  return parent_;
+  const uint32_t parent = scene_graph().parent(node_);
+  return parent == scene_graph_t::NO_NODE ? nullptr : scene_graph().object(parent);
 }
 
 
@@ -51,7 +66,8 @@ game_object_t *game_object_t::parent()
 */
 const game_object_t *game_object_t::parent() const
 {
-  return parent_;
+  const uint32_t parent = scene_graph().parent(node_);
+  return parent == scene_graph_t::NO_NODE ? nullptr : scene_graph().object(parent);
 }
 
 
@@ -63,10 +79,11 @@ const game_object_t *game_object_t::parent() const
 void game_object_t::add_child(game_object_t *child)
 {
   assert(child != nullptr);
-  assert(child->parent_ == nullptr);
+  assert(child->parent() == nullptr);
 
-  child->parent_ = this;
-  child->parent_iter_ = children_.insert(children_.cend(), child);
+  scene_graph().set_parent(child->node_, node_);
+  transform_store().mark_dirty(child->get_component<transform_t>()->slot());
+  child->mark_changed(TRANSFORM_COMPONENT);
 }
 
 
@@ -76,23 +93,77 @@ void game_object_t::add_child(game_object_t *child)
 */
 void game_object_t::remove_from_parent()
 {
-  assert(parent_);
+  assert(parent());
+
+  scene_graph().set_parent(node_, scene_graph_t::NO_NODE);
+  transform_store().mark_dirty(get_component<transform_t>()->slot());
+  mark_changed(TRANSFORM_COMPONENT);
+}
+
+
+
+/*!
+  \brief Returns the set of component IDs the object has.
+*/
+auto game_object_t::components() const -> const component_mask_t &
+{
+  return components_;
+}
+
+
+
+/*!
+  \brief Gets the handle of the component with the given ID, which the object
+  must have.
+*/
+const component_handle_t &game_object_t::component_handle(unsigned component_id) const
+{
+  assert(component_id < MAX_COMPONENT_IDS);
+  return component_indices_[component_id];
+}
+
+
+
+/*!
+  \brief Marks the component with the given ID changed in the current tick.
+*/
+void game_object_t::mark_changed(unsigned component_id)
+{
+  change_log().mark(this, component_id);
+}
+
 
-  parent_->children_.erase(parent_iter_);
-  parent_ = nullptr;
+
+/*!
+  \brief Returns the change_log() tick the component with the given ID last
+  changed in, or 0 if it never has.
+*/
+uint32_t game_object_t::changed_tick(unsigned component_id) const
+{
+  return changed_ticks_[component_id];
 }
 
 
 
 /*!
-  \brief Returns a const reference to the object's list of children.
+  \brief Returns the range of the object's children.
 
   Can be used for iterating over children or recursing down through the scene
-  graph. At no point should a reference or pointer to this be stored.
+  graph. The range is invalidated by any change to the object's children.
+*/
+auto game_object_t::children() const -> child_range_t
+{
+  return scene_graph().children(node_);
+}
+
+
+
+/*!
+  \brief Returns the object's node in scene_graph().
 */
-auto game_object_t::children() const -> const list_t &
+uint32_t game_object_t::node() const
 {
-  return children_;
+  return node_;
 }
 
 
@@ -10,8 +10,10 @@
 #include "../ext/memory_pool.hh"
 #include "components/component_handle.hh"
 #include "components/component_id.hh"
+#include "change_log.hh"
+#include "object_query.hh"
+#include "scene_graph.hh"
 #include <cassert>
-#include <list>
 
 
 namespace snow {
@@ -26,8 +28,8 @@ namespace snow {
 */
 struct game_object_t final
 {
-  //! \brief List container for game object pointers.
-  using list_t = std::list<game_object_t *>;
+  //! \brief Range of a game object's children, in the order they were added.
+  using child_range_t = scene_graph_t::child_range_t;
   // static void *operator new (size_t);
   // static void operator delete (void *);
 
@@ -56,21 +58,46 @@ struct game_object_t final
   template <typename T>
   bool has_component() const;
 
+  // IDs of the components the object has.
+  const component_mask_t &components() const;
+  // Handle of the component with the given ID. Only meaningful if the
+  // object has that component.
+  const component_handle_t &component_handle(unsigned component_id) const;
+
+  // Records that the component with the given ID changed in the current
+  // change_log() tick. Components call this through mark_changed().
+  void mark_changed(unsigned component_id);
+  // Tick the component with the given ID was last marked changed, or 0.
+  uint32_t changed_tick(unsigned component_id) const;
+  template <typename T>
+  bool changed_since(uint32_t tick) const;
+
   game_object_t *parent();
   const game_object_t *parent() const;
   void add_child(game_object_t *);
   void remove_from_parent();
-  const list_t &children() const;
+  child_range_t children() const;
+  // The object's node in scene_graph().
+  uint32_t node() const;
 
 private:
+  friend struct change_log_t;
+  friend struct object_query_t;
+  // Updates component_indices_ when compacting pools
+  template <typename T, unsigned ID, size_t RESERVED> friend struct component_t;
+
   void remove_component(unsigned component_id);
 
-  mutable std::bitset<MAX_COMPONENT_IDS> components_;
+  mutable component_mask_t components_;
   std::array<component_handle_t, MAX_COMPONENT_IDS> component_indices_;
 
-  game_object_t *parent_ = nullptr;
-  list_t::const_iterator parent_iter_;
-  list_t children_;
+  // Node in the scene_graph_t holding the object hierarchy
+  uint32_t node_;
+  // Position in the object_query_t registry
+  uint32_t query_index_ = 0;
+  // Per component ID, the tick it last changed and its change_log_t entry
+  std::array<uint32_t, MAX_COMPONENT_IDS> changed_ticks_;
+  std::array<uint32_t, MAX_COMPONENT_IDS> change_entries_;
 };
 
 
@@ -118,24 +145,24 @@ const T *game_object_t::get_component() const
 /*!
   \brief Gets the first component of type T available in the game object's
   children.
+
+  Descendants are searched depth-first, each child before its own children
+  and those before the child's next sibling.
   \returns A pointer to a component in a child it succeeds, otherwise nullptr.
 */
 template <typename T>
 T *game_object_t::get_child_component()
 {
-  T *child_comp = nullptr;
-  for (game_object_t *child : children_) {
-    child_comp = child->get_component<T>();
-    if (!child_comp) {
-      child_comp = child->get_child_component<T>();
-      if (child_comp) {
-        break;
-      }
-    } else {
-      break;
+  const scene_graph_t &graph = scene_graph();
+  for (uint32_t node = graph.next_in_subtree(node_, node_);
+       node != scene_graph_t::NO_NODE;
+       node = graph.next_in_subtree(node, node_)) {
+    T *child_comp = graph.object(node)->get_component<T>();
+    if (child_comp) {
+      return child_comp;
     }
   }
-  return child_comp;
+  return nullptr;
 }
 
 
@@ -146,19 +173,16 @@ T *game_object_t::get_child_component()
 template <typename T>
 const T *game_object_t::get_child_component() const
 {
-  const T *child_comp = nullptr;
-  for (const game_object_t *child : children_) {
-    child_comp = child->get_component<T>();
-    if (!child_comp) {
-      child_comp = child->get_child_component<T>();
-      if (child_comp) {
-        break;
-      }
-    } else {
-      break;
+  const scene_graph_t &graph = scene_graph();
+  for (uint32_t node = graph.next_in_subtree(node_, node_);
+       node != scene_graph_t::NO_NODE;
+       node = graph.next_in_subtree(node, node_)) {
+    const T *child_comp = graph.object(node)->get_component<T>();
+    if (child_comp) {
+      return child_comp;
     }
   }
-  return child_comp;
+  return nullptr;
 }
 
 
@@ -175,7 +199,10 @@ void game_object_t::add_component()
 {
   assert(!components_[T::COMPONENT_ID]);
   component_indices_[T::COMPONENT_ID] = (new T(this))->handle();
+  const component_mask_t before = components_;
   components_[T::COMPONENT_ID] = true;
+  object_query_t::object_changed(this, before);
+  mark_changed(T::COMPONENT_ID);
 }
 
 
@@ -194,7 +221,10 @@ void game_object_t::remove_component()
   assert(T::COMPONENT_ID != TRANSFORM_COMPONENT);
   assert(components_[T::COMPONENT_ID]);
   delete T::data_for_index(component_indices_[T::COMPONENT_ID].local_index);
+  change_log().forget(this, T::COMPONENT_ID);
+  const component_mask_t before = components_;
   components_[T::COMPONENT_ID] = false;
+  object_query_t::object_changed(this, before);
 }
 
 
@@ -217,6 +247,67 @@ bool game_object_t::has_component() const
 }
 
 
+
+/*!
+  \brief Returns whether the component of type T changed after the given
+  change_log() tick.
+*/
+template <typename T>
+bool game_object_t::changed_since(uint32_t tick) const
+{
+  return changed_ticks_[T::COMPONENT_ID] > tick;
+}
+
+
+
+template <typename... T, typename FN>
+void object_query_t::each(FN &&fn)
+{
+  for (game_object_t *object : objects()) {
+    fn(*object, *object->get_component<T>()...);
+  }
+}
+
+
+
+/*
+  Walks the change journal of each listed component in turn. An object found
+  in a later journal is skipped if an earlier listed component also changed,
+  since it was visited for that one already.
+*/
+template <typename... T, typename FN>
+void object_query_t::each_changed(uint32_t since, FN &&fn)
+{
+  const unsigned ids[] = { T::COMPONENT_ID... };
+  const size_t id_count = sizeof...(T);
+  const auto changed_before = [&] (const game_object_t &object, size_t index) {
+    for (size_t prior = 0; prior < index; ++prior) {
+      if (object.changed_tick(ids[prior]) > since) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  if (!change_log().has_history_since(since)) {
+    for (game_object_t *object : objects()) {
+      if (changed_before(*object, id_count)) {
+        fn(*object, *object->get_component<T>()...);
+      }
+    }
+    return;
+  }
+
+  for (size_t index = 0; index < id_count; ++index) {
+    change_log().each_changed_since(ids[index], since, [&] (game_object_t *object) {
+      if (matches(object->components()) && !changed_before(*object, index)) {
+        fn(*object, *object->get_component<T>()...);
+      }
+    });
+  }
+}
+
+
 } // namespace snow
 
 
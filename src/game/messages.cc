@@ -0,0 +1,15 @@
+/*
+  messages.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "messages.hh"
+
+
+namespace snow {
+
+
+const quantization_t PLAYER_POSITION_QUANT(-16384.0f, 16384.0f, 1.0f / 128.0f);
+
+
+} // namespace snow
@@ -0,0 +1,131 @@
+/*
+  messages.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__MESSAGES_HH__
+#define __SNOW__MESSAGES_HH__
+
+#include "../config.hh"
+#include "../net/netcvars.hh"
+#include "../net/netmessage_registry.hh"
+#include "components/player_mover.hh"
+#include <snow/math/vec3.hh>
+#include <algorithm>
+
+
+namespace snow {
+
+
+const uint16_t WELCOME_MESSAGE = 1;
+const uint16_t PLAYER_CORRECTION_MESSAGE = 32;
+const uint16_t PLAYER_INPUT_MESSAGE = 33;
+
+
+// Player positions on the wire: 1/128 unit steps within 16384 units of the
+// origin, 23 bits per axis
+extern const quantization_t PLAYER_POSITION_QUANT;
+
+
+template <typename STREAM>
+void serialize_position(STREAM &stream, vec3f_t &position)
+{
+  stream.quantized(position.x, PLAYER_POSITION_QUANT);
+  stream.quantized(position.y, PLAYER_POSITION_QUANT);
+  stream.quantized(position.z, PLAYER_POSITION_QUANT);
+}
+
+
+/* Sent by the server to a client once it's connected. */
+struct welcome_msg_t
+{
+  template <typename STREAM>
+  void serialize(STREAM &stream)
+  {
+  }
+};
+
+
+/* Authoritative player position from the server as of the newest input tick
+   it has applied. */
+struct player_correction_msg_t
+{
+  uint32_t  tick;
+  vec3f_t   position;
+
+  template <typename STREAM>
+  void serialize(STREAM &stream)
+  {
+    stream.varint(tick);
+    serialize_position(stream, position);
+  }
+};
+
+
+/* Movement input from a client, sent every tick. Each message repeats the
+   last few inputs the server hasn't acknowledged, so a lost packet doesn't
+   lose input. */
+struct player_input_msg_t
+{
+  static const uint32_t MAX_INPUTS = 4;
+
+  // Tick of the newest input
+  uint32_t        tick;
+  // Number of inputs, in [1, MAX_INPUTS]
+  uint32_t        count;
+  // Inputs for ticks tick - count + 1 through tick, oldest first
+  player_input_t  inputs[MAX_INPUTS];
+  // Where the player started, sent until the server acknowledges a tick.
+  // The server has no level to spawn players from, so it starts each player
+  // here.
+  bool            has_origin;
+  vec3f_t         origin;
+
+  template <typename STREAM>
+  void serialize(STREAM &stream)
+  {
+    uint32_t extra = count - 1;
+    stream.varint(tick);
+    stream.bits(extra, 2);
+    count = extra + 1;
+    for (uint32_t index = 0; index < count; ++index) {
+      serialize_axis(stream, inputs[index].x);
+      serialize_axis(stream, inputs[index].y);
+    }
+    stream.flag(has_origin);
+    if (has_origin) {
+      serialize_position(stream, origin);
+    }
+  }
+
+private:
+  // -1, 0, or 1 as 0, 1, or 2. 3 is read as 1.
+  template <typename STREAM>
+  static void serialize_axis(STREAM &stream, int8_t &axis)
+  {
+    uint32_t bits = static_cast<uint32_t>(axis + 1);
+    stream.bits(bits, 2);
+    axis = static_cast<int8_t>(std::min<uint32_t>(bits, 2)) - 1;
+  }
+};
+
+
+/*==============================================================================
+
+  Messages exchanged by the client and server, other than bulk transfers
+  (which netbulk_t consumes itself). Handlers receive them through
+  game_messages_t::dispatch() and send them with game_messages_t::write(), so
+  every message is decoded and length-checked in one place.
+
+==============================================================================*/
+using game_messages_t = netmessage_registry_t<
+  netmessage_def_t<WELCOME_MESSAGE, welcome_msg_t, 0, 0>,
+  netmessage_def_t<NET_CVAR_DELTA, netcvar_delta_msg_t, 1>,
+  netmessage_def_t<PLAYER_CORRECTION_MESSAGE, player_correction_msg_t, 10, 14>,
+  netmessage_def_t<PLAYER_INPUT_MESSAGE, player_input_msg_t, 2, 16>
+  >;
+
+
+} // namespace snow
+
+#endif /* end __SNOW__MESSAGES_HH__ include guard */
@@ -0,0 +1,345 @@
+/*
+  object_commands.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "object_commands.hh"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <unordered_set>
+#include <utility>
+
+
+namespace snow {
+
+
+namespace {
+
+
+object_commands_t g_object_commands;
+// Buffer IDs start at 1, so a default ref never matches a buffer
+std::atomic<uint32_t> g_next_buffer_id { 1 };
+
+
+// Sort keys are pairs: kind, then component ID, then pool index; then
+// buffer, then recorded order
+const int KEY_KIND_SHIFT = 56;
+const int KEY_COMPONENT_SHIFT = 48;
+const int KEY_BUFFER_SHIFT = 32;
+const size_t MAX_BUFFERS = 0xFFFF;
+
+
+using sort_key_t = std::pair<uint64_t, uint64_t>;
+
+
+// Returns whether ancestor is object or one of its ancestors.
+bool is_ancestor(const game_object_t *ancestor, const game_object_t *object)
+{
+  for (; object; object = object->parent()) {
+    if (object == ancestor) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// Lets every owner release object, then has the first owner that claims it
+// destroy it. Objects no owner claims are deleted.
+void destroy_through(game_object_t *object, object_owner_t *const *owners, size_t count)
+{
+  for (size_t index = 0; index < count; ++index) {
+    owners[index]->release_object(object);
+  }
+  for (size_t index = 0; index < count; ++index) {
+    if (owners[index]->destroy_object(object)) {
+      return;
+    }
+  }
+  delete object;
+}
+
+
+} // namespace <anon>
+
+
+
+object_commands_t &object_commands()
+{
+  return g_object_commands;
+}
+
+
+
+const uint32_t object_command_buffer_t::NO_PENDING;
+
+
+
+object_command_buffer_t::object_command_buffer_t() :
+  id_(g_next_buffer_id.fetch_add(1, std::memory_order_relaxed))
+{
+  /* nop */
+}
+
+
+
+auto object_command_buffer_t::create() -> object_ref_t
+{
+  object_ref_t ref { nullptr };
+  ref.pending = pending_++;
+  ref.buffer = id_;
+  record(CREATE, 0, ref, nullptr, nullptr);
+  return ref;
+}
+
+
+
+void object_command_buffer_t::destroy(object_ref_t object)
+{
+  record(DESTROY, 0, object, nullptr, nullptr);
+}
+
+
+
+void object_command_buffer_t::set_parent(object_ref_t object, object_ref_t parent)
+{
+  record(SET_PARENT, 0, object, parent, nullptr);
+}
+
+
+
+size_t object_command_buffer_t::size() const
+{
+  return commands_.size();
+}
+
+
+
+bool object_command_buffer_t::empty() const
+{
+  return commands_.empty();
+}
+
+
+
+void object_command_buffer_t::clear()
+{
+  commands_.clear();
+  pending_ = 0;
+}
+
+
+
+game_object_t *object_command_buffer_t::resolve(object_ref_t ref) const
+{
+  if (ref.pending == NO_PENDING) {
+    return ref.object;
+  } else if (ref.buffer != id_ || ref.pending >= created_.size()) {
+    return nullptr;
+  }
+  return created_[ref.pending];
+}
+
+
+
+void object_command_buffer_t::check_ref(const object_ref_t &ref) const
+{
+  if (ref.pending == NO_PENDING) {
+    return;
+  } else if (ref.buffer != id_) {
+    s_throw(std::invalid_argument, "Object ref belongs to a different command buffer");
+  } else if (ref.pending >= pending_) {
+    s_throw(std::invalid_argument, "Object ref is from a batch already played back");
+  }
+}
+
+
+
+void object_command_buffer_t::record(command_kind_t kind, unsigned component,
+  object_ref_t target, object_ref_t parent, void (*apply)(game_object_t *))
+{
+  assert(target.object || target.pending != NO_PENDING);
+  assert(component < MAX_COMPONENT_IDS);
+  check_ref(target);
+  check_ref(parent);
+  commands_.push_back(command_t { kind, uint8_t(component), target, parent, apply });
+}
+
+
+
+/*==============================================================================
+  play_back(buffers, count, owners, owner_count)
+
+    Makes every buffer's objects first, since any other command may refer to
+    them. The rest are then sorted by key, the objects to destroy are
+    collected so commands on them can be skipped, and everything else is
+    applied in key order.
+==============================================================================*/
+void object_command_buffer_t::play_back(object_command_buffer_t *const *buffers, size_t count,
+  object_owner_t *const *owners, size_t owner_count)
+{
+  if (count > MAX_BUFFERS) {
+    s_throw(std::invalid_argument, "Too many command buffers to play back at once");
+  }
+
+  size_t total = 0;
+  for (size_t buffer = 0; buffer < count; ++buffer) {
+    object_command_buffer_t &from = *buffers[buffer];
+    from.created_.assign(from.pending_, nullptr);
+    for (const command_t &command : from.commands_) {
+      if (command.kind == CREATE) {
+        from.created_[command.target.pending] = new game_object_t;
+      }
+    }
+    total += from.commands_.size() - from.pending_;
+  }
+
+  std::vector<sort_key_t> order;
+  order.reserve(total);
+  for (size_t buffer = 0; buffer < count; ++buffer) {
+    const object_command_buffer_t &from = *buffers[buffer];
+    for (size_t index = 0; index < from.commands_.size(); ++index) {
+      const command_t &command = from.commands_[index];
+      if (command.kind == CREATE) {
+        continue;
+      }
+      // Removals walk the removed component's pool, the rest the transforms
+      const game_object_t *const object = from.resolve(command.target);
+      const unsigned pool =
+        command.kind == REMOVE_COMPONENT && object->components()[command.component]
+        ? command.component
+        : unsigned(TRANSFORM_COMPONENT);
+      order.emplace_back((uint64_t(command.kind) << KEY_KIND_SHIFT) |
+                         (uint64_t(command.component) << KEY_COMPONENT_SHIFT) |
+                         uint64_t(object->component_handle(pool).local_index),
+                         (uint64_t(buffer) << KEY_BUFFER_SHIFT) | uint64_t(index));
+    }
+  }
+  std::sort(order.begin(), order.end());
+
+  const auto buffer_for = [buffers] (const sort_key_t &key) -> const object_command_buffer_t & {
+    return *buffers[key.second >> KEY_BUFFER_SHIFT];
+  };
+  const auto command_for = [&buffer_for] (const sort_key_t &key) -> const command_t & {
+    return buffer_for(key).commands_[uint32_t(key.second)];
+  };
+
+  std::unordered_set<game_object_t *> doomed;
+  for (const sort_key_t &key : order) {
+    if (command_for(key).kind == DESTROY) {
+      doomed.insert(buffer_for(key).resolve(command_for(key).target));
+    }
+  }
+
+  for (const sort_key_t &key : order) {
+    const command_t &command = command_for(key);
+    game_object_t *const object = buffer_for(key).resolve(command.target);
+
+    switch (command.kind) {
+    case REMOVE_COMPONENT:
+      if (!doomed.count(object) && object->components()[command.component]) {
+        command.apply(object);
+      }
+      break;
+
+    case ADD_COMPONENT:
+      if (!doomed.count(object) && !object->components()[command.component]) {
+        command.apply(object);
+      }
+      break;
+
+    case SET_PARENT: {
+      game_object_t *const parent = buffer_for(key).resolve(command.parent);
+      if (doomed.count(object) || (parent && doomed.count(parent)) ||
+          object->parent() == parent) {
+        break;
+      } else if (parent && is_ancestor(object, parent)) {
+        s_log_warning("Skipping reparent that would make an object its own ancestor");
+        break;
+      }
+      if (object->parent()) {
+        object->remove_from_parent();
+      }
+      if (parent) {
+        parent->add_child(object);
+      }
+    } break;
+
+    case DESTROY:
+      // The same object may be destroyed by more than one command
+      if (doomed.erase(object)) {
+        destroy_through(object, owners, owner_count);
+      }
+      break;
+
+    default: break;
+    }
+  }
+
+  for (size_t buffer = 0; buffer < count; ++buffer) {
+    buffers[buffer]->clear();
+  }
+}
+
+
+
+void object_command_buffer_t::play_back(object_owner_t *const *owners, size_t owner_count)
+{
+  object_command_buffer_t *const self = this;
+  play_back(&self, 1, owners, owner_count);
+}
+
+
+
+object_command_buffer_t &object_commands_t::local()
+{
+  std::lock_guard<std::mutex> guard(lock_);
+  std::unique_ptr<object_command_buffer_t> &buffer = by_thread_[std::this_thread::get_id()];
+  if (!buffer) {
+    buffer.reset(new object_command_buffer_t);
+    buffers_.push_back(buffer.get());
+  }
+  return *buffer;
+}
+
+
+
+void object_commands_t::play_back()
+{
+  std::lock_guard<std::mutex> guard(lock_);
+  // Free the buffers of threads that recorded nothing since the last
+  // playback -- including any that have exited
+  buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(),
+    [] (const object_command_buffer_t *buffer) { return buffer->empty(); }),
+    buffers_.end());
+  for (auto iter = by_thread_.begin(); iter != by_thread_.end();) {
+    if (iter->second->empty()) {
+      iter = by_thread_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+  object_command_buffer_t::play_back(buffers_.data(), buffers_.size(), owners_.data(),
+    owners_.size());
+}
+
+
+
+void object_commands_t::add_owner(object_owner_t *owner)
+{
+  assert(owner);
+  if (std::find(owners_.begin(), owners_.end(), owner) == owners_.end()) {
+    owners_.push_back(owner);
+  }
+}
+
+
+
+void object_commands_t::remove_owner(object_owner_t *owner)
+{
+  owners_.erase(std::remove(owners_.begin(), owners_.end(), owner), owners_.end());
+}
+
+
+} // namespace snow
@@ -0,0 +1,220 @@
+/*
+  object_commands.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__OBJECT_COMMANDS_HH__
+#define __SNOW__OBJECT_COMMANDS_HH__
+
+#include "../config.hh"
+#include "gameobject.hh"
+#include "object_owner.hh"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+namespace snow {
+
+
+/*==============================================================================
+
+  Records structural changes to game objects -- creating and destroying
+  objects, adding and removing components, and reparenting -- so they can be
+  applied later, at a point where nothing is iterating component pools or
+  the scene graph. A buffer has a single writer and takes no locks; see
+  object_commands_t for a buffer per thread.
+
+  Commands may target existing objects or objects created earlier in the
+  same batch: create() returns an object_ref_t standing in for the object
+  until it's made, and resolve() gives the object once the batch has been
+  played back, until the next playback. A ref to a pending object carries
+  the ID of the buffer that made it, and is only valid in that buffer:
+  recording it in another throws std::invalid_argument, and resolving it
+  through another gives null.
+
+==============================================================================*/
+struct S_EXPORT object_command_buffer_t
+{
+  static const uint32_t NO_PENDING = UINT32_MAX;
+
+  // Either an existing object or one this buffer will create.
+  struct object_ref_t
+  {
+    object_ref_t(game_object_t *existing) :
+      object(existing), pending(NO_PENDING), buffer(0) {}
+
+    game_object_t * object;
+    uint32_t        pending;
+    // ID of the buffer that created the pending object
+    uint32_t        buffer;
+  };
+
+  object_command_buffer_t();
+  ~object_command_buffer_t() = default;
+
+  object_command_buffer_t(const object_command_buffer_t &) = delete;
+  object_command_buffer_t &operator = (const object_command_buffer_t &) = delete;
+
+  object_ref_t    create();
+  void            destroy(object_ref_t object);
+  template <typename T>
+  void            add_component(object_ref_t object);
+  template <typename T>
+  void            remove_component(object_ref_t object);
+  // Makes object a child of parent, or detaches it if parent is null.
+  void            set_parent(object_ref_t object, object_ref_t parent);
+
+  size_t          size() const;
+  bool            empty() const;
+  // Drops recorded commands without applying them.
+  void            clear();
+
+  // The object a ref stands for, once played back.
+  game_object_t * resolve(object_ref_t ref) const;
+
+  /*
+    Applies the commands in count buffers as one batch and clears them.
+    Commands aren't applied in the order they were recorded but by kind, in
+    this order:
+
+      1. creations
+      2. component removals, grouped by component type
+      3. component additions, grouped by component type
+      4. reparenting
+      5. destruction
+
+    Within a kind (and component type), commands are applied in order of
+    their object's position in the component pool involved -- the
+    component's own pool for removals, the transform pool otherwise -- so
+    each pool is walked front to back in one run. Ties keep the order they
+    were recorded in, buffer by buffer. Commands that no longer apply are
+    skipped: adding a component the object has, removing one it lacks, or
+    anything touching an object destroyed in the same batch other than
+    destroying it.
+
+    Objects are destroyed through the owners given: see object_owner_t.
+  */
+  static void     play_back(object_command_buffer_t *const *buffers, size_t count,
+                            object_owner_t *const *owners = nullptr, size_t owner_count = 0);
+  void            play_back(object_owner_t *const *owners = nullptr, size_t owner_count = 0);
+
+private:
+  enum command_kind_t : uint8_t
+  {
+    CREATE,
+    REMOVE_COMPONENT,
+    ADD_COMPONENT,
+    SET_PARENT,
+    DESTROY
+  };
+
+  struct command_t
+  {
+    command_kind_t  kind;
+    uint8_t         component;
+    object_ref_t    target;
+    object_ref_t    parent;
+    void          (*apply)(game_object_t *);
+  };
+
+  template <typename T>
+  static void     add_component_thunk(game_object_t *object);
+  template <typename T>
+  static void     remove_component_thunk(game_object_t *object);
+
+  void            check_ref(const object_ref_t &ref) const;
+  void            record(command_kind_t kind, unsigned component, object_ref_t target,
+                         object_ref_t parent, void (*apply)(game_object_t *));
+
+  const uint32_t                id_;
+  std::vector<command_t>        commands_;
+  uint32_t                      pending_ = 0;
+  std::vector<game_object_t *>  created_;
+};
+
+
+
+/*==============================================================================
+
+  A set of command buffers, one per thread that records into it. Systems
+  running on any thread fetch their thread's buffer with local() -- once per
+  update, since it takes a lock -- and record into it freely. play_back() is
+  then called from one thread at a sync point, when no thread is recording,
+  and applies every buffer as a single batch, destroying objects through the
+  owners added with add_owner().
+
+  A buffer is only valid until the next play_back(), which frees the buffers
+  of threads that recorded nothing since the last one, so threads that have
+  finished don't leave theirs behind.
+
+==============================================================================*/
+struct S_EXPORT object_commands_t
+{
+  object_commands_t() = default;
+  ~object_commands_t() = default;
+
+  object_commands_t(const object_commands_t &) = delete;
+  object_commands_t &operator = (const object_commands_t &) = delete;
+
+  object_command_buffer_t &local();
+  void            play_back();
+
+  // Owners are offered objects in the order they were added. Not locked, so
+  // only change them while no thread is recording.
+  void            add_owner(object_owner_t *owner);
+  void            remove_owner(object_owner_t *owner);
+
+private:
+  std::mutex    lock_;
+  std::unordered_map<std::thread::id, std::unique_ptr<object_command_buffer_t>> by_thread_;
+  // Buffers in the order their threads first asked for them
+  std::vector<object_command_buffer_t *> buffers_;
+  std::vector<object_owner_t *> owners_;
+};
+
+
+// Commands played back by the client after each frame's logic systems run.
+S_EXPORT object_commands_t &object_commands();
+
+
+
+template <typename T>
+void object_command_buffer_t::add_component(object_ref_t object)
+{
+  record(ADD_COMPONENT, T::COMPONENT_ID, object, nullptr, &add_component_thunk<T>);
+}
+
+
+
+template <typename T>
+void object_command_buffer_t::remove_component(object_ref_t object)
+{
+  static_assert(T::COMPONENT_ID != TRANSFORM_COMPONENT,
+    "Transforms may not be removed from game objects");
+  record(REMOVE_COMPONENT, T::COMPONENT_ID, object, nullptr, &remove_component_thunk<T>);
+}
+
+
+
+template <typename T>
+void object_command_buffer_t::add_component_thunk(game_object_t *object)
+{
+  object->add_component<T>();
+}
+
+
+
+template <typename T>
+void object_command_buffer_t::remove_component_thunk(game_object_t *object)
+{
+  object->remove_component<T>();
+}
+
+
+} // namespace snow
+
+#endif /* end __SNOW__OBJECT_COMMANDS_HH__ include guard */
@@ -0,0 +1,31 @@
+/*
+  object_owner.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "object_owner.hh"
+
+namespace snow {
+
+
+object_owner_t::~object_owner_t()
+{
+  /* nop */
+}
+
+
+
+void object_owner_t::release_object(game_object_t *object)
+{
+  /* nop */
+}
+
+
+
+bool object_owner_t::destroy_object(game_object_t *object)
+{
+  return false;
+}
+
+
+} // namespace snow
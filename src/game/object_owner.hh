@@ -0,0 +1,56 @@
+/*
+  object_owner.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__OBJECT_OWNER_HH__
+#define __SNOW__OBJECT_OWNER_HH__
+
+#include "../config.hh"
+
+
+namespace snow {
+
+
+struct game_object_t;
+
+
+/*==============================================================================
+
+  Something that owns game objects or keeps pointers to them, and so has to
+  take part when an object is destroyed from outside it -- e.g. by an object
+  command. Before an object is destroyed, every owner it's offered to gets
+  release_object() and drops its pointers to it. Then each owner in turn
+  gets destroy_object() until one of them claims and deletes it; if none
+  does, the object is deleted as is.
+
+==============================================================================*/
+struct S_EXPORT object_owner_t
+{
+  virtual ~object_owner_t() = 0;
+
+  /*============================================================================
+    release_object(object)
+
+      Drops any pointers to object, which is about to be destroyed. The
+      object is still intact, but mustn't be deleted here.
+
+      Default implementation does nothing.
+  ============================================================================*/
+  virtual void release_object(game_object_t *object);
+
+  /*============================================================================
+    destroy_object(object)
+
+      Deletes object and returns true if it belongs to this owner, otherwise
+      returns false and leaves it alone.
+
+      Default implementation returns false.
+  ============================================================================*/
+  virtual bool destroy_object(game_object_t *object);
+};
+
+
+} // namespace snow
+
+#endif /* end __SNOW__OBJECT_OWNER_HH__ include guard */
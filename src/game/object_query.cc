@@ -0,0 +1,194 @@
+/*
+  object_query.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "object_query.hh"
+#include <algorithm>
+
+
+namespace snow {
+
+
+namespace {
+
+
+// Live game objects and their masks, stored densely so rebuilding a query is
+// a linear scan over the masks. An object's position is its query_index_.
+std::vector<game_object_t *>    g_objects;
+std::vector<component_mask_t>   g_masks;
+std::vector<object_query_t *>   g_queries;
+
+
+} // namespace <anon>
+
+
+
+const uint32_t object_query_t::NO_POSITION;
+
+
+
+object_query_t::object_query_t(const component_mask_t &required,
+  const component_mask_t &excluded) :
+  required_(required),
+  excluded_(excluded)
+{
+  g_queries.push_back(this);
+}
+
+
+
+object_query_t::~object_query_t()
+{
+  g_queries.erase(std::find(g_queries.begin(), g_queries.end(), this));
+}
+
+
+
+bool object_query_t::matches(const component_mask_t &mask) const
+{
+  return (mask & required_) == required_ && (mask & excluded_).none();
+}
+
+
+
+auto object_query_t::objects() -> const object_list_t &
+{
+  if (stale_) {
+    rebuild();
+  }
+  return objects_;
+}
+
+
+
+auto object_query_t::begin() -> object_list_t::const_iterator
+{
+  return objects().cbegin();
+}
+
+
+
+auto object_query_t::end() -> object_list_t::const_iterator
+{
+  return objects().cend();
+}
+
+
+
+size_t object_query_t::size()
+{
+  return objects().size();
+}
+
+
+
+bool object_query_t::empty()
+{
+  return objects().empty();
+}
+
+
+
+void object_query_t::object_added(game_object_t *object)
+{
+  object->query_index_ = static_cast<uint32_t>(g_objects.size());
+  g_objects.push_back(object);
+  g_masks.push_back(object->components_);
+  for (object_query_t *query : g_queries) {
+    if (query->stale_) {
+      continue;
+    }
+    query->positions_.push_back(NO_POSITION);
+    if (query->matches(object->components_)) {
+      query->append(object);
+    }
+  }
+}
+
+
+
+void object_query_t::object_removed(game_object_t *object)
+{
+  const uint32_t index = object->query_index_;
+  const uint32_t last_index = static_cast<uint32_t>(g_objects.size() - 1);
+  for (object_query_t *query : g_queries) {
+    if (query->stale_) {
+      continue;
+    }
+    if (query->positions_[index] != NO_POSITION) {
+      query->remove(object);
+    }
+    // Follow the registry's swap below
+    query->positions_[index] = query->positions_[last_index];
+    query->positions_.pop_back();
+  }
+
+  // Swap the last object into the removed object's place
+  game_object_t *last = g_objects.back();
+  g_objects[index] = last;
+  g_masks[index] = g_masks.back();
+  last->query_index_ = index;
+  g_objects.pop_back();
+  g_masks.pop_back();
+}
+
+
+
+void object_query_t::object_changed(game_object_t *object, const component_mask_t &before)
+{
+  const component_mask_t &after = object->components_;
+  g_masks[object->query_index_] = after;
+  for (object_query_t *query : g_queries) {
+    if (query->stale_) {
+      continue;
+    }
+    const bool matched = query->matches(before);
+    if (matched == query->matches(after)) {
+      continue;
+    } else if (matched) {
+      query->remove(object);
+    } else {
+      query->append(object);
+    }
+  }
+}
+
+
+
+void object_query_t::rebuild()
+{
+  objects_.clear();
+  const size_t count = g_masks.size();
+  positions_.assign(count, NO_POSITION);
+  for (size_t index = 0; index < count; ++index) {
+    if (matches(g_masks[index])) {
+      append(g_objects[index]);
+    }
+  }
+  stale_ = false;
+}
+
+
+
+void object_query_t::append(game_object_t *object)
+{
+  positions_[object->query_index_] = static_cast<uint32_t>(objects_.size());
+  objects_.push_back(object);
+}
+
+
+
+// Swaps the last matching object into the removed object's place.
+void object_query_t::remove(game_object_t *object)
+{
+  const uint32_t position = positions_[object->query_index_];
+  game_object_t *last = objects_.back();
+  objects_[position] = last;
+  positions_[last->query_index_] = position;
+  positions_[object->query_index_] = NO_POSITION;
+  objects_.pop_back();
+}
+
+
+} // namespace snow
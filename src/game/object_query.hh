@@ -0,0 +1,112 @@
+/*
+  object_query.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__OBJECT_QUERY_HH__
+#define __SNOW__OBJECT_QUERY_HH__
+
+#include "../config.hh"
+#include "components/component_id.hh"
+#include <cstdint>
+#include <vector>
+
+
+namespace snow {
+
+
+struct game_object_t;
+
+
+/*==============================================================================
+
+  A view of every game object whose components include all of a required set
+  and none of an excluded set, e.g. all objects with a transform and a light
+  but no projectile:
+
+    object_query_t lights {
+      component_mask({ TRANSFORM_COMPONENT, LIGHT_COMPONENT }),
+      component_mask({ PROJECTILE_COMPONENT })
+    };
+
+    lights.each<transform_t, point_light_t>(
+      [] (game_object_t &obj, transform_t &tform, point_light_t &light) {
+        ...
+      });
+
+  Live game objects and their component masks are kept in a flat registry.
+  Each query keeps its list of matching objects, along with each registry
+  entry's position in that list. When an object is created, destroyed, or
+  gains or loses a component, each query whose result the change affects
+  appends the object or swap-removes it, so keeping queries current costs a
+  constant amount per change rather than a scan of the registry. A query
+  builds its list from the registry once, the first time it's read.
+  Iterating a query only touches matching objects.
+
+  Lists change as soon as objects do, so don't create or destroy objects, or
+  add or remove components, while iterating a query. Record such changes
+  with object_commands() and play them back afterward. Not thread safe.
+
+==============================================================================*/
+struct S_EXPORT object_query_t
+{
+  using object_list_t = std::vector<game_object_t *>;
+
+  explicit object_query_t(const component_mask_t &required,
+    const component_mask_t &excluded = component_mask_t());
+  ~object_query_t();
+
+  object_query_t(const object_query_t &) = delete;
+  object_query_t &operator = (const object_query_t &) = delete;
+
+  bool                  matches(const component_mask_t &mask) const;
+
+  // Matching objects, in no particular order.
+  const object_list_t & objects();
+  object_list_t::const_iterator begin();
+  object_list_t::const_iterator end();
+  size_t                size();
+  bool                  empty();
+
+  // Calls fn(game_object_t &, T &...) for each matching object with the
+  // given components, which should all be among the required components.
+  template <typename... T, typename FN>
+  void                  each(FN &&fn);
+  // Like each(), but only for objects where at least one of the given
+  // components changed after change_log() tick since. Takes time in
+  // proportion to the number of changes rather than the number of matching
+  // objects, unless since is older than the change log's history.
+  template <typename... T, typename FN>
+  void                  each_changed(uint32_t since, FN &&fn);
+
+  // Called by game_object_t to keep the registry and queries current.
+  static void           object_added(game_object_t *object);
+  static void           object_removed(game_object_t *object);
+  static void           object_changed(game_object_t *object, const component_mask_t &before);
+
+private:
+  static const uint32_t NO_POSITION = UINT32_MAX;
+
+  void                  rebuild();
+  void                  append(game_object_t *object);
+  void                  remove(game_object_t *object);
+
+  component_mask_t      required_;
+  component_mask_t      excluded_;
+  // Whether the list has yet to be built from the registry
+  bool                  stale_ = true;
+  object_list_t         objects_;
+  // Position in objects_ of each registry entry, or NO_POSITION if it
+  // doesn't match, indexed by query_index_
+  std::vector<uint32_t> positions_;
+};
+
+
+} // namespace snow
+
+
+// object_query_t::each and each_changed are defined in gameobject.hh, once game_object_t is
+// complete
+#include "gameobject.hh"
+
+#endif /* end __SNOW__OBJECT_QUERY_HH__ include guard */
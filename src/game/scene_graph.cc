@@ -0,0 +1,201 @@
+/*
+  scene_graph.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "scene_graph.hh"
+#include "components/transform_store.hh"
+
+
+namespace snow {
+
+
+namespace {
+
+
+scene_graph_t g_scene_graph;
+
+
+} // namespace <anon>
+
+
+
+scene_graph_t &scene_graph()
+{
+  return g_scene_graph;
+}
+
+
+
+const uint32_t scene_graph_t::NO_NODE;
+
+
+
+uint32_t scene_graph_t::allocate(game_object_t *object)
+{
+  const node_t root = {
+    object, transform_store_t::NO_SLOT, NO_NODE, NO_NODE, NO_NODE, NO_NODE, NO_NODE
+  };
+  uint32_t node;
+  if (!free_.empty()) {
+    node = free_.back();
+    free_.pop_back();
+    nodes_[node] = root;
+  } else {
+    node = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(root);
+  }
+  order_changed_ = true;
+  return node;
+}
+
+
+
+void scene_graph_t::release(uint32_t node)
+{
+  unlink(node);
+  // Orphaned children become roots
+  uint32_t child = nodes_[node].first_child;
+  while (child != NO_NODE) {
+    node_t &child_node = nodes_[child];
+    const uint32_t next = child_node.next_sibling;
+    child_node.parent = NO_NODE;
+    child_node.prev_sibling = NO_NODE;
+    child_node.next_sibling = NO_NODE;
+    child = next;
+  }
+  nodes_[node] = {
+    nullptr, transform_store_t::NO_SLOT, NO_NODE, NO_NODE, NO_NODE, NO_NODE, NO_NODE
+  };
+  free_.push_back(node);
+  order_changed_ = true;
+}
+
+
+
+void scene_graph_t::set_parent(uint32_t node, uint32_t parent)
+{
+  if (node >= nodes_.size() || (parent != NO_NODE && parent >= nodes_.size())) {
+    s_throw(std::out_of_range, "Scene graph node is out of range");
+  }
+  assert(parent == NO_NODE || !is_ancestor(node, parent));
+
+  unlink(node);
+  if (parent == NO_NODE) {
+    return;
+  }
+
+  node_t &child_node = nodes_[node];
+  node_t &parent_node = nodes_[parent];
+  child_node.parent = parent;
+  child_node.prev_sibling = parent_node.last_child;
+  if (parent_node.last_child != NO_NODE) {
+    nodes_[parent_node.last_child].next_sibling = node;
+  } else {
+    parent_node.first_child = node;
+  }
+  parent_node.last_child = node;
+  order_changed_ = true;
+}
+
+
+
+bool scene_graph_t::is_ancestor(uint32_t ancestor, uint32_t node) const
+{
+  for (; node != NO_NODE; node = nodes_[node].parent) {
+    if (node == ancestor) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+
+void scene_graph_t::set_slot(uint32_t node, uint32_t slot)
+{
+  nodes_[node].slot = slot;
+}
+
+
+
+/*==============================================================================
+  depth_order()
+
+    Returns every live object sorted by depth in the hierarchy, parents always
+    before their children. Useful for passes that need a parent's results
+    before visiting its children.
+==============================================================================*/
+auto scene_graph_t::depth_order() -> const std::vector<game_object_t *> &
+{
+  if (order_changed_) {
+    build_order();
+  }
+  return order_;
+}
+
+
+
+auto scene_graph_t::node_order() -> const std::vector<uint32_t> &
+{
+  if (order_changed_) {
+    build_order();
+  }
+  return node_order_;
+}
+
+
+
+void scene_graph_t::unlink(uint32_t node)
+{
+  node_t &child_node = nodes_[node];
+  const uint32_t parent = child_node.parent;
+  if (parent == NO_NODE) {
+    return;
+  }
+
+  node_t &parent_node = nodes_[parent];
+  if (child_node.prev_sibling != NO_NODE) {
+    nodes_[child_node.prev_sibling].next_sibling = child_node.next_sibling;
+  } else {
+    parent_node.first_child = child_node.next_sibling;
+  }
+  if (child_node.next_sibling != NO_NODE) {
+    nodes_[child_node.next_sibling].prev_sibling = child_node.prev_sibling;
+  } else {
+    parent_node.last_child = child_node.prev_sibling;
+  }
+  child_node.parent = NO_NODE;
+  child_node.prev_sibling = NO_NODE;
+  child_node.next_sibling = NO_NODE;
+  order_changed_ = true;
+}
+
+
+
+void scene_graph_t::build_order()
+{
+  // Breadth-first from every root, using node_order_ as the frontier
+  node_order_.clear();
+  for (uint32_t node = 0; node < nodes_.size(); ++node) {
+    if (nodes_[node].object != nullptr && nodes_[node].parent == NO_NODE) {
+      node_order_.push_back(node);
+    }
+  }
+  for (size_t head = 0; head < node_order_.size(); ++head) {
+    for (uint32_t child = nodes_[node_order_[head]].first_child; child != NO_NODE;
+         child = nodes_[child].next_sibling) {
+      node_order_.push_back(child);
+    }
+  }
+
+  order_.clear();
+  order_.reserve(node_order_.size());
+  for (const uint32_t node : node_order_) {
+    order_.push_back(nodes_[node].object);
+  }
+  order_changed_ = false;
+}
+
+
+} // namespace snow
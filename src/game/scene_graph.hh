@@ -0,0 +1,213 @@
+/*
+  scene_graph.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__SCENE_GRAPH_HH__
+#define __SNOW__SCENE_GRAPH_HH__
+
+#include "../config.hh"
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+
+namespace snow {
+
+
+struct game_object_t;
+
+
+/*==============================================================================
+
+  Flat storage for the game object hierarchy. Every game object owns a node,
+  and nodes live in one contiguous array linked by index: each node knows its
+  parent, its first and last child, and its previous and next sibling.
+  Attaching or detaching a node only relinks its neighbours, so reparenting
+  is O(1) no matter how large the subtree being moved is.
+
+  Walks over the hierarchy (see next_in_subtree() and depth_order()) are
+  iterative and read only the node array, so they neither recurse nor chase
+  heap-allocated list nodes.
+
+  The graph is the only record of the hierarchy. Each node also holds its
+  object's transform_store_t slot, and transform_store_t::update_world()
+  propagates world matrices in node_order(), reading parents from here.
+
+  Node indices are reused once released, and the array grows as needed, so
+  refer to nodes by index rather than by pointer. Not thread safe.
+
+==============================================================================*/
+struct S_EXPORT scene_graph_t
+{
+  static const uint32_t NO_NODE = UINT32_MAX;
+
+  struct child_iterator_t;
+  struct child_range_t;
+
+  scene_graph_t() = default;
+  ~scene_graph_t() = default;
+
+  scene_graph_t(const scene_graph_t &) = delete;
+  scene_graph_t &operator = (const scene_graph_t &) = delete;
+
+  // Returns a new root node for the object.
+  uint32_t        allocate(game_object_t *object);
+  // Detaches the node from its parent and makes its children roots.
+  void            release(uint32_t node);
+
+  // Appends the node to parent's children, or detaches it if parent is
+  // NO_NODE. Making a node its own ancestor is a programming error: it
+  // asserts in debug builds, while release builds only relink, keeping this
+  // O(1). Callers that can't rule it out should check is_ancestor() first.
+  void            set_parent(uint32_t node, uint32_t parent);
+  // Whether ancestor is node or one of its ancestors. O(depth).
+  bool            is_ancestor(uint32_t ancestor, uint32_t node) const;
+
+  // Sets the transform_store_t slot of the node's object, or NO_SLOT.
+  void            set_slot(uint32_t node, uint32_t slot);
+
+  game_object_t * object(uint32_t node) const;
+  uint32_t        slot(uint32_t node) const;
+  uint32_t        parent(uint32_t node) const;
+  uint32_t        first_child(uint32_t node) const;
+  uint32_t        next_sibling(uint32_t node) const;
+  child_range_t   children(uint32_t node) const;
+
+  // Returns the node after node in a pre-order walk of root's subtree, or
+  // NO_NODE when the walk is done. Start the walk from root itself.
+  uint32_t        next_in_subtree(uint32_t node, uint32_t root) const;
+
+  // Every object, roots first, then their children, then grandchildren, and
+  // so on. Rebuilt only when the hierarchy has changed since the last call.
+  const std::vector<game_object_t *> &depth_order();
+  // The nodes of depth_order()'s objects, in the same order.
+  const std::vector<uint32_t> &node_order();
+
+private:
+  struct node_t
+  {
+    game_object_t * object;
+    uint32_t        slot;
+    uint32_t        parent;
+    uint32_t        first_child;
+    uint32_t        last_child;
+    uint32_t        prev_sibling;
+    uint32_t        next_sibling;
+  };
+
+  void            unlink(uint32_t node);
+  void            build_order();
+
+  std::vector<node_t>         nodes_;
+  std::vector<uint32_t>       free_;
+  std::vector<game_object_t *> order_;
+  std::vector<uint32_t>       node_order_;
+  bool                        order_changed_ = false;
+};
+
+
+// Graph shared by all game objects.
+S_EXPORT scene_graph_t &scene_graph();
+
+
+
+// Iterates over a node's children in the order they were added.
+struct scene_graph_t::child_iterator_t :
+  public std::iterator<std::forward_iterator_tag, game_object_t *>
+{
+  child_iterator_t(const scene_graph_t *graph, uint32_t node) :
+    graph_(graph), node_(node) { }
+
+  game_object_t *operator * () const { return graph_->object(node_); }
+  child_iterator_t &operator ++ () { node_ = graph_->next_sibling(node_); return *this; }
+  child_iterator_t operator ++ (int) { child_iterator_t prev = *this; ++*this; return prev; }
+  bool operator == (const child_iterator_t &other) const { return node_ == other.node_; }
+  bool operator != (const child_iterator_t &other) const { return node_ != other.node_; }
+
+private:
+  const scene_graph_t * graph_;
+  uint32_t              node_;
+};
+
+
+
+struct scene_graph_t::child_range_t
+{
+  child_range_t(const scene_graph_t *graph, uint32_t node) :
+    graph_(graph), node_(node) { }
+
+  child_iterator_t begin() const { return child_iterator_t(graph_, graph_->first_child(node_)); }
+  child_iterator_t end() const { return child_iterator_t(graph_, NO_NODE); }
+  bool empty() const { return graph_->first_child(node_) == NO_NODE; }
+
+private:
+  const scene_graph_t * graph_;
+  uint32_t              node_;
+};
+
+
+
+inline game_object_t *scene_graph_t::object(uint32_t node) const
+{
+  return nodes_[node].object;
+}
+
+
+
+inline uint32_t scene_graph_t::slot(uint32_t node) const
+{
+  return nodes_[node].slot;
+}
+
+
+
+inline uint32_t scene_graph_t::parent(uint32_t node) const
+{
+  return nodes_[node].parent;
+}
+
+
+
+inline uint32_t scene_graph_t::first_child(uint32_t node) const
+{
+  return nodes_[node].first_child;
+}
+
+
+
+inline uint32_t scene_graph_t::next_sibling(uint32_t node) const
+{
+  return nodes_[node].next_sibling;
+}
+
+
+
+inline auto scene_graph_t::children(uint32_t node) const -> child_range_t
+{
+  return child_range_t(this, node);
+}
+
+
+
+inline uint32_t scene_graph_t::next_in_subtree(uint32_t node, uint32_t root) const
+{
+  const node_t *current = &nodes_[node];
+  if (current->first_child != NO_NODE) {
+    return current->first_child;
+  }
+  // Climb until a node with an unvisited sibling, never leaving root
+  while (node != root) {
+    if (current->next_sibling != NO_NODE) {
+      return current->next_sibling;
+    }
+    node = current->parent;
+    current = &nodes_[node];
+  }
+  return NO_NODE;
+}
+
+
+} // namespace snow
+
+#endif /* end __SNOW__SCENE_GRAPH_HH__ include guard */
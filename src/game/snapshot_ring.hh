@@ -0,0 +1,155 @@
+/*
+  snapshot_ring.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__SNAPSHOT_RING_HH__
+#define __SNOW__SNAPSHOT_RING_HH__
+
+#include "../config.hh"
+#include <cstdint>
+
+
+namespace snow {
+
+
+/*==============================================================================
+
+  Fixed-size history of predicted simulation ticks. Each entry holds the input
+  applied on a tick and the state that resulted, so when the server corrects
+  an old tick, the prediction can be rebuilt by restoring the corrected state
+  and re-running the inputs since (see replay()).
+
+  Only the last SIZE ticks are kept. Entries live in a flat array indexed by
+  tick, so recording and looking up a tick never allocates or searches, and
+  replaying N ticks touches N consecutive entries. SIZE must be a power of
+  two.
+
+  STATE and INPUT should be small, trivially copyable types -- the ring copies
+  them by value.
+
+==============================================================================*/
+template <typename STATE, typename INPUT, size_t SIZE = 32>
+struct snapshot_ring_t
+{
+  static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "Ring size must be a power of two");
+
+  struct snapshot_t
+  {
+    uint32_t  tick;
+    INPUT     input;
+    // State after input was applied
+    STATE     state;
+  };
+
+  // Records the input and resulting state for a tick. Ticks must be recorded
+  // in order.
+  void record(uint32_t tick, const INPUT &input, const STATE &state);
+
+  // Returns the snapshot for a tick, or NULL if it's not in the ring.
+  const snapshot_t *find(uint32_t tick) const;
+
+  /*
+    Replaces the state at tick with corrected and re-applies every input
+    recorded after it, calling step(STATE &, const INPUT &) once per tick and
+    rewriting each snapshot's state. Returns the state at the latest tick.
+    tick must be in the ring.
+  */
+  template <typename FN>
+  STATE replay(uint32_t tick, const STATE &corrected, FN &&step);
+
+  bool empty() const;
+  uint32_t latest_tick() const;
+  void clear();
+
+private:
+  static const uint32_t MASK = static_cast<uint32_t>(SIZE - 1);
+
+  snapshot_t  entries_[SIZE];
+  uint32_t    latest_ = 0;
+  // Number of valid entries, at most SIZE
+  uint32_t    count_ = 0;
+};
+
+
+
+template <typename STATE, typename INPUT, size_t SIZE>
+void snapshot_ring_t<STATE, INPUT, SIZE>::record(uint32_t tick, const INPUT &input,
+  const STATE &state)
+{
+  if (count_ > 0 && tick != latest_ + 1) {
+    // A gap or a repeated tick invalidates everything before it
+    count_ = 0;
+  }
+  snapshot_t &entry = entries_[tick & MASK];
+  entry.tick = tick;
+  entry.input = input;
+  entry.state = state;
+  latest_ = tick;
+  if (count_ < SIZE) {
+    ++count_;
+  }
+}
+
+
+
+template <typename STATE, typename INPUT, size_t SIZE>
+auto snapshot_ring_t<STATE, INPUT, SIZE>::find(uint32_t tick) const -> const snapshot_t *
+{
+  // Unsigned distance back from the latest tick, so ticks in the future wrap
+  // around to large distances
+  if (count_ == 0 || latest_ - tick >= count_) {
+    return NULL;
+  }
+  return &entries_[tick & MASK];
+}
+
+
+
+template <typename STATE, typename INPUT, size_t SIZE>
+template <typename FN>
+STATE snapshot_ring_t<STATE, INPUT, SIZE>::replay(uint32_t tick, const STATE &corrected,
+  FN &&step)
+{
+  if (find(tick) == NULL) {
+    s_throw(std::out_of_range, "Tick is not in the snapshot ring");
+  }
+
+  STATE state = corrected;
+  entries_[tick & MASK].state = state;
+  for (uint32_t next = tick + 1; next - tick <= latest_ - tick; ++next) {
+    snapshot_t &entry = entries_[next & MASK];
+    step(state, static_cast<const INPUT &>(entry.input));
+    entry.state = state;
+  }
+  return state;
+}
+
+
+
+template <typename STATE, typename INPUT, size_t SIZE>
+bool snapshot_ring_t<STATE, INPUT, SIZE>::empty() const
+{
+  return count_ == 0;
+}
+
+
+
+template <typename STATE, typename INPUT, size_t SIZE>
+uint32_t snapshot_ring_t<STATE, INPUT, SIZE>::latest_tick() const
+{
+  return latest_;
+}
+
+
+
+template <typename STATE, typename INPUT, size_t SIZE>
+void snapshot_ring_t<STATE, INPUT, SIZE>::clear()
+{
+  count_ = 0;
+}
+
+
+} // namespace snow
+
+#endif /* end __SNOW__SNAPSHOT_RING_HH__ include guard */
@@ -0,0 +1,521 @@
+/*
+  spatial_index.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "spatial_index.hh"
+#include "change_log.hh"
+#include "gameobject.hh"
+#include "scene_graph.hh"
+#include "components/transform.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+
+namespace snow {
+
+
+namespace {
+
+
+const uint32_t NO_ENTRY = UINT32_MAX;
+// Cell coordinates are packed into 21 bits each
+const int32_t MAX_CELL_COORD = (1 << 20) - 1;
+const int32_t MIN_CELL_COORD = -(1 << 20);
+
+
+using candidate_t = std::pair<float, uint32_t>;
+
+
+
+int32_t cell_coord(float value, float inv_cell_size)
+{
+  const float cell = std::floor(value * inv_cell_size);
+  if (!(cell >= MIN_CELL_COORD)) {
+    return MIN_CELL_COORD;
+  } else if (cell > MAX_CELL_COORD) {
+    return MAX_CELL_COORD;
+  }
+  return static_cast<int32_t>(cell);
+}
+
+
+
+uint64_t cell_key(int32_t x, int32_t y, int32_t z)
+{
+  return (uint64_t(uint32_t(x) & 0x1FFFFF) << 42) |
+         (uint64_t(uint32_t(y) & 0x1FFFFF) << 21) |
+         uint64_t(uint32_t(z) & 0x1FFFFF);
+}
+
+
+
+float distance_sq(float x, float y, float z, const vec3f_t &p)
+{
+  const float dx = x - p.x;
+  const float dy = y - p.y;
+  const float dz = z - p.z;
+  return dx * dx + dy * dy + dz * dz;
+}
+
+
+
+// Keeps the count nearest candidates in a max-heap, farthest at the front.
+void push_candidate(std::vector<candidate_t> &heap, size_t count, const candidate_t &candidate)
+{
+  if (heap.size() < count) {
+    heap.push_back(candidate);
+    std::push_heap(heap.begin(), heap.end());
+  } else if (candidate.first < heap.front().first) {
+    std::pop_heap(heap.begin(), heap.end());
+    heap.back() = candidate;
+    std::push_heap(heap.begin(), heap.end());
+  }
+}
+
+
+
+uint64_t box_volume(int32_t lx, int32_t ly, int32_t lz, int32_t hx, int32_t hy, int32_t hz)
+{
+  if (hx < lx || hy < ly || hz < lz) {
+    return 0;
+  }
+  return uint64_t(hx - lx + 1) * uint64_t(hy - ly + 1) * uint64_t(hz - lz + 1);
+}
+
+
+} // namespace <anon>
+
+
+
+spatial_index_t::spatial_index_t(float cell_size) :
+  cell_size_(cell_size),
+  inv_cell_size_(cell_size > 0 ? 1.0f / cell_size : 0.0f)
+{
+  if (!(cell_size > 0)) {
+    s_throw(std::invalid_argument, "Spatial index cell size must be positive");
+  }
+  clear();
+}
+
+
+
+void spatial_index_t::insert(game_object_t *object)
+{
+  const uint32_t slot = object->get_component<transform_t>()->slot();
+  if (slot >= slot_entries_.size()) {
+    slot_entries_.resize(slot + 1, NO_ENTRY);
+  } else if (slot_entries_[slot] != NO_ENTRY) {
+    return;
+  }
+  const uint32_t entry = static_cast<uint32_t>(entries_.size());
+  entries_.push_back(entry_t { object, slot, 0, 0, nullptr });
+  slot_entries_[slot] = entry;
+  add_to_cell(entry, transform_store().world_translation(slot));
+}
+
+
+
+void spatial_index_t::remove(game_object_t *object)
+{
+  const uint32_t slot = object->get_component<transform_t>()->slot();
+  if (slot >= slot_entries_.size()) {
+    return;
+  }
+  const uint32_t entry = slot_entries_[slot];
+  if (entry == NO_ENTRY || entries_[entry].object != object) {
+    return;
+  }
+
+  remove_from_cell(entry);
+  slot_entries_[slot] = NO_ENTRY;
+  // Move the last entry into the removed one's place
+  const uint32_t last = static_cast<uint32_t>(entries_.size() - 1);
+  if (entry != last) {
+    const entry_t &moved = entries_[entry] = entries_[last];
+    slot_entries_[moved.slot] = entry;
+    moved.cell->items[moved.cell_pos].entry = entry;
+  }
+  entries_.pop_back();
+}
+
+
+
+bool spatial_index_t::contains(const game_object_t *object) const
+{
+  const uint32_t slot = object->get_component<transform_t>()->slot();
+  return slot < slot_entries_.size() &&
+         slot_entries_[slot] != NO_ENTRY &&
+         entries_[slot_entries_[slot]].object == object;
+}
+
+
+
+void spatial_index_t::release_object(game_object_t *object)
+{
+  remove(object);
+}
+
+
+
+void spatial_index_t::clear()
+{
+  cells_.clear();
+  entries_.clear();
+  slot_entries_.clear();
+  for (std::map<int32_t, uint32_t> &axis : occupied_) {
+    axis.clear();
+  }
+  lo_ = cell_coord_t { INT32_MAX, INT32_MAX, INT32_MAX };
+  hi_ = cell_coord_t { INT32_MIN, INT32_MIN, INT32_MIN };
+  // Objects inserted from here on are placed where they are now
+  since_ = change_log().tick() - 1;
+}
+
+
+
+size_t spatial_index_t::size() const
+{
+  return entries_.size();
+}
+
+
+
+float spatial_index_t::cell_size() const
+{
+  return cell_size_;
+}
+
+
+
+/*==============================================================================
+  update()
+
+    Refreshes the positions of indexed objects whose transforms were marked
+    changed since the last update, and of indexed objects below them.
+    Objects that stay within their cell are updated in place, the rest are
+    moved to their new cell.
+==============================================================================*/
+void spatial_index_t::update()
+{
+  const uint32_t tick = change_log().tick();
+  const bool tracked = change_log().each_changed_since(TRANSFORM_COMPONENT, since_,
+    [this] (game_object_t *object) {
+      refresh_subtree(object->node());
+    });
+  if (!tracked) {
+    for (uint32_t entry = 0; entry < entries_.size(); ++entry) {
+      refresh(entry);
+    }
+  }
+  // Changes may still be marked in the current tick
+  since_ = tick - 1;
+}
+
+
+
+void spatial_index_t::query_radius(const vec3f_t &center, float radius, object_list_t &out) const
+{
+  if (!(radius >= 0)) {
+    return;
+  }
+  const float radius_sq = radius * radius;
+  const cell_coord_t lo = coord_for(center.x - radius, center.y - radius, center.z - radius);
+  const cell_coord_t hi = coord_for(center.x + radius, center.y + radius, center.z + radius);
+  visit_cells(lo, hi, [&] (const cell_t &cell) {
+    for (const cell_item_t &item : cell.items) {
+      if (distance_sq(item.x, item.y, item.z, center) <= radius_sq) {
+        out.push_back(entries_[item.entry].object);
+      }
+    }
+  });
+}
+
+
+
+void spatial_index_t::query_box(const vec3f_t &min, const vec3f_t &max, object_list_t &out) const
+{
+  const cell_coord_t lo = coord_for(min.x, min.y, min.z);
+  const cell_coord_t hi = coord_for(max.x, max.y, max.z);
+  visit_cells(lo, hi, [&] (const cell_t &cell) {
+    for (const cell_item_t &item : cell.items) {
+      if (item.x >= min.x && item.x <= max.x &&
+          item.y >= min.y && item.y <= max.y &&
+          item.z >= min.z && item.z <= max.z) {
+        out.push_back(entries_[item.entry].object);
+      }
+    }
+  });
+}
+
+
+
+/*==============================================================================
+  query_nearest(center, count, out)
+
+    Visits rings of cells around center's cell, nearest ring first, keeping
+    the count nearest objects seen so far. Only rings that cross the box of
+    occupied cells are visited. Every object beyond ring r is at least r
+    cells' width from center, so the search stops once it has count objects
+    no farther than that. When a ring would take more lookups than there are
+    occupied cells, the remaining cells are scanned directly.
+==============================================================================*/
+void spatial_index_t::query_nearest(const vec3f_t &center, size_t count, object_list_t &out) const
+{
+  count = std::min(count, entries_.size());
+  if (count == 0) {
+    return;
+  }
+
+  std::vector<candidate_t> heap;
+  heap.reserve(count);
+  const auto visit = [&] (const cell_t &cell) {
+    for (const cell_item_t &item : cell.items) {
+      push_candidate(heap, count,
+        candidate_t { distance_sq(item.x, item.y, item.z, center), item.entry });
+    }
+  };
+
+  // Rings closer than the occupied cells are empty, and rings past them
+  // would be too
+  const cell_coord_t origin = coord_for(center.x, center.y, center.z);
+  const int32_t first_ring = std::max({
+    0,
+    lo_.x - origin.x, origin.x - hi_.x,
+    lo_.y - origin.y, origin.y - hi_.y,
+    lo_.z - origin.z, origin.z - hi_.z
+    });
+  const int32_t last_ring = std::max({
+    origin.x - lo_.x, hi_.x - origin.x,
+    origin.y - lo_.y, hi_.y - origin.y,
+    origin.z - lo_.z, hi_.z - origin.z
+    });
+
+  for (int32_t ring = first_ring; ring <= last_ring; ++ring) {
+    const uint64_t outer = box_volume(
+      std::max(origin.x - ring, lo_.x), std::max(origin.y - ring, lo_.y), std::max(origin.z - ring, lo_.z),
+      std::min(origin.x + ring, hi_.x), std::min(origin.y + ring, hi_.y), std::min(origin.z + ring, hi_.z));
+    const uint64_t inner = ring == 0 ? 0 : box_volume(
+      std::max(origin.x - ring + 1, lo_.x), std::max(origin.y - ring + 1, lo_.y), std::max(origin.z - ring + 1, lo_.z),
+      std::min(origin.x + ring - 1, hi_.x), std::min(origin.y + ring - 1, hi_.y), std::min(origin.z + ring - 1, hi_.z));
+
+    if (outer - inner > cells_.size()) {
+      for (const auto &pair : cells_) {
+        const cell_coord_t &coord = pair.second.coord;
+        const int32_t cell_ring = std::max({
+          std::abs(coord.x - origin.x),
+          std::abs(coord.y - origin.y),
+          std::abs(coord.z - origin.z)
+          });
+        if (cell_ring >= ring) {
+          visit(pair.second);
+        }
+      }
+      break;
+    }
+
+    visit_ring(origin, ring, visit);
+    // Objects past this ring are at least ring cells' width away
+    const float reach = float(ring) * cell_size_;
+    if (heap.size() == count && heap.front().first <= reach * reach) {
+      break;
+    }
+  }
+
+  std::sort_heap(heap.begin(), heap.end());
+  for (const candidate_t &candidate : heap) {
+    out.push_back(entries_[candidate.second].object);
+  }
+}
+
+
+
+auto spatial_index_t::coord_for(float x, float y, float z) const -> cell_coord_t
+{
+  return cell_coord_t {
+    cell_coord(x, inv_cell_size_),
+    cell_coord(y, inv_cell_size_),
+    cell_coord(z, inv_cell_size_)
+  };
+}
+
+
+
+void spatial_index_t::refresh(uint32_t entry)
+{
+  const vec3f_t pos = transform_store().world_translation(entries_[entry].slot);
+  const cell_coord_t coord = coord_for(pos.x, pos.y, pos.z);
+  entry_t &info = entries_[entry];
+  if (cell_key(coord.x, coord.y, coord.z) == info.cell_key) {
+    cell_item_t &item = info.cell->items[info.cell_pos];
+    item.x = pos.x;
+    item.y = pos.y;
+    item.z = pos.z;
+  } else {
+    remove_from_cell(entry);
+    add_to_cell(entry, pos);
+  }
+}
+
+
+
+// Refreshes every indexed object in the subtree rooted at node.
+void spatial_index_t::refresh_subtree(uint32_t node)
+{
+  const scene_graph_t &graph = scene_graph();
+  for (uint32_t next = node; next != scene_graph_t::NO_NODE; next = graph.next_in_subtree(next, node)) {
+    const uint32_t slot = graph.slot(next);
+    if (slot < slot_entries_.size() && slot_entries_[slot] != NO_ENTRY) {
+      refresh(slot_entries_[slot]);
+    }
+  }
+}
+
+
+
+void spatial_index_t::add_to_cell(uint32_t entry, const vec3f_t &pos)
+{
+  const cell_coord_t coord = coord_for(pos.x, pos.y, pos.z);
+  const uint64_t key = cell_key(coord.x, coord.y, coord.z);
+  cell_t &cell = cells_[key];
+  if (cell.items.empty()) {
+    cell.coord = coord;
+    count_cell(coord, 1);
+  }
+  entries_[entry].cell_key = key;
+  entries_[entry].cell = &cell;
+  entries_[entry].cell_pos = static_cast<uint32_t>(cell.items.size());
+  cell.items.push_back(cell_item_t { pos.x, pos.y, pos.z, entry });
+}
+
+
+
+void spatial_index_t::remove_from_cell(uint32_t entry)
+{
+  const entry_t &info = entries_[entry];
+  std::vector<cell_item_t> &items = info.cell->items;
+  if (info.cell_pos != items.size() - 1) {
+    items[info.cell_pos] = items.back();
+    entries_[items[info.cell_pos].entry].cell_pos = info.cell_pos;
+  }
+  items.pop_back();
+  if (items.empty()) {
+    count_cell(info.cell->coord, -1);
+    cells_.erase(info.cell_key);
+  }
+}
+
+
+
+// Counts a cell becoming occupied (delta 1) or empty (delta -1) and updates
+// the occupied box to match.
+void spatial_index_t::count_cell(const cell_coord_t &coord, int delta)
+{
+  const int32_t coords[3] = { coord.x, coord.y, coord.z };
+  int32_t *const lo[3] = { &lo_.x, &lo_.y, &lo_.z };
+  int32_t *const hi[3] = { &hi_.x, &hi_.y, &hi_.z };
+  for (int axis = 0; axis < 3; ++axis) {
+    std::map<int32_t, uint32_t> &counts = occupied_[axis];
+    if (delta > 0) {
+      ++counts[coords[axis]];
+    } else {
+      const auto found = counts.find(coords[axis]);
+      if (--found->second == 0) {
+        counts.erase(found);
+      }
+    }
+    if (counts.empty()) {
+      *lo[axis] = INT32_MAX;
+      *hi[axis] = INT32_MIN;
+    } else {
+      *lo[axis] = counts.begin()->first;
+      *hi[axis] = counts.rbegin()->first;
+    }
+  }
+}
+
+
+
+/*==============================================================================
+  visit_cells(lo, hi, fn)
+
+    Calls fn(const cell_t &) for each occupied cell within lo and hi. Looks
+    each cell in the box up, unless the box holds more cells than are
+    occupied, in which case it checks every occupied cell instead.
+==============================================================================*/
+template <typename FN>
+void spatial_index_t::visit_cells(const cell_coord_t &lo, const cell_coord_t &hi, FN &&fn) const
+{
+  const cell_coord_t from = { std::max(lo.x, lo_.x), std::max(lo.y, lo_.y), std::max(lo.z, lo_.z) };
+  const cell_coord_t to = { std::min(hi.x, hi_.x), std::min(hi.y, hi_.y), std::min(hi.z, hi_.z) };
+  const uint64_t volume = box_volume(from.x, from.y, from.z, to.x, to.y, to.z);
+  if (volume == 0) {
+    return;
+  }
+
+  if (volume > cells_.size()) {
+    for (const auto &pair : cells_) {
+      const cell_coord_t &coord = pair.second.coord;
+      if (coord.x >= from.x && coord.x <= to.x &&
+          coord.y >= from.y && coord.y <= to.y &&
+          coord.z >= from.z && coord.z <= to.z) {
+        fn(pair.second);
+      }
+    }
+    return;
+  }
+
+  for (int32_t x = from.x; x <= to.x; ++x) {
+    for (int32_t y = from.y; y <= to.y; ++y) {
+      for (int32_t z = from.z; z <= to.z; ++z) {
+        const auto found = cells_.find(cell_key(x, y, z));
+        if (found != cells_.end()) {
+          fn(found->second);
+        }
+      }
+    }
+  }
+}
+
+
+
+// Calls fn(const cell_t &) for each occupied cell on the surface of the cube
+// of cells ring cells out from center.
+template <typename FN>
+void spatial_index_t::visit_ring(const cell_coord_t &center, int32_t ring, FN &&fn) const
+{
+  const cell_coord_t from = {
+    std::max(center.x - ring, lo_.x), std::max(center.y - ring, lo_.y), std::max(center.z - ring, lo_.z)
+  };
+  const cell_coord_t to = {
+    std::min(center.x + ring, hi_.x), std::min(center.y + ring, hi_.y), std::min(center.z + ring, hi_.z)
+  };
+  const auto visit = [&] (int32_t x, int32_t y, int32_t z) {
+    const auto found = cells_.find(cell_key(x, y, z));
+    if (found != cells_.end()) {
+      fn(found->second);
+    }
+  };
+
+  for (int32_t x = from.x; x <= to.x; ++x) {
+    for (int32_t y = from.y; y <= to.y; ++y) {
+      if (std::abs(x - center.x) == ring || std::abs(y - center.y) == ring) {
+        for (int32_t z = from.z; z <= to.z; ++z) {
+          visit(x, y, z);
+        }
+      } else {
+        // Only the near and far faces are on the surface
+        if (center.z - ring >= from.z) {
+          visit(x, y, center.z - ring);
+        }
+        if (ring > 0 && center.z + ring <= to.z) {
+          visit(x, y, center.z + ring);
+        }
+      }
+    }
+  }
+}
+
+
+} // namespace snow
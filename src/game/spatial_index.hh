@@ -0,0 +1,142 @@
+/*
+  spatial_index.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__SPATIAL_INDEX_HH__
+#define __SNOW__SPATIAL_INDEX_HH__
+
+#include "../config.hh"
+#include "object_owner.hh"
+#include <snow/math/math3d.hh>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+
+namespace snow {
+
+
+struct game_object_t;
+
+
+/*==============================================================================
+
+  Index of game objects by their world translation, answering radius, box
+  and k-nearest queries without visiting every object.
+
+  Objects are bucketed in a uniform grid of cubic cells cell_size units wide.
+  Only occupied cells are stored (in a hash map keyed on cell coordinates), so
+  the grid has no bounds. Each cell keeps its objects' positions packed
+  together, so a query reads a few short runs of positions and only touches
+  the objects that match.
+
+  The index doesn't watch objects itself. Each index remembers the last
+  change_log() tick it has seen, and update() walks the transform changes
+  since then, re-bucketing each changed object and any indexed objects
+  below it in the hierarchy, since moving a parent moves its children. So
+  keeping the index current costs time in proportion to what moved rather
+  than to its size, and any number of indices can keep up independently. If
+  an index falls further behind than the change log's history, update()
+  refreshes every object.
+
+  Positions are read from world matrices, so update() should follow
+  transform_store_t::update_world(), and queries see positions as of the
+  last update(). Objects must be removed before they're destroyed; as an
+  object_owner_t, the index removes objects destroyed by object commands
+  itself. Not thread safe.
+
+==============================================================================*/
+struct S_EXPORT spatial_index_t : public object_owner_t
+{
+  using object_list_t = std::vector<game_object_t *>;
+
+  explicit spatial_index_t(float cell_size = 16.0f);
+  ~spatial_index_t() override = default;
+
+  spatial_index_t(const spatial_index_t &) = delete;
+  spatial_index_t &operator = (const spatial_index_t &) = delete;
+
+  // Adding an object already in the index or removing one that isn't does
+  // nothing.
+  void            insert(game_object_t *object);
+  void            remove(game_object_t *object);
+  bool            contains(const game_object_t *object) const;
+  // Removes an object about to be destroyed.
+  void            release_object(game_object_t *object) override;
+  void            clear();
+  size_t          size() const;
+  float           cell_size() const;
+
+  // Re-buckets objects whose transforms changed since the last update.
+  void            update();
+
+  // Queries append matching objects to out. Range queries return objects in
+  // no particular order. Bounds are inclusive.
+  void            query_radius(const vec3f_t &center, float radius, object_list_t &out) const;
+  void            query_box(const vec3f_t &min, const vec3f_t &max, object_list_t &out) const;
+  // Appends the count objects nearest center, nearest first.
+  void            query_nearest(const vec3f_t &center, size_t count, object_list_t &out) const;
+
+private:
+  struct cell_coord_t
+  {
+    int32_t x, y, z;
+  };
+
+  struct cell_item_t
+  {
+    float     x, y, z;
+    uint32_t  entry;
+  };
+
+  struct cell_t
+  {
+    cell_coord_t              coord;
+    std::vector<cell_item_t>  items;
+  };
+
+  // Cells are held by pointer as well as key -- the map never moves its
+  // elements, and this saves a lookup per moved object
+  struct entry_t
+  {
+    game_object_t * object;
+    uint32_t        slot;
+    uint32_t        cell_pos;
+    uint64_t        cell_key;
+    cell_t *        cell;
+  };
+
+  using cell_map_t = std::unordered_map<uint64_t, cell_t>;
+
+  cell_coord_t    coord_for(float x, float y, float z) const;
+  void            refresh(uint32_t entry);
+  void            refresh_subtree(uint32_t node);
+  void            add_to_cell(uint32_t entry, const vec3f_t &pos);
+  void            remove_from_cell(uint32_t entry);
+  void            count_cell(const cell_coord_t &coord, int delta);
+  template <typename FN>
+  void            visit_cells(const cell_coord_t &lo, const cell_coord_t &hi, FN &&fn) const;
+  template <typename FN>
+  void            visit_ring(const cell_coord_t &center, int32_t ring, FN &&fn) const;
+
+  float                   cell_size_;
+  float                   inv_cell_size_;
+  cell_map_t              cells_;
+  std::vector<entry_t>    entries_;
+  // Entry index by transform slot, NO_ENTRY where the slot isn't indexed
+  std::vector<uint32_t>   slot_entries_;
+  // Newest change_log() tick whose changes have all been seen
+  uint32_t                since_;
+  // Occupied cells per coordinate, one map per axis
+  std::map<int32_t, uint32_t> occupied_[3];
+  // Smallest box of cells holding every occupied cell
+  cell_coord_t            lo_;
+  cell_coord_t            hi_;
+};
+
+
+} // namespace snow
+
+#endif /* end __SNOW__SPATIAL_INDEX_HH__ include guard */
@@ -43,6 +43,10 @@ struct system_t
       the function does emit an event, it should be careful not to create an
       infinite loop by doing so.
 
+      NET_EVENT netevents are recycled once the event has been passed to all
+      systems. A system that needs a netevent after event() returns must call
+      netevent_pool_t::retain(event.net) and later netevent_pool_t::release.
+
       Default implementation simply returns true.
   ============================================================================*/
   virtual bool event(const event_t &event);
@@ -56,6 +60,11 @@ struct system_t
       This function may send out events as it desires, since it cannot
       accidentally create
 
+      Creating or destroying objects, changing their components, or
+      reparenting them while iterating components is unsafe. Record such
+      changes in object_commands().local() instead -- the client plays them
+      back once every logic system has run its frame.
+
       Default implementation does nothing.
   ============================================================================*/
   virtual void frame(double step, double timeslice);
@@ -4,12 +4,460 @@
   is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
 */
 #include "level.hh"
+#include "../gameobject.hh"
+#include "../resources.hh"
+#include "../components/component_pools.hh"
+#include "../components/player_mover.hh"
+#include "../components/point_light.hh"
+#include "../components/transform.hh"
+#include <cstring>
+#include <unordered_map>
 
 
 namespace snow {
 
 
+namespace {
 
 
+const size_t TRANSFORM_COLUMNS = transform_store_t::COLUMN_COUNT;
+
+
+struct level_header_t
+{
+  uint32_t  magic;
+  uint32_t  byte_order;
+  uint32_t  version;
+  uint32_t  object_count;
+  uint32_t  light_count;
+  uint32_t  mover_count;
+  uint32_t  material_count;
+};
+
+
+struct light_record_t
+{
+  uint32_t  object;
+  float     radius;
+  float     color[4];
+  uint32_t  cookie;
+};
+
+
+struct mover_record_t
+{
+  uint32_t  object;
+  int8_t    input[2];
+  uint8_t   padding[2];
+};
+
+
+static_assert(sizeof(level_header_t) % 4 == 0 && sizeof(light_record_t) % 4 == 0 &&
+  sizeof(mover_record_t) % 4 == 0, "Level records must keep sections 4-byte aligned");
+
+
+
+// Bounds-checked cursor over a snapshot. Nothing read from it is trusted.
+struct level_reader_t
+{
+  const uint8_t * data;
+  size_t          length;
+  size_t          offset;
+
+  const uint8_t *take(size_t count, size_t size)
+  {
+    if (size != 0 && count > (length - offset) / size) {
+      s_throw(std::invalid_argument, "Level snapshot is truncated");
+    }
+    const uint8_t *const at = data + offset;
+    offset += count * size;
+    return at;
+  }
+
+  template <typename T>
+  T read()
+  {
+    T value;
+    std::memcpy(&value, take(1, sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  // Copies a section of count records out in one go
+  template <typename T>
+  void read(size_t count, std::vector<T> &out)
+  {
+    const uint8_t *const at = take(count, sizeof(T));
+    out.resize(count);
+    std::memcpy(out.data(), at, count * sizeof(T));
+  }
+};
+
+
+
+game_object_t *object_for(const component_handle_t &handle)
+{
+  const component_base_t *const transform = component_handle_t::get(handle);
+  return transform ? transform->game_object : nullptr;
+}
+
+
+
+template <typename T>
+void append(level_t::charbuf_t &out, const T *values, size_t count)
+{
+  const uint8_t *const bytes = (const uint8_t *)values;
+  out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+
+} // namespace <anon>
+
+
+
+const uint32_t level_t::LEVEL_MAGIC;
+const uint32_t level_t::LEVEL_BYTE_ORDER;
+const uint32_t level_t::LEVEL_VERSION;
+const uint32_t level_t::NO_INDEX;
+
+
+
+level_t::level_t(resources_t *res) :
+  res_(res)
+{
+  /* nop */
+}
+
+
+
+level_t::~level_t()
+{
+  clear();
+}
+
+
+
+void level_t::clear()
+{
+  // Loaded children follow their parents, so deleting in reverse spares the
+  // scene graph from re-rooting them. Objects destroyed elsewhere are gone
+  // from the handle map and skipped.
+  for (auto iter = objects_.rbegin(); iter != objects_.rend(); ++iter) {
+    delete object_for(*iter);
+  }
+  objects_.clear();
+  indices_.clear();
+  if (res_) {
+    for (rmaterial_t *material : materials_) {
+      if (material) {
+        res_->release_material(material);
+      }
+    }
+  }
+  materials_.clear();
+  material_names_.clear();
+}
+
+
+
+/*==============================================================================
+  load(data, length)
+
+    Copies the parent, light and mover sections out of the snapshot in one
+    go each and validates everything before creating anything, then creates
+    the
+    objects, bulk copies their transforms into the transform store, links
+    each object to its parent, and adds lights and movers. Finally compacts
+    the component pools, closing the holes the previous level's objects
+    left.
+==============================================================================*/
+void level_t::load(const void *data, size_t length)
+{
+  clear();
+
+  level_reader_t reader { (const uint8_t *)data, length, 0 };
+  const level_header_t header = reader.read<level_header_t>();
+  if (header.magic != LEVEL_MAGIC) {
+    s_throw(std::invalid_argument, "Data is not a level snapshot");
+  } else if (header.byte_order != LEVEL_BYTE_ORDER) {
+    s_throw(std::invalid_argument, "Level snapshot was saved with a different byte order");
+  } else if (header.version != LEVEL_VERSION) {
+    s_throw(std::invalid_argument, "Unsupported level snapshot version %u", header.version);
+  }
+
+  const size_t count = header.object_count;
+  std::vector<uint32_t> parents;
+  reader.read(count, parents);
+  const float *columns[TRANSFORM_COLUMNS];
+  std::vector<float> aligned_columns;
+  // Sections start 4-byte aligned, so only the buffer itself may not be
+  if (reinterpret_cast<uintptr_t>(reader.data) % alignof(float) != 0) {
+    // Copy out of unaligned buffers so the columns can be read as floats
+    reader.read(count * TRANSFORM_COLUMNS, aligned_columns);
+    for (size_t column = 0; column < TRANSFORM_COLUMNS; ++column) {
+      columns[column] = aligned_columns.data() + column * count;
+    }
+  } else {
+    for (size_t column = 0; column < TRANSFORM_COLUMNS; ++column) {
+      columns[column] = (const float *)reader.take(count, sizeof(float));
+    }
+  }
+  std::vector<light_record_t> lights;
+  std::vector<mover_record_t> movers;
+  reader.read(header.light_count, lights);
+  reader.read(header.mover_count, movers);
+
+  std::vector<string> names;
+  names.reserve(header.material_count);
+  for (uint32_t index = 0; index < header.material_count; ++index) {
+    const uint32_t name_length = reader.read<uint32_t>();
+    if (name_length > length) {
+      s_throw(std::invalid_argument, "Level snapshot is truncated");
+    }
+    const char *const name = (const char *)reader.take((name_length + 3) & ~size_t(3), 1);
+    names.emplace_back(name, name + name_length);
+  }
+
+  for (size_t index = 0; index < count; ++index) {
+    if (parents[index] != NO_INDEX && parents[index] >= index) {
+      s_throw(std::invalid_argument, "Level object parents must precede their children");
+    }
+  }
+  for (const light_record_t &light : lights) {
+    if (light.object >= count || (light.cookie != NO_INDEX && light.cookie >= names.size())) {
+      s_throw(std::invalid_argument, "Level light has an out-of-range index");
+    }
+  }
+  for (const mover_record_t &mover : movers) {
+    if (mover.object >= count) {
+      s_throw(std::invalid_argument, "Level mover has an out-of-range index");
+    }
+  }
+
+  // The snapshot is sound from here on
+  material_names_ = std::move(names);
+  materials_.reserve(material_names_.size());
+  for (const string &name : material_names_) {
+    materials_.push_back(res_ ? res_->load_material(name) : nullptr);
+  }
+
+  std::vector<game_object_t *> objects;
+  std::vector<uint32_t> slots;
+  objects.reserve(count);
+  objects_.reserve(count);
+  slots.reserve(count);
+  transform_store().reserve(transform_store().size() + count);
+  for (size_t index = 0; index < count; ++index) {
+    game_object_t *const object = new game_object_t;
+    const transform_t *const transform = object->get_component<transform_t>();
+    objects.push_back(object);
+    track(transform->handle());
+    slots.push_back(transform->slot());
+  }
+  transform_store().load_columns(slots.data(), count, columns);
+
+  for (size_t index = 0; index < count; ++index) {
+    if (parents[index] != NO_INDEX) {
+      objects[parents[index]]->add_child(objects[index]);
+    }
+  }
+
+  for (const light_record_t &record : lights) {
+    game_object_t *const object = objects[record.object];
+    if (object->has_component<point_light_t>()) {
+      continue;
+    }
+    object->add_component<point_light_t>();
+    point_light_t *const light = object->get_component<point_light_t>();
+    light->radius = record.radius;
+    light->color = { record.color[0], record.color[1], record.color[2], record.color[3] };
+    light->cookie = record.cookie == NO_INDEX ? nullptr : materials_[record.cookie];
+  }
+
+  for (const mover_record_t &record : movers) {
+    game_object_t *const object = objects[record.object];
+    if (!object->has_component<player_mover_t>()) {
+      object->add_component<player_mover_t>();
+    }
+    object->get_component<player_mover_t>()->last_input = { record.input[0], record.input[1] };
+  }
+
+  compact_component_pools();
+}
+
+
+
+/*==============================================================================
+  save()
+
+    Writes the level's objects parents first. Objects whose parent isn't part
+    of the level are saved as roots, and children outside the level are left
+    out.
+==============================================================================*/
+auto level_t::save() const -> charbuf_t
+{
+  std::vector<const game_object_t *> live;
+  std::unordered_map<const game_object_t *, uint32_t> in_level;
+  live.reserve(objects_.size());
+  for (const component_handle_t &handle : objects_) {
+    if (const game_object_t *object = object_for(handle)) {
+      live.push_back(object);
+      in_level.emplace(object, NO_INDEX);
+    }
+  }
+
+  // Breadth-first from the level's roots gives parents lower indices
+  std::vector<const game_object_t *> order;
+  order.reserve(live.size());
+  for (const game_object_t *object : live) {
+    if (object->parent() == nullptr || in_level.count(object->parent()) == 0) {
+      order.push_back(object);
+    }
+  }
+  for (size_t head = 0; head < order.size(); ++head) {
+    in_level[order[head]] = static_cast<uint32_t>(head);
+    for (const game_object_t *child : order[head]->children()) {
+      if (in_level.count(child)) {
+        order.push_back(child);
+      }
+    }
+  }
+
+  const size_t count = order.size();
+  std::vector<uint32_t> parents(count);
+  std::vector<uint32_t> slots(count);
+  std::vector<light_record_t> lights;
+  std::vector<mover_record_t> movers;
+  for (size_t index = 0; index < count; ++index) {
+    const game_object_t *const object = order[index];
+    parents[index] = object->parent() ? in_level[object->parent()] : NO_INDEX;
+    slots[index] = object->get_component<transform_t>()->slot();
+
+    if (const point_light_t *light = object->get_component<point_light_t>()) {
+      const uint32_t cookie = material_index(light->cookie);
+      if (light->cookie && cookie == NO_INDEX) {
+        s_log_warning("Light cookie was not loaded through the level -- saving light without it");
+      }
+      lights.push_back(light_record_t {
+        static_cast<uint32_t>(index), light->radius,
+        { light->color.x, light->color.y, light->color.z, light->color.w },
+        cookie
+      });
+    }
+    if (const player_mover_t *mover = object->get_component<player_mover_t>()) {
+      movers.push_back(mover_record_t {
+        static_cast<uint32_t>(index), { mover->last_input.x, mover->last_input.y }, { 0, 0 }
+      });
+    }
+  }
+
+  std::vector<float> columns(count * TRANSFORM_COLUMNS);
+  float *column_ptrs[TRANSFORM_COLUMNS];
+  for (size_t column = 0; column < TRANSFORM_COLUMNS; ++column) {
+    column_ptrs[column] = columns.data() + column * count;
+  }
+  transform_store().store_columns(slots.data(), count, column_ptrs);
+
+  const level_header_t header = {
+    LEVEL_MAGIC, LEVEL_BYTE_ORDER, LEVEL_VERSION,
+    static_cast<uint32_t>(count),
+    static_cast<uint32_t>(lights.size()),
+    static_cast<uint32_t>(movers.size()),
+    static_cast<uint32_t>(material_names_.size())
+  };
+
+  charbuf_t out;
+  out.reserve(sizeof(header) + count * (sizeof(uint32_t) + TRANSFORM_COLUMNS * sizeof(float)) +
+              lights.size() * sizeof(light_record_t) + movers.size() * sizeof(mover_record_t));
+  append(out, &header, 1);
+  append(out, parents.data(), parents.size());
+  append(out, columns.data(), columns.size());
+  append(out, lights.data(), lights.size());
+  append(out, movers.data(), movers.size());
+  for (const string &name : material_names_) {
+    const uint32_t name_length = static_cast<uint32_t>(name.size());
+    append(out, &name_length, 1);
+    append(out, name.data(), name.size());
+    out.resize((out.size() + 3) & ~size_t(3), 0);
+  }
+  return out;
+}
+
+
+
+void level_t::add_object(game_object_t *object)
+{
+  assert(object);
+  track(object->get_component<transform_t>()->handle());
+}
+
+
+
+size_t level_t::object_count() const
+{
+  return objects_.size();
+}
+
+
+
+game_object_t *level_t::object(size_t index) const
+{
+  return object_for(objects_[index]);
+}
+
+
+
+bool level_t::destroy_object(game_object_t *object)
+{
+  const component_handle_t &handle = object->get_component<transform_t>()->handle();
+  if (handle.global_index >= indices_.size() ||
+      indices_[handle.global_index] == NO_INDEX ||
+      objects_[indices_[handle.global_index]] != handle) {
+    return false;
+  }
+  indices_[handle.global_index] = NO_INDEX;
+  delete object;
+  return true;
+}
+
+
+
+rmaterial_t *level_t::load_material(const string &name)
+{
+  for (size_t index = 0; index < material_names_.size(); ++index) {
+    if (material_names_[index] == name) {
+      return materials_[index];
+    }
+  }
+  material_names_.push_back(name);
+  materials_.push_back(res_ ? res_->load_material(name) : nullptr);
+  return materials_.back();
+}
+
+
+
+void level_t::track(const component_handle_t &handle)
+{
+  if (handle.global_index >= indices_.size()) {
+    indices_.resize(handle.global_index + 1, NO_INDEX);
+  }
+  indices_[handle.global_index] = static_cast<uint32_t>(objects_.size());
+  objects_.push_back(handle);
+}
+
+
+
+uint32_t level_t::material_index(const rmaterial_t *material) const
+{
+  if (material == nullptr) {
+    return NO_INDEX;
+  }
+  for (size_t index = 0; index < materials_.size(); ++index) {
+    if (materials_[index] == material) {
+      return static_cast<uint32_t>(index);
+    }
+  }
+  return NO_INDEX;
+}
+
 
 } // namespace snow
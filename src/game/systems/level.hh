@@ -7,17 +7,104 @@
 #define __SNOW__LEVEL_HH__
 
 #include "../../config.hh"
+#include "../components/component_handle.hh"
+#include "../object_owner.hh"
+#include <cstdint>
+#include <vector>
 
 
 namespace snow {
 
 
-struct level_t
+struct game_object_t;
+struct resources_t;
+struct rmaterial_t;
+
+
+/*==============================================================================
+
+  A level owns a set of game objects and can save them to, and load them
+  from, a binary snapshot. The snapshot stores each kind of component as
+  columns -- one contiguous array per field, indexed by object -- so loading
+  is a handful of bulk copies (transforms go straight into the transform
+  store) followed by a pass that links objects to their parents.
+
+  Pointers are stored as indices: an object's parent is its index in the
+  snapshot, and a light's cookie is an index into the snapshot's table of
+  material names. Objects are saved parents first, so a parent's index is
+  always lower than its children's.
+
+  Layout (version LEVEL_VERSION):
+
+    header        magic, byte order mark, version, object, light, mover and
+                  material counts
+    parents       uint32 per object, NO_INDEX for roots
+    transforms    TRANSFORM_COLUMNS float columns, one value per object
+    lights        object index, radius, color (4 floats), cookie index
+    movers        object index, last input (2 int8s), 2 bytes padding
+    materials     per name, a uint32 length and its bytes, padded to 4
+
+  Snapshots are written in the saving machine's byte order, and the byte
+  order mark records which: LEVEL_BYTE_ORDER reads back reversed on a
+  machine of the other order. Snapshots with a different magic, byte order
+  or version are rejected, as is any snapshot that's truncated or has
+  out-of-range indices.
+
+  The level refers to its objects through their transforms' handles, so an
+  object destroyed elsewhere simply drops out of the level instead of being
+  deleted again by clear(). As an object_owner_t, the level destroys its own
+  objects when object commands destroy them.
+
+==============================================================================*/
+struct S_EXPORT level_t : public object_owner_t
 {
+  static const uint32_t LEVEL_MAGIC = 0x564C4E53; // 'SNLV'
+  static const uint32_t LEVEL_BYTE_ORDER = 0x01020304;
+  static const uint32_t LEVEL_VERSION = 2;
+  static const uint32_t NO_INDEX = UINT32_MAX;
+
+  using charbuf_t = std::vector<uint8_t>;
+
+  // res is used to load light cookies. If null, cookies are left empty.
+  explicit level_t(resources_t *res = nullptr);
+  ~level_t();
+
+  level_t(const level_t &) = delete;
+  level_t &operator = (const level_t &) = delete;
 
+  // Destroys the level's objects and releases its materials.
   void clear();
-  void load();
+  // Replaces the level's contents with a snapshot. Throws
+  // std::invalid_argument if the snapshot is malformed, leaving the level
+  // empty.
+  void load(const void *data, size_t length);
+  charbuf_t save() const;
+
+  // Hands an object over to the level, which destroys it on clear().
+  void add_object(game_object_t *object);
+  // Number of objects added or loaded, including any since destroyed.
+  size_t object_count() const;
+  // Object at the given index, or null if it's since been destroyed.
+  game_object_t *object(size_t index) const;
+
+  // Deletes object if it was added to or loaded by the level.
+  bool destroy_object(game_object_t *object) override;
+
+  // Loads a material through the level so lights using it as a cookie can be
+  // saved by name.
+  rmaterial_t *load_material(const string &name);
+
+private:
+  void track(const component_handle_t &handle);
+  uint32_t material_index(const rmaterial_t *material) const;
 
+  resources_t *                   res_;
+  // Handles of the objects' transforms
+  std::vector<component_handle_t> objects_;
+  // Index in objects_ by transform handle slot, NO_INDEX where there's none
+  std::vector<uint32_t>           indices_;
+  std::vector<string>             material_names_;
+  std::vector<rmaterial_t *>      materials_;
 };
 
 
@@ -0,0 +1,387 @@
+/*
+  light_grid.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "light_grid.hh"
+#include "../components/point_light.hh"
+#include "../components/transform.hh"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define S_LIGHT_GRID_SSE 1
+#include <emmintrin.h>
+#endif
+
+
+namespace snow {
+
+
+static_assert(sizeof(mat4f_t) == sizeof(float) * 16,
+  "mat4f_t must be 16 tightly packed floats");
+
+
+
+const uint32_t light_grid_t::DEFAULT_TILE_SIZE;
+
+
+
+light_grid_t::light_grid_t(uint32_t tile_size) :
+  tile_size_(tile_size)
+{
+  if (tile_size == 0) {
+    s_throw(std::invalid_argument, "Light grid tile size must be nonzero");
+  }
+}
+
+
+
+void light_grid_t::resize(uint32_t width, uint32_t height)
+{
+  width_ = width;
+  height_ = height;
+  tiles_x_ = (width + tile_size_ - 1) / tile_size_;
+  tiles_y_ = (height + tile_size_ - 1) / tile_size_;
+}
+
+
+
+uint32_t light_grid_t::tile_size() const
+{
+  return tile_size_;
+}
+
+
+
+uint32_t light_grid_t::tiles_x() const
+{
+  return tiles_x_;
+}
+
+
+
+uint32_t light_grid_t::tiles_y() const
+{
+  return tiles_y_;
+}
+
+
+
+void light_grid_t::clear_lights()
+{
+  lx_.clear();
+  ly_.clear();
+  lz_.clear();
+  lr_.clear();
+  light_count_ = 0;
+  point_lights_.clear();
+}
+
+
+
+uint32_t light_grid_t::add_light(const vec3f_t &position, float radius)
+{
+  // Drop padding left by the last bin()
+  lx_.resize(light_count_);
+  ly_.resize(light_count_);
+  lz_.resize(light_count_);
+  lr_.resize(light_count_);
+  lx_.push_back(position.x);
+  ly_.push_back(position.y);
+  lz_.push_back(position.z);
+  lr_.push_back(radius);
+  return static_cast<uint32_t>(light_count_++);
+}
+
+
+
+void light_grid_t::add_point_lights()
+{
+  point_lights_.resize(light_count_, nullptr);
+  point_light_t::apply_fn([this] (point_light_t &light) {
+    const mat4f_t world = light.get_component<transform_t>()->world_mat4();
+    const float *m = (const float *)&world;
+    add_light(vec3f_t { m[12], m[13], m[14] }, light.radius);
+    point_lights_.push_back(&light);
+  });
+}
+
+
+
+size_t light_grid_t::light_count() const
+{
+  return light_count_;
+}
+
+
+
+auto light_grid_t::point_lights() const -> const std::vector<point_light_t *> &
+{
+  return point_lights_;
+}
+
+
+
+void light_grid_t::bin(const mat4f_t &view, const mat4f_t &projection)
+{
+  const size_t padded = (light_count_ + 3) & ~size_t(3);
+  lx_.resize(padded, 0.0f);
+  ly_.resize(padded, 0.0f);
+  lz_.resize(padded, 0.0f);
+  // Padding has no radius, so it's always culled
+  lr_.resize(padded, 0.0f);
+  x0_.resize(padded);
+  y0_.resize(padded);
+  x1_.resize(padded);
+  y1_.resize(padded);
+
+  const frustum_t frustum = make_frustum(view, projection);
+#if S_LIGHT_GRID_SSE
+  compute_rects_sse(frustum, 0, padded);
+#else
+  compute_rects_scalar(frustum, 0, padded);
+#endif
+  fill_tiles();
+}
+
+
+
+auto light_grid_t::tile_ranges() const -> const std::vector<uint32_t> &
+{
+  return ranges_;
+}
+
+
+
+auto light_grid_t::light_indices() const -> const std::vector<uint32_t> &
+{
+  return indices_;
+}
+
+
+
+size_t light_grid_t::visible_count() const
+{
+  return visible_;
+}
+
+
+
+/*==============================================================================
+  make_frustum(view, projection)
+
+    A perspective projection maps a view-space point to NDC x as
+    P[0] * (x / -z) - P[8], so scale and offset take x / -z straight to
+    tile coordinates. The near and far distances are recovered from
+    P[10] and P[14]; an infinite projection gets an infinite far distance.
+==============================================================================*/
+auto light_grid_t::make_frustum(const mat4f_t &view, const mat4f_t &projection) const -> frustum_t
+{
+  const float *p = (const float *)&projection;
+  frustum_t frustum;
+  std::memcpy(frustum.view, &view, sizeof(frustum.view));
+
+  const float half_tiles_x = 0.5f * float(width_) / float(tile_size_);
+  const float half_tiles_y = 0.5f * float(height_) / float(tile_size_);
+  frustum.scale_x = p[0] * half_tiles_x;
+  frustum.offset_x = (1.0f - p[8]) * half_tiles_x;
+  frustum.scale_y = p[5] * half_tiles_y;
+  frustum.offset_y = (1.0f - p[9]) * half_tiles_y;
+  frustum.extent_x = 2.0f * half_tiles_x;
+  frustum.extent_y = 2.0f * half_tiles_y;
+
+  frustum.near_dist = p[14] / (p[10] - 1.0f);
+  frustum.far_dist = p[14] / (p[10] + 1.0f);
+  if (!(frustum.far_dist > frustum.near_dist)) {
+    frustum.far_dist = HUGE_VALF;
+  }
+  return frustum;
+}
+
+
+
+/*==============================================================================
+  compute_rects_scalar(frustum, first, count)
+
+    Finds the tiles each light's sphere may cover. Over the part of the
+    sphere in front of the near plane, view-space depth ranges between
+    dmin and dmax and x between x - r and x + r, which bounds x / depth
+    without solving for the sphere's exact silhouette -- the largest ratio
+    is (x + r) / dmin if x + r is positive, and (x + r) / dmax otherwise.
+    Same for the smallest ratio and for y.
+
+    compute_rects_sse() does the same arithmetic in the same order, so both
+    produce the same rectangles.
+==============================================================================*/
+void light_grid_t::compute_rects_scalar(const frustum_t &frustum, size_t first, size_t count)
+{
+  const float *v = frustum.view;
+  const float max_x = float(tiles_x_) - 1.0f;
+  const float max_y = float(tiles_y_) - 1.0f;
+
+  for (size_t index = first; index < first + count; ++index) {
+    const float x = lx_[index], y = ly_[index], z = lz_[index], r = lr_[index];
+    const float vx = v[0] * x + v[4] * y + v[8] * z + v[12];
+    const float vy = v[1] * x + v[5] * y + v[9] * z + v[13];
+    const float depth = -(v[2] * x + v[6] * y + v[10] * z + v[14]);
+    const float dmin = std::max(depth - r, frustum.near_dist);
+    const float dmax = depth + r;
+
+    const float hx = vx + r, lx = vx - r;
+    const float hy = vy + r, ly = vy - r;
+    const float fx1 = (hx >= 0.0f ? hx / dmin : hx / dmax) * frustum.scale_x + frustum.offset_x;
+    const float fx0 = (lx <= 0.0f ? lx / dmin : lx / dmax) * frustum.scale_x + frustum.offset_x;
+    const float fy1 = (hy >= 0.0f ? hy / dmin : hy / dmax) * frustum.scale_y + frustum.offset_y;
+    const float fy0 = (ly <= 0.0f ? ly / dmin : ly / dmax) * frustum.scale_y + frustum.offset_y;
+
+    const bool visible = r > 0.0f && dmax > frustum.near_dist && depth - r < frustum.far_dist &&
+                         fx1 >= 0.0f && fx0 < frustum.extent_x &&
+                         fy1 >= 0.0f && fy0 < frustum.extent_y;
+    if (visible) {
+      x0_[index] = int32_t(std::min(std::max(fx0, 0.0f), max_x));
+      y0_[index] = int32_t(std::min(std::max(fy0, 0.0f), max_y));
+      x1_[index] = int32_t(std::min(std::max(fx1, 0.0f), max_x));
+      y1_[index] = int32_t(std::min(std::max(fy1, 0.0f), max_y));
+    } else {
+      x0_[index] = 1;
+      y0_[index] = 1;
+      x1_[index] = 0;
+      y1_[index] = 0;
+    }
+  }
+}
+
+
+
+#if S_LIGHT_GRID_SSE
+/*==============================================================================
+  compute_rects_sse(frustum, first, count)
+
+    compute_rects_scalar() for four lights at a time. count must be a
+    multiple of four. Both branches of each ratio are computed and the
+    right one selected by mask.
+==============================================================================*/
+void light_grid_t::compute_rects_sse(const frustum_t &frustum, size_t first, size_t count)
+{
+  const float *v = frustum.view;
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 near_dist = _mm_set1_ps(frustum.near_dist);
+  const __m128 far_dist = _mm_set1_ps(frustum.far_dist);
+  const __m128 scale_x = _mm_set1_ps(frustum.scale_x);
+  const __m128 offset_x = _mm_set1_ps(frustum.offset_x);
+  const __m128 scale_y = _mm_set1_ps(frustum.scale_y);
+  const __m128 offset_y = _mm_set1_ps(frustum.offset_y);
+  const __m128 extent_x = _mm_set1_ps(frustum.extent_x);
+  const __m128 extent_y = _mm_set1_ps(frustum.extent_y);
+  const __m128 max_x = _mm_set1_ps(float(tiles_x_) - 1.0f);
+  const __m128 max_y = _mm_set1_ps(float(tiles_y_) - 1.0f);
+  const __m128i one = _mm_set1_epi32(1);
+
+  // Selects a / dmin where the numerator's sign calls for it, else a / dmax
+  const auto ratio = [] (__m128 select, __m128 a, __m128 dmin, __m128 dmax) {
+    return _mm_or_ps(_mm_and_ps(select, _mm_div_ps(a, dmin)),
+                     _mm_andnot_ps(select, _mm_div_ps(a, dmax)));
+  };
+  const auto to_tile = [zero] (__m128 f, __m128 max) {
+    return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(f, zero), max));
+  };
+
+  for (size_t index = first; index < first + count; index += 4) {
+    const __m128 x = _mm_loadu_ps(&lx_[index]);
+    const __m128 y = _mm_loadu_ps(&ly_[index]);
+    const __m128 z = _mm_loadu_ps(&lz_[index]);
+    const __m128 r = _mm_loadu_ps(&lr_[index]);
+
+    const __m128 vx = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+      _mm_mul_ps(_mm_set1_ps(v[0]), x), _mm_mul_ps(_mm_set1_ps(v[4]), y)),
+      _mm_mul_ps(_mm_set1_ps(v[8]), z)), _mm_set1_ps(v[12]));
+    const __m128 vy = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+      _mm_mul_ps(_mm_set1_ps(v[1]), x), _mm_mul_ps(_mm_set1_ps(v[5]), y)),
+      _mm_mul_ps(_mm_set1_ps(v[9]), z)), _mm_set1_ps(v[13]));
+    const __m128 depth = _mm_sub_ps(zero, _mm_add_ps(_mm_add_ps(_mm_add_ps(
+      _mm_mul_ps(_mm_set1_ps(v[2]), x), _mm_mul_ps(_mm_set1_ps(v[6]), y)),
+      _mm_mul_ps(_mm_set1_ps(v[10]), z)), _mm_set1_ps(v[14])));
+    const __m128 front = _mm_sub_ps(depth, r);
+    const __m128 dmin = _mm_max_ps(front, near_dist);
+    const __m128 dmax = _mm_add_ps(depth, r);
+
+    const __m128 hx = _mm_add_ps(vx, r), lx = _mm_sub_ps(vx, r);
+    const __m128 hy = _mm_add_ps(vy, r), ly = _mm_sub_ps(vy, r);
+    const __m128 fx1 = _mm_add_ps(_mm_mul_ps(ratio(_mm_cmpge_ps(hx, zero), hx, dmin, dmax), scale_x), offset_x);
+    const __m128 fx0 = _mm_add_ps(_mm_mul_ps(ratio(_mm_cmple_ps(lx, zero), lx, dmin, dmax), scale_x), offset_x);
+    const __m128 fy1 = _mm_add_ps(_mm_mul_ps(ratio(_mm_cmpge_ps(hy, zero), hy, dmin, dmax), scale_y), offset_y);
+    const __m128 fy0 = _mm_add_ps(_mm_mul_ps(ratio(_mm_cmple_ps(ly, zero), ly, dmin, dmax), scale_y), offset_y);
+
+    __m128 visible = _mm_and_ps(_mm_cmpgt_ps(r, zero), _mm_cmpgt_ps(dmax, near_dist));
+    visible = _mm_and_ps(visible, _mm_cmplt_ps(front, far_dist));
+    visible = _mm_and_ps(visible, _mm_and_ps(_mm_cmpge_ps(fx1, zero), _mm_cmplt_ps(fx0, extent_x)));
+    visible = _mm_and_ps(visible, _mm_and_ps(_mm_cmpge_ps(fy1, zero), _mm_cmplt_ps(fy0, extent_y)));
+    const __m128i keep = _mm_castps_si128(visible);
+
+    // Culled lanes get the empty rectangle (1, 1) - (0, 0)
+    const __m128i x0 = _mm_or_si128(_mm_and_si128(keep, to_tile(fx0, max_x)), _mm_andnot_si128(keep, one));
+    const __m128i y0 = _mm_or_si128(_mm_and_si128(keep, to_tile(fy0, max_y)), _mm_andnot_si128(keep, one));
+    const __m128i x1 = _mm_and_si128(keep, to_tile(fx1, max_x));
+    const __m128i y1 = _mm_and_si128(keep, to_tile(fy1, max_y));
+    _mm_storeu_si128((__m128i *)&x0_[index], x0);
+    _mm_storeu_si128((__m128i *)&y0_[index], y0);
+    _mm_storeu_si128((__m128i *)&x1_[index], x1);
+    _mm_storeu_si128((__m128i *)&y1_[index], y1);
+  }
+}
+#endif
+
+
+
+/*==============================================================================
+  fill_tiles()
+
+    Builds the per-tile lists from the light rectangles as a counting sort:
+    count the lights per tile, turn the counts into offsets, then write each
+    light's index at its tiles' offsets. Lights are visited in index order,
+    so every tile's list is sorted.
+==============================================================================*/
+void light_grid_t::fill_tiles()
+{
+  const size_t tile_count = size_t(tiles_x_) * tiles_y_;
+  ranges_.assign(tile_count * 2, 0);
+  visible_ = 0;
+
+  for (size_t index = 0; index < light_count_; ++index) {
+    if (x0_[index] > x1_[index]) {
+      continue;
+    }
+    ++visible_;
+    for (int32_t y = y0_[index]; y <= y1_[index]; ++y) {
+      uint32_t *row = &ranges_[(size_t(y) * tiles_x_) * 2];
+      for (int32_t x = x0_[index]; x <= x1_[index]; ++x) {
+        ++row[x * 2 + 1];
+      }
+    }
+  }
+
+  uint32_t total = 0;
+  cursors_.resize(tile_count);
+  for (size_t tile = 0; tile < tile_count; ++tile) {
+    ranges_[tile * 2] = total;
+    cursors_[tile] = total;
+    total += ranges_[tile * 2 + 1];
+  }
+
+  indices_.resize(total);
+  for (size_t index = 0; index < light_count_; ++index) {
+    if (x0_[index] > x1_[index]) {
+      continue;
+    }
+    for (int32_t y = y0_[index]; y <= y1_[index]; ++y) {
+      uint32_t *row = &cursors_[size_t(y) * tiles_x_];
+      for (int32_t x = x0_[index]; x <= x1_[index]; ++x) {
+        indices_[row[x]++] = static_cast<uint32_t>(index);
+      }
+    }
+  }
+}
+
+
+} // namespace snow
@@ -0,0 +1,119 @@
+/*
+  light_grid.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__LIGHT_GRID_HH__
+#define __SNOW__LIGHT_GRID_HH__
+
+#include "../../config.hh"
+#include <snow/math/math3d.hh>
+#include <cstdint>
+#include <vector>
+
+
+namespace snow {
+
+
+struct point_light_t;
+
+
+/*==============================================================================
+
+  Bins point lights into screen tiles so a renderer only considers the lights
+  that can touch a given tile. The screen is split into tiles of tile_size
+  pixels, counted from the bottom-left (matching gl_FragCoord), and each tile
+  gets a list of the lights whose bounding spheres may cover it.
+
+  bin() projects each light's sphere to a conservative rectangle of tiles,
+  four lights at a time when SSE2 is available. Lights entirely behind the
+  near plane, beyond the far plane, or off screen are culled. The results
+  are two arrays ready for upload as buffers:
+
+    tile_ranges()     per tile, row by row, an offset into light_indices()
+                      and a count -- two uint32s per tile
+    light_indices()   the lights of every tile, packed, in the order they
+                      were added
+
+  Light indices refer to the order lights were added in. add_point_lights()
+  adds every point_light_t at its object's world position and records the
+  light in point_lights() at the same index, so light data can be uploaded
+  in that order.
+
+  The projection must be an OpenGL-style perspective projection (the camera
+  looks down -Z), optionally off-center. Not thread safe.
+
+==============================================================================*/
+struct S_EXPORT light_grid_t
+{
+  static const uint32_t DEFAULT_TILE_SIZE = 16;
+
+  explicit light_grid_t(uint32_t tile_size = DEFAULT_TILE_SIZE);
+  ~light_grid_t() = default;
+
+  light_grid_t(const light_grid_t &) = delete;
+  light_grid_t &operator = (const light_grid_t &) = delete;
+
+  // Sets the viewport size in pixels.
+  void            resize(uint32_t width, uint32_t height);
+  uint32_t        tile_size() const;
+  uint32_t        tiles_x() const;
+  uint32_t        tiles_y() const;
+
+  void            clear_lights();
+  // Adds a light in world space and returns its index.
+  uint32_t        add_light(const vec3f_t &position, float radius);
+  // Adds every point light, using world matrices as of the last
+  // transform_store_t::update_world().
+  void            add_point_lights();
+  size_t          light_count() const;
+  const std::vector<point_light_t *> &point_lights() const;
+
+  void            bin(const mat4f_t &view, const mat4f_t &projection);
+
+  const std::vector<uint32_t> &tile_ranges() const;
+  const std::vector<uint32_t> &light_indices() const;
+  // Number of lights that landed in at least one tile in the last bin().
+  size_t          visible_count() const;
+
+private:
+  // Light bounds are computed in view space from these
+  struct frustum_t
+  {
+    float view[16];
+    float scale_x, offset_x;
+    float scale_y, offset_y;
+    float near_dist, far_dist;
+    // Tiles across the viewport, fractional
+    float extent_x, extent_y;
+  };
+
+  frustum_t       make_frustum(const mat4f_t &view, const mat4f_t &projection) const;
+  void            compute_rects_scalar(const frustum_t &frustum, size_t first, size_t count);
+  void            compute_rects_sse(const frustum_t &frustum, size_t first, size_t count);
+  void            fill_tiles();
+
+  uint32_t                tile_size_;
+  uint32_t                width_ = 0;
+  uint32_t                height_ = 0;
+  uint32_t                tiles_x_ = 0;
+  uint32_t                tiles_y_ = 0;
+
+  // Lights as columns, padded to a multiple of four with culled lights
+  std::vector<float>      lx_, ly_, lz_, lr_;
+  size_t                  light_count_ = 0;
+  std::vector<point_light_t *> point_lights_;
+
+  // Tile rectangles per light, inclusive. Culled lights have x0 > x1.
+  std::vector<int32_t>    x0_, y0_, x1_, y1_;
+
+  std::vector<uint32_t>   ranges_;
+  std::vector<uint32_t>   indices_;
+  std::vector<uint32_t>   cursors_;
+  size_t                  visible_ = 0;
+};
+
+
+} // namespace snow
+
+#endif /* end __SNOW__LIGHT_GRID_HH__ include guard */
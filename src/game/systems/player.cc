@@ -53,6 +53,9 @@ bool player_t::event(const event_t &event)
     window_size_ = event.window_size;
   } return false; // WINDOW_SIZE_EVENT
 
+  case NET_EVENT:
+    return !game_messages_t::dispatch(*this, *event.net);
+
   default: return true;
   }
 }
@@ -62,9 +65,16 @@ bool player_t::event(const event_t &event)
 void player_t::frame(double step, double timeslice)
 {
   if (!player_) {
-    // If no player is set, just forcibly grab the last object that has a
-    // player_mover component.
-    player_mover_t::apply_fn([&] (player_mover_t &mover) { player_ = mover.game_object; });
+    // If no player is set, take the only object with a player_mover
+    // component. The query's order isn't meaningful, so with several
+    // candidates the player must be chosen with set_player.
+    const object_query_t::object_list_t &movers = movers_.objects();
+    if (movers.size() == 1) {
+      set_player(movers.front());
+    } else if (movers.size() > 1) {
+      s_log_note("%zu objects can be the player, none set", movers.size());
+      return;
+    }
     if (!player_) {
       s_log_note("No player object found");
       return;
@@ -78,13 +88,130 @@ void player_t::frame(double step, double timeslice)
   if (glfwGetKey(window, GLFW_KEY_A)) move_direction_.x -= 1;
   if (glfwGetKey(window, GLFW_KEY_D)) move_direction_.x += 1;
 
-  vec2f_t delta = {
-    static_cast<float>(move_direction_.x),
-    static_cast<float>(move_direction_.y)
+  const player_input_t input = {
+    static_cast<int8_t>(move_direction_.x),
+    static_cast<int8_t>(move_direction_.y)
   };
-  delta.normalize().scale(4.0f);
 
-  player_->get_component<player_mover_t>()->move(delta);
+  player_->get_component<player_mover_t>()->apply(input, speed());
+  prediction_.record(tick_, input, player_->get_component<transform_t>()->translation());
+  send_input();
+  ++tick_;
+
+  correction_.x *= CORRECTION_DECAY;
+  correction_.y *= CORRECTION_DECAY;
+  correction_.z *= CORRECTION_DECAY;
+}
+
+
+
+void player_t::set_player(game_object_t *player)
+{
+  player_ = player;
+  prediction_.clear();
+  acked_ = false;
+  correction_ = vec3f_t::zero;
+  if (player_) {
+    origin_ = player_->get_component<transform_t>()->translation();
+  }
+}
+
+
+
+void player_t::set_send_fn(send_fn_t fn, void *context)
+{
+  send_fn_ = fn;
+  send_context_ = context;
+}
+
+
+
+void player_t::set_speed_cvar(const cvar_t *speed)
+{
+  speed_ = speed;
+}
+
+
+
+float player_t::speed() const
+{
+  return speed_ ? speed_->getf() : player_mover_t::SPEED;
+}
+
+
+
+// Sends this tick's input along with as many unacknowledged inputs before it
+// as fit in a message.
+void player_t::send_input()
+{
+  if (send_fn_ == NULL) {
+    return;
+  }
+
+  player_input_msg_t msg;
+  msg.tick = tick_;
+  msg.count = 1;
+  while (msg.count < player_input_msg_t::MAX_INPUTS &&
+         (!acked_ || tick_ - msg.count != acked_tick_) &&
+         prediction_.find(tick_ - msg.count) != NULL) {
+    msg.count += 1;
+  }
+  for (uint32_t index = 0; index < msg.count; ++index) {
+    msg.inputs[index] = prediction_.find(tick_ - msg.count + 1 + index)->input;
+  }
+  msg.has_origin = !acked_;
+  msg.origin = origin_;
+
+  netevent_t event;
+  game_messages_t::write(msg, event);
+  send_fn_(send_context_, event);
+}
+
+
+
+void player_t::correct(uint32_t tick, const vec3f_t &position)
+{
+  if (!player_) {
+    return;
+  }
+
+  transform_t *transform = player_->get_component<transform_t>();
+  const prediction_t::snapshot_t *snapshot = prediction_.find(tick);
+  if (snapshot == NULL) {
+    // Too old (or too new) to reconcile, so take the server's word for it
+    s_log_warning("Player correction for tick %u is outside the prediction window", tick);
+    transform->set_translation(position);
+    prediction_.clear();
+    return;
+  }
+
+  const vec3f_t error = snapshot->state - position;
+  if (error.length() < CORRECTION_EPSILON) {
+    return;
+  }
+
+  const vec3f_t predicted = transform->translation();
+  const float speed = this->speed();
+  const vec3f_t corrected = prediction_.replay(tick, position,
+    [speed](vec3f_t &state, const player_input_t &input) {
+      player_mover_t::simulate(state, input, speed);
+    });
+  transform->set_translation(corrected);
+  // Keep drawing the player where it was and let the offset decay
+  correction_ += predicted - corrected;
+}
+
+
+
+void player_t::on_message(const player_correction_msg_t &msg, const netevent_t &event)
+{
+  // Corrections are sent unreliably, so one may arrive after a newer one
+  if (acked_ && static_cast<int32_t>(msg.tick - acked_tick_) <= 0) {
+    return;
+  }
+  acked_tick_ = msg.tick;
+  acked_ = true;
+  correct(msg.tick, msg.position);
 }
 
 
@@ -105,7 +232,7 @@ void player_t::draw(double timeslice)
 
   rmaterial_t::set_modelview(mat4f_t::identity);
   // truncate Z
-  const vec2f_t pos = player_->get_component<transform_t>()->translation();
+  const vec2f_t pos = player_->get_component<transform_t>()->translation() + correction_;
 
   drawer_.clear();
   drawer_.set_rotation(atan2(pos.y - mouse_pos_.y, mouse_pos_.x - pos.x) * S_RAD2DEG + 90);
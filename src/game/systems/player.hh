@@ -8,7 +8,12 @@
 
 #include "../../config.hh"
 #include "../system.hh"
+#include "../messages.hh"
+#include "../object_query.hh"
+#include "../snapshot_ring.hh"
+#include "../components/player_mover.hh"
 #include <snow/math/vec2.hh>
+#include <snow/math/vec3.hh>
 #include "../../renderer/buffer.hh"
 #include "../../renderer/draw_2d.hh"
 #include "../../renderer/vertex_array.hh"
@@ -18,11 +23,31 @@ namespace snow {
 
 
 struct game_object_t;
-struct player_mover_t;
 
 
+/*==============================================================================
+
+  Local player system. Input is applied immediately (predicted) and each tick
+  is recorded in a snapshot ring and sent to the server, along with any
+  earlier inputs the server hasn't acknowledged yet. The server applies the
+  inputs and answers with its position as of the newest tick it applied.
+  The player is rewound to that position and every input since is
+  re-simulated.
+  The difference between the old and new predictions is drawn as an offset
+  that decays over a few ticks, so corrections don't snap visibly.
+
+==============================================================================*/
 struct player_t : system_t
 {
+  // Ticks of prediction kept, enough to cover a round trip of 640ms
+  static const size_t PREDICTION_TICKS = 32;
+  // Fraction of the correction offset kept each tick
+  static constexpr float CORRECTION_DECAY = 0.75f;
+  // Corrections smaller than this are ignored
+  static constexpr float CORRECTION_EPSILON = 0.01f;
+
+  // Sends a netevent to the server, e.g. through client_t::send_netstate.
+  using send_fn_t = void (*)(void *context, const netevent_t &event);
 
   player_t();
   ~player_t() override;
@@ -31,18 +56,53 @@ struct player_t : system_t
   void frame(double step, double timeslice) override;
   void draw(double timeslice) override;
 
+  // Sets the object controlled by the player. If none is set, frame() takes
+  // the only object with a player_mover component, if there's exactly one.
   void set_player(game_object_t *player);
+  // Sets the function input is sent to the server with. Input isn't sent if
+  // fn is NULL.
+  void set_send_fn(send_fn_t fn, void *context);
+  // Sets the cvar movement speed is read from, as registered by
+  // player_mover_t::register_speed. player_mover_t::SPEED is used if NULL.
+  void set_speed_cvar(const cvar_t *speed);
+
+  // Reconciles the predicted player with its authoritative position at the
+  // given tick.
+  void correct(uint32_t tick, const vec3f_t &position);
+
+  // Dispatched from game_messages_t
+  void on_message(const player_correction_msg_t &msg, const netevent_t &event);
 
 private:
+  using prediction_t = snapshot_ring_t<vec3f_t, player_input_t, PREDICTION_TICKS>;
+
   vec2f_t mouse_pos_ = { 0, 0 };
   vec2f_t window_size_ = { 800, 600 };
   vec2_t<int> move_direction_ = { 0, 0 };
   game_object_t *player_ = nullptr;
+  // Objects that can be the player
+  object_query_t movers_ { component_mask({ PLAYER_COMPONENT }) };
+  uint32_t tick_ = 0;
+  prediction_t prediction_;
+  // Newest tick the server has applied input for
+  uint32_t acked_tick_ = 0;
+  bool acked_ = false;
+  // Where the player was when it was set, sent until the server
+  // acknowledges a tick
+  vec3f_t origin_ = { 0, 0, 0 };
+  const cvar_t *speed_ = NULL;
+  send_fn_t send_fn_ = NULL;
+  void *send_context_ = NULL;
+  // Offset from the simulated position to where the player is drawn
+  vec3f_t correction_ = { 0, 0, 0 };
   rmaterial_t *player_mat_ = nullptr;
   rdraw_2d_t drawer_;
   rbuffer_t vbuffer_;
   rbuffer_t ibuffer_;
   rvertex_array_t vao_;
+
+  float speed() const;
+  void send_input();
 };
 
 
@@ -0,0 +1,355 @@
+/*
+  bitstream.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "bitstream.hh"
+#include <cmath>
+
+
+namespace snow {
+
+
+namespace {
+
+
+inline uint32_t bit_mask(unsigned count)
+{
+  return count >= 32 ? 0xFFFFFFFFU : ((0x1U << count) - 1);
+}
+
+
+} // namespace <anon>
+
+
+
+/*******************************************************************************
+*                                quantization_t                                *
+*******************************************************************************/
+
+quantization_t::quantization_t(float min, float max, float precision) :
+  min_(min),
+  max_(max),
+  precision_(precision)
+{
+  if (!(max > min)) {
+    s_throw(std::invalid_argument, "Quantization range is empty");
+  } else if (!(precision > 0)) {
+    s_throw(std::invalid_argument, "Quantization precision must be positive");
+  }
+
+  const double steps = std::ceil(((double)max - (double)min) / (double)precision);
+  if (steps > (double)UINT32_MAX) {
+    s_throw(std::out_of_range, "Quantization requires more than 32 bits");
+  }
+
+  max_steps_ = static_cast<uint32_t>(steps);
+  bits_ = 0;
+  while (bits_ < 32 && (max_steps_ >> bits_) != 0) {
+    ++bits_;
+  }
+}
+
+
+
+unsigned quantization_t::bits() const
+{
+  return bits_;
+}
+
+
+
+uint32_t quantization_t::quantize(float value) const
+{
+  if (!(value > min_)) {
+    return 0;
+  } else if (!(value < max_)) {
+    return max_steps_;
+  }
+  const double steps = std::floor(((double)value - (double)min_) / (double)precision_ + 0.5);
+  return steps >= (double)max_steps_ ? max_steps_ : static_cast<uint32_t>(steps);
+}
+
+
+
+float quantization_t::dequantize(uint32_t steps) const
+{
+  if (steps >= max_steps_) {
+    return max_;
+  }
+  return static_cast<float>((double)min_ + (double)steps * (double)precision_);
+}
+
+
+
+/*******************************************************************************
+*                                 bit_writer_t                                 *
+*******************************************************************************/
+
+bit_writer_t::bit_writer_t(charbuf_t &buffer) :
+  buffer_(buffer),
+  start_length_(buffer.size())
+{
+  /* nop */
+}
+
+
+
+bit_writer_t::~bit_writer_t()
+{
+  if (scratch_bits_ > 0) {
+    s_log_warning("bit_writer_t destroyed with %u unflushed bits", scratch_bits_);
+  }
+}
+
+
+
+void bit_writer_t::write_bits(uint32_t value, unsigned count)
+{
+  assert(count <= 32);
+  scratch_ |= static_cast<uint64_t>(value & bit_mask(count)) << scratch_bits_;
+  scratch_bits_ += count;
+  while (scratch_bits_ >= 8) {
+    buffer_.push_back(static_cast<uint8_t>(scratch_));
+    scratch_ >>= 8;
+    scratch_bits_ -= 8;
+  }
+}
+
+
+
+void bit_writer_t::write_bool(bool value)
+{
+  write_bits(value ? 1 : 0, 1);
+}
+
+
+
+void bit_writer_t::write_varint(uint64_t value)
+{
+  while (value >= 0x80) {
+    write_bits(static_cast<uint32_t>(value & 0x7F) | 0x80, 8);
+    value >>= 7;
+  }
+  write_bits(static_cast<uint32_t>(value), 8);
+}
+
+
+
+void bit_writer_t::write_zigzag(int64_t value)
+{
+  write_varint(zigzag_encode(value));
+}
+
+
+
+void bit_writer_t::write_quantized(float value, const quantization_t &quant)
+{
+  write_bits(quant.quantize(value), quant.bits());
+}
+
+
+
+void bit_writer_t::write_bytes(const uint8_t *data, size_t length)
+{
+  align();
+  buffer_.insert(buffer_.end(), data, data + length);
+}
+
+
+
+void bit_writer_t::align()
+{
+  if (scratch_bits_ > 0) {
+    write_bits(0, 8 - scratch_bits_);
+  }
+}
+
+
+
+void bit_writer_t::flush()
+{
+  align();
+}
+
+
+
+size_t bit_writer_t::bit_length() const
+{
+  return (buffer_.size() - start_length_) * 8 + scratch_bits_;
+}
+
+
+
+/*******************************************************************************
+*                                 bit_reader_t                                 *
+*******************************************************************************/
+
+bit_reader_t::bit_reader_t(const uint8_t *data, size_t length) :
+  data_(data),
+  length_(data ? length : 0)
+{
+  /* nop */
+}
+
+
+
+uint32_t bit_reader_t::read_bits(unsigned count)
+{
+  assert(count <= 32);
+  if (failed_) {
+    return 0;
+  }
+
+  while (scratch_bits_ < count) {
+    if (offset_ >= length_) {
+      fail();
+      return 0;
+    }
+    scratch_ |= static_cast<uint64_t>(data_[offset_++]) << scratch_bits_;
+    scratch_bits_ += 8;
+  }
+
+  const uint32_t value = static_cast<uint32_t>(scratch_) & bit_mask(count);
+  scratch_ = count >= 64 ? 0 : (scratch_ >> count);
+  scratch_bits_ -= count;
+  return value;
+}
+
+
+
+bool bit_reader_t::read_bool()
+{
+  return read_bits(1) != 0;
+}
+
+
+
+uint64_t bit_reader_t::read_varint()
+{
+  uint64_t value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    const uint32_t group = read_bits(8);
+    if (shift == 63 && group > 1) {
+      break;
+    }
+    value |= static_cast<uint64_t>(group & 0x7F) << shift;
+    if ((group & 0x80) == 0) {
+      return failed_ ? 0 : value;
+    }
+  }
+  fail();
+  return 0;
+}
+
+
+
+int64_t bit_reader_t::read_zigzag()
+{
+  return zigzag_decode(read_varint());
+}
+
+
+
+float bit_reader_t::read_quantized(const quantization_t &quant)
+{
+  return quant.dequantize(read_bits(quant.bits()));
+}
+
+
+
+bool bit_reader_t::read_bytes(uint8_t *out, size_t length)
+{
+  align();
+  if (failed_ || length > length_ - offset_) {
+    fail();
+    return false;
+  }
+  memcpy(out, data_ + offset_, length);
+  offset_ += length;
+  return true;
+}
+
+
+
+void bit_reader_t::align()
+{
+  const unsigned partial = scratch_bits_ % 8;
+  if (partial > 0) {
+    read_bits(partial);
+  }
+}
+
+
+
+bool bit_reader_t::ok() const
+{
+  return !failed_;
+}
+
+
+
+size_t bit_reader_t::bits_remaining() const
+{
+  return failed_ ? 0 : (length_ - offset_) * 8 + scratch_bits_;
+}
+
+
+
+void bit_reader_t::fail()
+{
+  failed_ = true;
+  scratch_ = 0;
+  scratch_bits_ = 0;
+}
+
+
+
+/*******************************************************************************
+*                            byte-aligned varints                              *
+*******************************************************************************/
+
+size_t varint_length(uint64_t value)
+{
+  size_t length = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    ++length;
+  }
+  return length;
+}
+
+
+
+size_t write_varint(uint8_t *data, uint64_t value)
+{
+  size_t length = 0;
+  while (value >= 0x80) {
+    data[length++] = static_cast<uint8_t>(value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  data[length++] = static_cast<uint8_t>(value);
+  return length;
+}
+
+
+
+size_t read_varint(const uint8_t *data, size_t length, uint64_t &value)
+{
+  value = 0;
+  for (size_t index = 0; index < length && index < MAX_VARINT_LENGTH; ++index) {
+    // The last byte only has room for the 64th bit
+    if (index == MAX_VARINT_LENGTH - 1 && data[index] > 1) {
+      break;
+    }
+    value |= static_cast<uint64_t>(data[index] & 0x7F) << (7 * index);
+    if ((data[index] & 0x80) == 0) {
+      return index + 1;
+    }
+  }
+  value = 0;
+  return 0;
+}
+
+
+} // namespace snow
@@ -0,0 +1,207 @@
+/*
+  bitstream.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__BITSTREAM_HH__
+#define __SNOW__BITSTREAM_HH__
+
+#include "../config.hh"
+#include <cstdint>
+#include <vector>
+
+
+namespace snow {
+
+
+/*==============================================================================
+
+  Fixed-range float quantization. Values are clamped to [min, max] and stored
+  as an integer number of precision-sized steps from min using the fewest bits
+  that can hold every step.
+
+==============================================================================*/
+struct quantization_t
+{
+  quantization_t(float min, float max, float precision);
+
+  unsigned  bits() const;
+  uint32_t  quantize(float value) const;
+  float     dequantize(uint32_t steps) const;
+
+private:
+  float     min_;
+  float     max_;
+  float     precision_;
+  uint32_t  max_steps_;
+  unsigned  bits_;
+};
+
+
+
+/*==============================================================================
+
+  Bit-level writer. Appends to a byte buffer, packing values LSB-first. Bits
+  are buffered in a 64-bit scratch word and written out a byte at a time, so
+  the resulting layout is independent of host endianness. flush() must be
+  called once done writing to write out any partial byte.
+
+  The writer and bit_reader_t share a set of serialize functions (bits, flag,
+  varint, zigzag, quantized) that take their values by reference, so a single
+  templated serialize(STREAM &) function can describe a message's layout for
+  both reading and writing. See netmessage.hh.
+
+==============================================================================*/
+struct bit_writer_t
+{
+  using charbuf_t = std::vector<uint8_t>;
+
+  static const bool IS_READING = false;
+  static const bool IS_WRITING = true;
+
+  explicit bit_writer_t(charbuf_t &buffer);
+  ~bit_writer_t();
+
+  bit_writer_t(const bit_writer_t &) = delete;
+  bit_writer_t &operator = (const bit_writer_t &) = delete;
+
+  // count must be in [0, 32]. Bits of value above count are ignored.
+  void      write_bits(uint32_t value, unsigned count);
+  void      write_bool(bool value);
+  // Variable-length integers: 7 bits per group plus a continuation bit.
+  void      write_varint(uint64_t value);
+  // Varint of a zigzag-encoded signed integer, so small negative values stay
+  // small.
+  void      write_zigzag(int64_t value);
+  void      write_quantized(float value, const quantization_t &quant);
+  // Pads to the next byte boundary, then writes the bytes.
+  void      write_bytes(const uint8_t *data, size_t length);
+  // Pads with zero bits to the next byte boundary.
+  void      align();
+  // Writes any pending bits to the buffer.
+  void      flush();
+
+  // Number of bits written so far, including unflushed bits.
+  size_t    bit_length() const;
+
+  // Serialize interface
+  void      bits(uint32_t value, unsigned count) { write_bits(value, count); }
+  void      flag(bool value)                     { write_bool(value); }
+  void      varint(uint64_t value)               { write_varint(value); }
+  void      zigzag(int64_t value)                { write_zigzag(value); }
+  void      quantized(float value, const quantization_t &quant)
+                                                 { write_quantized(value, quant); }
+  bool      ok() const                           { return true; }
+
+private:
+  charbuf_t & buffer_;
+  uint64_t    scratch_ = 0;
+  unsigned    scratch_bits_ = 0;
+  size_t      start_length_;
+};
+
+
+
+/*==============================================================================
+
+  Bit-level reader for data written by bit_writer_t. Reading past the end of
+  the data or reading an overlong varint marks the reader as failed, after
+  which every read returns zero. Check ok() once done reading rather than
+  after every read.
+
+==============================================================================*/
+struct bit_reader_t
+{
+  static const bool IS_READING = true;
+  static const bool IS_WRITING = false;
+
+  bit_reader_t(const uint8_t *data, size_t length);
+
+  uint32_t  read_bits(unsigned count);
+  bool      read_bool();
+  uint64_t  read_varint();
+  int64_t   read_zigzag();
+  float     read_quantized(const quantization_t &quant);
+  // Skips to the next byte boundary, then copies length bytes to out.
+  bool      read_bytes(uint8_t *out, size_t length);
+  void      align();
+
+  bool      ok() const;
+  // Marks the reader as failed, e.g. when a serialize function finds a value
+  // it can't accept.
+  void      fail();
+  // Number of bits not yet read (includes padding in the final byte).
+  size_t    bits_remaining() const;
+
+  // Serialize interface
+  template <typename T>
+  void      bits(T &value, unsigned count)  { value = static_cast<T>(read_bits(count)); }
+  void      flag(bool &value)               { value = read_bool(); }
+  template <typename T>
+  void      varint(T &value);
+  template <typename T>
+  void      zigzag(T &value);
+  void      quantized(float &value, const quantization_t &quant)
+                                            { value = read_quantized(quant); }
+
+private:
+  const uint8_t * data_;
+  size_t          length_;
+  size_t          offset_ = 0;
+  uint64_t        scratch_ = 0;
+  unsigned        scratch_bits_ = 0;
+  bool            failed_ = false;
+};
+
+
+
+template <typename T>
+void bit_reader_t::varint(T &value)
+{
+  const uint64_t read = read_varint();
+  value = static_cast<T>(read);
+  // Reject values that don't fit the field they're read into
+  if (static_cast<uint64_t>(value) != read) {
+    fail();
+  }
+}
+
+
+
+template <typename T>
+void bit_reader_t::zigzag(T &value)
+{
+  const int64_t read = read_zigzag();
+  value = static_cast<T>(read);
+  if (static_cast<int64_t>(value) != read) {
+    fail();
+  }
+}
+
+
+
+/*==============================================================================
+  Byte-aligned varint helpers for fixed headers that don't need bit packing.
+  read_varint returns the number of bytes read, or zero if the varint is
+  truncated or overlong.
+==============================================================================*/
+const size_t MAX_VARINT_LENGTH = 10;
+
+size_t    varint_length(uint64_t value);
+size_t    write_varint(uint8_t *data, uint64_t value);
+size_t    read_varint(const uint8_t *data, size_t length, uint64_t &value);
+
+inline uint64_t zigzag_encode(int64_t value)
+{
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t value)
+{
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 0x1);
+}
+
+
+} // namespace snow
+
+#endif /* end __SNOW__BITSTREAM_HH__ include guard */
@@ -0,0 +1,641 @@
+/*
+  netbulk.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "netbulk.hh"
+#include "bitstream.hh"
+#include "netmessage_registry.hh"
+#include <snow-ext/hash.hh>
+#include <algorithm>
+#include <limits>
+
+
+namespace snow {
+
+
+namespace {
+
+
+struct netbulk_begin_msg_t
+{
+  uint32_t  id;
+  uint32_t  tag;
+  uint64_t  length;
+  uint64_t  hash;
+
+  template <typename STREAM>
+  void serialize(STREAM &stream)
+  {
+    uint32_t hash_lo = static_cast<uint32_t>(hash);
+    uint32_t hash_hi = static_cast<uint32_t>(hash >> 32);
+    stream.varint(id);
+    stream.varint(tag);
+    stream.varint(length);
+    stream.bits(hash_lo, 32);
+    stream.bits(hash_hi, 32);
+    hash = (static_cast<uint64_t>(hash_hi) << 32) | hash_lo;
+  }
+};
+
+
+struct netbulk_ack_msg_t
+{
+  uint32_t  id;
+  // Bytes the receiver has, which is where the sender continues from
+  uint64_t  offset;
+
+  template <typename STREAM>
+  void serialize(STREAM &stream)
+  {
+    stream.varint(id);
+    stream.varint(offset);
+  }
+};
+
+
+struct netbulk_cancel_msg_t
+{
+  uint32_t  id;
+  // Whether the transfer's sender cancelled it, as opposed to its receiver
+  bool      from_sender;
+  // Whether the receiver gave up because the data failed its integrity check
+  bool      failed;
+
+  template <typename STREAM>
+  void serialize(STREAM &stream)
+  {
+    stream.varint(id);
+    stream.flag(from_sender);
+    stream.flag(failed);
+  }
+};
+
+
+// Chunks are framed by hand so their data can be copied straight into the
+// payload: [varint id][varint offset][data...]
+using netbulk_registry_t = netmessage_registry_t<
+  netmessage_def_t<NET_BULK_BEGIN, netbulk_begin_msg_t, 11, 28>,
+  netmessage_def_t<NET_BULK_ACK, netbulk_ack_msg_t, 2, 15>,
+  netmessage_def_t<NET_BULK_CANCEL, netbulk_cancel_msg_t, 2, 6>
+  >;
+
+
+const double UNLIMITED = std::numeric_limits<double>::infinity();
+
+
+inline uint64_t payload_hash(const netbulk_t::charbuf_t &data)
+{
+  return murmur3::hash64((const char *)data.data(), data.size());
+}
+
+
+
+// Smallest nonzero of the two limits, or zero if neither is set
+inline uint32_t min_limit(uint32_t lhs, uint32_t rhs)
+{
+  if (lhs == 0) {
+    return rhs;
+  } else if (rhs == 0) {
+    return lhs;
+  }
+  return std::min(lhs, rhs);
+}
+
+
+} // namespace <anon>
+
+
+
+const size_t netbulk_t::CHUNK_LENGTH;
+const size_t netbulk_t::DEFAULT_WINDOW;
+const size_t netbulk_t::ACK_INTERVAL;
+const uint64_t netbulk_t::MAX_TRANSFER_LENGTH;
+const size_t netbulk_t::MAX_PARTIALS;
+const size_t netbulk_t::MAX_FINISHED;
+constexpr double netbulk_t::DEFAULT_SHARE;
+
+
+
+struct netbulk_t::handler_t
+{
+  netbulk_t & bulk;
+  ENetPeer *  peer;
+
+  void on_message(const netbulk_begin_msg_t &msg, const netevent_t &)
+  {
+    bulk.begin_incoming(peer, msg.id, msg.tag, msg.length, msg.hash);
+  }
+
+  void on_message(const netbulk_ack_msg_t &msg, const netevent_t &)
+  {
+    outgoing_t *outgoing = bulk.find_outgoing(peer, msg.id);
+    if (outgoing == NULL || msg.offset > outgoing->data.size()) {
+      return;
+    }
+
+    const size_t offset = static_cast<size_t>(msg.offset);
+    if (outgoing->status == NET_BULK_WAITING) {
+      // The first acknowledgement says where to start -- past zero if the
+      // receiver is resuming a partial transfer
+      outgoing->status = NET_BULK_SENDING;
+      outgoing->sent = offset;
+    }
+    outgoing->acked = std::max(outgoing->acked, offset);
+    outgoing->sent = std::max(outgoing->sent, offset);
+
+    if (outgoing->acked == outgoing->data.size()) {
+      bulk.stats_.transfers_sent += 1;
+      bulk.finish_outgoing(*outgoing, NET_BULK_DONE);
+    }
+  }
+
+  void on_message(const netbulk_cancel_msg_t &msg, const netevent_t &)
+  {
+    if (msg.from_sender) {
+      incoming_t *incoming = bulk.find_incoming(peer, msg.id);
+      if (incoming != NULL) {
+        bulk.stats_.transfers_cancelled += 1;
+        bulk.remove_incoming(*incoming);
+      }
+    } else {
+      outgoing_t *outgoing = bulk.find_outgoing(peer, msg.id);
+      if (outgoing == NULL) {
+        return;
+      } else if (msg.failed) {
+        bulk.stats_.transfers_failed += 1;
+        bulk.finish_outgoing(*outgoing, NET_BULK_FAILED);
+      } else {
+        bulk.stats_.transfers_cancelled += 1;
+        bulk.finish_outgoing(*outgoing, NET_BULK_CANCELLED);
+      }
+    }
+  }
+};
+
+
+
+void netbulk_t::set_receive_fn(receive_fn_t fn)
+{
+  receive_fn_ = std::move(fn);
+}
+
+
+
+void netbulk_t::set_bandwidth(uint32_t bytes_per_second)
+{
+  bandwidth_ = bytes_per_second;
+}
+
+
+
+void netbulk_t::set_share(double share)
+{
+  if (!(share > 0 && share <= 1)) {
+    s_throw(std::invalid_argument, "Bulk bandwidth share must be in (0, 1]");
+  }
+  share_ = share;
+}
+
+
+
+void netbulk_t::set_window(size_t bytes)
+{
+  if (bytes < 2 * ACK_INTERVAL) {
+    s_throw(std::invalid_argument, "Bulk window must be at least twice the ack interval");
+  }
+  window_ = bytes;
+}
+
+
+
+void netbulk_t::set_info_fn(netpeer_info_fn_t fn, void *context)
+{
+  info_fn_ = fn;
+  info_context_ = context;
+}
+
+
+
+uint32_t netbulk_t::send(ENetPeer *peer, uint32_t tag, charbuf_t data)
+{
+  if (peer == NULL) {
+    s_throw(std::invalid_argument, "ENetPeer is null");
+  } else if (data.size() > MAX_TRANSFER_LENGTH) {
+    s_throw(std::invalid_argument, "Bulk transfer is too large");
+  }
+
+  track(peer);
+  const uint32_t id = next_id_++;
+  const uint64_t hash = payload_hash(data);
+
+  netevent_t begin;
+  netbulk_registry_t::write(netbulk_begin_msg_t { id, tag, data.size(), hash }, begin);
+  control_.push_back({ peer, std::move(begin) });
+
+  outgoing_.push_back({ peer, id, tag, hash, NET_BULK_WAITING, std::move(data), 0, 0 });
+  return id;
+}
+
+
+
+void netbulk_t::cancel(uint32_t id)
+{
+  outgoing_t *outgoing = find_outgoing(id);
+  if (outgoing == NULL) {
+    return;
+  }
+  send_cancel(outgoing->peer, id, true);
+  stats_.transfers_cancelled += 1;
+  finish_outgoing(*outgoing, NET_BULK_CANCELLED);
+}
+
+
+
+void netbulk_t::cancel_incoming(ENetPeer *peer, uint32_t id)
+{
+  incoming_t *incoming = find_incoming(peer, id);
+  if (incoming == NULL) {
+    return;
+  }
+  send_cancel(peer, id, false);
+  stats_.transfers_cancelled += 1;
+  remove_incoming(*incoming);
+}
+
+
+
+netbulk_status_t netbulk_t::status(uint32_t id) const
+{
+  const outgoing_t *outgoing = find_outgoing(id);
+  if (outgoing != NULL) {
+    return outgoing->status;
+  }
+  for (const auto &finished : finished_) {
+    if (finished.first == id) {
+      return finished.second;
+    }
+  }
+  return NET_BULK_NONE;
+}
+
+
+
+double netbulk_t::progress(uint32_t id) const
+{
+  const outgoing_t *outgoing = find_outgoing(id);
+  if (outgoing == NULL) {
+    return status(id) == NET_BULK_DONE ? 1.0 : 0.0;
+  } else if (outgoing->data.empty()) {
+    return 0.0;
+  }
+  return static_cast<double>(outgoing->acked) / outgoing->data.size();
+}
+
+
+
+bool netbulk_t::handle(ENetPeer *peer, const netevent_t &event)
+{
+  const uint16_t message = event.message();
+  if (message < NET_BULK_BEGIN || message > NET_BULK_CANCEL) {
+    return false;
+  }
+
+  track(peer);
+  if (message == NET_BULK_CHUNK) {
+    receive_chunk(peer, event.payload(), event.payload_length());
+  } else {
+    handler_t handler { *this, peer };
+    if (!netbulk_registry_t::dispatch(handler, event)) {
+      s_log_warning("Rejected malformed bulk transfer message %u", (unsigned)message);
+    }
+  }
+  return true;
+}
+
+
+
+void netbulk_t::update(netevent_batch_t &batch, double tick_length)
+{
+  // Peers reused for another connection are dropped before anything queued
+  // for the old one can go out. Dropping a peer only removes its own budget,
+  // so iterating down from the end doesn't skip any.
+  for (size_t index = budgets_.size(); index-- > 0;) {
+    budget_t &budget = budgets_[index];
+    const netpeer_info_t info = netpeer_info(budget.peer, info_fn_, info_context_);
+    if (info.generation != budget.generation) {
+      drop(budget.peer);
+      continue;
+    }
+    budget.bytes = std::min(budget.bytes + bytes_per_tick(info, tick_length),
+      static_cast<double>(window_));
+  }
+
+  for (control_t &control : control_) {
+    batch.queue(control.peer, NET_BULK_CHANNEL, control.event, ENET_PACKET_FLAG_RELIABLE);
+  }
+  control_.clear();
+
+  // Transfers to the same peer share its budget, oldest first
+  for (outgoing_t &outgoing : outgoing_) {
+    if (outgoing.status != NET_BULK_SENDING) {
+      continue;
+    }
+
+    double &budget = track(outgoing.peer).bytes;
+    while (outgoing.sent < outgoing.data.size() &&
+           outgoing.sent - outgoing.acked < window_) {
+      const size_t length = std::min(CHUNK_LENGTH, outgoing.data.size() - outgoing.sent);
+      if (budget < static_cast<double>(length)) {
+        break;
+      }
+      send_chunk(outgoing, batch);
+      budget -= static_cast<double>(length);
+    }
+  }
+}
+
+
+
+void netbulk_t::drop(ENetPeer *peer)
+{
+  for (const outgoing_t &outgoing : outgoing_) {
+    if (outgoing.peer == peer) {
+      stats_.transfers_failed += 1;
+      finished_.emplace_back(outgoing.id, NET_BULK_FAILED);
+    }
+  }
+  outgoing_.erase(std::remove_if(outgoing_.begin(), outgoing_.end(),
+    [peer](const outgoing_t &outgoing) { return outgoing.peer == peer; }),
+    outgoing_.end());
+  while (finished_.size() > MAX_FINISHED) {
+    finished_.pop_front();
+  }
+
+  for (incoming_t &incoming : incoming_) {
+    if (incoming.peer == peer && incoming.received > 0) {
+      incoming.peer = NULL;
+      partials_.push_back(std::move(incoming));
+    }
+  }
+  incoming_.erase(std::remove_if(incoming_.begin(), incoming_.end(),
+    [peer](const incoming_t &incoming) {
+      return incoming.peer == peer || incoming.peer == NULL;
+    }),
+    incoming_.end());
+  while (partials_.size() > MAX_PARTIALS) {
+    partials_.pop_front();
+  }
+
+  control_.erase(std::remove_if(control_.begin(), control_.end(),
+    [peer](const control_t &control) { return control.peer == peer; }),
+    control_.end());
+  budgets_.erase(std::remove_if(budgets_.begin(), budgets_.end(),
+    [peer](const budget_t &budget) { return budget.peer == peer; }),
+    budgets_.end());
+}
+
+
+
+netbulk_stats_t netbulk_t::stats() const
+{
+  return stats_;
+}
+
+
+
+auto netbulk_t::find_outgoing(uint32_t id) -> outgoing_t *
+{
+  for (outgoing_t &outgoing : outgoing_) {
+    if (outgoing.id == id) {
+      return &outgoing;
+    }
+  }
+  return NULL;
+}
+
+
+
+auto netbulk_t::find_outgoing(uint32_t id) const -> const outgoing_t *
+{
+  for (const outgoing_t &outgoing : outgoing_) {
+    if (outgoing.id == id) {
+      return &outgoing;
+    }
+  }
+  return NULL;
+}
+
+
+
+auto netbulk_t::find_outgoing(ENetPeer *peer, uint32_t id) -> outgoing_t *
+{
+  outgoing_t *outgoing = find_outgoing(id);
+  return outgoing != NULL && outgoing->peer == peer ? outgoing : NULL;
+}
+
+
+
+auto netbulk_t::find_incoming(ENetPeer *peer, uint32_t id) -> incoming_t *
+{
+  for (incoming_t &incoming : incoming_) {
+    if (incoming.peer == peer && incoming.id == id) {
+      return &incoming;
+    }
+  }
+  return NULL;
+}
+
+
+
+void netbulk_t::begin_incoming(ENetPeer *peer, uint32_t id, uint32_t tag,
+  uint64_t length, uint64_t hash)
+{
+  if (length > MAX_TRANSFER_LENGTH) {
+    s_log_warning("Refusing bulk transfer of %llu bytes", (unsigned long long)length);
+    send_cancel(peer, id, false, true);
+    return;
+  } else if (find_incoming(peer, id) != NULL) {
+    return;
+  }
+
+  auto partial = std::find_if(partials_.begin(), partials_.end(),
+    [&](const incoming_t &incoming) {
+      return incoming.tag == tag && incoming.hash == hash && incoming.data.size() == length;
+    });
+
+  if (partial != partials_.end()) {
+    incoming_.push_back(std::move(*partial));
+    partials_.erase(partial);
+    stats_.bytes_resumed += incoming_.back().received;
+  } else {
+    incoming_.push_back({ NULL, id, tag, hash, charbuf_t(static_cast<size_t>(length)), 0, 0 });
+  }
+
+  incoming_t &incoming = incoming_.back();
+  incoming.peer = peer;
+  incoming.id = id;
+  incoming.acked = incoming.received;
+  send_ack(peer, id, incoming.received);
+
+  if (incoming.received == incoming.data.size()) {
+    complete_incoming(incoming);
+  }
+}
+
+
+
+void netbulk_t::receive_chunk(ENetPeer *peer, const uint8_t *data, size_t length)
+{
+  uint64_t id = 0;
+  uint64_t offset = 0;
+  size_t read = read_varint(data, length, id);
+  size_t header = read;
+  if (read > 0) {
+    read = read_varint(data + header, length - header, offset);
+    header += read;
+  }
+  if (read == 0) {
+    s_log_warning("Rejected malformed bulk transfer chunk");
+    return;
+  }
+
+  incoming_t *incoming = find_incoming(peer, static_cast<uint32_t>(id));
+  const size_t chunk_length = length - header;
+  // Chunks arrive in order on the reliable channel, so anything else is left
+  // over from before the transfer was resumed
+  if (incoming == NULL || offset != incoming->received ||
+      chunk_length > incoming->data.size() - incoming->received) {
+    return;
+  }
+
+  memcpy(incoming->data.data() + incoming->received, data + header, chunk_length);
+  incoming->received += chunk_length;
+  stats_.bytes_received += chunk_length;
+
+  if (incoming->received == incoming->data.size()) {
+    complete_incoming(*incoming);
+  } else if (incoming->received - incoming->acked >= ACK_INTERVAL) {
+    incoming->acked = incoming->received;
+    send_ack(peer, incoming->id, incoming->received);
+  }
+}
+
+
+
+void netbulk_t::complete_incoming(incoming_t &incoming)
+{
+  if (payload_hash(incoming.data) != incoming.hash) {
+    s_log_error("Bulk transfer %u failed its integrity check", incoming.id);
+    send_cancel(incoming.peer, incoming.id, false, true);
+    stats_.transfers_failed += 1;
+    remove_incoming(incoming);
+    return;
+  }
+
+  send_ack(incoming.peer, incoming.id, incoming.data.size());
+  stats_.transfers_received += 1;
+
+  ENetPeer *const peer = incoming.peer;
+  const uint32_t tag = incoming.tag;
+  charbuf_t data = std::move(incoming.data);
+  remove_incoming(incoming);
+
+  if (receive_fn_) {
+    receive_fn_(peer, tag, std::move(data));
+  }
+}
+
+
+
+void netbulk_t::remove_incoming(incoming_t &incoming)
+{
+  const size_t index = &incoming - incoming_.data();
+  incoming_.erase(incoming_.begin() + index);
+}
+
+
+
+void netbulk_t::finish_outgoing(outgoing_t &outgoing, netbulk_status_t status)
+{
+  finished_.emplace_back(outgoing.id, status);
+  if (finished_.size() > MAX_FINISHED) {
+    finished_.pop_front();
+  }
+  const size_t index = &outgoing - outgoing_.data();
+  outgoing_.erase(outgoing_.begin() + index);
+}
+
+
+
+void netbulk_t::send_ack(ENetPeer *peer, uint32_t id, uint64_t offset)
+{
+  netevent_t ack;
+  netbulk_registry_t::write(netbulk_ack_msg_t { id, offset }, ack);
+  control_.push_back({ peer, std::move(ack) });
+}
+
+
+
+void netbulk_t::send_cancel(ENetPeer *peer, uint32_t id, bool from_sender, bool failed)
+{
+  netevent_t cancel;
+  netbulk_registry_t::write(netbulk_cancel_msg_t { id, from_sender, failed }, cancel);
+  control_.push_back({ peer, std::move(cancel) });
+}
+
+
+
+auto netbulk_t::track(ENetPeer *peer) -> budget_t &
+{
+  const enet_uint32 generation = netpeer_info(peer, info_fn_, info_context_).generation;
+  for (budget_t &budget : budgets_) {
+    if (budget.peer != peer) {
+      continue;
+    } else if (budget.generation == generation) {
+      return budget;
+    }
+    drop(peer);
+    break;
+  }
+  // New peers start with nothing rather than a full window, so a transfer
+  // doesn't open with a burst
+  budgets_.push_back({ peer, generation, 0.0 });
+  return budgets_.back();
+}
+
+
+
+double netbulk_t::bytes_per_tick(const netpeer_info_t &info, double tick_length) const
+{
+  const uint32_t limit = min_limit(info.incoming_bandwidth, info.outgoing_bandwidth);
+  double rate = limit == 0 ? UNLIMITED : static_cast<double>(limit) * share_;
+  if (bandwidth_ != 0) {
+    rate = std::min(rate, static_cast<double>(bandwidth_));
+  }
+  return rate * tick_length;
+}
+
+
+
+void netbulk_t::send_chunk(outgoing_t &outgoing, netevent_batch_t &batch)
+{
+  const size_t length = std::min(CHUNK_LENGTH, outgoing.data.size() - outgoing.sent);
+
+  charbuf_t payload(2 * MAX_VARINT_LENGTH + length);
+  size_t header = write_varint(payload.data(), outgoing.id);
+  header += write_varint(payload.data() + header, outgoing.sent);
+  memcpy(payload.data() + header, outgoing.data.data() + outgoing.sent, length);
+  payload.resize(header + length);
+
+  netevent_t chunk;
+  chunk.set_message(NET_BULK_CHUNK);
+  chunk.set_buffer(std::move(payload));
+  batch.queue(outgoing.peer, NET_BULK_CHANNEL, chunk, ENET_PACKET_FLAG_RELIABLE);
+
+  outgoing.sent += length;
+  stats_.bytes_sent += length;
+}
+
+
+} // namespace snow
@@ -0,0 +1,234 @@
+/*
+  netbulk.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__NETBULK_HH__
+#define __SNOW__NETBULK_HH__
+
+#include "../config.hh"
+#include "netevent.hh"
+#include "netevent_batch.hh"
+#include <enet/enet.h>
+#include <deque>
+#include <functional>
+#include <vector>
+
+
+namespace snow {
+
+
+// ENet channel reserved for bulk transfers, so real-time messages on other
+// channels are never sequenced behind bulk data.
+const enet_uint8 NET_BULK_CHANNEL = 2;
+// Number of channels hosts and connections must be created with.
+const size_t NET_CHANNEL_COUNT = NET_BULK_CHANNEL + 1;
+
+
+enum netbulk_message_id_t : uint16_t
+{
+  NET_BULK_BEGIN = 16,
+  NET_BULK_CHUNK,
+  NET_BULK_ACK,
+  NET_BULK_CANCEL
+};
+
+
+enum netbulk_status_t : int
+{
+  // Unknown transfer, or one finished long enough ago to be forgotten
+  NET_BULK_NONE,
+  // Waiting for the receiver to say where to start
+  NET_BULK_WAITING,
+  NET_BULK_SENDING,
+  NET_BULK_DONE,
+  NET_BULK_CANCELLED,
+  // Disconnected, or the receiver rejected the data
+  NET_BULK_FAILED
+};
+
+
+struct netbulk_stats_t
+{
+  uint64_t  bytes_sent;
+  uint64_t  bytes_received;
+  // Bytes a receiver already had when a transfer was resumed
+  uint64_t  bytes_resumed;
+  uint64_t  transfers_sent;
+  uint64_t  transfers_received;
+  uint64_t  transfers_cancelled;
+  uint64_t  transfers_failed;
+};
+
+
+/*==============================================================================
+
+  Chunked transfers of large payloads (level data, cvar dumps, assets) over
+  NET_BULK_CHANNEL. A payload is never built into a single netevent. The
+  sender cuts it into CHUNK_LENGTH chunks as bandwidth allows, and the
+  receiver assembles them and checks the whole payload against its murmur3
+  hash before handing it over.
+
+  Flow control is two-fold. Each peer's bulk traffic gets a share of its
+  bandwidth (the same limits netscheduler_t uses), and no more than a window
+  of unacknowledged bytes is ever handed to ENet. Bounding what's queued in
+  ENet keeps real-time packets from waiting behind bulk data in the peer's
+  outgoing queue.
+
+  If a peer disconnects mid-transfer, the receiver keeps the partial payload.
+  Sending the same payload again (same tag, length and hash) resumes from
+  where the receiver left off. Either side can cancel a transfer.
+
+  Bandwidth is looked up with the info function (see netpeer_info_t), so a
+  peer whose host is serviced by netio_t must use netio_t::info_fn. A peer
+  reused for another connection is dropped as though it had disconnected.
+
+  Both sides of a connection need a netbulk_t. Received netevents go through
+  handle(), which consumes bulk messages, and update() is called once a tick
+  to send chunks and acknowledgements. Not thread safe.
+
+==============================================================================*/
+struct netbulk_t
+{
+  using charbuf_t = std::vector<uint8_t>;
+  // Called with each payload received and verified
+  using receive_fn_t = std::function<void(ENetPeer *peer, uint32_t tag, charbuf_t &&data)>;
+
+  static const size_t   CHUNK_LENGTH = 1024;
+  static const size_t   DEFAULT_WINDOW = 16 * CHUNK_LENGTH;
+  // Receivers acknowledge progress every ACK_INTERVAL bytes
+  static const size_t   ACK_INTERVAL = 4 * CHUNK_LENGTH;
+  static const uint64_t MAX_TRANSFER_LENGTH = 64 * 1024 * 1024;
+  // Partial payloads kept around to resume from
+  static const size_t   MAX_PARTIALS = 4;
+  // Finished transfers whose status is remembered
+  static const size_t   MAX_FINISHED = 32;
+  // Fraction of a peer's bandwidth bulk transfers may use by default
+  static constexpr double DEFAULT_SHARE = 0.5;
+
+  netbulk_t() = default;
+  ~netbulk_t() = default;
+
+  netbulk_t(const netbulk_t &) = delete;
+  netbulk_t &operator = (const netbulk_t &) = delete;
+
+  void set_receive_fn(receive_fn_t fn);
+  // Caps bulk traffic to each peer in bytes per second. Zero for no cap
+  // beyond the peer's share.
+  void set_bandwidth(uint32_t bytes_per_second);
+  // Sets the fraction, in (0, 1], of each peer's bandwidth bulk traffic may
+  // use.
+  void set_share(double share);
+  // Sets the number of unacknowledged bytes allowed per transfer. Must be at
+  // least twice ACK_INTERVAL.
+  void set_window(size_t bytes);
+  // Sets the function used to look up peer bandwidth and generation. Peers
+  // are read directly if fn is NULL.
+  void set_info_fn(netpeer_info_fn_t fn, void *context);
+
+  // Starts sending data to the peer. tag is passed to the receiver to say
+  // what the data is. Returns the transfer's ID.
+  uint32_t send(ENetPeer *peer, uint32_t tag, charbuf_t data);
+  // Cancels an outgoing transfer.
+  void cancel(uint32_t id);
+  // Cancels a transfer being received from the peer.
+  void cancel_incoming(ENetPeer *peer, uint32_t id);
+
+  netbulk_status_t status(uint32_t id) const;
+  // Fraction of an outgoing transfer acknowledged by the receiver.
+  double progress(uint32_t id) const;
+
+  // Handles a bulk message from the peer. Returns false if the netevent isn't
+  // a bulk message.
+  bool handle(ENetPeer *peer, const netevent_t &event);
+  // Queues chunks and control messages for this tick.
+  void update(netevent_batch_t &batch, double tick_length);
+  // Forgets the peer. Outgoing transfers to it fail, and incoming ones are
+  // kept to be resumed.
+  void drop(ENetPeer *peer);
+
+  netbulk_stats_t stats() const;
+
+private:
+  struct outgoing_t
+  {
+    ENetPeer *        peer;
+    uint32_t          id;
+    uint32_t          tag;
+    uint64_t          hash;
+    netbulk_status_t  status;
+    charbuf_t         data;
+    // Bytes handed to ENet and bytes acknowledged
+    size_t            sent;
+    size_t            acked;
+  };
+
+  struct incoming_t
+  {
+    ENetPeer *        peer;
+    uint32_t          id;
+    uint32_t          tag;
+    uint64_t          hash;
+    charbuf_t         data;
+    size_t            received;
+    size_t            acked;
+  };
+
+  struct control_t
+  {
+    ENetPeer *        peer;
+    netevent_t        event;
+  };
+
+  // One per peer with transfers or control messages
+  struct budget_t
+  {
+    ENetPeer *        peer;
+    // Generation of the connection everything kept for the peer is for
+    enet_uint32       generation;
+    double            bytes;
+  };
+
+  // Dispatch target for control messages from a peer
+  struct handler_t;
+
+  outgoing_t *find_outgoing(uint32_t id);
+  const outgoing_t *find_outgoing(uint32_t id) const;
+  outgoing_t *find_outgoing(ENetPeer *peer, uint32_t id);
+  incoming_t *find_incoming(ENetPeer *peer, uint32_t id);
+
+  void begin_incoming(ENetPeer *peer, uint32_t id, uint32_t tag, uint64_t length, uint64_t hash);
+  void receive_chunk(ENetPeer *peer, const uint8_t *data, size_t length);
+  void complete_incoming(incoming_t &incoming);
+  void remove_incoming(incoming_t &incoming);
+  void finish_outgoing(outgoing_t &outgoing, netbulk_status_t status);
+  void send_ack(ENetPeer *peer, uint32_t id, uint64_t offset);
+  void send_cancel(ENetPeer *peer, uint32_t id, bool from_sender, bool failed = false);
+
+  // Returns the peer's budget, first dropping the peer if it's been reused
+  // for another connection since it was last seen
+  budget_t &track(ENetPeer *peer);
+  double bytes_per_tick(const netpeer_info_t &info, double tick_length) const;
+  void send_chunk(outgoing_t &outgoing, netevent_batch_t &batch);
+
+  receive_fn_t            receive_fn_ { };
+  uint32_t                bandwidth_ = 0;
+  double                  share_ = DEFAULT_SHARE;
+  size_t                  window_ = DEFAULT_WINDOW;
+  netpeer_info_fn_t       info_fn_ = NULL;
+  void *                  info_context_ = NULL;
+  uint32_t                next_id_ = 1;
+  std::vector<outgoing_t> outgoing_ { };
+  std::vector<incoming_t> incoming_ { };
+  // Incoming transfers interrupted by a disconnect, oldest first
+  std::deque<incoming_t>  partials_ { };
+  std::deque<std::pair<uint32_t, netbulk_status_t>> finished_ { };
+  std::vector<control_t>  control_ { };
+  std::vector<budget_t>   budgets_ { };
+  netbulk_stats_t         stats_ { 0, 0, 0, 0, 0, 0, 0 };
+};
+
+
+} // namespace snow
+
+#endif /* end __SNOW__NETBULK_HH__ include guard */
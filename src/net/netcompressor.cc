@@ -0,0 +1,464 @@
+/*
+  netcompressor.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "netcompressor.hh"
+#include <chrono>
+
+
+namespace snow {
+
+
+namespace {
+
+
+const unsigned  HASH_BITS     = 12;
+const size_t    HASH_SIZE     = 0x1 << HASH_BITS;
+const uint32_t  EMPTY_SLOT    = UINT32_MAX;
+const size_t    MIN_MATCH     = 4;
+// Matches stop short of the end of input so the final sequence always has a
+// few literals, which keeps the match loop from reading past the input.
+const size_t    LAST_LITERALS = 5;
+const size_t    MAX_OFFSET    = 0xFFFF;
+const unsigned  RUN_MASK      = 0xF;
+
+
+using clock_t = std::chrono::steady_clock;
+
+
+inline uint64_t elapsed_nsec(const clock_t::time_point &start)
+{
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    clock_t::now() - start).count());
+}
+
+
+
+inline uint32_t read32(const uint8_t *p)
+{
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+
+
+inline uint32_t hash32(uint32_t sequence)
+{
+  return (sequence * 2654435761U) >> (32 - HASH_BITS);
+}
+
+
+
+// Writes the extended part of a length whose token nibble was saturated.
+// Returns false if out of space.
+inline bool write_length(uint8_t *&op, const uint8_t *out_end, size_t length)
+{
+  for (; length >= 255; length -= 255) {
+    if (op >= out_end) {
+      return false;
+    }
+    *op++ = 255;
+  }
+  if (op >= out_end) {
+    return false;
+  }
+  *op++ = static_cast<uint8_t>(length);
+  return true;
+}
+
+
+
+// Reads the extended part of a length. Returns false if the input ends first.
+inline bool read_length(const uint8_t *&ip, const uint8_t *in_end, size_t &length)
+{
+  uint8_t next;
+  do {
+    if (ip >= in_end) {
+      return false;
+    }
+    next = *ip++;
+    length += next;
+  } while (next == 255);
+  return true;
+}
+
+
+
+// Writes a sequence of literals followed by a match of match_length bytes
+// (zero for the final, literal-only sequence).
+bool write_sequence(uint8_t *&op, const uint8_t *out_end,
+  const uint8_t *literals, size_t literal_length,
+  size_t offset, size_t match_length)
+{
+  if (op >= out_end) {
+    return false;
+  }
+
+  uint8_t *token = op++;
+  *token = static_cast<uint8_t>(
+    (literal_length >= RUN_MASK ? RUN_MASK : literal_length) << 4);
+  if (literal_length >= RUN_MASK && !write_length(op, out_end, literal_length - RUN_MASK)) {
+    return false;
+  }
+
+  if (literal_length > static_cast<size_t>(out_end - op)) {
+    return false;
+  }
+  memcpy(op, literals, literal_length);
+  op += literal_length;
+
+  if (match_length == 0) {
+    return true;
+  }
+
+  if (out_end - op < 2) {
+    return false;
+  }
+  *op++ = static_cast<uint8_t>(offset & 0xFF);
+  *op++ = static_cast<uint8_t>(offset >> 8);
+
+  const size_t extra = match_length - MIN_MATCH;
+  *token |= static_cast<uint8_t>(extra >= RUN_MASK ? RUN_MASK : extra);
+  if (extra >= RUN_MASK && !write_length(op, out_end, extra - RUN_MASK)) {
+    return false;
+  }
+
+  return true;
+}
+
+
+} // namespace <anon>
+
+
+
+double netcompressor_stats_t::ratio() const
+{
+  return bytes_in > 0 ? static_cast<double>(bytes_out) / static_cast<double>(bytes_in) : 1.0;
+}
+
+
+
+netcompressor_t::netcompressor_t() :
+  dictionary_table_(HASH_SIZE, EMPTY_SLOT),
+  table_(HASH_SIZE, EMPTY_SLOT)
+{
+  /* nop */
+}
+
+
+
+void netcompressor_t::set_dictionary(const uint8_t *data, size_t length)
+{
+  if (length > MAX_DICTIONARY_LENGTH) {
+    data += length - MAX_DICTIONARY_LENGTH;
+    length = MAX_DICTIONARY_LENGTH;
+  }
+
+  dictionary_.assign(data, data + length);
+  // The window always begins with the dictionary, so only the datagram needs
+  // copying in per packet
+  window_ = dictionary_;
+  std::fill(dictionary_table_.begin(), dictionary_table_.end(), EMPTY_SLOT);
+  for (size_t index = 0; index + MIN_MATCH <= length; ++index) {
+    dictionary_table_[hash32(read32(data + index))] = static_cast<uint32_t>(index);
+  }
+}
+
+
+
+bool netcompressor_t::load_dictionary(const string &path)
+{
+  if (path.empty()) {
+    set_dictionary(NULL, 0);
+    return true;
+  }
+
+  PHYSFS_File *file = PHYSFS_openRead(path.c_str());
+  if (!file) {
+    s_log_error("Unable to open compression dictionary at '%s'", path.c_str());
+    return false;
+  }
+
+  const PHYSFS_sint64 length = PHYSFS_fileLength(file);
+  std::vector<uint8_t> buffer(length > 0 ? static_cast<size_t>(length) : 0);
+  const PHYSFS_sint64 read = PHYSFS_readBytes(file, buffer.data(), buffer.size());
+  PHYSFS_close(file);
+
+  if (length < 0 || read != length) {
+    s_log_error("Unable to read compression dictionary at '%s'", path.c_str());
+    return false;
+  }
+
+  set_dictionary(buffer.data(), buffer.size());
+  return true;
+}
+
+
+
+size_t netcompressor_t::dictionary_length() const
+{
+  return dictionary_.size();
+}
+
+
+
+void netcompressor_t::attach(ENetHost *host)
+{
+  if (host == NULL) {
+    s_throw(std::invalid_argument, "ENetHost is null");
+  }
+
+  // The compressor's lifetime is managed by its owner, so no destroy callback
+  ENetCompressor compressor;
+  compressor.context = this;
+  compressor.compress = enet_compress;
+  compressor.decompress = enet_decompress;
+  compressor.destroy = NULL;
+  enet_host_compress(host, &compressor);
+}
+
+
+
+void netcompressor_t::detach(ENetHost *host)
+{
+  if (host == NULL) {
+    s_throw(std::invalid_argument, "ENetHost is null");
+  }
+  enet_host_compress(host, NULL);
+}
+
+
+
+void netcompressor_t::apply_mode(ENetHost *host, int mode, netcompressor_t &compressor)
+{
+  switch (mode) {
+  case NET_COMPRESS_NONE:
+    detach(host);
+    break;
+  case NET_COMPRESS_LZ:
+    compressor.attach(host);
+    break;
+  case NET_COMPRESS_RANGE_CODER:
+    if (enet_host_compress_with_range_coder(host) != 0) {
+      s_log_error("Unable to enable range coder compression");
+      detach(host);
+    }
+    break;
+  default:
+    s_log_warning("Invalid compression mode %d, disabling compression", mode);
+    detach(host);
+    break;
+  }
+}
+
+
+
+netcompressor_stats_t netcompressor_t::stats() const
+{
+  return {
+    packets_compressed_.load(),
+    packets_skipped_.load(),
+    bytes_in_.load(),
+    bytes_out_.load(),
+    compress_nsec_.load(),
+    packets_decompressed_.load(),
+    decompress_failures_.load(),
+    decompress_nsec_.load()
+  };
+}
+
+
+
+void netcompressor_t::reset_stats()
+{
+  packets_compressed_ = 0;
+  packets_skipped_ = 0;
+  bytes_in_ = 0;
+  bytes_out_ = 0;
+  compress_nsec_ = 0;
+  packets_decompressed_ = 0;
+  decompress_failures_ = 0;
+  decompress_nsec_ = 0;
+}
+
+
+
+size_t netcompressor_t::compress(const uint8_t *in, size_t in_length,
+  uint8_t *out, size_t out_limit)
+{
+  const size_t base = dictionary_.size();
+  window_.resize(base + in_length);
+  if (in_length > 0) {
+    memcpy(window_.data() + base, in, in_length);
+  }
+  return compress_window(out, out_limit);
+}
+
+
+
+size_t netcompressor_t::compress_window(uint8_t *out, size_t out_limit)
+{
+  const size_t base = dictionary_.size();
+  table_ = dictionary_table_;
+
+  const uint8_t *const window = window_.data();
+  const size_t end = window_.size();
+  const size_t match_limit = end > LAST_LITERALS ? end - LAST_LITERALS : 0;
+  uint8_t *op = out;
+  const uint8_t *const out_end = out + out_limit;
+  size_t anchor = base;
+  size_t ip = base;
+
+  while (ip + MIN_MATCH <= match_limit) {
+    const uint32_t sequence = read32(window + ip);
+    uint32_t &slot = table_[hash32(sequence)];
+    const size_t ref = slot;
+    slot = static_cast<uint32_t>(ip);
+
+    if (ref == EMPTY_SLOT || ip - ref > MAX_OFFSET || read32(window + ref) != sequence) {
+      ++ip;
+      continue;
+    }
+
+    size_t length = MIN_MATCH;
+    while (ip + length < match_limit && window[ref + length] == window[ip + length]) {
+      ++length;
+    }
+
+    if (!write_sequence(op, out_end, window + anchor, ip - anchor, ip - ref, length)) {
+      return 0;
+    }
+
+    ip += length;
+    anchor = ip;
+  }
+
+  if (!write_sequence(op, out_end, window + anchor, end - anchor, 0, 0)) {
+    return 0;
+  }
+
+  return static_cast<size_t>(op - out);
+}
+
+
+
+size_t netcompressor_t::decompress(const uint8_t *in, size_t in_length,
+  uint8_t *out, size_t out_limit) const
+{
+  const uint8_t *ip = in;
+  const uint8_t *const in_end = in + in_length;
+  const uint8_t *const dict = dictionary_.data();
+  const size_t dict_length = dictionary_.size();
+  size_t op = 0;
+
+  while (ip < in_end) {
+    const unsigned token = *ip++;
+
+    size_t literal_length = token >> 4;
+    if (literal_length == RUN_MASK && !read_length(ip, in_end, literal_length)) {
+      return 0;
+    }
+    if (literal_length > static_cast<size_t>(in_end - ip) || literal_length > out_limit - op) {
+      return 0;
+    }
+    memcpy(out + op, ip, literal_length);
+    ip += literal_length;
+    op += literal_length;
+
+    if (ip == in_end) {
+      break;
+    }
+
+    if (in_end - ip < 2) {
+      return 0;
+    }
+    const size_t offset = static_cast<size_t>(ip[0]) | (static_cast<size_t>(ip[1]) << 8);
+    ip += 2;
+    if (offset == 0 || offset > op + dict_length) {
+      return 0;
+    }
+
+    size_t match_length = token & RUN_MASK;
+    if (match_length == RUN_MASK && !read_length(ip, in_end, match_length)) {
+      return 0;
+    }
+    match_length += MIN_MATCH;
+    if (match_length > out_limit - op) {
+      return 0;
+    }
+
+    // Copy any part of the match that lies in the dictionary, then the rest
+    // from output (byte-wise, since matches may overlap themselves)
+    if (offset > op) {
+      const size_t from_dict = std::min(offset - op, match_length);
+      memcpy(out + op, dict + dict_length - (offset - op), from_dict);
+      op += from_dict;
+      match_length -= from_dict;
+    }
+    for (; match_length > 0; --match_length, ++op) {
+      out[op] = out[op - offset];
+    }
+  }
+
+  return op;
+}
+
+
+
+size_t netcompressor_t::enet_compress(void *context, const ENetBuffer *in_buffers,
+  size_t in_buffer_count, size_t in_limit, enet_uint8 *out_data, size_t out_limit)
+{
+  netcompressor_t *self = (netcompressor_t *)context;
+  const clock_t::time_point start = clock_t::now();
+
+  // Gather ENet's buffers directly into the window after the dictionary
+  const size_t base = self->dictionary_.size();
+  std::vector<uint8_t> &window = self->window_;
+  window.resize(base + in_limit);
+  size_t gathered = 0;
+  for (size_t index = 0; index < in_buffer_count && gathered < in_limit; ++index) {
+    const size_t length = std::min(in_buffers[index].dataLength, in_limit - gathered);
+    memcpy(window.data() + base + gathered, in_buffers[index].data, length);
+    gathered += length;
+  }
+  window.resize(base + gathered);
+
+  const size_t result = self->compress_window(out_data, out_limit);
+
+  self->compress_nsec_ += elapsed_nsec(start);
+  self->bytes_in_ += gathered;
+  if (result > 0 && result < gathered) {
+    self->packets_compressed_ += 1;
+    self->bytes_out_ += result;
+  } else {
+    self->packets_skipped_ += 1;
+    self->bytes_out_ += gathered;
+  }
+
+  return result;
+}
+
+
+
+size_t netcompressor_t::enet_decompress(void *context, const enet_uint8 *in_data,
+  size_t in_limit, enet_uint8 *out_data, size_t out_limit)
+{
+  netcompressor_t *self = (netcompressor_t *)context;
+  const clock_t::time_point start = clock_t::now();
+
+  const size_t result = self->decompress(in_data, in_limit, out_data, out_limit);
+
+  self->decompress_nsec_ += elapsed_nsec(start);
+  if (result > 0) {
+    self->packets_decompressed_ += 1;
+  } else {
+    self->decompress_failures_ += 1;
+  }
+
+  return result;
+}
+
+
+} // namespace snow
@@ -0,0 +1,130 @@
+/*
+  netcompressor.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__NETCOMPRESSOR_HH__
+#define __SNOW__NETCOMPRESSOR_HH__
+
+#include "../config.hh"
+#include <enet/enet.h>
+#include <atomic>
+#include <vector>
+
+
+namespace snow {
+
+
+/*! Compression modes, as used by the net_compress cvar. */
+enum netcompress_mode_t : int
+{
+  NET_COMPRESS_NONE = 0,
+  //! LZ codec (netcompressor_t)
+  NET_COMPRESS_LZ,
+  //! ENet's built-in adaptive range coder
+  NET_COMPRESS_RANGE_CODER,
+};
+
+
+/*! Snapshot of a compressor's counters. */
+struct netcompressor_stats_t
+{
+  uint64_t  packets_compressed;
+  // Packets ENet sent uncompressed because they didn't get smaller
+  uint64_t  packets_skipped;
+  uint64_t  bytes_in;         // uncompressed bytes passed to compress
+  uint64_t  bytes_out;        // bytes produced for compressed packets
+  uint64_t  compress_nsec;
+  uint64_t  packets_decompressed;
+  uint64_t  decompress_failures;
+  uint64_t  decompress_nsec;
+
+  // Compressed/uncompressed size of all packets offered for compression.
+  // Skipped packets count at their uncompressed size.
+  double    ratio() const;
+};
+
+
+/*==============================================================================
+
+  LZ77-class packet compressor for ENet hosts, using an LZ4-style sequence
+  format: a token holding literal and match lengths, the literals, then a
+  16-bit match offset. Matches are found through a single-entry hash table,
+  so compression is a single pass over each datagram.
+
+  An optional preset dictionary acts as history preceding every datagram,
+  letting small messages match against common byte patterns (e.g., netevent
+  headers and frequent payloads). Both ends of a connection must use the same
+  dictionary and mode, or packets will fail to decompress and be dropped.
+
+  ENet calls the compressor from the thread servicing the host. Stats may be
+  read from any thread.
+
+==============================================================================*/
+struct netcompressor_t
+{
+  static const size_t MAX_DICTIONARY_LENGTH = 16384;
+
+  netcompressor_t();
+
+  netcompressor_t(const netcompressor_t &) = delete;
+  netcompressor_t &operator = (const netcompressor_t &) = delete;
+
+  // Replaces the preset dictionary. Only the last MAX_DICTIONARY_LENGTH bytes
+  // are used. Must not be called while attached to a host being serviced.
+  void set_dictionary(const uint8_t *data, size_t length);
+  // Loads the dictionary from a file through PhysicsFS. An empty path clears
+  // the dictionary. Returns false if the file can't be read.
+  bool load_dictionary(const string &path);
+  size_t dictionary_length() const;
+
+  // Sets the host's compressor to this one. The compressor must outlive the
+  // host or be detached first.
+  void attach(ENetHost *host);
+  // Removes any compressor from the host.
+  static void detach(ENetHost *host);
+
+  // Sets the host's compression according to a netcompress_mode_t, attaching
+  // or detaching compressor as needed.
+  static void apply_mode(ENetHost *host, int mode, netcompressor_t &compressor);
+
+  netcompressor_stats_t stats() const;
+  void reset_stats();
+
+  // Raw codec. Both return the number of bytes written to out, or zero if the
+  // output doesn't fit out_limit or the input is malformed.
+  size_t compress(const uint8_t *in, size_t in_length, uint8_t *out, size_t out_limit);
+  size_t decompress(const uint8_t *in, size_t in_length, uint8_t *out, size_t out_limit) const;
+
+private:
+  static size_t enet_compress(void *context, const ENetBuffer *in_buffers,
+    size_t in_buffer_count, size_t in_limit, enet_uint8 *out_data, size_t out_limit);
+  static size_t enet_decompress(void *context, const enet_uint8 *in_data,
+    size_t in_limit, enet_uint8 *out_data, size_t out_limit);
+
+  // Compresses the datagram following the dictionary in window_
+  size_t compress_window(uint8_t *out, size_t out_limit);
+
+  std::vector<uint8_t>  dictionary_ { };
+  // Hash table primed with dictionary positions, copied into table_ before
+  // each datagram
+  std::vector<uint32_t> dictionary_table_;
+  std::vector<uint32_t> table_;
+  // Dictionary followed by the datagram being compressed. The dictionary
+  // part is only written by set_dictionary.
+  std::vector<uint8_t>  window_ { };
+
+  std::atomic<uint64_t> packets_compressed_   { 0 };
+  std::atomic<uint64_t> packets_skipped_      { 0 };
+  std::atomic<uint64_t> bytes_in_             { 0 };
+  std::atomic<uint64_t> bytes_out_            { 0 };
+  std::atomic<uint64_t> compress_nsec_        { 0 };
+  std::atomic<uint64_t> packets_decompressed_ { 0 };
+  std::atomic<uint64_t> decompress_failures_  { 0 };
+  std::atomic<uint64_t> decompress_nsec_      { 0 };
+};
+
+
+} // namespace snow
+
+#endif /* end __SNOW__NETCOMPRESSOR_HH__ include guard */
@@ -0,0 +1,173 @@
+/*
+  netcvars.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "netcvars.hh"
+#include "netmessage.hh"
+#include <cstring>
+
+
+namespace snow {
+
+
+namespace {
+
+
+const unsigned CVAR_VALUE_TYPE_BITS = 2;
+// Smallest encoding of a cvar: its hash, type, and a one-byte varint value
+const size_t CVAR_VALUE_MIN_BITS = 32 + CVAR_VALUE_TYPE_BITS + 8;
+
+
+
+uint32_t float_bits(float value)
+{
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+
+
+float bits_float(uint32_t bits)
+{
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+
+} // namespace <anon>
+
+
+
+void netcvar_delta_msg_t::serialize(bit_writer_t &stream)
+{
+  stream.write_varint(values.size());
+  for (const netcvar_value_t &value : values) {
+    stream.write_bits(value.hash, 32);
+    stream.write_bits(value.type, CVAR_VALUE_TYPE_BITS);
+    switch (value.type) {
+    case NETCVAR_INT:
+      stream.write_zigzag(value.int_value);
+      break;
+    case NETCVAR_FLOAT:
+      stream.write_bits(float_bits(value.float_value), 32);
+      break;
+    default:
+      stream.write_varint(value.string_value.size());
+      stream.write_bytes((const uint8_t *)value.string_value.data(),
+        value.string_value.size());
+      break;
+    }
+  }
+}
+
+
+
+void netcvar_delta_msg_t::serialize(bit_reader_t &stream)
+{
+  // Bound the count by the payload before anything is allocated for it
+  const uint64_t count = stream.read_varint();
+  if (!stream.ok() || count > stream.bits_remaining() / CVAR_VALUE_MIN_BITS) {
+    stream.fail();
+    return;
+  }
+
+  values.resize(count);
+  for (netcvar_value_t &value : values) {
+    value.hash = stream.read_bits(32);
+    value.type = stream.read_bits(CVAR_VALUE_TYPE_BITS);
+    switch (value.type) {
+    case NETCVAR_INT:
+      value.int_value = stream.read_zigzag();
+      break;
+    case NETCVAR_FLOAT:
+      value.float_value = bits_float(stream.read_bits(32));
+      break;
+    case NETCVAR_STRING: {
+      const uint64_t string_length = stream.read_varint();
+      stream.align();
+      if (string_length > stream.bits_remaining() / 8) {
+        stream.fail();
+        return;
+      }
+      value.string_value.resize(string_length);
+      stream.read_bytes((uint8_t *)&value.string_value[0], string_length);
+    } break;
+    default:
+      stream.fail();
+      return;
+    }
+  }
+}
+
+
+
+void write_cvar_delta(const std::vector<cvar_t *> &cvars, netevent_t &event)
+{
+  netcvar_delta_msg_t delta;
+  delta.values.resize(cvars.size());
+  for (size_t index = 0; index < cvars.size(); ++index) {
+    const cvar_t *cvar = cvars[index];
+    netcvar_value_t &value = delta.values[index];
+    value.hash = cvar->name_hash();
+    switch (cvar->type()) {
+    case CVAR_INT:
+      value.type = NETCVAR_INT;
+      value.int_value = cvar->geti();
+      break;
+    case CVAR_FLOAT:
+      value.type = NETCVAR_FLOAT;
+      value.float_value = cvar->getf();
+      break;
+    default:
+      value.type = NETCVAR_STRING;
+      value.string_value = cvar->gets();
+      break;
+    }
+  }
+
+  event.set_message(NET_CVAR_DELTA);
+  write_message(delta, event);
+}
+
+
+
+void apply_cvar_delta(cvar_set_t &cvars, const netcvar_delta_msg_t &delta,
+  netcvar_stats_t *stats)
+{
+  for (const netcvar_value_t &value : delta.values) {
+    cvar_t *cvar = cvars.get_cvar(value.hash);
+    if (cvar == NULL) {
+      if (stats) {
+        stats->unknown += 1;
+      }
+      continue;
+    } else if ((cvar->flags() & (CVAR_SERVER | CVAR_REPLICATED)) == 0) {
+      if (stats) {
+        stats->rejected += 1;
+      }
+      continue;
+    }
+
+    switch (value.type) {
+    case NETCVAR_INT:
+      cvar->seti_force((int)value.int_value, true);
+      break;
+    case NETCVAR_FLOAT:
+      cvar->setf_force(value.float_value, true);
+      break;
+    default:
+      cvar->sets_force(value.string_value, true);
+      break;
+    }
+
+    if (stats) {
+      stats->applied += 1;
+    }
+  }
+}
+
+
+} // namespace snow
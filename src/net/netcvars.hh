@@ -0,0 +1,106 @@
+/*
+  netcvars.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__NETCVARS_HH__
+#define __SNOW__NETCVARS_HH__
+
+#include "../config.hh"
+#include "../console.hh"
+#include "bitstream.hh"
+#include "netevent.hh"
+#include <vector>
+
+
+namespace snow {
+
+
+const uint16_t NET_CVAR_DELTA = 20;
+
+
+/*==============================================================================
+
+  Cvar replication
+
+  The server collects the replicated cvars (CVAR_REPLICATED) changed during a
+  tick with cvar_set_t::take_replicated() and sends them to clients as a
+  single NET_CVAR_DELTA netevent. Each cvar in the delta is its name's
+  murmur3 hash32 -- the key cvar_set_t already looks cvars up by -- and its
+  value in its own type:
+
+    varint    count
+    count times:
+      32 bits   name hash
+      2 bits    type (0 = int, 1 = float, 2 = string)
+      int:      zigzag varint
+      float:    32 bits, IEEE 754
+      string:   varint length, then the bytes from the next byte boundary
+
+  A delta is decoded into a netcvar_delta_msg_t, normally by a message
+  registry (see netmessage_registry.hh), and clients apply it with
+  apply_cvar_delta(), which sets each cvar through its typed setter, so
+  nothing is converted to or parsed from a string. Only cvars the client
+  registered as the server's (CVAR_SERVER or CVAR_REPLICATED) may be set by
+  a delta. Deltas set them even if they're read-only, but any other cvar
+  named in a delta is rejected, so a server can't touch the client's own
+  settings.
+
+==============================================================================*/
+
+
+enum netcvar_value_type_t : uint32_t
+{
+  NETCVAR_INT    = 0,
+  NETCVAR_FLOAT  = 1,
+  NETCVAR_STRING = 2
+};
+
+
+struct netcvar_value_t
+{
+  uint32_t  hash;
+  uint32_t  type;
+  int64_t   int_value;
+  float     float_value;
+  string    string_value;
+};
+
+
+struct netcvar_delta_msg_t
+{
+  std::vector<netcvar_value_t> values;
+
+  // The layout depends on each value's type, so reading and writing are
+  // separate rather than a single serialize template. Reading fails the
+  // stream on an unknown type or a count or length the payload can't hold.
+  void serialize(bit_writer_t &stream);
+  void serialize(bit_reader_t &stream);
+};
+
+
+struct netcvar_stats_t
+{
+  // Cvars set from a delta
+  size_t  applied;
+  // Cvars in a delta with no matching cvar in the set
+  size_t  unknown;
+  // Cvars in a delta that aren't server cvars in the set
+  size_t  rejected;
+};
+
+
+// Writes the cvars to the netevent's payload and sets its message to
+// NET_CVAR_DELTA.
+void write_cvar_delta(const std::vector<cvar_t *> &cvars, netevent_t &event);
+
+// Sets the server cvars (CVAR_SERVER or CVAR_REPLICATED) in a decoded delta,
+// even if they're read-only. Cvars not registered with the set, or registered
+// without either flag, are skipped and counted.
+void apply_cvar_delta(cvar_set_t &cvars, const netcvar_delta_msg_t &delta,
+  netcvar_stats_t *stats = NULL);
+
+
+} // namespace snow
+
+#endif /* end __SNOW__NETCVARS_HH__ include guard */
@@ -4,15 +4,125 @@
   is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
 */
 #include "netevent.hh"
+#include "netevent_batch.hh"
+#include "netpacket_pool.hh"
+#include "nettransport.hh"
+#include "bitstream.hh"
+#include "../timing.hh"
+#include <cmath>
 #include <snow/types/object_pool.hh>
 
 
 namespace snow {
 
 
-void netevent_t::set_sender(uint16_t sender)
+namespace {
+
+
+netevent_stats_t g_netevent_stats;
+
+
+} // namespace <anon>
+
+
+
+netevent_stats_t &netevent_stats()
 {
-  sender_ = sender;
+  return g_netevent_stats;
+}
+
+
+
+const uint32_t netevent_t::MAX_ID;
+const int64_t netevent_t::MAX_TICK;
+
+
+
+netevent_t::netevent_t(const netevent_t &other) :
+  sender_(other.sender_),
+  message_(other.message_),
+  time_(other.time_),
+  buffer_(other.buffer_),
+  packet_(other.packet_),
+  borrowed_(other.borrowed_),
+  borrowed_length_(other.borrowed_length_)
+{
+  if (packet_) {
+    netpacket_retain(packet_);
+  }
+}
+
+
+
+netevent_t::netevent_t(netevent_t &&other) :
+  sender_(other.sender_),
+  message_(other.message_),
+  time_(other.time_),
+  buffer_(std::move(other.buffer_)),
+  packet_(other.packet_),
+  borrowed_(other.borrowed_),
+  borrowed_length_(other.borrowed_length_)
+{
+  other.packet_ = NULL;
+  other.borrowed_ = NULL;
+  other.borrowed_length_ = 0;
+}
+
+
+
+netevent_t::~netevent_t()
+{
+  release_packet();
+}
+
+
+
+netevent_t &netevent_t::operator = (const netevent_t &other)
+{
+  if (this != &other) {
+    if (other.packet_) {
+      netpacket_retain(other.packet_);
+    }
+    release_packet();
+    sender_ = other.sender_;
+    message_ = other.message_;
+    time_ = other.time_;
+    buffer_ = other.buffer_;
+    packet_ = other.packet_;
+    borrowed_ = other.borrowed_;
+    borrowed_length_ = other.borrowed_length_;
+  }
+  return *this;
+}
+
+
+
+netevent_t &netevent_t::operator = (netevent_t &&other)
+{
+  if (this != &other) {
+    release_packet();
+    sender_ = other.sender_;
+    message_ = other.message_;
+    time_ = other.time_;
+    buffer_ = std::move(other.buffer_);
+    packet_ = other.packet_;
+    borrowed_ = other.borrowed_;
+    borrowed_length_ = other.borrowed_length_;
+    other.packet_ = NULL;
+    other.borrowed_ = NULL;
+    other.borrowed_length_ = 0;
+  }
+  return *this;
+}
+
+
+
+void netevent_t::set_sender(uint32_t sender)
+{
+  if (sender > MAX_ID) {
+    s_throw(std::out_of_range, "Netevent sender ID does not fit in 16 bits");
+  }
+  sender_ = static_cast<uint16_t>(sender);
 }
 
 
@@ -24,22 +134,27 @@ void netevent_t::set_time(double time)
 
 
 
-void netevent_t::set_message(uint16_t message)
+void netevent_t::set_message(uint32_t message)
 {
-  message_ = message;
+  if (message > MAX_ID) {
+    s_throw(std::out_of_range, "Netevent message ID does not fit in 16 bits");
+  }
+  message_ = static_cast<uint16_t>(message);
 }
 
 
 
 void netevent_t::set_buffer(charbuf_t &&buf)
 {
-  buffer_ = buf;
+  release_packet();
+  buffer_ = std::move(buf);
 }
 
 
 
 void netevent_t::set_buffer(const charbuf_t &buf)
 {
+  release_packet();
   buffer_ = buf;
 }
 
@@ -68,6 +183,7 @@ double netevent_t::time() const
 
 auto netevent_t::buffer() const -> const charbuf_t &
 {
+  detach();
   return buffer_;
 }
 
@@ -75,86 +191,244 @@ auto netevent_t::buffer() const -> const charbuf_t &
 
 auto netevent_t::buffer() -> charbuf_t &
 {
+  detach();
   return buffer_;
 }
 
 
 
+const uint8_t *netevent_t::payload() const
+{
+  return packet_ ? borrowed_ : buffer_.data();
+}
+
+
+
+size_t netevent_t::payload_length() const
+{
+  return packet_ ? borrowed_length_ : buffer_.size();
+}
+
+
+
+bool netevent_t::is_borrowed() const
+{
+  return packet_ != NULL;
+}
+
+
+
+size_t netevent_t::header_length() const
+{
+  return varint_length(sender_) + varint_length(message_) +
+         varint_length(zigzag_encode(tick()));
+}
+
+
+
 size_t netevent_t::data_length() const
 {
-  return sizeof(sender_) + sizeof(message_) + sizeof(time_) + buffer_.size();
+  return header_length() + payload_length();
 }
 
 
 
-void netevent_t::read_from(const ENetPacket *const packet)
+bool netevent_t::read_from(const ENetPacket *const packet)
 {
   if (packet == NULL) {
     s_throw(std::invalid_argument, "ENetPacket is null");
   }
 
-  const uint16_t *shortbuf = (const uint16_t *)packet->data;
-  size_t size = packet->dataLength;
-  if (size >= sizeof(sender_)) {
-    sender_ = shortbuf[0];
-    size -= sizeof(sender_);
+  return read_from(packet->data, packet->dataLength);
+}
+
+
+
+void netevent_t::write_to(ENetPacket *packet)
+{
+  if (packet == NULL) {
+    s_throw(std::invalid_argument, "ENetPacket is null");
   }
 
-  if (size >= sizeof(message_)) {
-    message_ = shortbuf[1];
-    size -= sizeof(message_);
+  const size_t datalen = data_length();
+
+  if (packet->dataLength != datalen && enet_packet_resize(packet, datalen)) {
+    s_throw(std::runtime_error, "Failed to resize ENetPacket");
   }
 
-  if (size >= sizeof(time_)) {
-    time_ = *(double *)(shortbuf + 2);
-    size -= sizeof(time_);
+  write_to(packet->data);
+}
+
+
+
+bool netevent_t::read_from(const uint8_t *data, size_t length)
+{
+  release_packet();
+
+  const size_t header_length = read_header(data, length);
+  if (header_length == 0) {
+    buffer_.clear();
+    return false;
+  }
+  data += header_length;
+  length -= header_length;
+
+  if (length > buffer_.capacity()) {
+    netevent_stats().payload_allocs += 1;
   }
 
-  buffer_.resize(size);
-  if (size > 0) {
-    const int data_offset = sizeof(sender_) + sizeof(message_) + sizeof(time_);
-    memcpy(buffer_.data(), packet->data + data_offset, size);
+  buffer_.resize(length);
+  if (length > 0) {
+    netevent_stats().payload_copies += 1;
+    memcpy(buffer_.data(), data, length);
   }
+  return true;
 }
 
 
 
-void netevent_t::write_to(ENetPacket *packet)
+bool netevent_t::borrow_from(ENetPacket *packet, const uint8_t *data, size_t length)
 {
   if (packet == NULL) {
     s_throw(std::invalid_argument, "ENetPacket is null");
+  } else if (data < packet->data || data + length > packet->data + packet->dataLength) {
+    s_throw(std::out_of_range, "Netevent data is not inside the packet");
   }
 
-  const size_t datalen = data_length();
+  // Retain first in case this netevent already borrows the same packet
+  netpacket_retain(packet);
+  release_packet();
+  buffer_.clear();
 
-  if (packet->dataLength != datalen && enet_packet_resize(packet, datalen)) {
-    s_throw(std::runtime_error, "Failed to resize ENetPacket");
+  const size_t header_length = read_header(data, length);
+  if (header_length == 0) {
+    netpacket_release(packet);
+    return false;
   }
+  packet_ = packet;
+  borrowed_ = data + header_length;
+  borrowed_length_ = length - header_length;
+  return true;
+}
+
+
+
+void netevent_t::release()
+{
+  release_packet();
+  buffer_.clear();
+}
+
+
 
-  uint16_t *shortbuf = (uint16_t *)packet->data;
-  shortbuf[0] = sender_;
-  shortbuf[1] = message_;
-  *(double *)(shortbuf + 2) = time_;
-  if (!buffer_.empty()) {
-    const int data_offset = sizeof(sender_) + sizeof(message_) + sizeof(time_);
-    memcpy(packet->data + data_offset, buffer_.data(), buffer_.size());
+size_t netevent_t::read_header(const uint8_t *data, size_t length)
+{
+  if (data == NULL && length > 0) {
+    s_throw(std::invalid_argument, "Netevent data is null");
+  }
+
+  size_t offset = 0;
+  const auto read_field = [&] (uint64_t &value, uint64_t max_value) {
+    const size_t read = read_varint(data + offset, length - offset, value);
+    offset += read;
+    return read > 0 && value <= max_value;
+  };
+
+  // All three fields must be present and well-formed, and the IDs must fit
+  // in 16 bits, or the netevent is left as it was
+  uint64_t sender = 0;
+  uint64_t message = 0;
+  uint64_t tick = 0;
+  if (!read_field(sender, MAX_ID) ||
+      !read_field(message, MAX_ID) ||
+      !read_field(tick, UINT64_MAX)) {
+    netevent_stats().messages_rejected += 1;
+    return 0;
+  }
+
+  sender_ = static_cast<uint16_t>(sender);
+  message_ = static_cast<uint16_t>(message);
+  time_ = static_cast<double>(zigzag_decode(tick)) * FRAME_SEQ_TIME;
+  return offset;
+}
+
+
+
+int64_t netevent_t::tick() const
+{
+  // Out-of-range ticks are clamped rather than left to an undefined
+  // conversion, and NaN is sent as tick zero
+  const double tick = std::floor(time_ * FRAME_HERTZ + 0.5);
+  if (!(tick == tick)) {
+    return 0;
+  } else if (tick >= static_cast<double>(MAX_TICK)) {
+    return MAX_TICK;
+  } else if (tick <= -static_cast<double>(MAX_TICK)) {
+    return -MAX_TICK;
+  }
+  return static_cast<int64_t>(tick);
+}
+
+
+
+void netevent_t::detach() const
+{
+  if (packet_) {
+    netevent_stats().payload_allocs += 1;
+    netevent_stats().payload_copies += 1;
+    buffer_.assign(borrowed_, borrowed_ + borrowed_length_);
+    release_packet();
   }
 }
 
 
+
+void netevent_t::release_packet() const
+{
+  if (packet_) {
+    ENetPacket *packet = packet_;
+    packet_ = NULL;
+    netpacket_release(packet);
+  }
+}
+
+
+
+size_t netevent_t::write_to(uint8_t *data) const
+{
+  if (data == NULL) {
+    s_throw(std::invalid_argument, "Netevent data is null");
+  }
+
+  size_t offset = write_varint(data, sender_);
+  offset += write_varint(data + offset, message_);
+  offset += write_varint(data + offset, zigzag_encode(tick()));
+  const size_t length = payload_length();
+  if (length > 0) {
+    memcpy(data + offset, payload(), length);
+  }
+  return offset + length;
+}
+
+
+
 bool netevent_t::send(ENetPeer *peer, enet_uint8 channel, int flags)
 {
-  ENetPacket *packet = enet_packet_create(NULL, data_length(), flags);
-  write_to(packet);
-  return enet_peer_send(peer, channel, packet) == 0;
+  netevent_stats().messages_sent += 1;
+  ENetPacket *packet = netevent_batch_t::make_packet(*this, flags);
+  if (netpeer_send(peer, channel, packet) != 0) {
+    enet_packet_destroy(packet);
+    return false;
+  }
+  return true;
 }
 
 
 void netevent_t::broadcast(ENetHost *host, enet_uint8 channel, int flags)
 {
-  ENetPacket *packet = enet_packet_create(NULL, data_length(), flags);
-  write_to(packet);
-  enet_host_broadcast(host, channel, packet);
+  netevent_stats().messages_sent += 1;
+  ENetPacket *packet = netevent_batch_t::make_packet(*this, flags);
+  nethost_broadcast(host, channel, packet);
 }
 
 
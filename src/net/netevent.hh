@@ -8,17 +8,73 @@
 
 #include "../config.hh"
 #include <enet/enet.h>
+#include <atomic>
+#include <cstdint>
 #include <vector>
 
 
 namespace snow {
 
+
+/*
+  Counters for netevent traffic, used to track allocations and payload copies
+  per message. Shared by all clients and servers in the process.
+*/
+struct netevent_stats_t
+{
+  std::atomic<uint64_t> messages_sent     { 0 };
+  std::atomic<uint64_t> messages_received { 0 };
+  // Packet data buffers allocated (pooled packet misses and oversized packets)
+  std::atomic<uint64_t> packet_allocs     { 0 };
+  // Netevent payload buffers allocated or grown
+  std::atomic<uint64_t> payload_allocs    { 0 };
+  // Netevent payloads copied out of received packets
+  std::atomic<uint64_t> payload_copies    { 0 };
+  // Netevents rejected for malformed headers, or by a netmessage_registry_t
+  // for unknown IDs, bad lengths, or malformed payloads
+  std::atomic<uint64_t> messages_rejected { 0 };
+};
+
+
+S_EXPORT netevent_stats_t &netevent_stats();
+
+
+/*==============================================================================
+
+  A single message sent between hosts. A netevent either owns its payload in
+  its buffer or borrows it from a received ENetPacket (see borrow_from). A
+  borrowed netevent holds a reference to its packet until it's released,
+  reassigned, or destroyed, and is copied into an owned buffer only if its
+  buffer is requested.
+
+==============================================================================*/
 struct netevent_t
 {
   using charbuf_t = std::vector<uint8_t>;
 
-  void              set_sender(uint16_t sender);
-  void              set_message(uint16_t message);
+  /*
+    The header preceding the payload is three byte-aligned varints: sender,
+    message, and the zigzag-encoded simulation tick (time * FRAME_HERTZ). Time
+    is rounded to the nearest tick when written. Typical headers are 3 to 5
+    bytes, compared to 12 for fixed-width fields.
+  */
+  static const size_t MAX_HEADER_LENGTH = 3 + 3 + 10;
+  // Largest sender or message ID
+  static const uint32_t MAX_ID = UINT16_MAX;
+  // Ticks are clamped to this magnitude when written
+  static const int64_t MAX_TICK = INT64_C(1) << 53;
+
+  netevent_t() = default;
+  netevent_t(const netevent_t &other);
+  netevent_t(netevent_t &&other);
+  ~netevent_t();
+
+  netevent_t &operator = (const netevent_t &other);
+  netevent_t &operator = (netevent_t &&other);
+
+  // Throw std::out_of_range if the ID is above MAX_ID.
+  void              set_sender(uint32_t sender);
+  void              set_message(uint32_t message);
   void              set_time(double time);
   void              set_buffer(charbuf_t &&buf);
   void              set_buffer(const charbuf_t &buf);
@@ -26,24 +82,58 @@ struct netevent_t
   uint16_t          sender() const;
   uint16_t          message() const;
   double            time() const;
+  // If the netevent borrows its payload, buffer() copies the payload into the
+  // netevent's own buffer and releases the packet first. Prefer payload() for
+  // read-only access.
   const charbuf_t & buffer() const;
   charbuf_t &       buffer();
+  const uint8_t *   payload() const;
+  size_t            payload_length() const;
+  bool              is_borrowed() const;
+  size_t            header_length() const;
   size_t            data_length() const;
 
-  void read_from(const ENetPacket *const packet);
+  // The read functions return false if the header is truncated or malformed
+  // or holds an ID above MAX_ID, counting the netevent in
+  // netevent_stats().messages_rejected. The netevent is then left with no
+  // payload and its previous sender, message and time.
+  bool read_from(const ENetPacket *const packet);
   void write_to(ENetPacket *packet);
 
-  // Creates packets and sends them over the given medium
+  // Reads/writes the netevent from/to a raw buffer. write_to requires at least
+  // data_length() bytes of storage and returns the number of bytes written.
+  bool read_from(const uint8_t *data, size_t length);
+  size_t write_to(uint8_t *data) const;
+
+  // Reads the netevent at data, which must point into the packet, without
+  // copying its payload. The netevent keeps a reference to the packet (see
+  // netpacket_retain) until release() is called.
+  bool borrow_from(ENetPacket *packet, const uint8_t *data, size_t length);
+  // Drops the netevent's payload and any packet it borrows.
+  void release();
+
+  // Creates packets and sends them over the given medium. Each packet holds a
+  // single framed netevent -- see netevent_batch_t to combine several netevents
+  // into one packet.
   bool send(ENetPeer *peer, enet_uint8 channel,
     int flags = ENET_PACKET_FLAG_RELIABLE);
   void broadcast(ENetHost *host, enet_uint8 channel,
     int flags = ENET_PACKET_FLAG_RELIABLE);
 
 private:
-  uint16_t    sender_   = 0;
-  uint16_t    message_  = 0;
-  double      time_     = 0;
-  charbuf_t   buffer_   { };
+  size_t read_header(const uint8_t *data, size_t length);
+  int64_t tick() const;
+  void detach() const;
+  void release_packet() const;
+
+  uint16_t              sender_   = 0;
+  uint16_t              message_  = 0;
+  double                time_     = 0;
+  mutable charbuf_t     buffer_   { };
+  // Borrowed payload -- only valid while packet_ is non-null
+  mutable ENetPacket *  packet_   = NULL;
+  const uint8_t *       borrowed_ = NULL;
+  size_t                borrowed_length_ = 0;
 };
 
 
@@ -0,0 +1,200 @@
+/*
+  netevent_batch.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "netevent_batch.hh"
+#include "netpacket_pool.hh"
+#include "nettransport.hh"
+#include <algorithm>
+
+
+namespace snow {
+
+
+netevent_batch_t::~netevent_batch_t()
+{
+  for (pending_t &pending : pending_) {
+    enet_packet_destroy(pending.packet);
+  }
+}
+
+
+
+bool netevent_batch_t::queue(ENetPeer *peer, enet_uint8 channel,
+  const netevent_t &event, int flags)
+{
+  if (peer == NULL) {
+    s_throw(std::invalid_argument, "ENetPeer is null");
+  }
+
+  const size_t max_length = batch_length(peer);
+  const size_t framed_length = sizeof(length_t) + event.data_length();
+
+  netevent_stats().messages_sent += 1;
+
+  // Netevents that can't share a packet go out on their own
+  if (framed_length > max_length || event.data_length() >= OVERSIZED_LENGTH) {
+    ENetPacket *packet = make_packet(event, flags);
+    if (send_packet(peer, channel, packet) != 0) {
+      enet_packet_destroy(packet);
+      return false;
+    }
+    return true;
+  }
+
+  auto iter = std::find_if(pending_.begin(), pending_.end(),
+    [peer, channel](const pending_t &pending) {
+      return pending.peer == peer && pending.channel == channel;
+    });
+
+  bool sent = true;
+  if (iter != pending_.end() &&
+      (iter->flags != flags || iter->length + framed_length > max_length)) {
+    sent = send_pending(*iter);
+    pending_.erase(iter);
+    iter = pending_.end();
+  }
+
+  if (iter == pending_.end()) {
+    ENetPacket *packet = netpacket_pool_t::default_pool().create(max_length, flags);
+    if (packet == NULL) {
+      s_throw(std::runtime_error, "Failed to allocate ENetPacket");
+    }
+    pending_.push_back({ peer, channel, flags, packet, 0 });
+    iter = pending_.end() - 1;
+  }
+
+  const length_t length = static_cast<length_t>(event.data_length());
+  uint8_t *data = iter->packet->data + iter->length;
+  memcpy(data, &length, sizeof(length));
+  event.write_to(data + sizeof(length));
+  iter->length += framed_length;
+
+  return sent;
+}
+
+
+
+void netevent_batch_t::broadcast(ENetHost *host, enet_uint8 channel,
+  const netevent_t &event, int flags)
+{
+  broadcast_peers_.clear();
+  nethost_peers(host, broadcast_peers_);
+  for (ENetPeer *peer : broadcast_peers_) {
+    queue(peer, channel, event, flags);
+  }
+}
+
+
+
+bool netevent_batch_t::flush()
+{
+  bool sent = true;
+  for (pending_t &pending : pending_) {
+    sent = send_pending(pending) && sent;
+  }
+  pending_.clear();
+  return sent;
+}
+
+
+
+void netevent_batch_t::drop(ENetPeer *peer)
+{
+  auto new_end = std::remove_if(pending_.begin(), pending_.end(),
+    [peer](const pending_t &pending) {
+      if (pending.peer == peer) {
+        enet_packet_destroy(pending.packet);
+        return true;
+      }
+      return false;
+    });
+  pending_.erase(new_end, pending_.end());
+}
+
+
+
+size_t netevent_batch_t::pending() const
+{
+  return pending_.size();
+}
+
+
+
+void netevent_batch_t::set_send_fn(send_fn_t fn, void *context)
+{
+  send_fn_ = fn;
+  send_context_ = context;
+}
+
+
+
+void netevent_batch_t::set_info_fn(netpeer_info_fn_t fn, void *context)
+{
+  info_fn_ = fn;
+  info_context_ = context;
+}
+
+
+
+ENetPacket *netevent_batch_t::make_packet(const netevent_t &event, int flags)
+{
+  const size_t event_length = event.data_length();
+  const length_t prefix = event_length >= OVERSIZED_LENGTH
+                          ? OVERSIZED_LENGTH
+                          : static_cast<length_t>(event_length);
+
+  ENetPacket *packet = netpacket_pool_t::default_pool().create(
+    sizeof(prefix) + event_length, flags);
+  if (packet == NULL) {
+    s_throw(std::runtime_error, "Failed to allocate ENetPacket");
+  }
+
+  memcpy(packet->data, &prefix, sizeof(prefix));
+  event.write_to(packet->data + sizeof(prefix));
+  return packet;
+}
+
+
+
+size_t netevent_batch_t::batch_length(const ENetPeer *peer) const
+{
+  const size_t mtu = netpeer_info(peer, info_fn_, info_context_).mtu;
+  if (mtu < MIN_BATCH_LENGTH + PROTOCOL_OVERHEAD) {
+    return MIN_BATCH_LENGTH;
+  }
+  return mtu - PROTOCOL_OVERHEAD;
+}
+
+
+
+int netevent_batch_t::send_packet(ENetPeer *peer, enet_uint8 channel,
+  ENetPacket *packet)
+{
+  if (send_fn_ != NULL) {
+    return send_fn_(send_context_, peer, channel, packet);
+  }
+  return netpeer_send(peer, channel, packet);
+}
+
+
+
+bool netevent_batch_t::send_pending(pending_t &pending)
+{
+  ENetPacket *packet = pending.packet;
+  pending.packet = NULL;
+
+  // Shrinking a packet only adjusts its length, so this never reallocates
+  if (enet_packet_resize(packet, pending.length) ||
+      send_packet(pending.peer, pending.channel, packet) != 0) {
+    s_log_error("Unable to send netevent batch of %zu bytes", pending.length);
+    enet_packet_destroy(packet);
+    return false;
+  }
+
+  return true;
+}
+
+
+} // namespace snow
@@ -0,0 +1,160 @@
+/*
+  netevent_batch.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__NETEVENT_BATCH_HH__
+#define __SNOW__NETEVENT_BATCH_HH__
+
+#include "../config.hh"
+#include "netevent.hh"
+#include "nettransport.hh"
+#include <enet/enet.h>
+#include <vector>
+
+
+namespace snow {
+
+
+/*==============================================================================
+
+  Outgoing netevent aggregator. Netevents queued for the same peer and channel
+  during a tick are packed into a single MTU-sized packet, each prefixed by its
+  length, and handed to ENet when the batch is flushed (usually at the end of a
+  tick). This avoids paying per-packet allocation, queueing, and protocol
+  header costs for every small message.
+
+  Packet layout:
+    [uint16 length][netevent][uint16 length][netevent]...
+
+  A length of OVERSIZED_LENGTH means the netevent occupies the remainder of the
+  packet. This is only used for netevents too large to share a packet.
+
+  All packets sent by netevent_t::send and netevent_t::broadcast use the same
+  layout, so receivers should always read packets through split().
+
+==============================================================================*/
+struct netevent_batch_t
+{
+  using length_t = uint16_t;
+  // Hands a packet to a transport. Same semantics as netpeer_send: on
+  // failure, the packet still belongs to the caller.
+  using send_fn_t = int (*)(void *context, ENetPeer *peer, enet_uint8 channel,
+    ENetPacket *packet);
+
+  static const length_t OVERSIZED_LENGTH = 0xFFFF;
+  // Bytes of a peer's MTU reserved for ENet protocol headers when sizing a
+  // batch. Batches larger than the MTU would be fragmented by ENet.
+  static const size_t   PROTOCOL_OVERHEAD = 48;
+  // Smallest batch size used if a peer reports an unusually small MTU.
+  static const size_t   MIN_BATCH_LENGTH = 256;
+
+  netevent_batch_t() = default;
+  ~netevent_batch_t();
+
+  netevent_batch_t(const netevent_batch_t &) = delete;
+  netevent_batch_t &operator = (const netevent_batch_t &) = delete;
+
+  // Appends the netevent to the pending packet for the given peer and channel.
+  // If the netevent doesn't fit in the pending packet or the flags differ, the
+  // pending packet is sent first. Returns false if ENet refused a packet.
+  bool queue(ENetPeer *peer, enet_uint8 channel, const netevent_t &event,
+    int flags = ENET_PACKET_FLAG_RELIABLE);
+  // Queues the netevent for all connected peers of the host, including local
+  // peers (see nethost_peers).
+  void broadcast(ENetHost *host, enet_uint8 channel, const netevent_t &event,
+    int flags = ENET_PACKET_FLAG_RELIABLE);
+  // Sends all pending packets. Returns false if ENet refused any of them.
+  bool flush();
+  // Discards any pending packets for the peer. Must be called before a peer is
+  // disconnected or reset.
+  void drop(ENetPeer *peer);
+
+  // Number of pending packets not yet handed to ENet.
+  size_t pending() const;
+
+  // Sets the function used to send packets, e.g. to hand them to a network
+  // thread (see netio_t). Packets go through netpeer_send if fn is NULL.
+  void set_send_fn(send_fn_t fn, void *context);
+  // Sets the function used to look up a peer's MTU, e.g. netio_t::info_fn
+  // when the peer's host is serviced on another thread. Peers are read
+  // directly if fn is NULL.
+  void set_info_fn(netpeer_info_fn_t fn, void *context);
+
+  // Allocates a packet holding a single framed netevent.
+  static ENetPacket *make_packet(const netevent_t &event, int flags);
+
+  /*
+    Splits a received packet into its netevents and calls fn(data, length) for
+    each. data points into the packet, so nothing is copied, and the pointer is
+    only valid for as long as the packet is. Returns the number of netevents
+    read. Stops early if the packet is malformed.
+  */
+  template <typename FN>
+  static size_t split(const ENetPacket *packet, FN &&fn);
+
+private:
+  struct pending_t
+  {
+    ENetPeer *    peer;
+    enet_uint8    channel;
+    int           flags;
+    ENetPacket *  packet;
+    size_t        length;
+  };
+
+  size_t batch_length(const ENetPeer *peer) const;
+  int send_packet(ENetPeer *peer, enet_uint8 channel, ENetPacket *packet);
+  bool send_pending(pending_t &pending);
+
+  std::vector<pending_t> pending_ { };
+  // Scratch list of a host's peers for broadcast()
+  std::vector<ENetPeer *> broadcast_peers_ { };
+  send_fn_t              send_fn_ = NULL;
+  void *                 send_context_ = NULL;
+  netpeer_info_fn_t      info_fn_ = NULL;
+  void *                 info_context_ = NULL;
+};
+
+
+
+template <typename FN>
+size_t netevent_batch_t::split(const ENetPacket *packet, FN &&fn)
+{
+  if (packet == NULL) {
+    s_throw(std::invalid_argument, "ENetPacket is null");
+  }
+
+  const uint8_t *data = packet->data;
+  size_t remaining = packet->dataLength;
+  size_t count = 0;
+
+  while (remaining >= sizeof(length_t)) {
+    length_t length;
+    memcpy(&length, data, sizeof(length));
+    data += sizeof(length);
+    remaining -= sizeof(length);
+
+    size_t event_length = length;
+    if (length == OVERSIZED_LENGTH) {
+      event_length = remaining;
+    } else if (event_length > remaining) {
+      s_log_error("Malformed netevent batch: netevent length %zu exceeds remaining %zu bytes",
+        event_length, remaining);
+      break;
+    }
+
+    fn(data, event_length);
+    ++count;
+
+    data += event_length;
+    remaining -= event_length;
+  }
+
+  return count;
+}
+
+
+} // namespace snow
+
+#endif /* end __SNOW__NETEVENT_BATCH_HH__ include guard */
@@ -0,0 +1,109 @@
+/*
+  netevent_pool.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "netevent_pool.hh"
+#include <cstddef>
+
+
+namespace snow {
+
+
+netevent_pool_t::~netevent_pool_t()
+{
+  if (live_ > 0) {
+    s_log_warning("Destroying netevent pool with %zu netevents still retained", live_);
+  }
+}
+
+
+
+netevent_t *netevent_pool_t::acquire()
+{
+  if (free_list_ == nullptr) {
+    grow();
+  }
+
+  entry_t *entry = free_list_;
+  free_list_ = entry->next_free;
+  entry->next_free = nullptr;
+  entry->refs = 1;
+  ++live_;
+  return &entry->event;
+}
+
+
+
+void netevent_pool_t::retain(const netevent_t *event)
+{
+  entry_t *entry = entry_ptr(event);
+  assert(entry->refs > 0);
+  ++entry->refs;
+}
+
+
+
+void netevent_pool_t::release(const netevent_t *event)
+{
+  entry_t *entry = entry_ptr(event);
+  assert(entry->refs > 0);
+  if (--entry->refs == 0) {
+    entry->pool->recycle(entry);
+  }
+}
+
+
+
+size_t netevent_pool_t::live() const
+{
+  return live_;
+}
+
+
+
+size_t netevent_pool_t::capacity() const
+{
+  return chunks_.size() * CHUNK_SIZE;
+}
+
+
+
+auto netevent_pool_t::entry_ptr(const netevent_t *event) -> entry_t *
+{
+  if (event == nullptr) {
+    s_throw(std::invalid_argument, "Netevent is null");
+  }
+  return (entry_t *)(((char *)event) - offsetof(entry_t, event));
+}
+
+
+
+void netevent_pool_t::recycle(entry_t *entry)
+{
+  // Drop the payload now rather than on reuse so borrowed packets are freed
+  // as soon as possible
+  entry->event.release();
+  entry->next_free = free_list_;
+  free_list_ = entry;
+  --live_;
+}
+
+
+
+void netevent_pool_t::grow()
+{
+  chunk_t chunk { new entry_t[CHUNK_SIZE] };
+  // Link in reverse so entries are handed out in address order
+  for (size_t index = CHUNK_SIZE; index > 0; --index) {
+    entry_t &entry = chunk[index - 1];
+    entry.pool = this;
+    entry.refs = 0;
+    entry.next_free = free_list_;
+    free_list_ = &entry;
+  }
+  chunks_.emplace_back(std::move(chunk));
+}
+
+
+} // namespace snow
@@ -0,0 +1,82 @@
+/*
+  netevent_pool.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__NETEVENT_POOL_HH__
+#define __SNOW__NETEVENT_POOL_HH__
+
+#include "../config.hh"
+#include "netevent.hh"
+#include <memory>
+#include <vector>
+
+
+namespace snow {
+
+
+/*==============================================================================
+
+  Reference-counted storage for received netevents. Netevents are allocated in
+  fixed-size chunks so their addresses stay valid while they're passed around
+  in event_t::net, and released netevents are reused most-recently-freed first
+  to keep the working set small and warm.
+
+  A netevent is acquired with a single reference owned by whoever dispatches
+  it. Anything that needs to keep the netevent past dispatch (e.g., a system
+  deferring its handling to frame()) must retain() it and release() it once
+  done. When the last reference is released, the netevent drops its payload
+  and goes back on the free list.
+
+  Not thread safe -- a pool and its netevents should only be used by the
+  thread that dispatches them.
+
+==============================================================================*/
+struct netevent_pool_t
+{
+  // Number of netevents allocated at a time when the pool runs dry
+  static const size_t CHUNK_SIZE = 64;
+
+  netevent_pool_t() = default;
+  ~netevent_pool_t();
+
+  netevent_pool_t(const netevent_pool_t &) = delete;
+  netevent_pool_t &operator = (const netevent_pool_t &) = delete;
+
+  // Returns a netevent with a reference count of one.
+  netevent_t *acquire();
+
+  // Adds/removes a reference to a netevent acquired from a netevent_pool_t.
+  // Passing any other netevent is undefined behavior.
+  static void retain(const netevent_t *event);
+  static void release(const netevent_t *event);
+
+  // Number of netevents currently acquired.
+  size_t live() const;
+  // Total number of netevents allocated by the pool.
+  size_t capacity() const;
+
+private:
+  struct entry_t
+  {
+    netevent_t          event;
+    netevent_pool_t *   pool;
+    entry_t *           next_free;
+    unsigned            refs;
+  };
+
+  using chunk_t = std::unique_ptr<entry_t[]>;
+
+  static entry_t *entry_ptr(const netevent_t *event);
+  void recycle(entry_t *entry);
+  void grow();
+
+  std::vector<chunk_t>  chunks_ { };
+  entry_t *             free_list_ = nullptr;
+  size_t                live_ = 0;
+};
+
+
+} // namespace snow
+
+#endif /* end __SNOW__NETEVENT_POOL_HH__ include guard */
@@ -0,0 +1,284 @@
+/*
+  netio.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "netio.hh"
+#include <cstring>
+
+
+namespace snow {
+
+
+netio_t::~netio_t()
+{
+  inbound_t inbound;
+  while (inbound_.pop(inbound)) {
+    if (inbound.event.packet) {
+      enet_packet_destroy(inbound.event.packet);
+    }
+  }
+  for (const inbound_t &pending : inbound_backlog_) {
+    if (pending.event.packet) {
+      enet_packet_destroy(pending.event.packet);
+    }
+  }
+
+  outbound_t message;
+  while (outbound_.pop(message)) {
+    if (message.packet) {
+      enet_packet_destroy(message.packet);
+    }
+  }
+  for (const outbound_t &pending : outbound_backlog_) {
+    if (pending.packet) {
+      enet_packet_destroy(pending.packet);
+    }
+  }
+}
+
+
+
+void netio_t::set_host(ENetHost *host)
+{
+  host_ = host;
+  const size_t peer_count = host != NULL ? host->peerCount : 0;
+  sent_info_.assign(peer_count, netpeer_info_t { 0, 0, 0, 0 });
+  peer_info_.assign(peer_count, netpeer_info_t { 0, 0, 0, 0 });
+}
+
+
+
+ENetHost *netio_t::host() const
+{
+  return host_;
+}
+
+
+
+void netio_t::service(enet_uint32 timeout)
+{
+  if (host_ == NULL) {
+    s_throw(std::runtime_error, "No host to service");
+  }
+
+  while (!inbound_backlog_.empty() && inbound_.push(inbound_backlog_.front())) {
+    inbound_backlog_.pop_front();
+  }
+
+  send_outbound();
+
+  // Service once with the timeout, then pick up anything else already
+  // received without waiting again
+  ENetEvent event;
+  int result = enet_host_service(host_, &event, timeout);
+  while (result > 0) {
+    queue_event(event);
+    result = enet_host_check_events(host_, &event);
+  }
+
+  if (result < 0) {
+    s_log_error("Error servicing network host");
+  }
+
+  queue_info_changes();
+}
+
+
+
+bool netio_t::receive(ENetEvent &event)
+{
+  // The simulation thread calls this at least once a tick, so it's a good
+  // point to retry anything that didn't fit the outbound queue
+  post_backlog();
+
+  inbound_t inbound;
+  while (inbound_.pop(inbound)) {
+    if (inbound.event.type == ENET_EVENT_TYPE_CONNECT ||
+        inbound.event.type == ENET_EVENT_TYPE_NONE) {
+      peer_info_[peer_index(inbound.event.peer)] = inbound.info;
+    }
+    if (inbound.event.type != ENET_EVENT_TYPE_NONE) {
+      event = inbound.event;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+
+int netio_t::send(ENetPeer *peer, enet_uint8 channel, ENetPacket *packet)
+{
+  if (peer == NULL) {
+    s_throw(std::invalid_argument, "ENetPeer is null");
+  } else if (packet == NULL) {
+    s_throw(std::invalid_argument, "ENetPacket is null");
+  } else if (netlocal_t::is_local(peer)) {
+    return netlocal_t::send(peer, channel, packet);
+  }
+  post({ peer, peer_info(peer).generation, channel, packet, 0 });
+  return 0;
+}
+
+
+
+void netio_t::disconnect(ENetPeer *peer, enet_uint32 data)
+{
+  if (peer == NULL) {
+    s_throw(std::invalid_argument, "ENetPeer is null");
+  } else if (netlocal_t::is_local(peer)) {
+    netlocal_t::disconnect(peer);
+    return;
+  }
+  post({ peer, peer_info(peer).generation, 0, NULL, data });
+}
+
+
+
+netpeer_info_t netio_t::peer_info(const ENetPeer *peer) const
+{
+  if (netlocal_t::is_local(peer)) {
+    return netpeer_info(peer);
+  }
+  const size_t index = peer_index(peer);
+  if (index == SIZE_MAX) {
+    s_throw(std::invalid_argument, "Peer does not belong to the host");
+  }
+  return peer_info_[index];
+}
+
+
+
+netio_stats_t netio_t::stats() const
+{
+  return netio_stats_t {
+    events_received_.load(),
+    packets_sent_.load(),
+    send_failures_.load(),
+    inbound_deferred_.load(),
+    outbound_deferred_.load()
+  };
+}
+
+
+
+int netio_t::send_fn(void *context, ENetPeer *peer, enet_uint8 channel, ENetPacket *packet)
+{
+  return ((netio_t *)context)->send(peer, channel, packet);
+}
+
+
+
+netpeer_info_t netio_t::info_fn(void *context, const ENetPeer *peer)
+{
+  return ((const netio_t *)context)->peer_info(peer);
+}
+
+
+
+size_t netio_t::peer_index(const ENetPeer *peer) const
+{
+  // Only the address of the host's peer array is read, which ENet never
+  // changes after creating the host
+  if (host_ == NULL || peer < host_->peers || peer >= host_->peers + host_->peerCount) {
+    return SIZE_MAX;
+  }
+  return static_cast<size_t>(peer - host_->peers);
+}
+
+
+
+void netio_t::post(const outbound_t &message)
+{
+  post_backlog();
+  if (!outbound_backlog_.empty() || !outbound_.push(message)) {
+    outbound_backlog_.push_back(message);
+    outbound_deferred_ += 1;
+  }
+}
+
+
+
+void netio_t::post_backlog()
+{
+  while (!outbound_backlog_.empty() && outbound_.push(outbound_backlog_.front())) {
+    outbound_backlog_.pop_front();
+  }
+}
+
+
+
+void netio_t::queue_event(const ENetEvent &event)
+{
+  events_received_ += 1;
+  inbound_t inbound = { event, netpeer_info_t { 0, 0, 0, 0 } };
+  if (event.type == ENET_EVENT_TYPE_CONNECT) {
+    inbound.info = netpeer_info(event.peer);
+    sent_info_[peer_index(event.peer)] = inbound.info;
+  }
+  queue_inbound(inbound);
+}
+
+
+
+void netio_t::queue_inbound(const inbound_t &inbound)
+{
+  if (!inbound_backlog_.empty() || !inbound_.push(inbound)) {
+    inbound_backlog_.push_back(inbound);
+    inbound_deferred_ += 1;
+  }
+}
+
+
+
+// Sends an info update for each connected peer whose MTU or bandwidth has
+// changed since its info was last sent.
+void netio_t::queue_info_changes()
+{
+  ENetPeer *const peers_end = host_->peers + host_->peerCount;
+  for (ENetPeer *peer = host_->peers; peer < peers_end; ++peer) {
+    if (peer->state != ENET_PEER_STATE_CONNECTED) {
+      continue;
+    }
+    netpeer_info_t &sent = sent_info_[peer - host_->peers];
+    const netpeer_info_t info = netpeer_info(peer);
+    // Peers whose connect event hasn't been queued yet get their info with it
+    if (info.generation != sent.generation ||
+        std::memcmp(&info, &sent, sizeof(info)) == 0) {
+      continue;
+    }
+    sent = info;
+    ENetEvent update;
+    std::memset(&update, 0, sizeof(update));
+    update.type = ENET_EVENT_TYPE_NONE;
+    update.peer = peer;
+    queue_inbound({ update, info });
+  }
+}
+
+
+
+void netio_t::send_outbound()
+{
+  outbound_t message;
+  while (outbound_.pop(message)) {
+    // The peer may have disconnected, or even been reused for another
+    // connection, since the message was queued
+    const bool current = message.peer->connectID == message.generation;
+    if (message.packet == NULL) {
+      if (current) {
+        enet_peer_disconnect(message.peer, message.data);
+      }
+    } else if (!current || message.peer->state != ENET_PEER_STATE_CONNECTED ||
+               enet_peer_send(message.peer, message.channel, message.packet) != 0) {
+      enet_packet_destroy(message.packet);
+      send_failures_ += 1;
+    } else {
+      packets_sent_ += 1;
+    }
+  }
+}
+
+
+} // namespace snow
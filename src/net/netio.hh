@@ -0,0 +1,155 @@
+/*
+  netio.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__NETIO_HH__
+#define __SNOW__NETIO_HH__
+
+#include "../config.hh"
+#include "netlocal.hh"
+#include "nettransport.hh"
+#include <enet/enet.h>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+
+namespace snow {
+
+
+struct netio_stats_t
+{
+  uint64_t  events_received;
+  uint64_t  packets_sent;
+  // Packets ENet refused to queue, usually because the peer disconnected
+  uint64_t  send_failures;
+  // Events or packets that had to wait for space in a full queue
+  uint64_t  inbound_deferred;
+  uint64_t  outbound_deferred;
+};
+
+
+/*==============================================================================
+
+  Hands an ENetHost off to a dedicated network thread. The network thread
+  calls service() in a loop, which sends packets queued by the simulation
+  thread and services the host, queueing any events it receives. The
+  simulation thread reads those events with receive() at the start of a tick
+  and sends with send(), neither of which touch the host.
+
+  ENet isn't thread-safe, so once a host is handed off, only the network
+  thread may call ENet functions on it or its peers. Received packets are an
+  exception: they belong to the receiver, who destroys them as usual.
+
+  Events and packets are passed by value through a lock-free queue in each
+  direction. If a queue is full, its producer keeps the overflow in a backlog
+  and retries on its next call, so nothing is lost or reordered.
+
+  Local peers (see netlocal.hh) don't belong to the host, so send() passes
+  them straight to their connection.
+
+  The simulation thread can't read the host's peers either, since ENet
+  updates their MTU and bandwidth as it services them. The network thread
+  copies each peer's netpeer_info_t into its connect event, and sends an
+  update whenever the info changes, which receive() applies before returning
+  the next event. The simulation thread reads the copies with peer_info(),
+  or hands info_fn to anything that sizes traffic by them. Packets sent to a
+  peer are tagged with the generation the simulation thread knew it by, and
+  are dropped if ENet has since reused the peer for another connection.
+
+==============================================================================*/
+struct netio_t
+{
+  static const size_t QUEUE_SIZE = 4096;
+
+  netio_t() = default;
+  ~netio_t();
+
+  netio_t(const netio_t &) = delete;
+  netio_t &operator = (const netio_t &) = delete;
+
+  // Sets the host serviced by the network thread. Must be called before the
+  // network thread starts.
+  void set_host(ENetHost *host);
+  ENetHost *host() const;
+
+  /* Network thread only */
+  // Sends queued packets, then services the host for up to timeout
+  // milliseconds and queues any events received.
+  void service(enet_uint32 timeout);
+
+  /* Simulation thread only */
+  // Reads the next event received by the host. Returns false if there are no
+  // events. Any packet must be destroyed by the receiver.
+  bool receive(ENetEvent &event);
+  // Queues the packet to be sent to the peer. The packet is destroyed if ENet
+  // refuses it. Returns nonzero only if a local peer refused it.
+  int send(ENetPeer *peer, enet_uint8 channel, ENetPacket *packet);
+  // Queues a disconnect for the peer.
+  void disconnect(ENetPeer *peer, enet_uint32 data = 0);
+  // The peer's info as of the last event received. Local peers are read
+  // directly. Peers that haven't connected have zero info.
+  netpeer_info_t peer_info(const ENetPeer *peer) const;
+
+  // May be called from any thread.
+  netio_stats_t stats() const;
+
+  // send() as a netevent_batch_t send function, with the netio_t as context.
+  static int send_fn(void *context, ENetPeer *peer, enet_uint8 channel, ENetPacket *packet);
+  // peer_info() as a netpeer_info_fn_t, with the netio_t as context.
+  static netpeer_info_t info_fn(void *context, const ENetPeer *peer);
+
+private:
+  struct inbound_t
+  {
+    // ENET_EVENT_TYPE_NONE for an info update
+    ENetEvent       event;
+    // Set for connect events and info updates
+    netpeer_info_t  info;
+  };
+
+  struct outbound_t
+  {
+    ENetPeer *    peer;
+    // Generation of the connection the packet is for
+    enet_uint32   generation;
+    enet_uint8    channel;
+    // NULL for a disconnect, in which case data is the disconnect data
+    ENetPacket *  packet;
+    enet_uint32   data;
+  };
+
+  // Index of an ENet peer in the host's peers, or SIZE_MAX if not a peer of
+  // the host
+  size_t peer_index(const ENetPeer *peer) const;
+  void post(const outbound_t &message);
+  void post_backlog();
+  void queue_event(const ENetEvent &event);
+  void queue_inbound(const inbound_t &inbound);
+  void queue_info_changes();
+  void send_outbound();
+
+  ENetHost *                                  host_ = NULL;
+  // Events from the network thread to the simulation thread
+  netlocal_queue_t<inbound_t, QUEUE_SIZE>     inbound_;
+  std::deque<inbound_t>                       inbound_backlog_;
+  // Info last sent for each peer, by peer index (network thread)
+  std::vector<netpeer_info_t>                 sent_info_;
+  // Info last received for each peer, by peer index (simulation thread)
+  std::vector<netpeer_info_t>                 peer_info_;
+  // Packets from the simulation thread to the network thread
+  netlocal_queue_t<outbound_t, QUEUE_SIZE>    outbound_;
+  std::deque<outbound_t>                      outbound_backlog_;
+
+  std::atomic<uint64_t> events_received_ { 0 };
+  std::atomic<uint64_t> packets_sent_ { 0 };
+  std::atomic<uint64_t> send_failures_ { 0 };
+  std::atomic<uint64_t> inbound_deferred_ { 0 };
+  std::atomic<uint64_t> outbound_deferred_ { 0 };
+};
+
+
+} // namespace snow
+
+#endif /* end __SNOW__NETIO_HH__ include guard */
@@ -0,0 +1,292 @@
+/*
+  netlocal.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "netlocal.hh"
+#include "netpacket_pool.hh"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+
+namespace snow {
+
+
+namespace {
+
+
+// ENet peer IDs never exceed ENET_PROTOCOL_MAXIMUM_PEER_ID (0xFFF), so local
+// peers are marked with an ID no ENet peer can have.
+const enet_uint16 LOCAL_PEER_ID = 0xFFFF;
+
+// Local peers included in broadcasts to a host, by host
+std::mutex g_hosted_lock;
+std::vector<std::pair<const ENetHost *, ENetPeer *>> g_hosted;
+
+
+} // namespace <anon>
+
+
+
+netlocal_t::netlocal_t()
+{
+  init_endpoint(server_, &client_);
+  init_endpoint(client_, &server_);
+}
+
+
+
+netlocal_t::~netlocal_t()
+{
+  {
+    std::lock_guard<std::mutex> lock(g_hosted_lock);
+    ENetPeer *const peer = &client_.peer;
+    g_hosted.erase(std::remove_if(g_hosted.begin(), g_hosted.end(),
+      [peer](const std::pair<const ENetHost *, ENetPeer *> &hosted) {
+        return hosted.second == peer;
+      }), g_hosted.end());
+  }
+  drain(server_);
+  drain(client_);
+}
+
+
+
+ENetPeer *netlocal_t::server_peer()
+{
+  return &server_.peer;
+}
+
+
+
+ENetPeer *netlocal_t::client_peer()
+{
+  return &client_.peer;
+}
+
+
+
+ENetPeer *netlocal_t::connect(ENetHost *host)
+{
+  if (host != NULL) {
+    std::lock_guard<std::mutex> lock(g_hosted_lock);
+    const std::pair<const ENetHost *, ENetPeer *> hosted { host, &client_.peer };
+    if (std::find(g_hosted.begin(), g_hosted.end(), hosted) == g_hosted.end()) {
+      g_hosted.push_back(hosted);
+    }
+  }
+  server_.generation.fetch_add(1, std::memory_order_relaxed);
+  client_.generation.fetch_add(1, std::memory_order_relaxed);
+  server_.state.store(ENET_PEER_STATE_CONNECTED, std::memory_order_release);
+  client_.state.store(ENET_PEER_STATE_CONNECTED, std::memory_order_release);
+  post(server_, { ENET_EVENT_TYPE_CONNECT, 0, NULL });
+  return &server_.peer;
+}
+
+
+
+bool netlocal_t::is_local(const ENetPeer *peer)
+{
+  return peer != NULL && peer->host == NULL && peer->incomingPeerID == LOCAL_PEER_ID;
+}
+
+
+
+bool netlocal_t::is_connected(const ENetPeer *peer)
+{
+  return endpoint_of(peer)->state.load(std::memory_order_acquire) == ENET_PEER_STATE_CONNECTED;
+}
+
+
+
+enet_uint32 netlocal_t::generation(const ENetPeer *peer)
+{
+  return endpoint_of(peer)->generation.load(std::memory_order_acquire);
+}
+
+
+
+void netlocal_t::hosted_peers(const ENetHost *host, std::vector<ENetPeer *> &peers)
+{
+  std::lock_guard<std::mutex> lock(g_hosted_lock);
+  for (const auto &hosted : g_hosted) {
+    if (hosted.first == host && is_connected(hosted.second)) {
+      peers.push_back(hosted.second);
+    }
+  }
+}
+
+
+
+void netlocal_t::broadcast(const ENetHost *host, enet_uint8 channel,
+  const ENetPacket *packet)
+{
+  if (packet == NULL) {
+    s_throw(std::invalid_argument, "ENetPacket is null");
+  }
+
+  std::lock_guard<std::mutex> lock(g_hosted_lock);
+  for (const auto &hosted : g_hosted) {
+    if (hosted.first != host || !is_connected(hosted.second)) {
+      continue;
+    }
+    // The receiver destroys what it's sent, so each peer needs its own copy
+    ENetPacket *copy = netpacket_pool_t::default_pool().create(packet->dataLength, packet->flags);
+    if (copy == NULL) {
+      s_throw(std::runtime_error, "Failed to allocate ENetPacket");
+    }
+    std::memcpy(copy->data, packet->data, packet->dataLength);
+    post(*endpoint_of(hosted.second), { ENET_EVENT_TYPE_RECEIVE, channel, copy });
+  }
+}
+
+
+
+int netlocal_t::send(ENetPeer *peer, enet_uint8 channel, ENetPacket *packet)
+{
+  endpoint_t *endpoint = endpoint_of(peer);
+  if (packet == NULL) {
+    s_throw(std::invalid_argument, "ENetPacket is null");
+  } else if (endpoint->state.load(std::memory_order_acquire) != ENET_PEER_STATE_CONNECTED) {
+    return -1;
+  }
+  post(*endpoint, { ENET_EVENT_TYPE_RECEIVE, channel, packet });
+  return 0;
+}
+
+
+
+bool netlocal_t::receive(ENetPeer *peer, ENetEvent &event)
+{
+  endpoint_t *endpoint = endpoint_of(peer);
+
+  // The receiving thread also sends through this endpoint, so this is a safe
+  // point to retry anything that didn't fit the remote's queue.
+  while (!endpoint->backlog.empty() &&
+         endpoint->remote->inbound.push(endpoint->backlog.front())) {
+    endpoint->backlog.pop_front();
+  }
+
+  message_t message;
+  if (!endpoint->inbound.pop(message)) {
+    return false;
+  }
+
+  if (message.type == ENET_EVENT_TYPE_DISCONNECT) {
+    endpoint->state.store(ENET_PEER_STATE_DISCONNECTED, std::memory_order_release);
+  }
+
+  event.type = message.type;
+  event.peer = peer;
+  event.channelID = message.channel;
+  event.data = 0;
+  event.packet = message.packet;
+  return true;
+}
+
+
+
+void netlocal_t::disconnect(ENetPeer *peer)
+{
+  endpoint_t *endpoint = endpoint_of(peer);
+  ENetPeerState connected = ENET_PEER_STATE_CONNECTED;
+  // Only the disconnect that changes the state tells the other side
+  if (!endpoint->state.compare_exchange_strong(connected, ENET_PEER_STATE_DISCONNECTED,
+      std::memory_order_acq_rel)) {
+    return;
+  }
+  post(*endpoint, { ENET_EVENT_TYPE_DISCONNECT, 0, NULL });
+}
+
+
+
+auto netlocal_t::endpoint_of(const ENetPeer *peer) -> endpoint_t *
+{
+  if (!is_local(peer)) {
+    s_throw(std::invalid_argument, "Peer is not a local peer");
+  }
+  return static_cast<endpoint_t *>(peer->data);
+}
+
+
+
+// Posts a message to the remote side of the endpoint, keeping messages in
+// order behind any existing backlog.
+bool netlocal_t::post(endpoint_t &from, const message_t &message)
+{
+  netlocal_queue_t<message_t, QUEUE_SIZE> &queue = from.remote->inbound;
+  while (!from.backlog.empty() && queue.push(from.backlog.front())) {
+    from.backlog.pop_front();
+  }
+
+  if (!from.backlog.empty() || !queue.push(message)) {
+    if (from.backlog.size() >= MAX_BACKLOG) {
+      overflow(from);
+      if (message.packet) {
+        enet_packet_destroy(message.packet);
+      }
+    } else {
+      from.backlog.push_back(message);
+    }
+    return false;
+  }
+
+  return true;
+}
+
+
+
+// Disconnects an endpoint whose remote has stopped receiving. The backlog is
+// replaced by a disconnect event, delivered once the remote catches up.
+void netlocal_t::overflow(endpoint_t &from)
+{
+  s_log_warning("Local peer fell %zu messages behind, disconnecting it", from.backlog.size());
+  for (const message_t &pending : from.backlog) {
+    if (pending.packet) {
+      enet_packet_destroy(pending.packet);
+    }
+  }
+  from.backlog.clear();
+  from.backlog.push_back({ ENET_EVENT_TYPE_DISCONNECT, 0, NULL });
+  from.state.store(ENET_PEER_STATE_DISCONNECTED, std::memory_order_release);
+  from.generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+
+void netlocal_t::init_endpoint(endpoint_t &endpoint, endpoint_t *remote)
+{
+  memset(&endpoint.peer, 0, sizeof(endpoint.peer));
+  endpoint.peer.state = ENET_PEER_STATE_DISCONNECTED;
+  endpoint.state.store(ENET_PEER_STATE_DISCONNECTED, std::memory_order_relaxed);
+  endpoint.generation.store(0, std::memory_order_relaxed);
+  endpoint.peer.mtu = ENET_PROTOCOL_MAXIMUM_MTU;
+  endpoint.peer.incomingPeerID = LOCAL_PEER_ID;
+  endpoint.peer.outgoingPeerID = LOCAL_PEER_ID;
+  endpoint.peer.data = &endpoint;
+  endpoint.remote = remote;
+}
+
+
+
+// Destroys any packets still waiting for the endpoint's owner or its remote.
+// Only safe when neither side is sending or receiving.
+void netlocal_t::drain(endpoint_t &endpoint)
+{
+  message_t message;
+  while (endpoint.inbound.pop(message)) {
+    if (message.packet) {
+      enet_packet_destroy(message.packet);
+    }
+  }
+  for (const message_t &pending : endpoint.backlog) {
+    if (pending.packet) {
+      enet_packet_destroy(pending.packet);
+    }
+  }
+  endpoint.backlog.clear();
+}
+
+
+} // namespace snow
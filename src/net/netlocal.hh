@@ -0,0 +1,201 @@
+/*
+  netlocal.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__NETLOCAL_HH__
+#define __SNOW__NETLOCAL_HH__
+
+#include "../config.hh"
+#include <enet/enet.h>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+
+namespace snow {
+
+
+/*==============================================================================
+
+  Bounded single-producer, single-consumer queue. push() and pop() never
+  block or lock; push() fails if the queue is full. SIZE must be a power of
+  two.
+
+==============================================================================*/
+template <typename T, size_t SIZE>
+struct netlocal_queue_t
+{
+  static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "Queue size must be a power of two");
+
+  netlocal_queue_t() = default;
+  netlocal_queue_t(const netlocal_queue_t &) = delete;
+  netlocal_queue_t &operator = (const netlocal_queue_t &) = delete;
+
+  // Producer only
+  bool push(const T &value);
+  // Consumer only
+  bool pop(T &value);
+
+  bool empty() const;
+
+private:
+  static const size_t MASK = SIZE - 1;
+  // Keep producer and consumer indices on separate cache lines
+  static const size_t CACHE_LINE = 64;
+
+  alignas(CACHE_LINE) std::atomic<size_t> head_ { 0 }; // next to pop
+  alignas(CACHE_LINE) std::atomic<size_t> tail_ { 0 }; // next to push
+  alignas(CACHE_LINE) T                   values_[SIZE];
+};
+
+
+
+template <typename T, size_t SIZE>
+bool netlocal_queue_t<T, SIZE>::push(const T &value)
+{
+  const size_t tail = tail_.load(std::memory_order_relaxed);
+  if (tail - head_.load(std::memory_order_acquire) >= SIZE) {
+    return false;
+  }
+  values_[tail & MASK] = value;
+  tail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+
+
+template <typename T, size_t SIZE>
+bool netlocal_queue_t<T, SIZE>::pop(T &value)
+{
+  const size_t head = head_.load(std::memory_order_relaxed);
+  if (head == tail_.load(std::memory_order_acquire)) {
+    return false;
+  }
+  value = values_[head & MASK];
+  head_.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+
+
+template <typename T, size_t SIZE>
+bool netlocal_queue_t<T, SIZE>::empty() const
+{
+  return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+}
+
+
+
+/*==============================================================================
+
+  In-process connection between a client and server in the same process,
+  bypassing ENet and the loopback interface. Each side talks to the other
+  through an ENetPeer owned by the connection, so code keyed on ENetPeer
+  (netevent_batch_t, netscheduler_t) works unchanged. Local peers aren't part
+  of any ENetHost, so they must be serviced with receive() rather than
+  enet_host_service, and sent to with netpeer_send (see nettransport.hh)
+  rather than enet_peer_send. A connection made with a host is included in
+  that host's broadcasts through nethost_broadcast and nethost_peers.
+
+  Packets are passed between sides by pointer through a lock-free queue per
+  direction, so nothing is copied, checksummed, or fragmented. The receiver
+  gets packets under the same ownership rules as packets received from ENet
+  and must destroy them when done (or retain/release them).
+
+  Each direction supports one sending thread and one receiving thread. If a
+  queue is full, packets wait in a backlog owned by the sender until the
+  receiver catches up, so reliable sends aren't lost. The backlog holds at
+  most MAX_BACKLOG messages: a receiver that falls further behind is treated
+  like an ENet peer that timed out. Everything waiting for it is dropped, the
+  sender's peer is disconnected (and its generation bumped), and the
+  receiver gets a disconnect event once it reads again.
+
+  Local peers keep a pointer to their connection in ENetPeer::data, which
+  mustn't be changed.
+
+  Both threads change a connection's state, so it's kept in an atomic rather
+  than the peers' ENetPeer::state, which isn't maintained for local peers.
+  Use is_connected() (or netpeer_is_connected) instead.
+
+==============================================================================*/
+struct netlocal_t
+{
+  static const size_t QUEUE_SIZE = 4096;
+  // Messages a sender may have waiting on top of a full queue
+  static const size_t MAX_BACKLOG = 4 * QUEUE_SIZE;
+
+  netlocal_t();
+  ~netlocal_t();
+
+  netlocal_t(const netlocal_t &) = delete;
+  netlocal_t &operator = (const netlocal_t &) = delete;
+
+  // Peer the client uses to reach the server.
+  ENetPeer *server_peer();
+  // Peer the server uses to reach the client.
+  ENetPeer *client_peer();
+
+  // Marks both peers as connected and queues a connect event for the server.
+  // Returns the client's peer for the server. If host is given, the server's
+  // peer for the client is included in broadcasts to that host (see
+  // broadcast()). Must be called from the client's thread.
+  ENetPeer *connect(ENetHost *host = NULL);
+
+  // Whether the peer belongs to a netlocal_t.
+  static bool is_local(const ENetPeer *peer);
+  // Whether the local peer is connected.
+  static bool is_connected(const ENetPeer *peer);
+  // Number of times the peer has been connected (see netpeer_info_t).
+  static enet_uint32 generation(const ENetPeer *peer);
+  // Appends the connected local peers included in broadcasts to host.
+  static void hosted_peers(const ENetHost *host, std::vector<ENetPeer *> &peers);
+  // Sends a copy of the packet to each connected local peer included in
+  // broadcasts to host. The packet still belongs to the caller.
+  static void broadcast(const ENetHost *host, enet_uint8 channel, const ENetPacket *packet);
+  // Queues the packet for the other side of the peer's connection. Returns
+  // nonzero if the peer isn't connected.
+  static int send(ENetPeer *peer, enet_uint8 channel, ENetPacket *packet);
+  // Reads the next event sent to the owner of peer. Returns false if there
+  // are no events. Any packet must be destroyed by the receiver.
+  static bool receive(ENetPeer *peer, ENetEvent &event);
+  // Disconnects the peer and queues a disconnect event for the other side.
+  static void disconnect(ENetPeer *peer);
+
+private:
+  struct message_t
+  {
+    ENetEventType type;
+    enet_uint8    channel;
+    ENetPacket *  packet;
+  };
+
+  // Endpoints are found from their peers through ENetPeer::data
+  struct endpoint_t
+  {
+    ENetPeer                                  peer;
+    // Written by both threads: released by connect() and disconnects, and
+    // acquired before sending
+    std::atomic<ENetPeerState>                state;
+    std::atomic<enet_uint32>                  generation;
+    endpoint_t *                              remote;
+    // Messages sent to this endpoint's owner
+    netlocal_queue_t<message_t, QUEUE_SIZE>   inbound;
+    // Messages from this endpoint's owner that didn't fit the remote's queue
+    std::deque<message_t>                     backlog;
+  };
+
+  static endpoint_t *endpoint_of(const ENetPeer *peer);
+  static bool post(endpoint_t &from, const message_t &message);
+  static void overflow(endpoint_t &from);
+  static void init_endpoint(endpoint_t &endpoint, endpoint_t *remote);
+  static void drain(endpoint_t &endpoint);
+
+  endpoint_t server_;
+  endpoint_t client_;
+};
+
+
+} // namespace snow
+
+#endif /* end __SNOW__NETLOCAL_HH__ include guard */
@@ -0,0 +1,89 @@
+/*
+  netmessage.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__NETMESSAGE_HH__
+#define __SNOW__NETMESSAGE_HH__
+
+#include "../config.hh"
+#include "bitstream.hh"
+#include "netevent.hh"
+
+
+namespace snow {
+
+
+/*==============================================================================
+
+  Message schemas
+
+  A netevent payload type describes its layout once with a serialize member
+  template that's used for both writing and reading:
+
+    struct move_msg_t
+    {
+      static const quantization_t POSITION;
+
+      float     x, y;
+      uint32_t  sequence;
+      bool      firing;
+
+      template <typename STREAM>
+      void serialize(STREAM &stream)
+      {
+        stream.quantized(x, POSITION);
+        stream.quantized(y, POSITION);
+        stream.varint(sequence);
+        stream.flag(firing);
+      }
+    };
+
+  write_message/read_message then encode and decode the payload of a netevent
+  using that layout. read_message returns false if the payload is truncated,
+  a value doesn't fit its field, or there are whole bytes left unread.
+
+==============================================================================*/
+
+
+template <typename T>
+void write_message(const T &message, netevent_t::charbuf_t &out)
+{
+  bit_writer_t writer(out);
+  // serialize() doesn't modify the message when writing
+  const_cast<T &>(message).serialize(writer);
+  writer.flush();
+}
+
+
+
+template <typename T>
+void write_message(const T &message, netevent_t &event)
+{
+  netevent_t::charbuf_t buffer;
+  write_message(message, buffer);
+  event.set_buffer(std::move(buffer));
+}
+
+
+
+template <typename T>
+bool read_message(T &message, const uint8_t *data, size_t length)
+{
+  bit_reader_t reader(data, length);
+  message.serialize(reader);
+  return reader.ok() && reader.bits_remaining() < 8;
+}
+
+
+
+template <typename T>
+bool read_message(T &message, const netevent_t &event)
+{
+  return read_message(message, event.payload(), event.payload_length());
+}
+
+
+} // namespace snow
+
+#endif /* end __SNOW__NETMESSAGE_HH__ include guard */
@@ -0,0 +1,331 @@
+/*
+  netmessage_registry.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__NETMESSAGE_REGISTRY_HH__
+#define __SNOW__NETMESSAGE_REGISTRY_HH__
+
+#include "../config.hh"
+#include "netmessage.hh"
+#include <type_traits>
+#include <utility>
+
+
+namespace snow {
+
+
+const size_t NETMESSAGE_UNBOUNDED = SIZE_MAX;
+
+
+/*==============================================================================
+
+  Binds a message ID to its payload type (see netmessage.hh) and the range of
+  payload lengths, in bytes, accepted for it. Payloads outside the range are
+  rejected before they're decoded.
+
+==============================================================================*/
+template <uint16_t ID, typename T, size_t MIN_LENGTH = 0,
+  size_t MAX_LENGTH = NETMESSAGE_UNBOUNDED>
+struct netmessage_def_t
+{
+  static_assert(MIN_LENGTH <= MAX_LENGTH, "Message length range is empty");
+
+  using type = T;
+
+  static const uint16_t id         = ID;
+  static const size_t   min_length = MIN_LENGTH;
+  static const size_t   max_length = MAX_LENGTH;
+};
+
+
+namespace netmessage_detail {
+
+
+template <size_t... INDICES>
+struct index_list_t
+{
+  using type = index_list_t;
+};
+
+template <typename LHS, typename RHS>
+struct concat_indices_t;
+
+template <size_t... LHS, size_t... RHS>
+struct concat_indices_t<index_list_t<LHS...>, index_list_t<RHS...>> :
+  index_list_t<LHS..., (sizeof...(LHS) + RHS)...> { };
+
+// Builds index_list_t<0, ..., COUNT - 1> with log(COUNT) instantiation depth
+template <size_t COUNT>
+struct make_indices_t :
+  concat_indices_t<
+    typename make_indices_t<COUNT / 2>::type,
+    typename make_indices_t<COUNT - COUNT / 2>::type> { };
+
+template <> struct make_indices_t<0> : index_list_t<> { };
+template <> struct make_indices_t<1> : index_list_t<0> { };
+
+
+// Placeholder for IDs with no definition
+struct no_def_t
+{
+  using type = void;
+
+  static const size_t min_length = NETMESSAGE_UNBOUNDED;
+  static const size_t max_length = 0;
+};
+
+
+template <size_t ID, typename... DEFS>
+struct find_id_t
+{
+  using type = no_def_t;
+};
+
+template <size_t ID, typename DEF, typename... REST>
+struct find_id_t<ID, DEF, REST...>
+{
+  using type = typename std::conditional<DEF::id == ID,
+    DEF, typename find_id_t<ID, REST...>::type>::type;
+};
+
+
+template <typename T, typename... DEFS>
+struct find_type_t
+{
+  using type = no_def_t;
+};
+
+template <typename T, typename DEF, typename... REST>
+struct find_type_t<T, DEF, REST...>
+{
+  using type = typename std::conditional<std::is_same<typename DEF::type, T>::value,
+    DEF, typename find_type_t<T, REST...>::type>::type;
+};
+
+
+template <typename... DEFS>
+struct max_id_t
+{
+  static const size_t value = 0;
+};
+
+template <typename DEF, typename... REST>
+struct max_id_t<DEF, REST...>
+{
+  static const size_t value = DEF::id > max_id_t<REST...>::value
+    ? DEF::id : max_id_t<REST...>::value;
+};
+
+
+template <typename... DEFS>
+struct unique_ids_t
+{
+  static const bool value = true;
+};
+
+template <typename DEF, typename... REST>
+struct unique_ids_t<DEF, REST...>
+{
+  static const bool value =
+    std::is_same<typename find_id_t<DEF::id, REST...>::type, no_def_t>::value &&
+    unique_ids_t<REST...>::value;
+};
+
+
+// Whether HANDLER has an on_message(const T &, const netevent_t &) member
+template <typename HANDLER, typename T>
+struct handles_t
+{
+private:
+  template <typename H>
+  static auto test(int) -> decltype(
+    std::declval<H &>().on_message(std::declval<const T &>(), std::declval<const netevent_t &>()),
+    std::true_type());
+
+  template <typename H>
+  static std::false_type test(...);
+
+public:
+  static const bool value = decltype(test<HANDLER>(0))::value;
+};
+
+template <typename HANDLER>
+struct handles_t<HANDLER, void>
+{
+  static const bool value = false;
+};
+
+
+} // namespace netmessage_detail
+
+
+
+/*==============================================================================
+
+  Compile-time registry of message definitions:
+
+    using game_messages_t = netmessage_registry_t<
+      netmessage_def_t<MSG_MOVE, move_msg_t, 4, 12>,
+      netmessage_def_t<MSG_CHAT, chat_msg_t>
+      >;
+
+  dispatch() looks the netevent's message ID up in tables built at compile
+  time and indexed by ID, checks the payload length, decodes the payload into
+  its registered type and calls the handler's matching on_message overload:
+
+    struct handler_t
+    {
+      void on_message(const move_msg_t &msg, const netevent_t &event);
+      void on_message(const chat_msg_t &msg, const netevent_t &event);
+    };
+
+  Handlers only need overloads for the messages they care about. Unknown IDs,
+  out-of-range lengths, and malformed payloads are rejected without calling
+  the handler and counted in netevent_stats().messages_rejected. Messages
+  known to the registry but unhandled return false without being decoded.
+
+  IDs should be dense, since tables are sized by the largest ID.
+
+==============================================================================*/
+template <typename... DEFS>
+struct netmessage_registry_t
+{
+  static_assert(sizeof...(DEFS) > 0, "Registry has no messages");
+  static_assert(netmessage_detail::unique_ids_t<DEFS...>::value,
+    "Message IDs must be unique");
+
+  static const size_t MAX_ID = netmessage_detail::max_id_t<DEFS...>::value;
+  static const size_t TABLE_SIZE = MAX_ID + 1;
+
+  static_assert(TABLE_SIZE <= 4096, "Message IDs should be dense");
+
+  // ID and definition of a registered payload type
+  template <typename T>
+  using def_of = typename netmessage_detail::find_type_t<T, DEFS...>::type;
+
+  template <typename T>
+  static constexpr uint16_t id_of()
+  {
+    static_assert(!std::is_same<def_of<T>, netmessage_detail::no_def_t>::value,
+      "Message type is not registered");
+    return def_of<T>::id;
+  }
+
+  // Whether a message with the given ID and payload length is acceptable.
+  static bool accepts(uint16_t id, size_t length)
+  {
+    return accepts(id, length, indices_t());
+  }
+
+  // Sets event's message ID and payload from message.
+  template <typename T>
+  static void write(const T &message, netevent_t &event)
+  {
+    event.set_message(id_of<T>());
+    write_message(message, event);
+  }
+
+  // Decodes event into message if its ID is the one registered for T.
+  template <typename T>
+  static bool read(T &message, const netevent_t &event)
+  {
+    if (event.message() != id_of<T>() ||
+        !accepts(event.message(), event.payload_length()) ||
+        !read_message(message, event)) {
+      netevent_stats().messages_rejected += 1;
+      return false;
+    }
+    return true;
+  }
+
+  // Decodes event and passes it to the handler. Returns true if a handler
+  // was called.
+  template <typename HANDLER>
+  static bool dispatch(HANDLER &handler, const netevent_t &event)
+  {
+    return dispatch(handler, event, indices_t());
+  }
+
+private:
+  using indices_t = typename netmessage_detail::make_indices_t<TABLE_SIZE>::type;
+
+  template <size_t ID>
+  using def_for = typename netmessage_detail::find_id_t<ID, DEFS...>::type;
+
+  template <typename HANDLER>
+  using handler_fn_t = bool (*)(HANDLER &, const netevent_t &);
+
+
+  struct bounds_t
+  {
+    size_t min_length;
+    size_t max_length;
+  };
+
+
+  template <typename HANDLER, typename DEF>
+  static bool invoke(HANDLER &handler, const netevent_t &event)
+  {
+    typename DEF::type message;
+    if (!read_message(message, event)) {
+      netevent_stats().messages_rejected += 1;
+      return false;
+    }
+    handler.on_message(message, event);
+    return true;
+  }
+
+
+  // Table entry for a handler and definition -- null if the handler has no
+  // on_message overload for the definition's type or there's no definition
+  template <typename HANDLER, typename DEF,
+    bool HANDLED = netmessage_detail::handles_t<HANDLER, typename DEF::type>::value>
+  struct handler_for_t
+  {
+    static constexpr handler_fn_t<HANDLER> value = nullptr;
+  };
+
+  template <typename HANDLER, typename DEF>
+  struct handler_for_t<HANDLER, DEF, true>
+  {
+    static constexpr handler_fn_t<HANDLER> value = &invoke<HANDLER, DEF>;
+  };
+
+
+  // Both tables are constant-initialized, so there's no first-use cost
+  template <size_t... IDS>
+  static bool accepts(uint16_t id, size_t length, netmessage_detail::index_list_t<IDS...>)
+  {
+    static const bounds_t bounds[TABLE_SIZE] = {
+      { def_for<IDS>::min_length, def_for<IDS>::max_length }...
+    };
+    return id < TABLE_SIZE &&
+      length >= bounds[id].min_length &&
+      length <= bounds[id].max_length;
+  }
+
+
+  template <typename HANDLER, size_t... IDS>
+  static bool dispatch(HANDLER &handler, const netevent_t &event,
+    netmessage_detail::index_list_t<IDS...>)
+  {
+    static const handler_fn_t<HANDLER> handlers[TABLE_SIZE] = {
+      handler_for_t<HANDLER, def_for<IDS>>::value...
+    };
+
+    const uint16_t id = event.message();
+    if (!accepts(id, event.payload_length())) {
+      netevent_stats().messages_rejected += 1;
+      return false;
+    }
+
+    const handler_fn_t<HANDLER> fn = handlers[id];
+    return fn != nullptr && fn(handler, event);
+  }
+};
+
+
+} // namespace snow
+
+#endif /* end __SNOW__NETMESSAGE_REGISTRY_HH__ include guard */
@@ -0,0 +1,163 @@
+/*
+  netpacket_pool.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "netpacket_pool.hh"
+#include "netevent.hh"
+#include <cstdlib>
+
+
+namespace snow {
+
+
+namespace {
+
+
+netpacket_pool_t g_default_packet_pool;
+
+
+// Offset from a block to its data, padded to keep packet data aligned
+const size_t BLOCK_DATA_OFFSET = 16;
+
+
+} // namespace <anon>
+
+
+
+netpacket_pool_t::netpacket_pool_t(size_t max_free_blocks) :
+  max_free_(max_free_blocks)
+{
+  static_assert(sizeof(block_t) <= BLOCK_DATA_OFFSET,
+    "Packet block header must fit in the block data offset");
+}
+
+
+
+netpacket_pool_t::~netpacket_pool_t()
+{
+  std::lock_guard<std::mutex> guard(lock_);
+  while (free_list_) {
+    block_t *next = free_list_->next;
+    std::free(free_list_);
+    free_list_ = next;
+  }
+  num_free_ = 0;
+}
+
+
+
+ENetPacket *netpacket_pool_t::create(size_t length, int flags)
+{
+  if (length > BLOCK_LENGTH) {
+    netevent_stats().packet_allocs += 1;
+    return enet_packet_create(NULL, length, flags);
+  }
+
+  block_t *block = acquire();
+  if (block == nullptr) {
+    return NULL;
+  }
+
+  uint8_t *data = (uint8_t *)block + BLOCK_DATA_OFFSET;
+  ENetPacket *packet = enet_packet_create(data, length,
+    flags | ENET_PACKET_FLAG_NO_ALLOCATE);
+
+  if (packet == NULL) {
+    recycle(block);
+    return NULL;
+  }
+
+  packet->freeCallback = free_packet;
+  return packet;
+}
+
+
+
+size_t netpacket_pool_t::free_blocks() const
+{
+  std::lock_guard<std::mutex> guard(lock_);
+  return num_free_;
+}
+
+
+
+netpacket_pool_t &netpacket_pool_t::default_pool()
+{
+  return g_default_packet_pool;
+}
+
+
+
+void netpacket_pool_t::free_packet(ENetPacket *packet)
+{
+  block_t *block = (block_t *)(packet->data - BLOCK_DATA_OFFSET);
+  block->pool->recycle(block);
+  packet->data = NULL;
+}
+
+
+
+auto netpacket_pool_t::acquire() -> block_t *
+{
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (free_list_) {
+      block_t *block = free_list_;
+      free_list_ = block->next;
+      --num_free_;
+      return block;
+    }
+  }
+
+  netevent_stats().packet_allocs += 1;
+  block_t *block = (block_t *)std::malloc(BLOCK_DATA_OFFSET + BLOCK_LENGTH);
+  if (block) {
+    block->pool = this;
+    block->next = nullptr;
+  }
+  return block;
+}
+
+
+
+void netpacket_pool_t::recycle(block_t *block)
+{
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (num_free_ < max_free_) {
+      block->next = free_list_;
+      free_list_ = block;
+      ++num_free_;
+      return;
+    }
+  }
+
+  std::free(block);
+}
+
+
+
+void netpacket_retain(ENetPacket *packet)
+{
+  if (packet == NULL) {
+    s_throw(std::invalid_argument, "ENetPacket is null");
+  }
+  ++packet->referenceCount;
+}
+
+
+
+void netpacket_release(ENetPacket *packet)
+{
+  if (packet == NULL) {
+    s_throw(std::invalid_argument, "ENetPacket is null");
+  }
+  assert(packet->referenceCount > 0);
+  if (--packet->referenceCount == 0) {
+    enet_packet_destroy(packet);
+  }
+}
+
+
+} // namespace snow
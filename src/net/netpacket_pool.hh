@@ -0,0 +1,81 @@
+/*
+  netpacket_pool.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__NETPACKET_POOL_HH__
+#define __SNOW__NETPACKET_POOL_HH__
+
+#include "../config.hh"
+#include <enet/enet.h>
+#include <mutex>
+
+
+namespace snow {
+
+
+/*==============================================================================
+
+  Pool of data buffers for outgoing ENet packets. Packets are created with
+  ENET_PACKET_FLAG_NO_ALLOCATE over a pooled buffer and given a freeCallback
+  that returns the buffer to its pool once ENet is done with the packet, so
+  steady-state sending doesn't malloc/free packet data.
+
+  Packets larger than BLOCK_LENGTH fall back to ENet's own allocation.
+
+  The pool is safe to use from multiple threads, since packets are released
+  by whichever thread's host destroys them.
+
+==============================================================================*/
+struct netpacket_pool_t
+{
+  // Large enough for any packet that fits in a single ENet datagram
+  static const size_t BLOCK_LENGTH = ENET_PROTOCOL_MAXIMUM_MTU;
+  // Maximum number of free blocks kept around by default
+  static const size_t DEFAULT_MAX_FREE_BLOCKS = 256;
+
+  netpacket_pool_t(size_t max_free_blocks = DEFAULT_MAX_FREE_BLOCKS);
+  ~netpacket_pool_t();
+
+  netpacket_pool_t(const netpacket_pool_t &) = delete;
+  netpacket_pool_t &operator = (const netpacket_pool_t &) = delete;
+
+  // Creates a packet of the given length. The packet's contents are
+  // uninitialized. Returns NULL if the packet could not be allocated.
+  ENetPacket *create(size_t length, int flags);
+
+  // Number of blocks currently held in the free list.
+  size_t free_blocks() const;
+
+  static netpacket_pool_t &default_pool();
+
+private:
+  struct block_t
+  {
+    netpacket_pool_t *  pool;
+    block_t *           next;
+  };
+
+  static void free_packet(ENetPacket *packet);
+
+  block_t *acquire();
+  void recycle(block_t *block);
+
+  mutable std::mutex  lock_;
+  block_t *           free_list_ = nullptr;
+  size_t              num_free_ = 0;
+  size_t              max_free_;
+};
+
+
+// Reference counting for packets held outside of ENet (e.g., received packets
+// borrowed by netevents). Uses the packet's own referenceCount, so packets
+// still queued by ENet are never destroyed early. Only safe to use from the
+// thread that owns the packet's host.
+void netpacket_retain(ENetPacket *packet);
+void netpacket_release(ENetPacket *packet);
+
+
+} // namespace snow
+
+#endif /* end __SNOW__NETPACKET_POOL_HH__ include guard */
@@ -0,0 +1,333 @@
+/*
+  netscheduler.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "netscheduler.hh"
+#include "../timing.hh"
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+
+namespace snow {
+
+
+namespace {
+
+
+const double UNLIMITED = std::numeric_limits<double>::infinity();
+
+
+inline bool is_valid_priority(netpriority_t priority)
+{
+  return priority >= NET_PRIORITY_HIGH && priority < NET_PRIORITY_COUNT;
+}
+
+
+
+// Smallest nonzero of the two limits, or zero if neither is set
+inline uint32_t min_limit(uint32_t lhs, uint32_t rhs)
+{
+  if (lhs == 0) {
+    return rhs;
+  } else if (rhs == 0) {
+    return lhs;
+  }
+  return std::min(lhs, rhs);
+}
+
+
+} // namespace <anon>
+
+
+
+netscheduler_t::netscheduler_t()
+{
+  weights_[NET_PRIORITY_HIGH] = 4.0;
+  weights_[NET_PRIORITY_NORMAL] = 2.0;
+  weights_[NET_PRIORITY_LOW] = 1.0;
+
+  drop_ticks_[NET_PRIORITY_HIGH] = 0;
+  drop_ticks_[NET_PRIORITY_NORMAL] = 0;
+  // Low priority state that's a second old isn't worth sending
+  drop_ticks_[NET_PRIORITY_LOW] = static_cast<unsigned>(FRAME_HERTZ);
+}
+
+
+
+netscheduler_t::~netscheduler_t()
+{
+  /* nop */
+}
+
+
+
+void netscheduler_t::set_bandwidth(uint32_t bytes_per_second)
+{
+  bandwidth_ = bytes_per_second;
+}
+
+
+
+uint32_t netscheduler_t::bandwidth() const
+{
+  return bandwidth_;
+}
+
+
+
+void netscheduler_t::set_weight(netpriority_t priority, double weight)
+{
+  if (!is_valid_priority(priority)) {
+    s_throw(std::invalid_argument, "Invalid priority class");
+  } else if (!(weight > 0)) {
+    s_throw(std::invalid_argument, "Priority weight must be positive");
+  }
+  weights_[priority] = weight;
+}
+
+
+
+void netscheduler_t::set_drop_ticks(netpriority_t priority, unsigned ticks)
+{
+  if (!is_valid_priority(priority)) {
+    s_throw(std::invalid_argument, "Invalid priority class");
+  }
+  drop_ticks_[priority] = ticks;
+}
+
+
+
+void netscheduler_t::set_info_fn(netpeer_info_fn_t fn, void *context)
+{
+  info_fn_ = fn;
+  info_context_ = context;
+}
+
+
+
+void netscheduler_t::send(ENetPeer *peer, enet_uint8 channel,
+  const netevent_t &event, int flags)
+{
+  if (peer == NULL) {
+    s_throw(std::invalid_argument, "ENetPeer is null");
+  }
+  state_for(peer).messages.push_back({ channel, flags, event });
+}
+
+
+
+void netscheduler_t::update(ENetPeer *peer, uint32_t key, netpriority_t priority,
+  enet_uint8 channel, const netevent_t &event, int flags)
+{
+  if (peer == NULL) {
+    s_throw(std::invalid_argument, "ENetPeer is null");
+  } else if (!is_valid_priority(priority)) {
+    s_throw(std::invalid_argument, "Invalid priority class");
+  }
+
+  peer_state_t &state = state_for(peer);
+  auto found = state.index.find(key);
+  if (found != state.index.end()) {
+    // Keep the accumulated priority so that frequently updated keys still
+    // make their way to the front, but the payload is new, so its age (which
+    // decides when it's dropped) starts over
+    update_t &pending = state.updates[found->second];
+    pending.priority = priority;
+    pending.channel = channel;
+    pending.flags = flags;
+    pending.age = 0;
+    pending.event = event;
+    state.stats.updates_replaced += 1;
+    return;
+  }
+
+  state.index.emplace(key, state.updates.size());
+  state.updates.push_back({ key, priority, channel, flags, 0, 0.0, event });
+}
+
+
+
+void netscheduler_t::schedule(netevent_batch_t &batch, double tick_length)
+{
+  for (peer_state_t &state : peers_) {
+    schedule_peer(state, batch, tick_length);
+  }
+}
+
+
+
+void netscheduler_t::drop(ENetPeer *peer)
+{
+  auto iter = std::remove_if(peers_.begin(), peers_.end(),
+    [peer](const peer_state_t &state) { return state.peer == peer; });
+  peers_.erase(iter, peers_.end());
+}
+
+
+
+netscheduler_stats_t netscheduler_t::stats(const ENetPeer *peer) const
+{
+  const peer_state_t *state = find_state(peer);
+  if (state == NULL) {
+    return netscheduler_stats_t { 0, 0, 0, 0, 0, 0, 0 };
+  }
+  netscheduler_stats_t stats = state->stats;
+  stats.queued = state->updates.size();
+  stats.budget = state->budget;
+  return stats;
+}
+
+
+
+auto netscheduler_t::state_for(ENetPeer *peer) -> peer_state_t &
+{
+  const netpeer_info_t info = netpeer_info(peer, info_fn_, info_context_);
+  for (peer_state_t &state : peers_) {
+    if (state.peer == peer) {
+      check_generation(state, info);
+      return state;
+    }
+  }
+
+  peers_.emplace_back();
+  peer_state_t &state = peers_.back();
+  state.peer = peer;
+  state.generation = info.generation;
+  state.budget = 0;
+  state.stats = netscheduler_stats_t { 0, 0, 0, 0, 0, 0, 0 };
+  return state;
+}
+
+
+
+auto netscheduler_t::find_state(const ENetPeer *peer) const -> const peer_state_t *
+{
+  for (const peer_state_t &state : peers_) {
+    if (state.peer == peer) {
+      return &state;
+    }
+  }
+  return NULL;
+}
+
+
+
+double netscheduler_t::bytes_per_tick(const netpeer_info_t &info, double tick_length) const
+{
+  uint32_t limit = min_limit(bandwidth_, info.incoming_bandwidth);
+  limit = min_limit(limit, info.outgoing_bandwidth);
+  return limit == 0 ? UNLIMITED : static_cast<double>(limit) * tick_length;
+}
+
+
+
+bool netscheduler_t::check_generation(peer_state_t &state, const netpeer_info_t &info)
+{
+  if (state.generation == info.generation) {
+    return true;
+  }
+  // The peer is a new connection now, so nothing queued is meant for it and
+  // its budget and counters start over
+  state.generation = info.generation;
+  state.budget = 0;
+  state.messages.clear();
+  state.updates.clear();
+  state.index.clear();
+  state.stats = netscheduler_stats_t { 0, 0, 0, 0, 0, 0, 0 };
+  return false;
+}
+
+
+
+void netscheduler_t::schedule_peer(peer_state_t &state, netevent_batch_t &batch,
+  double tick_length)
+{
+  const netpeer_info_t info = netpeer_info(state.peer, info_fn_, info_context_);
+  if (!check_generation(state, info)) {
+    return;
+  }
+
+  const double per_tick = bytes_per_tick(info, tick_length);
+  const double max_budget = per_tick * MAX_BURST_TICKS;
+  state.budget = std::min(state.budget + per_tick, max_budget);
+
+  // Unconditional messages first. These may put the budget into debt, which
+  // holds back updates until it's paid off.
+  for (const message_t &message : state.messages) {
+    const size_t cost = message.event.data_length() + FRAMING_LENGTH;
+    batch.queue(state.peer, message.channel, message.event, message.flags);
+    state.budget -= cost;
+    state.stats.bytes_sent += cost;
+  }
+  state.messages.clear();
+
+  // Age updates and discard those that have waited too long. Iterate in
+  // reverse so removal (which moves the last update down) doesn't skip any.
+  for (size_t index = state.updates.size(); index-- > 0;) {
+    update_t &pending = state.updates[index];
+    pending.age += 1;
+    pending.accumulated += weights_[pending.priority];
+    const unsigned drop_ticks = drop_ticks_[pending.priority];
+    if (drop_ticks > 0 && pending.age > drop_ticks) {
+      state.stats.updates_dropped += 1;
+      remove_update(state, index);
+    }
+  }
+
+  if (state.updates.empty()) {
+    return;
+  }
+
+  order_.resize(state.updates.size());
+  for (size_t index = 0; index < order_.size(); ++index) {
+    order_[index] = index;
+  }
+  const std::vector<update_t> &updates = state.updates;
+  std::sort(order_.begin(), order_.end(), [&updates](size_t lhs, size_t rhs) {
+    return updates[lhs].accumulated > updates[rhs].accumulated;
+  });
+
+  // Send in priority order until an update doesn't fit. Stopping there rather
+  // than skipping ahead to smaller updates keeps large updates from starving.
+  // An update larger than the maximum budget is still sent once the budget is
+  // full, going into debt.
+  size_t sent = 0;
+  for (; sent < order_.size(); ++sent) {
+    const update_t &pending = updates[order_[sent]];
+    const double cost = static_cast<double>(pending.event.data_length() + FRAMING_LENGTH);
+    if (cost > state.budget && state.budget < max_budget) {
+      break;
+    }
+    batch.queue(state.peer, pending.channel, pending.event, pending.flags);
+    state.budget -= cost;
+    state.stats.bytes_sent += static_cast<uint64_t>(cost);
+    state.stats.updates_sent += 1;
+  }
+  state.stats.updates_deferred += order_.size() - sent;
+
+  // Remove sent updates from the highest index down so removal doesn't move
+  // any other sent update
+  order_.resize(sent);
+  std::sort(order_.begin(), order_.end(), std::greater<size_t>());
+  for (const size_t index : order_) {
+    remove_update(state, index);
+  }
+}
+
+
+
+void netscheduler_t::remove_update(peer_state_t &state, size_t index)
+{
+  state.index.erase(state.updates[index].key);
+  const size_t last = state.updates.size() - 1;
+  if (index != last) {
+    state.updates[index] = std::move(state.updates[last]);
+    state.index[state.updates[index].key] = index;
+  }
+  state.updates.pop_back();
+}
+
+
+} // namespace snow
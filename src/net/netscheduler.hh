@@ -0,0 +1,182 @@
+/*
+  netscheduler.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__NETSCHEDULER_HH__
+#define __SNOW__NETSCHEDULER_HH__
+
+#include "../config.hh"
+#include "netevent.hh"
+#include "netevent_batch.hh"
+#include "nettransport.hh"
+#include <enet/enet.h>
+#include <unordered_map>
+#include <vector>
+
+
+namespace snow {
+
+
+/*! Priority classes for state updates passed to netscheduler_t::update. */
+enum netpriority_t : int
+{
+  NET_PRIORITY_HIGH = 0,
+  NET_PRIORITY_NORMAL,
+  NET_PRIORITY_LOW,
+  NET_PRIORITY_COUNT
+};
+
+
+/*! Per-peer scheduler counters. */
+struct netscheduler_stats_t
+{
+  // State updates waiting to be sent
+  size_t    queued;
+  // Bytes the peer may still send this tick (negative if over budget)
+  double    budget;
+  uint64_t  bytes_sent;
+  uint64_t  updates_sent;
+  // Ticks in which an update was held back for lack of budget
+  uint64_t  updates_deferred;
+  // Updates overwritten by a newer update for the same key before being sent
+  uint64_t  updates_replaced;
+  // Updates discarded after waiting longer than their class allows
+  uint64_t  updates_dropped;
+};
+
+
+/*==============================================================================
+
+  Per-peer outgoing bandwidth scheduler. Sits in front of a netevent_batch_t
+  and decides what gets sent each tick when there's more to send than the
+  peer's bandwidth allows.
+
+  Two kinds of traffic go through it:
+
+  - Events passed to send() are always sent on the next schedule(), in order,
+    regardless of budget. Use this for reliable, must-arrive messages.
+  - State updates passed to update() are keyed (usually by entity). A newer
+    update for a key replaces the older one if it hasn't been sent yet, so
+    only the latest state is ever sent and the queue can't grow beyond the
+    number of keys. Each tick an update waits, its accumulated priority grows
+    by its class weight, and schedule() sends updates in order of accumulated
+    priority until the tick's byte budget is spent. Sending an update resets
+    its key's priority, so a steady stream of high priority updates can't
+    starve lower classes forever. An update whose payload has waited longer
+    than its class's drop limit is discarded. Replacing an update keeps its
+    accumulated priority but starts its payload's age over.
+
+  The budget is refilled each tick from the smallest nonzero of the
+  scheduler's bandwidth, the host's outgoing bandwidth, and the peer's
+  incoming bandwidth, and unspent budget carries over for up to
+  MAX_BURST_TICKS ticks. With no bandwidth limits at all, everything queued
+  is sent every tick.
+
+  Peer bandwidth is looked up with the scheduler's info function (see
+  netpeer_info_t), so a peer whose host is serviced by netio_t must use
+  netio_t::info_fn. Whatever is queued for a peer is kept with the peer's
+  generation and discarded if the peer is reused for another connection
+  before it's sent.
+
+==============================================================================*/
+struct netscheduler_t
+{
+  // Ticks of unspent budget a peer may accumulate
+  static const unsigned MAX_BURST_TICKS = 4;
+  // Framing bytes added per netevent in a batch
+  static const size_t   FRAMING_LENGTH = sizeof(netevent_batch_t::length_t);
+
+  netscheduler_t();
+  ~netscheduler_t();
+
+  netscheduler_t(const netscheduler_t &) = delete;
+  netscheduler_t &operator = (const netscheduler_t &) = delete;
+
+  // Bandwidth limit in bytes per second applied to all peers. Zero means no
+  // limit beyond what ENet was configured with.
+  void set_bandwidth(uint32_t bytes_per_second);
+  uint32_t bandwidth() const;
+
+  // Weight added to an update's accumulated priority for each tick it waits.
+  void set_weight(netpriority_t priority, double weight);
+  // Ticks an update's payload of the given class may wait before it's
+  // dropped. Zero means updates of the class are never dropped.
+  void set_drop_ticks(netpriority_t priority, unsigned ticks);
+  // Sets the function used to look up peer bandwidth and generation. Peers
+  // are read directly if fn is NULL.
+  void set_info_fn(netpeer_info_fn_t fn, void *context);
+
+  // Queues an event to be sent on the next schedule() regardless of budget.
+  void send(ENetPeer *peer, enet_uint8 channel, const netevent_t &event,
+    int flags = ENET_PACKET_FLAG_RELIABLE);
+  // Queues or replaces the pending state update for key.
+  void update(ENetPeer *peer, uint32_t key, netpriority_t priority,
+    enet_uint8 channel, const netevent_t &event, int flags = 0);
+
+  // Moves this tick's events and updates into the batch. Call once per tick,
+  // before flushing the batch. tick_length is the tick duration in seconds.
+  void schedule(netevent_batch_t &batch, double tick_length);
+
+  // Discards everything queued for the peer. Must be called before a peer is
+  // disconnected or reset.
+  void drop(ENetPeer *peer);
+
+  netscheduler_stats_t stats(const ENetPeer *peer) const;
+
+private:
+  struct update_t
+  {
+    uint32_t      key;
+    netpriority_t priority;
+    enet_uint8    channel;
+    int           flags;
+    // Ticks the current payload has waited
+    unsigned      age;
+    // Priority accumulated since the key was last sent, across replacements
+    double        accumulated;
+    netevent_t    event;
+  };
+
+  struct message_t
+  {
+    enet_uint8    channel;
+    int           flags;
+    netevent_t    event;
+  };
+
+  struct peer_state_t
+  {
+    ENetPeer *                          peer;
+    // Generation of the connection the queued traffic is for
+    enet_uint32                         generation;
+    double                              budget;
+    std::vector<message_t>              messages;
+    std::vector<update_t>               updates;
+    std::unordered_map<uint32_t, size_t> index;
+    netscheduler_stats_t                stats;
+  };
+
+  peer_state_t &state_for(ENetPeer *peer);
+  const peer_state_t *find_state(const ENetPeer *peer) const;
+  double bytes_per_tick(const netpeer_info_t &info, double tick_length) const;
+  // Clears the state's queues if the peer's generation changed. Returns
+  // false if it did.
+  bool check_generation(peer_state_t &state, const netpeer_info_t &info);
+  void schedule_peer(peer_state_t &state, netevent_batch_t &batch, double tick_length);
+  void remove_update(peer_state_t &state, size_t index);
+
+  uint32_t                  bandwidth_ = 0;
+  double                    weights_[NET_PRIORITY_COUNT];
+  unsigned                  drop_ticks_[NET_PRIORITY_COUNT];
+  netpeer_info_fn_t         info_fn_ = NULL;
+  void *                    info_context_ = NULL;
+  std::vector<peer_state_t> peers_ { };
+  // Scratch list of update indices sorted by accumulated priority
+  std::vector<size_t>       order_ { };
+};
+
+
+} // namespace snow
+
+#endif /* end __SNOW__NETSCHEDULER_HH__ include guard */
@@ -0,0 +1,378 @@
+/*
+  netsim.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "netsim.hh"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+
+namespace snow {
+
+
+namespace {
+
+
+uint64_t now_ms()
+{
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+
+
+// Each link gets its own seed so the directions and clients don't all make
+// the same decisions
+netsim_config_t config_for_link(netsim_config_t config, size_t client_index, bool upstream)
+{
+  config.seed += static_cast<uint32_t>(client_index * 2 + (upstream ? 0 : 1));
+  return config;
+}
+
+
+
+void add_stats(netsim_stats_t &sum, const netsim_stats_t &stats)
+{
+  sum.received += stats.received;
+  sum.delivered += stats.delivered;
+  sum.lost += stats.lost;
+  sum.overflowed += stats.overflowed;
+  sum.duplicated += stats.duplicated;
+  sum.reordered += stats.reordered;
+}
+
+
+} // namespace <anon>
+
+
+
+/*******************************************************************************
+*                                netsim_link_t                                 *
+*******************************************************************************/
+
+bool netsim_link_t::datagram_t::operator > (const datagram_t &other) const
+{
+  return due_ms > other.due_ms || (due_ms == other.due_ms && sequence > other.sequence);
+}
+
+
+
+netsim_link_t::netsim_link_t(const netsim_config_t &config) :
+  config_(config),
+  rng_(config.seed),
+  stats_ { 0, 0, 0, 0, 0, 0 }
+{
+  /* nop */
+}
+
+
+
+void netsim_link_t::configure(const netsim_config_t &config)
+{
+  if (config.seed != config_.seed) {
+    rng_.seed(config.seed);
+  }
+  config_ = config;
+}
+
+
+
+const netsim_config_t &netsim_link_t::config() const
+{
+  return config_;
+}
+
+
+
+void netsim_link_t::submit(const uint8_t *data, size_t length, uint64_t now_ms)
+{
+  stats_.received += 1;
+
+  if (chance(config_.loss)) {
+    stats_.lost += 1;
+    return;
+  }
+
+  schedule(data, length, now_ms);
+
+  if (chance(config_.duplicate)) {
+    stats_.duplicated += 1;
+    schedule(data, length, now_ms);
+  }
+}
+
+
+
+uint64_t netsim_link_t::next_due() const
+{
+  return queue_.empty() ? UINT64_MAX : queue_.front().due_ms;
+}
+
+
+
+size_t netsim_link_t::queued() const
+{
+  return queue_.size();
+}
+
+
+
+netsim_stats_t netsim_link_t::stats() const
+{
+  return stats_;
+}
+
+
+
+bool netsim_link_t::chance(float probability)
+{
+  if (!(probability > 0)) {
+    return false;
+  }
+  return std::uniform_real_distribution<float>(0.0f, 1.0f)(rng_) < probability;
+}
+
+
+
+void netsim_link_t::schedule(const uint8_t *data, size_t length, uint64_t now_ms)
+{
+  int64_t delay = config_.latency_ms;
+  if (config_.jitter_ms > 0) {
+    const int64_t jitter = config_.jitter_ms;
+    delay += std::uniform_int_distribution<int64_t>(-jitter, jitter)(rng_);
+  }
+
+  if (chance(config_.reorder)) {
+    // Hold it back long enough that anything sent shortly after overtakes it
+    const int64_t hold = std::max<int64_t>(config_.latency_ms, 20);
+    delay += std::uniform_int_distribution<int64_t>(1, hold)(rng_);
+    stats_.reordered += 1;
+  }
+
+  uint64_t due_ms = now_ms + static_cast<uint64_t>(std::max<int64_t>(delay, 0));
+
+  if (config_.bandwidth > 0) {
+    // Datagrams are serialized onto the wire one at a time, then delayed
+    const uint64_t start_ms = std::max(now_ms, wire_free_ms_);
+    if (start_ms - now_ms > MAX_QUEUE_MS) {
+      stats_.overflowed += 1;
+      return;
+    }
+    const uint64_t transmit_ms = (length * 1000 + config_.bandwidth - 1) / config_.bandwidth;
+    wire_free_ms_ = start_ms + transmit_ms;
+    due_ms += wire_free_ms_ - now_ms;
+  }
+
+  queue_.push_back({ due_ms, sequence_++, std::vector<uint8_t>(data, data + length) });
+  std::push_heap(queue_.begin(), queue_.end(), std::greater<datagram_t>());
+}
+
+
+
+void netsim_link_t::pop_due(datagram_t &out)
+{
+  std::pop_heap(queue_.begin(), queue_.end(), std::greater<datagram_t>());
+  out = std::move(queue_.back());
+  queue_.pop_back();
+}
+
+
+
+/*******************************************************************************
+*                                   netsim_t                                   *
+*******************************************************************************/
+
+netsim_t::~netsim_t()
+{
+  stop();
+}
+
+
+
+bool netsim_t::start(enet_uint16 port, const ENetAddress &target)
+{
+  if (running_) {
+    s_throw(std::runtime_error, "Network simulator is already running");
+  }
+
+  ENetAddress address;
+  address.host = ENET_HOST_ANY;
+  address.port = port;
+
+  socket_ = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+  if (socket_ == ENET_SOCKET_NULL) {
+    s_log_error("Unable to create network simulator socket");
+    return false;
+  }
+
+  enet_socket_set_option(socket_, ENET_SOCKOPT_NONBLOCK, 1);
+  if (enet_socket_bind(socket_, &address) < 0) {
+    s_log_error("Unable to bind network simulator to port %d", (int)port);
+    enet_socket_destroy(socket_);
+    socket_ = ENET_SOCKET_NULL;
+    return false;
+  }
+
+  target_ = target;
+  stopped_ = false;
+  running_ = true;
+  async_thread(&netsim_t::run, this);
+  return true;
+}
+
+
+
+void netsim_t::stop()
+{
+  running_ = false;
+  while (!stopped_) {
+    std::this_thread::yield();
+  }
+}
+
+
+
+bool netsim_t::is_running() const
+{
+  return running_;
+}
+
+
+
+void netsim_t::configure(const netsim_config_t &config)
+{
+  std::lock_guard<std::mutex> guard(lock_);
+  config_ = config;
+  config_changed_ = true;
+}
+
+
+
+netsim_stats_t netsim_t::upstream_stats() const
+{
+  std::lock_guard<std::mutex> guard(lock_);
+  netsim_stats_t sum { 0, 0, 0, 0, 0, 0 };
+  for (const relay_t &relay : relays_) {
+    add_stats(sum, relay.upstream.stats());
+  }
+  return sum;
+}
+
+
+
+netsim_stats_t netsim_t::downstream_stats() const
+{
+  std::lock_guard<std::mutex> guard(lock_);
+  netsim_stats_t sum { 0, 0, 0, 0, 0, 0 };
+  for (const relay_t &relay : relays_) {
+    add_stats(sum, relay.downstream.stats());
+  }
+  return sum;
+}
+
+
+
+void netsim_t::run()
+{
+  uint8_t data[ENET_PROTOCOL_MAXIMUM_MTU];
+  ENetBuffer buffer;
+  buffer.data = data;
+  buffer.dataLength = sizeof(data);
+
+  while (running_) {
+    enet_uint32 condition = ENET_SOCKET_WAIT_RECEIVE;
+    enet_socket_wait(socket_, &condition, 1);
+
+    std::lock_guard<std::mutex> guard(lock_);
+
+    if (config_changed_) {
+      size_t index = 0;
+      for (relay_t &relay : relays_) {
+        relay.upstream.configure(config_for_link(config_, index, true));
+        relay.downstream.configure(config_for_link(config_, index, false));
+        ++index;
+      }
+      config_changed_ = false;
+    }
+
+    const uint64_t now = now_ms();
+    ENetAddress from;
+    int length;
+
+    while ((length = enet_socket_receive(socket_, &from, &buffer, 1)) > 0) {
+      relay_for(from).upstream.submit(data, static_cast<size_t>(length), now);
+    }
+
+    for (relay_t &relay : relays_) {
+      while ((length = enet_socket_receive(relay.socket, &from, &buffer, 1)) > 0) {
+        relay.downstream.submit(data, static_cast<size_t>(length), now);
+      }
+
+      relay.upstream.poll(now, [&](const uint8_t *out, size_t out_length) {
+        ENetBuffer send_buffer { (void *)out, out_length };
+        enet_socket_send(relay.socket, &target_, &send_buffer, 1);
+      });
+
+      relay.downstream.poll(now, [&](const uint8_t *out, size_t out_length) {
+        ENetBuffer send_buffer { (void *)out, out_length };
+        enet_socket_send(socket_, &relay.address, &send_buffer, 1);
+      });
+    }
+  }
+
+  close_all();
+  stopped_ = true;
+}
+
+
+
+auto netsim_t::relay_for(const ENetAddress &address) -> relay_t &
+{
+  for (relay_t &relay : relays_) {
+    if (relay.address.host == address.host && relay.address.port == address.port) {
+      return relay;
+    }
+  }
+
+  const ENetSocket socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+  if (socket == ENET_SOCKET_NULL) {
+    s_throw(std::runtime_error, "Unable to create network simulator client socket");
+  }
+
+  ENetAddress local;
+  local.host = ENET_HOST_ANY;
+  local.port = 0;
+  enet_socket_set_option(socket, ENET_SOCKOPT_NONBLOCK, 1);
+  enet_socket_bind(socket, &local);
+
+  const size_t index = relays_.size();
+  relays_.push_back({
+    address,
+    socket,
+    netsim_link_t(config_for_link(config_, index, true)),
+    netsim_link_t(config_for_link(config_, index, false))
+  });
+  return relays_.back();
+}
+
+
+
+void netsim_t::close_all()
+{
+  std::lock_guard<std::mutex> guard(lock_);
+  for (relay_t &relay : relays_) {
+    enet_socket_destroy(relay.socket);
+  }
+  relays_.clear();
+
+  if (socket_ != ENET_SOCKET_NULL) {
+    enet_socket_destroy(socket_);
+    socket_ = ENET_SOCKET_NULL;
+  }
+}
+
+
+} // namespace snow
@@ -0,0 +1,188 @@
+/*
+  netsim.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__NETSIM_HH__
+#define __SNOW__NETSIM_HH__
+
+#include "../config.hh"
+#include <enet/enet.h>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <random>
+#include <vector>
+
+
+namespace snow {
+
+
+/*! Simulated network conditions. Probabilities are in [0, 1]. */
+struct netsim_config_t
+{
+  uint32_t  latency_ms   = 0;
+  // Latency varies uniformly by up to +/- jitter_ms per datagram
+  uint32_t  jitter_ms    = 0;
+  float     loss         = 0;
+  float     duplicate    = 0;
+  // Chance a datagram is held back long enough for later ones to overtake it
+  float     reorder      = 0;
+  // Bytes per second in each direction, or zero for no cap
+  uint32_t  bandwidth    = 0;
+  uint32_t  seed         = 1;
+};
+
+
+/*! Counters for one direction of a netsim link. */
+struct netsim_stats_t
+{
+  uint64_t  received;
+  uint64_t  delivered;
+  uint64_t  lost;
+  // Dropped because the bandwidth-limited queue was full
+  uint64_t  overflowed;
+  uint64_t  duplicated;
+  uint64_t  reordered;
+};
+
+
+/*==============================================================================
+
+  One direction of a simulated link. Datagrams submitted to the link come out
+  of poll() once their delivery time has passed, after loss, duplication,
+  latency, jitter, reordering, and bandwidth limits are applied.
+
+  All randomness comes from an RNG seeded by the config, and all timing from
+  the timestamps passed in, so a given config and sequence of submit/poll
+  calls always produces the same output. This makes the link usable on its
+  own in tests without sockets or real time.
+
+==============================================================================*/
+struct netsim_link_t
+{
+  // Datagrams queued beyond this many milliseconds of bandwidth are dropped,
+  // as a router with a full buffer would
+  static const uint32_t MAX_QUEUE_MS = 1000;
+
+  explicit netsim_link_t(const netsim_config_t &config = netsim_config_t());
+
+  // Replaces the config. Reseeds the RNG if the seed changed.
+  void configure(const netsim_config_t &config);
+  const netsim_config_t &config() const;
+
+  void submit(const uint8_t *data, size_t length, uint64_t now_ms);
+  // Calls fn(data, length) for each datagram due by now_ms, in delivery order.
+  // Returns the number delivered.
+  template <typename FN>
+  size_t poll(uint64_t now_ms, FN &&fn);
+
+  // Time the next datagram is due, or UINT64_MAX if none are queued.
+  uint64_t next_due() const;
+  size_t queued() const;
+  netsim_stats_t stats() const;
+
+private:
+  struct datagram_t
+  {
+    uint64_t              due_ms;
+    // Submission order, used to keep equal due times stable
+    uint64_t              sequence;
+    std::vector<uint8_t>  data;
+
+    bool operator > (const datagram_t &other) const;
+  };
+
+  bool chance(float probability);
+  void schedule(const uint8_t *data, size_t length, uint64_t now_ms);
+  void pop_due(datagram_t &out);
+
+  netsim_config_t         config_;
+  std::mt19937            rng_;
+  // Min-heap on due time
+  std::vector<datagram_t> queue_ { };
+  uint64_t                sequence_ = 0;
+  // When the simulated wire is next free, for the bandwidth cap
+  uint64_t                wire_free_ms_ = 0;
+  netsim_stats_t          stats_;
+};
+
+
+
+template <typename FN>
+size_t netsim_link_t::poll(uint64_t now_ms, FN &&fn)
+{
+  size_t count = 0;
+  datagram_t datagram;
+  while (!queue_.empty() && queue_.front().due_ms <= now_ms) {
+    pop_due(datagram);
+    fn(datagram.data.data(), datagram.data.size());
+    stats_.delivered += 1;
+    ++count;
+  }
+  return count;
+}
+
+
+
+/*==============================================================================
+
+  UDP relay that runs network traffic through a pair of netsim links. Clients
+  send to the relay's port instead of the server's. Each client gets its own
+  socket to the server, so the server sees one address per client. Runs on
+  its own thread once started.
+
+  Used to put simulated conditions between ENet hosts on loopback without
+  patching ENet or using outside tools.
+
+==============================================================================*/
+struct netsim_t
+{
+  netsim_t() = default;
+  ~netsim_t();
+
+  netsim_t(const netsim_t &) = delete;
+  netsim_t &operator = (const netsim_t &) = delete;
+
+  // Starts relaying from port to target. Returns false if the relay socket
+  // can't be bound.
+  bool start(enet_uint16 port, const ENetAddress &target);
+  // Stops the relay thread and closes all sockets. Blocks until stopped.
+  void stop();
+  bool is_running() const;
+
+  // May be called from any thread. Applies to both directions.
+  void configure(const netsim_config_t &config);
+
+  // Combined stats for all clients, to the server (upstream) and from it
+  // (downstream).
+  netsim_stats_t upstream_stats() const;
+  netsim_stats_t downstream_stats() const;
+
+private:
+  struct relay_t
+  {
+    ENetAddress   address;
+    ENetSocket    socket;
+    netsim_link_t upstream;
+    netsim_link_t downstream;
+  };
+
+  void run();
+  relay_t &relay_for(const ENetAddress &address);
+  void close_all();
+
+  ENetAddress             target_;
+  ENetSocket              socket_ = ENET_SOCKET_NULL;
+  std::list<relay_t>      relays_ { };
+  netsim_config_t         config_ { };
+  bool                    config_changed_ = false;
+  mutable std::mutex      lock_;
+  std::atomic<bool>       running_ { false };
+  std::atomic<bool>       stopped_ { true };
+};
+
+
+} // namespace snow
+
+#endif /* end __SNOW__NETSIM_HH__ include guard */
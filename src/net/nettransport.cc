@@ -0,0 +1,107 @@
+/*
+  nettransport.cc -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#include "nettransport.hh"
+#include "netlocal.hh"
+
+
+namespace snow {
+
+
+int netpeer_send(ENetPeer *peer, enet_uint8 channel, ENetPacket *packet)
+{
+  if (netlocal_t::is_local(peer)) {
+    return netlocal_t::send(peer, channel, packet);
+  }
+  return enet_peer_send(peer, channel, packet);
+}
+
+
+
+void netpeer_disconnect(ENetPeer *peer, enet_uint32 data)
+{
+  if (netlocal_t::is_local(peer)) {
+    netlocal_t::disconnect(peer);
+  } else {
+    enet_peer_disconnect(peer, data);
+  }
+}
+
+
+
+bool netpeer_is_local(const ENetPeer *peer)
+{
+  return netlocal_t::is_local(peer);
+}
+
+
+
+bool netpeer_is_connected(const ENetPeer *peer)
+{
+  if (netlocal_t::is_local(peer)) {
+    return netlocal_t::is_connected(peer);
+  }
+  return peer->state == ENET_PEER_STATE_CONNECTED;
+}
+
+
+
+netpeer_info_t netpeer_info(const ENetPeer *peer)
+{
+  if (peer == NULL) {
+    s_throw(std::invalid_argument, "ENetPeer is null");
+  } else if (netlocal_t::is_local(peer)) {
+    return netpeer_info_t { netlocal_t::generation(peer), peer->mtu, 0, 0 };
+  }
+  return netpeer_info_t {
+    peer->connectID,
+    peer->mtu,
+    peer->incomingBandwidth,
+    peer->host != NULL ? peer->host->outgoingBandwidth : 0
+  };
+}
+
+
+
+netpeer_info_t netpeer_info(const ENetPeer *peer, netpeer_info_fn_t fn, void *context)
+{
+  if (fn != NULL) {
+    return fn(context, peer);
+  }
+  return netpeer_info(peer);
+}
+
+
+
+void nethost_peers(ENetHost *host, std::vector<ENetPeer *> &peers)
+{
+  if (host == NULL) {
+    s_throw(std::invalid_argument, "ENetHost is null");
+  }
+
+  ENetPeer *const peers_end = host->peers + host->peerCount;
+  for (ENetPeer *peer = host->peers; peer < peers_end; ++peer) {
+    if (peer->state == ENET_PEER_STATE_CONNECTED) {
+      peers.push_back(peer);
+    }
+  }
+  netlocal_t::hosted_peers(host, peers);
+}
+
+
+
+void nethost_broadcast(ENetHost *host, enet_uint8 channel, ENetPacket *packet)
+{
+  if (host == NULL) {
+    s_throw(std::invalid_argument, "ENetHost is null");
+  }
+  // Copies go to local peers first, since ENet destroys the packet if no
+  // peer of its own takes it
+  netlocal_t::broadcast(host, channel, packet);
+  enet_host_broadcast(host, channel, packet);
+}
+
+
+} // namespace snow
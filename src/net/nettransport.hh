@@ -0,0 +1,77 @@
+/*
+  nettransport.hh -- Copyright (c) 2013 Noel Cower. All rights reserved.
+  See COPYING under the project root for the source code license. If this file
+  is not present, refer to <https://raw.github.com/nilium/snow/master/COPYING>.
+*/
+#ifndef __SNOW__NETTRANSPORT_HH__
+#define __SNOW__NETTRANSPORT_HH__
+
+#include "../config.hh"
+#include <enet/enet.h>
+#include <vector>
+
+
+namespace snow {
+
+
+/*==============================================================================
+
+  Transport-independent peer operations. Peers are either ENet peers or local
+  peers belonging to a netlocal_t (an in-process connection to a server in the
+  same process). These route to whichever transport the peer uses, so callers
+  can treat both kinds of peer the same way. Same semantics as the ENet
+  functions they wrap.
+
+==============================================================================*/
+int   netpeer_send(ENetPeer *peer, enet_uint8 channel, ENetPacket *packet);
+void  netpeer_disconnect(ENetPeer *peer, enet_uint32 data = 0);
+bool  netpeer_is_local(const ENetPeer *peer);
+bool  netpeer_is_connected(const ENetPeer *peer);
+
+// Host operations also reach local peers connected through the host (see
+// netlocal_t::connect). nethost_peers appends every connected peer of the
+// host to peers. nethost_broadcast takes ownership of the packet, as
+// enet_host_broadcast does; local peers are sent copies of it.
+void  nethost_peers(ENetHost *host, std::vector<ENetPeer *> &peers);
+void  nethost_broadcast(ENetHost *host, enet_uint8 channel, ENetPacket *packet);
+
+
+
+/*==============================================================================
+
+  The parts of a peer's connection that senders size their traffic by. ENet
+  changes these on the thread servicing the peer's host, so a host serviced
+  on another thread (see netio_t) hands out copies taken on its own thread
+  rather than letting them be read from the peer.
+
+  ENet reuses ENetPeers for new connections, so anything kept per peer
+  should also keep the generation it was made for and be discarded once the
+  peer's generation changes.
+
+==============================================================================*/
+struct netpeer_info_t
+{
+  // Changes with each new connection through the peer
+  enet_uint32   generation;
+  enet_uint32   mtu;
+  // The peer's incoming and its host's outgoing bandwidth in bytes per
+  // second. Zero if unlimited.
+  enet_uint32   incoming_bandwidth;
+  enet_uint32   outgoing_bandwidth;
+};
+
+
+// Looks up a peer's info, e.g. netio_t::info_fn
+using netpeer_info_fn_t = netpeer_info_t (*)(void *context, const ENetPeer *peer);
+
+
+// Reads a peer's info from the peer itself. ENet peers must only be read on
+// the thread servicing their host. Local peers may be read from any thread.
+netpeer_info_t netpeer_info(const ENetPeer *peer);
+// Looks the info up through fn if set, otherwise reads it from the peer.
+netpeer_info_t netpeer_info(const ENetPeer *peer, netpeer_info_fn_t fn, void *context);
+
+
+} // namespace snow
+
+#endif /* end __SNOW__NETTRANSPORT_HH__ include guard */
@@ -5,9 +5,16 @@
 */
 #include "sv_main.hh"
 #include <snow/snow-common.hh>
+#include "../net/netcvars.hh"
+#include "../game/messages.hh"
 #include "../net/netevent.hh"
+#include "../net/netpacket_pool.hh"
 #include "../renderer/sgl.hh"
 #include "../timing.hh"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
 
 
 namespace snow {
@@ -17,6 +24,9 @@ namespace {
 
 server_t g_default_server;
 const int SERVER_TIMEOUT = 2; // 1 second
+// Milliseconds the network thread waits for traffic before checking for
+// outgoing packets again
+const enet_uint32 NET_TIMEOUT = 1;
 
 
 } // namespace
@@ -38,17 +48,42 @@ void server_t::initialize(int argc, const char **argv)
   host_addr.host = ENET_HOST_ANY;
   host_addr.port = DEFAULT_SERVER_PORT;
 
-  host_ = enet_host_create(&host_addr, num_clients_, 2, 0, 0);
+  host_ = enet_host_create(&host_addr, num_clients_, NET_CHANNEL_COUNT, 0, 0);
 
   if (host_ == NULL) {
     s_throw(std::runtime_error, "Unable to create server host");
   }
 
+  // Registered before the frameloop starts so the first clients get them
+  player_speed_ = player_mover_t::register_speed(cvars_, true);
+
+  netio_.set_host(host_);
+  netevent_batch_.set_send_fn(netio_t::send_fn, &netio_);
+  netevent_batch_.set_info_fn(netio_t::info_fn, &netio_);
+  netscheduler_.set_info_fn(netio_t::info_fn, &netio_);
+  netbulk_.set_info_fn(netio_t::info_fn, &netio_);
+
+  netio_stopped_ = false;
+  netio_running_ = true;
+  async_thread(&server_t::run_netio, this);
   async_thread(&server_t::run_frameloop, this);
 }
 
 
 
+void server_t::run_netio()
+{
+  while (netio_running_) {
+    if (compression_changed_) {
+      update_compression();
+    }
+    netio_.service(NET_TIMEOUT);
+  }
+  netio_stopped_ = true;
+}
+
+
+
 void server_t::run_frameloop()
 {
   frameloop();
@@ -65,51 +100,260 @@ void server_t::kill(bool block)
 
 
 
-void server_t::frameloop()
+void server_t::set_compression(int mode, const string &dictionary)
 {
-  #define NET_TIMEOUT 1
+  std::lock_guard<std::mutex> lock(compression_lock_);
+  compress_mode_ = mode;
+  compress_dictionary_ = dictionary;
+  compression_changed_ = true;
+}
+
+
+
+void server_t::update_compression()
+{
+  std::lock_guard<std::mutex> lock(compression_lock_);
+  if (!netcompressor_.load_dictionary(compress_dictionary_)) {
+    s_log_warning("Server compressing without a dictionary");
+  }
+  netcompressor_t::apply_mode(host_, compress_mode_, netcompressor_);
+  compression_changed_ = false;
+}
+
+
+
+ENetPeer *server_t::connect_local()
+{
+  // The local client is included in broadcasts to the server's host
+  return local_.connect(host_);
+}
+
+
+
+cvar_set_t &server_t::cvars()
+{
+  return cvars_;
+}
+
+
+
+server_tick_stats_t server_t::tick_stats() const
+{
+  std::lock_guard<std::mutex> lock(tick_stats_lock_);
+  server_tick_stats_t stats = tick_stats_;
+  stats.stddev_ms = stats.ticks > 1 ? std::sqrt(tick_m2_ / (stats.ticks - 1)) : 0.0;
+  return stats;
+}
+
+
+
+netio_stats_t server_t::netio_stats() const
+{
+  return netio_.stats();
+}
+
+
+
+netcompressor_stats_t server_t::compression_stats() const
+{
+  return netcompressor_.stats();
+}
+
+
+
+struct server_t::message_handler_t
+{
+  server_t &  server;
+  ENetPeer *  peer;
+
+  void on_message(const player_input_msg_t &msg, const netevent_t &)
+  {
+    server.apply_input(peer, msg);
+  }
+};
+
 
+
+void server_t::frameloop()
+{
   running_ = true;
 
   base_time_ = glfwGetTime();
   sim_time_ = 0;
-  int num_peers = 0;
 
   while (running_) {
+    // Sleep until the next tick is due. The network thread keeps servicing
+    // the host in the meantime.
+    const double wait = sim_time_ - (glfwGetTime() - base_time_);
+    if (wait > 0) {
+      std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+    }
+
+    const double tick_start = glfwGetTime();
 
     ENetEvent event;
-    while (enet_host_service(host_, &event, NET_TIMEOUT) > 0) {
-      s_log_note("Event received");
-      switch (event.type) {
-      case ENET_EVENT_TYPE_CONNECT: {
-        s_log_note("Client connected");
-        ++num_peers;
-
-        netevent_t msg;
-        msg.set_sender(0);
-        msg.set_message(1);
-        msg.set_time(sim_time_);
-        msg.send(event.peer, 1, ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT);
-      } break;
-
-      case ENET_EVENT_TYPE_RECEIVE:
-        enet_packet_destroy(event.packet);
-      break;
-
-      case ENET_EVENT_TYPE_DISCONNECT:
-        s_log_note("Client disconnected");
-        --num_peers;
-      break;
-
-      default:
-      break;
-      }
+    while (netio_.receive(event)) {
+      handle_event(event);
+    }
+    while (netlocal_t::receive(local_.client_peer(), event)) {
+      handle_event(event);
     }
 
+    // Applies delayed cvar changes before input is simulated, and queues the
+    // replicated ones before scheduling so they go out with this tick's
+    // packets
+    replicate_cvars();
+    send_corrections();
+
     const double cur_time = glfwGetTime() - base_time_;
     while (sim_time_ < cur_time) {
       sim_time_ += FRAME_SEQ_TIME;
+      // Pick what fits in each peer's bandwidth for this tick
+      netscheduler_.schedule(netevent_batch_, FRAME_SEQ_TIME);
+      netbulk_.update(netevent_batch_, FRAME_SEQ_TIME);
     }
+
+    // Anything queued for peers during the tick goes out as one packet per
+    // peer and channel
+    netevent_batch_.flush();
+
+    record_tick(glfwGetTime() - tick_start);
+  }
+}
+
+
+
+void server_t::record_tick(double seconds)
+{
+  const double ms = seconds * 1000.0;
+  std::lock_guard<std::mutex> lock(tick_stats_lock_);
+  tick_stats_.ticks += 1;
+  const double delta = ms - tick_stats_.mean_ms;
+  tick_stats_.mean_ms += delta / tick_stats_.ticks;
+  tick_m2_ += delta * (ms - tick_stats_.mean_ms);
+  tick_stats_.max_ms = std::max(tick_stats_.max_ms, ms);
+}
+
+
+
+void server_t::replicate_cvars()
+{
+  cvars_.update_cvars();
+  replicated_.clear();
+  cvars_.take_replicated(replicated_);
+  if (replicated_.empty() || peers_.empty()) {
+    return;
+  }
+
+  // One delta per tick, shared by every client
+  netevent_t delta;
+  write_cvar_delta(replicated_, delta);
+  delta.set_time(sim_time_);
+  for (ENetPeer *peer : peers_) {
+    netscheduler_.send(peer, 0, delta);
+  }
+}
+
+
+
+// Applies each input newer than the last one applied for the peer's player.
+// Inputs lost beyond what the message repeats are skipped, and the client is
+// corrected for them.
+void server_t::apply_input(ENetPeer *peer, const player_input_msg_t &msg)
+{
+  const uint32_t first = msg.tick - (msg.count - 1);
+  auto player = std::find_if(players_.begin(), players_.end(),
+    [peer](const player_state_t &player) { return player.peer == peer; });
+  if (player == players_.end()) {
+    const vec3f_t origin = msg.has_origin ? msg.origin : vec3f_t::zero;
+    players_.push_back({ peer, first - 1, origin, false });
+    player = players_.end() - 1;
+  }
+
+  for (uint32_t index = 0; index < msg.count; ++index) {
+    const uint32_t tick = first + index;
+    if (static_cast<int32_t>(tick - player->tick) <= 0) {
+      continue;
+    }
+    player_mover_t::simulate(player->position, msg.inputs[index], player_speed_->getf());
+    player->tick = tick;
+    player->changed = true;
+  }
+}
+
+
+
+void server_t::send_corrections()
+{
+  for (player_state_t &player : players_) {
+    if (!player.changed) {
+      continue;
+    }
+    netevent_t correction;
+    game_messages_t::write(player_correction_msg_t { player.tick, player.position }, correction);
+    correction.set_time(sim_time_);
+    // Only the newest correction matters, so an unsent one is replaced
+    netscheduler_.update(player.peer, PLAYER_CORRECTION_MESSAGE, NET_PRIORITY_HIGH, 1,
+      correction);
+    player.changed = false;
+  }
+}
+
+
+
+void server_t::handle_event(ENetEvent &event)
+{
+  s_log_note("Event received");
+  switch (event.type) {
+  case ENET_EVENT_TYPE_CONNECT: {
+    s_log_note("Client connected");
+    ++num_peers_;
+
+    netevent_t msg;
+    msg.set_sender(0);
+    game_messages_t::write(welcome_msg_t(), msg);
+    msg.set_time(sim_time_);
+    netscheduler_.send(event.peer, 1, msg, ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT);
+
+    // New clients get every replicated cvar, then only changes
+    replicated_.clear();
+    cvars_.find_cvars(CVAR_REPLICATED, replicated_);
+    if (!replicated_.empty()) {
+      netevent_t cvars;
+      write_cvar_delta(replicated_, cvars);
+      cvars.set_time(sim_time_);
+      netscheduler_.send(event.peer, 0, cvars);
+    }
+    peers_.push_back(event.peer);
+  } break;
+
+  case ENET_EVENT_TYPE_RECEIVE:
+    netpacket_retain(event.packet);
+    netevent_batch_t::split(event.packet, [&](const uint8_t *data, size_t length) {
+      netevent_t netevent;
+      if (netevent.borrow_from(event.packet, data, length) &&
+          !netbulk_.handle(event.peer, netevent)) {
+        message_handler_t handler { *this, event.peer };
+        game_messages_t::dispatch(handler, netevent);
+      }
+    });
+    netpacket_release(event.packet);
+  break;
+
+  case ENET_EVENT_TYPE_DISCONNECT:
+    s_log_note("Client disconnected");
+    netscheduler_.drop(event.peer);
+    netbulk_.drop(event.peer);
+    netevent_batch_.drop(event.peer);
+    peers_.erase(std::remove(peers_.begin(), peers_.end(), event.peer), peers_.end());
+    players_.erase(std::remove_if(players_.begin(), players_.end(),
+      [&event](const player_state_t &player) { return player.peer == event.peer; }),
+      players_.end());
+    --num_peers_;
+  break;
+
+  default:
+  break;
   }
 }
 
@@ -117,7 +361,15 @@ void server_t::frameloop()
 
 void server_t::shutdown()
 {
+  netio_running_ = false;
+  while (!netio_stopped_) {
+    std::this_thread::yield();
+  }
+
   if (host_) {
+    // The network thread is gone, so send what's left from this thread
+    netevent_batch_.flush();
+    netio_.service(0);
     enet_host_flush(host_);
     enet_host_destroy(host_);
   }
@@ -7,11 +7,33 @@
 #define __SNOW_SV_MAIN_HH__
 
 #include "../config.hh"
+#include "../console.hh"
+#include "../game/messages.hh"
+#include "../net/netcompressor.hh"
+#include "../net/netbulk.hh"
+#include "../net/netevent_batch.hh"
+#include "../net/netio.hh"
+#include "../net/netlocal.hh"
+#include "../net/netscheduler.hh"
 #include <enet/enet.h>
 #include <atomic>
+#include <mutex>
+#include <vector>
 
 namespace snow {
 
+
+// Time spent simulating each server tick, from draining received events to
+// flushing outgoing packets.
+struct server_tick_stats_t
+{
+  uint64_t  ticks;
+  double    mean_ms;
+  double    stddev_ms;
+  double    max_ms;
+};
+
+
 struct server_t
 {
   static const int DEFAULT_SERVER_PORT = 23208;
@@ -25,17 +47,83 @@ struct server_t
   // is false, it will kill the server and return without waiting for it to
   // finish.
   void kill(bool block = true);
+  // Sets the compression mode (a netcompress_mode_t) and dictionary path used
+  // by the server host. Takes effect the next time the network thread
+  // services the host.
+  void set_compression(int mode, const string &dictionary);
+  // Connects a client in the same process to the server through an
+  // in-process connection rather than ENet. Returns the client's peer for the
+  // server. Call from the client's thread after initialize().
+  ENetPeer *connect_local();
+
+  // Server cvars. Delayed changes take effect at the start of the next server
+  // tick, before anything is simulated, and changes to CVAR_REPLICATED cvars
+  // go out to every client with that tick's packets. Only the server's thread
+  // may touch the set once the frameloop is running.
+  cvar_set_t &cvars();
+
+  // May be called from any thread.
+  server_tick_stats_t tick_stats() const;
+  netio_stats_t netio_stats() const;
+  netcompressor_stats_t compression_stats() const;
 
 private:
+  // A client's player as simulated from its input
+  struct player_state_t
+  {
+    ENetPeer *  peer;
+    // Newest input tick applied, in the client's ticks
+    uint32_t    tick;
+    vec3f_t     position;
+    // Whether a correction is due for the tick
+    bool        changed;
+  };
+
+  // Dispatch target for game messages from a peer
+  struct message_handler_t;
+
+  // ENet is serviced on its own thread so socket work and ACKs aren't held up
+  // by (or hold up) the simulation. Only the network thread touches host_
+  // once it's running.
+  void run_netio();
   void frameloop();
+  void record_tick(double seconds);
   void shutdown();
+  void update_compression();
+  void handle_event(ENetEvent &event);
+  void replicate_cvars();
+  void apply_input(ENetPeer *peer, const player_input_msg_t &msg);
+  void send_corrections();
 
   std::atomic<bool> shutdown_ { false };
   std::atomic<bool> running_ { false };
   int num_clients_ = 16;
+  int num_peers_ = 0;
   ENetHost *host_ = NULL;
+  netio_t netio_;
+  std::atomic<bool> netio_running_ { false };
+  std::atomic<bool> netio_stopped_ { true };
+  netevent_batch_t netevent_batch_;
+  netscheduler_t netscheduler_;
+  netbulk_t netbulk_;
+  cvar_set_t cvars_;
+  std::vector<cvar_t *> replicated_;
+  // Replicated gameplay tunables
+  cvar_t *player_speed_ = NULL;
+  std::vector<ENetPeer *> peers_;
+  std::vector<player_state_t> players_;
+  netlocal_t local_;
+  netcompressor_t netcompressor_;
+  std::mutex compression_lock_;
+  std::atomic<bool> compression_changed_ { false };
+  int compress_mode_ = NET_COMPRESS_NONE;
+  string compress_dictionary_;
   double base_time_ = 0.0;
   double sim_time_ = 0.0;
+  mutable std::mutex tick_stats_lock_;
+  server_tick_stats_t tick_stats_ { 0, 0.0, 0.0, 0.0 };
+  // Running sum of squared differences from the mean, for the variance
+  double tick_m2_ = 0.0;
 };
 
 